@@ -15,6 +15,9 @@ LIMIT="160kbit"
 LOCALNET_V4="192.168.0.0/16"
 #defines the IPv6 address space for which you wish to disable rate limiting
 LOCALNET_V6="fe80::/10"
+#qdisc of the unlimited class. Set to "fq" in order to pace the UDP multicast
+#streams configured with pacing=txtime (see README.md), or leave empty
+UNLIMITED_QDISC=""
 
 #delete existing rules
 tc qdisc del dev ${IF} root
@@ -29,6 +32,10 @@ tc class add dev ${IF} parent 1: classid 1:1 htb rate ${LINKCEIL} ceil ${LINKCEI
 tc class add dev ${IF} parent 1:1 classid 1:10 htb rate ${LINKCEIL} ceil ${LINKCEIL} prio 0
 tc class add dev ${IF} parent 1:1 classid 1:11 htb rate ${LIMIT} ceil ${LIMIT} prio 1
 
+if [ -n "${UNLIMITED_QDISC}" ] ; then
+	tc qdisc add dev ${IF} parent 1:10 handle 10: ${UNLIMITED_QDISC}
+fi
+
 #add handles to our classes so packets marked with <x> go into the class with "... handle <x> fw ..."
 tc filter add dev ${IF} parent 1: protocol ip prio 1 handle 1 fw classid 1:10
 tc filter add dev ${IF} parent 1: protocol ip prio 2 handle 2 fw classid 1:11
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <assert.h>
+#include <cmath>
+#include <backfill.h>
+
+
+BackfillScheduler::BackfillScheduler(const BackfillConfig& config) : m_offset(config.offset)
+{
+    assert(config.depth >= 0 && config.offset >= 0);
+    switch (config.policy) {
+    case BackfillPolicy::LINEAR:
+        m_carousels.push_back({0, config.depth, 1});
+        break;
+    case BackfillPolicy::CAROUSELS:
+        assert(config.recent_depth > 0 && config.recent_weight > 0);
+        if (config.depth != 0 && config.recent_depth >= config.depth) {
+            m_carousels.push_back({0, config.depth, 1});
+        } else {
+            m_carousels.push_back({0, config.recent_depth, static_cast<double>(config.recent_weight)});
+            m_carousels.push_back({config.recent_depth, config.depth, 1});
+        }
+        break;
+    case BackfillPolicy::DECAY:
+        /* Tiers of decay_depth blocks, each sent at half the rate per block of
+         * the tier above it */
+        assert(config.decay_depth > 0);
+        for (int k = 0; k < BACKFILL_DECAY_TIERS; k++) {
+            const int min_depth = k * config.decay_depth;
+            int max_depth = (k == BACKFILL_DECAY_TIERS - 1) ? config.depth : min_depth + config.decay_depth;
+            if (config.depth != 0 && max_depth >= config.depth)
+                max_depth = config.depth;
+            m_carousels.push_back({min_depth, max_depth, std::ldexp(1.0, -k)});
+            if (max_depth == config.depth)
+                break;
+        }
+        break;
+    }
+}
+
+void BackfillScheduler::Range(const Carousel& c, int chain_height, int& lo, int& hi)
+{
+    hi = chain_height - c.min_depth;
+    lo = (c.max_depth == 0) ? 0 : std::max(0, chain_height - c.max_depth + 1);
+}
+
+int BackfillScheduler::Next(int chain_height, const std::set<int>& skip)
+{
+    assert(chain_height >= 0);
+
+    /* Pick the carousel with blocks that is furthest behind in virtual time. A
+     * carousel that had no blocks catches up with the others, rather than
+     * claiming the share it missed. */
+    std::vector<size_t> order;
+    for (size_t i = 0; i < m_carousels.size(); i++) {
+        Carousel& c = m_carousels[i];
+        int lo, hi;
+        Range(c, chain_height, lo, hi);
+        if (hi < lo) {
+            c.active = false;
+            continue;
+        }
+        if (!c.active) {
+            c.pass = std::max(c.pass, m_vtime);
+            c.active = true;
+        }
+        order.push_back(i);
+    }
+    // The top carousel always contains the tip
+    assert(!order.empty());
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return m_carousels[a].pass < m_carousels[b].pass;
+    });
+
+    /* Fall back to the carousels next in line while all blocks of the
+     * preferred one are skipped */
+    for (const size_t best : order) {
+        Carousel& c = m_carousels[best];
+        int lo, hi;
+        Range(c, chain_height, lo, hi);
+        if (c.next_height == -1)
+            c.next_height = lo + m_offset % (hi - lo + 1);
+        else if (c.next_height < lo || c.next_height > hi)
+            c.next_height = lo;
+
+        int height = c.next_height;
+        for (int n = hi - lo; n > 0 && skip.count(height); n--)
+            height = (height == hi) ? lo : height + 1;
+        if (skip.count(height))
+            continue;
+        c.next_height = height + 1;
+
+        m_last = best;
+        m_vtime = c.pass;
+
+        /* Keep the virtual times small enough for the charges to remain exact */
+        if (m_vtime > std::ldexp(1.0, 40)) {
+            for (Carousel& carousel : m_carousels)
+                carousel.pass -= m_vtime;
+            m_vtime = 0;
+        }
+        return height;
+    }
+    return -1;
+}
+
+void BackfillScheduler::Charge(uint64_t bytes)
+{
+    Carousel& c = m_carousels[m_last];
+    c.pass += bytes / c.weight;
+    c.last_bytes = bytes;
+}
+
+std::vector<int> BackfillScheduler::Peek(int chain_height, size_t n, const std::set<int>& skip) const
+{
+    BackfillScheduler copy(*this);
+    std::vector<int> heights;
+    heights.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        const int height = copy.Next(chain_height, skip);
+        if (height == -1)
+            break;
+        heights.push_back(height);
+        // Assume a token size for carousels without any charge yet
+        const Carousel& c = copy.m_carousels[copy.m_last];
+        copy.Charge(c.last_bytes ? c.last_bytes : 1);
+    }
+    return heights;
+}
@@ -0,0 +1,98 @@
+#ifndef BITCOIN_BACKFILL_H
+#define BITCOIN_BACKFILL_H
+
+#include <set>
+#include <stdint.h>
+#include <vector>
+
+
+/** Policies for picking the historic blocks repeated by a multicast stream */
+enum class BackfillPolicy {
+    LINEAR,    //!< cycle through the whole backfill window
+    CAROUSELS, //!< separate carousels for the most recent blocks and the rest
+    DECAY,     //!< send each block less often the deeper it is in the chain
+};
+
+struct BackfillConfig {
+    BackfillPolicy policy = BackfillPolicy::LINEAR;
+    int depth = 0;              //!< blocks in the window (0 for the full chain)
+    int offset = 0;             //!< starting point relative to the bottom of each carousel
+    int recent_depth = 6;       //!< CAROUSELS: blocks in the recent carousel
+    uint32_t recent_weight = 1; //!< CAROUSELS: weight of the recent carousel relative to the rest
+    int decay_depth = 144;      //!< DECAY: blocks after which a block is sent half as often
+};
+
+/** Maximum number of tiers of the DECAY policy. The last tier covers the
+ *  remainder of the backfill window. */
+static const int BACKFILL_DECAY_TIERS = 8;
+
+/**
+ * Schedules the transmission of historic blocks (backfill)
+ *
+ * The backfill window is split into carousels, each covering a range of depths
+ * below the chain tip and cycling through the blocks within it, from the
+ * bottom up. Carousels are picked by stride scheduling: each carousel gets a
+ * share of the bytes sent by the backfill proportional to its weight. Because
+ * the carousels track heights rather than positions, a carousel keeps its
+ * place when the tip advances, and restarts from its bottom once it reaches
+ * its top or falls behind its range.
+ */
+class BackfillScheduler
+{
+private:
+    struct Carousel {
+        int min_depth;       //!< depth of the top block (0 for the tip)
+        int max_depth;       //!< depth past the bottom block (0 for the full chain)
+        double weight;
+        int next_height = -1; //!< next block to send (-1 until started)
+        double pass = 0;      //!< virtual time of the stride scheduler
+        bool active = false;  //!< whether the carousel had blocks last time
+        uint64_t last_bytes = 0; //!< bytes of the last block charged
+
+        Carousel(int min, int max, double w) : min_depth(min), max_depth(max), weight(w) {}
+    };
+    std::vector<Carousel> m_carousels;
+    int m_offset;
+    size_t m_last = 0;   //!< carousel of the last block returned by Next()
+    double m_vtime = 0;  //!< pass of the last carousel picked
+
+    /** Range of heights covered by a carousel, empty if hi < lo */
+    static void Range(const Carousel& c, int chain_height, int& lo, int& hi);
+
+public:
+    explicit BackfillScheduler(const BackfillConfig& config);
+
+    /**
+     * @brief Pick the next block to send. A carousel passes over the blocks to
+     * skip (e.g. those still being sent), and if it has no other block, the
+     * carousel next in line is picked instead.
+     * @param (int) Current chain height.
+     * @param (std::set<int>) Heights of the blocks to skip.
+     * @return (int) Height of the block, or -1 if all blocks are skipped.
+     */
+    int Next(int chain_height, const std::set<int>& skip = std::set<int>());
+
+    /**
+     * @brief Account for the transmission of the last block returned by Next().
+     * @param (uint64_t) Bytes it takes to send the block.
+     * @return Void.
+     */
+    void Charge(uint64_t bytes);
+
+    /**
+     * @brief Predict the blocks the next calls to Next() pick, assuming each
+     * block takes as many bytes as the last one charged to its carousel.
+     * @param (int) Current chain height.
+     * @param (size_t) Number of blocks to predict.
+     * @param (std::set<int>) Heights of the blocks each call skips.
+     * @return (std::vector<int>) Heights of the blocks.
+     */
+    std::vector<int> Peek(int chain_height, size_t n, const std::set<int>& skip = std::set<int>()) const;
+
+    /** Index of the carousel of the last block returned by Next() */
+    size_t LastCarousel() const { return m_last; }
+
+    size_t NumCarousels() const { return m_carousels.size(); }
+};
+
+#endif
@@ -0,0 +1,67 @@
+// Copyright (c) 2020 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <bench/data.h>
+
+#include <compressor.h>
+#include <primitives/block.h>
+#include <streams.h>
+#include <version.h>
+
+// Throughput of the transaction compression used for blocks and txn relayed
+// over UDP, in bytes of uncompressed transactions per second
+
+static CBlock ReadTestBlock()
+{
+    CDataStream stream(benchmark::data::block413567, SER_NETWORK, PROTOCOL_VERSION);
+    CBlock block;
+    stream >> block;
+    return block;
+}
+
+static void CompressBlockTransactions(benchmark::Bench& bench, codec_version_t codec_version)
+{
+    const CBlock block = ReadTestBlock();
+    std::vector<unsigned char> data;
+    data.reserve(benchmark::data::block413567.size());
+
+    bench.batch(benchmark::data::block413567.size()).unit("byte").run([&] {
+        data.clear();
+        VectorOutputStream stream(&data, SER_NETWORK, PROTOCOL_VERSION);
+        for (const CTransactionRef& tx : block.vtx)
+            stream << CTxCompressor(*tx, codec_version);
+    });
+}
+
+static void DecompressBlockTransactions(benchmark::Bench& bench, codec_version_t codec_version)
+{
+    const CBlock block = ReadTestBlock();
+    std::vector<unsigned char> data;
+    {
+        VectorOutputStream stream(&data, SER_NETWORK, PROTOCOL_VERSION);
+        for (const CTransactionRef& tx : block.vtx)
+            stream << CTxCompressor(*tx, codec_version);
+    }
+    std::vector<CMutableTransaction> txn(block.vtx.size());
+
+    bench.batch(benchmark::data::block413567.size()).unit("byte").run([&] {
+        VectorInputStream stream(&data, SER_NETWORK, PROTOCOL_VERSION);
+        for (CMutableTransaction& tx : txn) {
+            tx.vin.clear();
+            tx.vout.clear();
+            stream >> CTxCompressor(tx, codec_version);
+        }
+    });
+}
+
+static void CompressBlockTransactionsV1(benchmark::Bench& bench) { CompressBlockTransactions(bench, codec_version_t::v1); }
+static void CompressBlockTransactionsV2(benchmark::Bench& bench) { CompressBlockTransactions(bench, codec_version_t::v2); }
+static void DecompressBlockTransactionsV1(benchmark::Bench& bench) { DecompressBlockTransactions(bench, codec_version_t::v1); }
+static void DecompressBlockTransactionsV2(benchmark::Bench& bench) { DecompressBlockTransactions(bench, codec_version_t::v2); }
+
+BENCHMARK(CompressBlockTransactionsV1);
+BENCHMARK(CompressBlockTransactionsV2);
+BENCHMARK(DecompressBlockTransactionsV1);
+BENCHMARK(DecompressBlockTransactionsV2);
@@ -11,13 +11,20 @@
 #include <crypto/siphash.h>
 #include <random.h>
 #include <streams.h>
+#include <sync.h>
 #include <txmempool.h>
 #include <validation.h>
 #include <util/system.h>
+#include <util/time.h>
 
+#include <algorithm>
+#include <deque>
 #include <unordered_map>
 
 #include <chrono>
+/** Number of txids whose short IDs InitData computes at once */
+static constexpr size_t SHORTID_BATCH_SIZE = 64;
+
 #define to_millis_double(t) (std::chrono::duration_cast<std::chrono::duration<double, std::chrono::milliseconds::period> >(t).count())
 
 CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID, bool fDeterministic) :
@@ -26,10 +33,12 @@ CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool f
     FillShortTxIDSelector();
     //TODO: Use our mempool prior to block acceptance to predictively fill more than just the coinbase
     prefilledtxn[0] = {0, block.vtx[0]};
+    std::vector<uint256> txhashes(shorttxids.size());
     for (size_t i = 1; i < block.vtx.size(); i++) {
         const CTransaction& tx = *block.vtx[i];
-        shorttxids[i - 1] = GetShortID(fUseWTXID ? tx.GetWitnessHash() : tx.GetHash());
+        txhashes[i - 1] = fUseWTXID ? tx.GetWitnessHash() : tx.GetHash();
     }
+    GetShortIDs(txhashes.data(), shorttxids.data(), txhashes.size());
 }
 
 void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector() const {
@@ -48,6 +57,13 @@ uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const {
     return SipHashUint256(shorttxidk0, shorttxidk1, txhash) & 0xffffffffffffL;
 }
 
+void CBlockHeaderAndShortTxIDs::GetShortIDs(const uint256* txhashes, uint64_t* shortids, size_t count) const {
+    static_assert(SHORTTXIDS_LENGTH == 6, "shorttxids calculation assumes 6-byte shorttxids");
+    SipHashUint256Batch(shorttxidk0, shorttxidk1, txhashes, shortids, count);
+    for (size_t i = 0; i < count; i++)
+        shortids[i] &= 0xffffffffffffL;
+}
+
 
 ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const std::vector<std::pair<uint256, CTransactionRef>>& extra_txn) {
     const bool fBench = LogAcceptCategory(BCLog::BENCH);
@@ -115,6 +131,8 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
         return READ_STATUS_FAILED; // Short ID collision
 
     std::vector<bool> have_txn(txn_available.size());
+    uint256 batch_hashes[SHORTID_BATCH_SIZE];
+    uint64_t batch_shortids[SHORTID_BATCH_SIZE];
 
     std::chrono::steady_clock::time_point shortids_mapped;
     if (fBench)
@@ -122,61 +140,117 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
 
     {
     LOCK(pool->cs);
-    for (size_t i = 0; i < pool->vTxHashes.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(pool->vTxHashes[i].first);
-        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
-        if (idit != shorttxids.end()) {
-            if (!have_txn[idit->second]) {
-                txn_available[idit->second] = pool->vTxHashes[i].second->GetSharedTx();
-                have_txn[idit->second]  = true;
+    // If this block was already initialized from another peer, reuse the
+    // mempool matches found then, unless they were incomplete and the mempool
+    // has changed since.
+    const uint256 block_hash = cmpctblock.header.GetHash();
+    auto cached = std::find_if(pool->m_shortid_matches.begin(), pool->m_shortid_matches.end(),
+            [&](const CTxMemPool::ShortIDMatches& m) {
+                return m.block_hash == block_hash && m.nonce == cmpctblock.nonce && m.shorttxids == cmpctblock.shorttxids;
+            });
+    if (cached != pool->m_shortid_matches.end() &&
+            (cached->complete || cached->txn_updated == pool->GetTransactionsUpdated())) {
+        for (const auto& match : cached->matches) {
+            const uint16_t idx = shorttxids.find(match.first)->second;
+            if (match.second.IsNull()) {
+                have_txn[idx] = true;
+                continue;
+            }
+            auto it = pool->mapTx.get<index_by_wtxid>().find(match.second);
+            if (it != pool->mapTx.get<index_by_wtxid>().end()) {
+                txn_available[idx] = it->GetSharedTx();
+                have_txn[idx] = true;
                 mempool_count++;
-            } else {
-                // If we find two mempool txn that match the short id, just request it.
-                // This should be rare enough that the extra bandwidth doesn't matter,
-                // but eating a round-trip due to FillBlock failure would be annoying
-                if (txn_available[idit->second]) {
-                    txn_available[idit->second].reset();
-                    mempool_count--;
+            }
+        }
+        std::rotate(pool->m_shortid_matches.begin(), cached, cached + 1);
+    } else {
+        for (size_t batch = 0; batch < pool->vTxHashes.size() && mempool_count != shorttxids.size(); batch += SHORTID_BATCH_SIZE) {
+            const size_t batch_count = std::min(SHORTID_BATCH_SIZE, pool->vTxHashes.size() - batch);
+            for (size_t j = 0; j < batch_count; j++)
+                batch_hashes[j] = pool->vTxHashes[batch + j].first;
+            cmpctblock.GetShortIDs(batch_hashes, batch_shortids, batch_count);
+
+            for (size_t j = 0; j < batch_count; j++) {
+                const size_t i = batch + j;
+                std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(batch_shortids[j]);
+                if (idit != shorttxids.end()) {
+                    if (!have_txn[idit->second]) {
+                        txn_available[idit->second] = pool->vTxHashes[i].second->GetSharedTx();
+                        have_txn[idit->second]  = true;
+                        mempool_count++;
+                    } else {
+                        // If we find two mempool txn that match the short id, just request it.
+                        // This should be rare enough that the extra bandwidth doesn't matter,
+                        // but eating a round-trip due to FillBlock failure would be annoying
+                        if (txn_available[idit->second]) {
+                            txn_available[idit->second].reset();
+                            mempool_count--;
+                        }
+                    }
                 }
+                // Though ideally we'd continue scanning for the two-txn-match-shortid case,
+                // the performance win of an early exit here is too good to pass up and worth
+                // the extra risk.
+                if (mempool_count == shorttxids.size())
+                    break;
             }
         }
-        // Though ideally we'd continue scanning for the two-txn-match-shortid case,
-        // the performance win of an early exit here is too good to pass up and worth
-        // the extra risk.
-        if (mempool_count == shorttxids.size())
-            break;
+
+        if (cached != pool->m_shortid_matches.end())
+            pool->m_shortid_matches.erase(cached);
+        pool->m_shortid_matches.emplace_front();
+        if (pool->m_shortid_matches.size() > CTxMemPool::SHORTID_MATCHES_CACHE_SIZE)
+            pool->m_shortid_matches.pop_back();
+        CTxMemPool::ShortIDMatches& matches = pool->m_shortid_matches.front();
+        matches.block_hash = block_hash;
+        matches.nonce = cmpctblock.nonce;
+        matches.shorttxids = cmpctblock.shorttxids;
+        matches.txn_updated = pool->GetTransactionsUpdated();
+        matches.complete = mempool_count == shorttxids.size();
+        for (const auto& shortid : shorttxids) {
+            if (have_txn[shortid.second])
+                matches.matches.emplace_back(shortid.first, txn_available[shortid.second] ? txn_available[shortid.second]->GetWitnessHash() : uint256());
+        }
     }
     }
 
-    for (size_t i = 0; i < extra_txn.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(extra_txn[i].first);
-        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
-        if (idit != shorttxids.end()) {
-            if (!have_txn[idit->second]) {
-                txn_available[idit->second] = extra_txn[i].second;
-                have_txn[idit->second]  = true;
-                mempool_count++;
-                extra_count++;
-            } else {
-                // If we find two mempool/extra txn that match the short id, just
-                // request it.
-                // This should be rare enough that the extra bandwidth doesn't matter,
-                // but eating a round-trip due to FillBlock failure would be annoying
-                // Note that we don't want duplication between extra_txn and mempool to
-                // trigger this case, so we compare witness hashes first
-                if (txn_available[idit->second] &&
-                        txn_available[idit->second]->GetWitnessHash() != extra_txn[i].second->GetWitnessHash()) {
-                    txn_available[idit->second].reset();
-                    mempool_count--;
-                    extra_count--;
+    for (size_t batch = 0; batch < extra_txn.size() && mempool_count != shorttxids.size(); batch += SHORTID_BATCH_SIZE) {
+        const size_t batch_count = std::min(SHORTID_BATCH_SIZE, extra_txn.size() - batch);
+        for (size_t j = 0; j < batch_count; j++)
+            batch_hashes[j] = extra_txn[batch + j].first;
+        cmpctblock.GetShortIDs(batch_hashes, batch_shortids, batch_count);
+
+        for (size_t j = 0; j < batch_count; j++) {
+            const size_t i = batch + j;
+            std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(batch_shortids[j]);
+            if (idit != shorttxids.end()) {
+                if (!have_txn[idit->second]) {
+                    txn_available[idit->second] = extra_txn[i].second;
+                    have_txn[idit->second]  = true;
+                    mempool_count++;
+                    extra_count++;
+                } else {
+                    // If we find two mempool/extra txn that match the short id, just
+                    // request it.
+                    // This should be rare enough that the extra bandwidth doesn't matter,
+                    // but eating a round-trip due to FillBlock failure would be annoying
+                    // Note that we don't want duplication between extra_txn and mempool to
+                    // trigger this case, so we compare witness hashes first
+                    if (txn_available[idit->second] &&
+                            txn_available[idit->second]->GetWitnessHash() != extra_txn[i].second->GetWitnessHash()) {
+                        txn_available[idit->second].reset();
+                        mempool_count--;
+                        extra_count--;
+                    }
                 }
             }
+            // Though ideally we'd continue scanning for the two-txn-match-shortid case,
+            // the performance win of an early exit here is too good to pass up and worth
+            // the extra risk.
+            if (mempool_count == shorttxids.size())
+                break;
         }
-        // Though ideally we'd continue scanning for the two-txn-match-shortid case,
-        // the performance win of an early exit here is too good to pass up and worth
-        // the extra risk.
-        if (mempool_count == shorttxids.size())
-            break;
     }
 
     if (fBench) {
@@ -240,12 +314,25 @@ ReadStatus PartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<
 }
 
 
+// The context codec v2 encodes the transactions of a block in, with all of
+// them known
+static CompressionBlockContext GetCompressionBlockContext(const CBlock& block, codec_version_t const cv) {
+    if (cv < codec_version_t::v2)
+        return CompressionBlockContext();
+    CompressionBlockContext block_ctx(block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); i++)
+        block_ctx.SetTxid(i, block.vtx[i]->GetHash());
+    block_ctx.BuildIndex();
+    return block_ctx;
+}
+
 CBlockHeaderAndLengthShortTxIDs::CBlockHeaderAndLengthShortTxIDs(const CBlock& block,
         codec_version_t const cv, bool const fDeterministic) :
     CBlockHeaderAndShortTxIDs(block, true, fDeterministic),
     codec_version(cv),
     txlens(shorttxids.size())
 {
+    const CompressionBlockContext block_ctx = GetCompressionBlockContext(block, codec_version);
     int32_t lastprefilledindex = -1;
     uint16_t index_offset = 0;
     auto prefilledit = prefilledtxn.cbegin();
@@ -256,7 +343,7 @@ CBlockHeaderAndLengthShortTxIDs::CBlockHeaderAndLengthShortTxIDs(const CBlock& b
             index_offset++;
         } else {
 	    const CTransactionRef& tx = block.vtx[i];
-            txlens[i - index_offset] = GetSerializeSize(CTxCompressor(*tx, codec_version), PROTOCOL_VERSION);
+            txlens[i - index_offset] = GetSerializeSize(CTxCompressor(*tx, codec_version, block_ctx, i), PROTOCOL_VERSION);
     	}
     }
 }
@@ -338,12 +425,13 @@ struct FillIndexOffsetMapSerializer {
     VectorOutputStream& stream;
     const CBlock& block;
     codec_version_t codec_version;
+    const CompressionBlockContext& block_ctx;
     void operator()(size_t offset, size_t index) {
         if (stream.pos() < offset)
             stream.skip_bytes(offset - stream.pos());
         assert(stream.pos() == offset);
 	const CTransactionRef& tx = block.vtx[index];
-	stream << CTxCompressor(*tx, codec_version);
+	stream << CTxCompressor(*tx, codec_version, block_ctx, index);
     }
 };
 
@@ -352,7 +440,8 @@ ChunkCodedBlock::ChunkCodedBlock(const CBlock& block, const CBlockHeaderAndLengt
     VectorOutputStream stream(&codedBlock, SER_NETWORK, PROTOCOL_VERSION);
 
     {
-        FillIndexOffsetMapSerializer ser{stream, block, headerAndIDs.codec_ver()};
+        const CompressionBlockContext block_ctx = GetCompressionBlockContext(block, headerAndIDs.codec_ver());
+        FillIndexOffsetMapSerializer ser{stream, block, headerAndIDs.codec_ver(), block_ctx};
         auto const ret = headerAndIDs.FillIndexOffsetMap(ser);
         assert(ret == READ_STATUS_OK);
     }
@@ -367,6 +456,11 @@ ChunkCodedBlock::ChunkCodedBlock(const CBlock& block, const CBlockHeaderAndLengt
 }
 
 
+// Number of transactions DoParallelFill serializes per FECWorkerPool range
+static const size_t PARALLEL_FILL_RANGE_SIZE = 64;
+// Number of transactions DoParallelFill serializes per call
+static const size_t PARALLEL_FILL_SLICE_SIZE = 16 * PARALLEL_FILL_RANGE_SIZE;
+
 static inline uint16_t get_txlens_index(const std::map<uint16_t, uint16_t>& txn_prefilled, uint16_t real_index) {
     if (txn_prefilled.empty())
         return real_index;
@@ -376,11 +470,58 @@ static inline uint16_t get_txlens_index(const std::map<uint16_t, uint16_t>& txn_
 }
 
 struct FillIndexOffsetMapCallback {
-    std::map<size_t, size_t>& index_offsets;
+    std::vector<std::pair<size_t, size_t>>& index_offsets;
     void operator()(size_t offset, size_t index) {
-        index_offsets[offset] = index;
+        // Offsets are provided in increasing order
+        index_offsets.emplace_back(offset, index);
     }
 };
+// Coded block buffers of destroyed PartiallyDownloadedChunkBlocks, kept for
+// reuse so that receiving a block does not allocate (and page in) a fresh
+// buffer of up to MAX_BLOCK_SERIALIZED_SIZE * MAX_CHUNK_CODED_BLOCK_SIZE_FACTOR.
+// Each buffer is stored with the time it was returned. The most recently
+// returned buffer is reused first, so the oldest ones are those left idle.
+static const size_t CODED_BLOCK_CACHE_COUNT = 8;
+static Mutex cs_coded_block_cache;
+static std::deque<std::pair<std::vector<unsigned char>, std::chrono::seconds>> coded_block_cache GUARDED_BY(cs_coded_block_cache);
+
+static std::vector<unsigned char> GetCodedBlockBuffer() {
+    std::vector<unsigned char> buf;
+    LOCK(cs_coded_block_cache);
+    if (!coded_block_cache.empty()) {
+        buf.swap(coded_block_cache.back().first);
+        coded_block_cache.pop_back();
+    }
+    return buf;
+}
+
+static void ReturnCodedBlockBuffer(std::vector<unsigned char>& buf) {
+    if (!buf.capacity())
+        return;
+    buf.clear();
+    LOCK(cs_coded_block_cache);
+    if (coded_block_cache.size() < CODED_BLOCK_CACHE_COUNT)
+        coded_block_cache.emplace_back(std::move(buf), GetTime<std::chrono::seconds>());
+}
+
+size_t TrimCodedBlockBufferCache() {
+    const std::chrono::seconds cutoff = GetTime<std::chrono::seconds>() - CODED_BLOCK_CACHE_IDLE_TIME;
+    std::vector<std::vector<unsigned char>> idle;
+    {
+        LOCK(cs_coded_block_cache);
+        while (!coded_block_cache.empty() && coded_block_cache.front().second < cutoff) {
+            idle.emplace_back(std::move(coded_block_cache.front().first));
+            coded_block_cache.pop_front();
+        }
+    }
+    // The buffers are freed here, outside of the lock
+    return idle.size();
+}
+
+PartiallyDownloadedChunkBlock::~PartiallyDownloadedChunkBlock() {
+    ReturnCodedBlockBuffer(codedBlock);
+}
+
 ReadStatus PartiallyDownloadedChunkBlock::InitData(const CBlockHeaderAndLengthShortTxIDs& comprblock, const std::vector<std::pair<uint256, CTransactionRef>>& extra_txn) {
     const bool fBench = LogAcceptCategory(BCLog::BENCH);
     std::chrono::steady_clock::time_point start;
@@ -410,6 +551,7 @@ ReadStatus PartiallyDownloadedChunkBlock::InitData(const CBlockHeaderAndLengthSh
     if (allTxnFromMempool)
         return READ_STATUS_OK;
 
+    index_offsets.reserve(comprblock.shorttxids.size());
     FillIndexOffsetMapCallback fiomCallback{index_offsets};
     status = comprblock.FillIndexOffsetMap(fiomCallback);
     if (status != READ_STATUS_OK)
@@ -426,18 +568,28 @@ ReadStatus PartiallyDownloadedChunkBlock::InitData(const CBlockHeaderAndLengthSh
         assert(inserted);
     }
 
+    if (codec_version >= codec_version_t::v2) {
+        block_ctx = CompressionBlockContext(txn_available.size());
+        for (size_t i = 0; i < txn_available.size(); i++) {
+            if (txn_available[i])
+                block_ctx.SetTxid(i, txn_available[i]->GetHash());
+        }
+        block_ctx.BuildIndex();
+        DropTxnSpendingMissingTxn(comprblock);
+    }
+
     if (index_offsets.size()) {
         size_t codedBlockSize = DIV_CEIL(
-                                index_offsets.rbegin()->first +
-                                comprblock.txlens[get_txlens_index(txn_prefilled, index_offsets.rbegin()->second)] + 80,
+                                index_offsets.back().first +
+                                comprblock.txlens[get_txlens_index(txn_prefilled, index_offsets.back().second)] + 80,
                             FEC_CHUNK_SIZE) * FEC_CHUNK_SIZE;
         chunksAvailable.resize(codedBlockSize / FEC_CHUNK_SIZE);
         remainingChunks = codedBlockSize / FEC_CHUNK_SIZE;
+        if (!codedBlock.capacity())
+            codedBlock = GetCodedBlockBuffer();
         codedBlock.resize(codedBlockSize);
     }
 
-    fill_coding_index_offsets_it = index_offsets.begin();
-
     if (fBench) {
         std::chrono::steady_clock::time_point finished(std::chrono::steady_clock::now());
         LogPrintf("PartiallyDownloadedChunkBlock::InitData took %lf %lf %lf ms\n", to_millis_double(base_data_initd - start), to_millis_double(index_offset_mapped - base_data_initd), to_millis_double(finished - index_offset_mapped));
@@ -446,50 +598,97 @@ ReadStatus PartiallyDownloadedChunkBlock::InitData(const CBlockHeaderAndLengthSh
     return READ_STATUS_OK;
 }
 
-bool PartiallyDownloadedChunkBlock::SerializeTransaction(VectorOutputStream& stream, std::map<size_t, size_t>::iterator it) {
-    if (stream.pos() < it->first)
-        stream.skip_bytes(it->first - stream.pos());
-    assert(stream.pos() == it->first);
+void PartiallyDownloadedChunkBlock::DropTxnSpendingMissingTxn(const CBlockHeaderAndLengthShortTxIDs& comprblock) {
+    // The short IDs of the transactions we are missing, to tell whether a
+    // mempool transaction could be one of them
+    std::vector<uint64_t> missing_shortids;
+    for (size_t i = 0; i < txn_available.size(); i++) {
+        if (!txn_available[i])
+            missing_shortids.push_back(comprblock.shorttxids[get_txlens_index(txn_prefilled, i)]);
+    }
+    std::sort(missing_shortids.begin(), missing_shortids.end());
+
+    // A parent which is neither one of the block's transactions we have nor
+    // in the mempool is confirmed already if the child is in the mempool, as
+    // the mempool only holds transactions spending the UTXO set or each
+    // other. Otherwise it may well be one we are missing.
+    LOCK(pool->cs);
+    for (size_t i = 0; i < txn_available.size(); i++) {
+        if (!txn_available[i] || txn_prefilled.count(i))
+            continue;
+        const CTransaction& tx = *txn_available[i];
+        const bool in_mempool = pool->mapTx.count(tx.GetHash());
+        bool reproducible = true;
+        for (const CTxIn& txin : tx.vin) {
+            size_t index;
+            if (txin.prevout.IsNull() || block_ctx.FindEarlierTxid(txin.prevout.hash, i, index))
+                continue;
+            auto it = pool->mapTx.find(txin.prevout.hash);
+            if (it != pool->mapTx.end()) {
+                const uint64_t shortid = comprblock.GetShortID(it->GetTx().GetWitnessHash());
+                reproducible = !std::binary_search(missing_shortids.begin(), missing_shortids.end(), shortid);
+            } else {
+                reproducible = in_mempool;
+            }
+            if (!reproducible)
+                break;
+        }
+        if (!reproducible) {
+            txn_available[i].reset();
+            mempool_count--;
+        }
+    }
+}
+
+size_t PartiallyDownloadedChunkBlock::NextTxOffset(size_t pos) const {
+    // The last transaction may run up to the header in the last 80 bytes
+    return pos + 1 < index_offsets.size() ? index_offsets[pos + 1].first : codedBlock.size() - 80;
+}
+
+bool PartiallyDownloadedChunkBlock::SerializeTransaction(VectorOutputStream& stream, size_t pos) {
+    if (stream.pos() < index_offsets[pos].first)
+        stream.skip_bytes(index_offsets[pos].first - stream.pos());
+    assert(stream.pos() == index_offsets[pos].first);
 
     // We're fine blindly serializing tx -> either it came from mempool and is fully valid,
     // or it was received over the wire, so it shouldn't be able to eat all our memory.
-    const CTransactionRef& tx = PartiallyDownloadedBlock::txn_available[it->second];
+    const CTransactionRef& tx = PartiallyDownloadedBlock::txn_available[index_offsets[pos].second];
 
     /* We're serializing txns in order to form the chunk-coded block in advance
      * of actually receiving it from the UDP peer. Hence, we must compress txns
      * with the same codec that is going to be used by tx peer. The codec has
      * been advertised within the CBlockHeaderAndLengthShortTxIDs structure. */
-    stream << CTxCompressor(*tx, codec_version);
+    stream << CTxCompressor(*tx, codec_version, block_ctx, index_offsets[pos].second);
 
-    it++;
-    if (it == index_offsets.end())
-        return true;
-    else
-        return stream.pos() <= it->first;
+    return stream.pos() <= NextTxOffset(pos);
 }
 
 ReadStatus PartiallyDownloadedChunkBlock::DoIterativeFill(size_t& firstChunkProcessed) {
-    std::map<size_t, size_t>::iterator current_it = fill_coding_index_offsets_it;
-    size_t current_index = current_it->first;
+    size_t current_pos = fill_coding_index_offsets_pos;
+    size_t current_index = index_offsets[current_pos].first;
 
     VectorOutputStream stream(&codedBlock, SER_NETWORK, PROTOCOL_VERSION, current_index);
 
     firstChunkProcessed = current_index / FEC_CHUNK_SIZE;
 
-    for (; fill_coding_index_offsets_it != index_offsets.end(); fill_coding_index_offsets_it++) {
-        if (fill_coding_index_offsets_it->first / FEC_CHUNK_SIZE == current_index / FEC_CHUNK_SIZE)
-            haveChunk &= IsTxAvailable(fill_coding_index_offsets_it->second);
+    for (; fill_coding_index_offsets_pos < index_offsets.size(); fill_coding_index_offsets_pos++) {
+        if (index_offsets[fill_coding_index_offsets_pos].first / FEC_CHUNK_SIZE == current_index / FEC_CHUNK_SIZE)
+            haveChunk &= IsTxAvailable(index_offsets[fill_coding_index_offsets_pos].second);
         else
             break;
     }
+    // The chunks up to the one the next transaction starts in (or all the
+    // remaining ones after the last transaction) are done with
+    const size_t next_chunk = fill_coding_index_offsets_pos < index_offsets.size() ?
+                              index_offsets[fill_coding_index_offsets_pos].first / FEC_CHUNK_SIZE : chunksAvailable.size();
 
     // First process the chunk we were most recently in
     if (haveChunk) {
-        for (; current_it != fill_coding_index_offsets_it; current_it++) {
-            if (!SerializeTransaction(stream, current_it))
+        for (; current_pos != fill_coding_index_offsets_pos; current_pos++) {
+            if (!SerializeTransaction(stream, current_pos))
                 return READ_STATUS_FAILED; // Could be a shorttxid collision
         }
-        for (size_t i = current_index / FEC_CHUNK_SIZE; i < fill_coding_index_offsets_it->first / FEC_CHUNK_SIZE; i++) {
+        for (size_t i = current_index / FEC_CHUNK_SIZE; i < next_chunk; i++) {
             if (i == chunksAvailable.size() - 1) {
                 // Write the header to the last 80 bytes of the last chunk
                 size_t header_pos = chunksAvailable.size() * FEC_CHUNK_SIZE - 80;
@@ -509,16 +708,16 @@ ReadStatus PartiallyDownloadedChunkBlock::DoIterativeFill(size_t& firstChunkProc
     haveChunk = true; // Next chunk gets a fresh start
 
     // If we're gonna try to process this chunk later...
-    if (fill_coding_index_offsets_it != index_offsets.end() && IsTxAvailable(fill_coding_index_offsets_it->second)) {
-        current_index = fill_coding_index_offsets_it->first;
+    if (fill_coding_index_offsets_pos < index_offsets.size() && IsTxAvailable(index_offsets[fill_coding_index_offsets_pos].second)) {
+        current_index = index_offsets[fill_coding_index_offsets_pos].first;
         if (current_index % FEC_CHUNK_SIZE != 0) {
             // If we don't start on a chunk boundry, we assume the previous transaction
             // came into our chunk, as otherwise our packing algorithm is braindead
-            assert(fill_coding_index_offsets_it != index_offsets.begin());
-            std::map<size_t, size_t>::iterator previt = fill_coding_index_offsets_it; previt--;
-            if (IsTxAvailable(previt->second)) {
-                if (stream.pos() <= previt->first) { // If previt was not already encoded...
-                    if (!SerializeTransaction(stream, previt))
+            assert(fill_coding_index_offsets_pos != 0);
+            const size_t prev_pos = fill_coding_index_offsets_pos - 1;
+            if (IsTxAvailable(index_offsets[prev_pos].second)) {
+                if (stream.pos() <= index_offsets[prev_pos].first) { // If prev_pos was not already encoded...
+                    if (!SerializeTransaction(stream, prev_pos))
                         return READ_STATUS_FAILED; // Could be a shorttxid collision
                 }
             } else
@@ -529,8 +728,72 @@ ReadStatus PartiallyDownloadedChunkBlock::DoIterativeFill(size_t& firstChunkProc
     return READ_STATUS_OK;
 }
 
+ReadStatus PartiallyDownloadedChunkBlock::DoParallelFill(FECWorkerPool& pool, const std::function<void(size_t, size_t)>& chunks_ready) {
+    assert(!IsIterativeFillDone());
+    const size_t slice_begin = fill_coding_index_offsets_pos;
+    const size_t slice_end = std::min(slice_begin + PARALLEL_FILL_SLICE_SIZE, index_offsets.size());
+
+    // Each transaction is serialized aside first and only copied into place
+    // if it fits before the next one, so that workers never write to the
+    // same bytes, even given a shorttxid collision.
+    auto serialize = [this, slice_begin](size_t begin, size_t end) {
+        std::vector<unsigned char> tx_data;
+        for (size_t i = slice_begin + begin; i < slice_begin + end; i++) {
+            const CTransactionRef& tx = PartiallyDownloadedBlock::txn_available[index_offsets[i].second];
+            if (!tx)
+                continue;
+            tx_data.clear();
+            VectorOutputStream stream(&tx_data, SER_NETWORK, PROTOCOL_VERSION);
+            stream << CTxCompressor(*tx, codec_version, block_ctx, index_offsets[i].second);
+            if (tx_data.size() > NextTxOffset(i) - index_offsets[i].first)
+                return false; // Could be a shorttxid collision
+            memcpy(&codedBlock[index_offsets[i].first], tx_data.data(), tx_data.size());
+        }
+        return true;
+    };
+
+    // A chunk is available if every transaction overlapping it is, which is
+    // known once all of those were serialized. chunk_pos is the transaction
+    // covering the start of the next chunk to be checked.
+    size_t& chunk = parallel_fill_chunk;
+    size_t& chunk_pos = parallel_fill_chunk_pos;
+    auto check_chunks = [&](size_t, size_t end) {
+        const size_t txn_done = slice_begin + end;
+        const size_t first_chunk = chunk;
+        while (chunk < chunksAvailable.size()) {
+            const size_t chunk_end = (chunk + 1) * FEC_CHUNK_SIZE;
+            size_t last_pos = chunk_pos;
+            bool have_chunk = IsTxAvailable(index_offsets[last_pos].second);
+            while (last_pos + 1 < index_offsets.size() && index_offsets[last_pos + 1].first < chunk_end)
+                have_chunk &= IsTxAvailable(index_offsets[++last_pos].second);
+            if (last_pos >= txn_done)
+                break;
+
+            if (have_chunk) {
+                if (chunk == chunksAvailable.size() - 1) {
+                    // Write the header to the last 80 bytes of the last chunk
+                    VectorOutputStream stream(&codedBlock, SER_NETWORK, PROTOCOL_VERSION, codedBlock.size() - 80);
+                    stream << header;
+                }
+                if (!chunksAvailable[chunk])
+                    remainingChunks--;
+                chunksAvailable[chunk] = true;
+            }
+
+            chunk++;
+            chunk_pos = last_pos + 1 < index_offsets.size() && index_offsets[last_pos + 1].first == chunk_end ? last_pos + 1 : last_pos;
+        }
+        if (chunk != first_chunk && chunks_ready)
+            chunks_ready(first_chunk, chunk);
+    };
+
+    const bool success = pool.Run(slice_end - slice_begin, PARALLEL_FILL_RANGE_SIZE, serialize, check_chunks);
+    fill_coding_index_offsets_pos = slice_end;
+    return success ? READ_STATUS_OK : READ_STATUS_FAILED;
+}
+
 bool PartiallyDownloadedChunkBlock::IsIterativeFillDone() const {
-    return allTxnFromMempool || fill_coding_index_offsets_it == index_offsets.end();
+    return allTxnFromMempool || fill_coding_index_offsets_pos == index_offsets.size();
 }
 
 uint256& PartiallyDownloadedChunkBlock::GetBlockHash() const {
@@ -589,20 +852,24 @@ ReadStatus PartiallyDownloadedChunkBlock::FinalizeBlock() {
     if (fBench)
         mempool_filled = std::chrono::steady_clock::now();
 
-    // TODO: This is really slow (like several ms)
-    // We should migrate to keeping the partially-decoded block as a unique_ptr
-    // and decode transactions as we go...this will not only save the deserialize
-    // time we spend here, but by calling GetHash() at that time, save the
-    // hashing time we'll spend later to check the hash of each transaction.
+    // Transactions whose chunks all arrived before the block became
+    // decodeable were already deserialized (and hashed) by DecodeTxnInChunk,
+    // only the rest has to be decoded here.
     VectorInputStream stream(&codedBlock, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_CACHE);
     for (auto it = index_offsets.cbegin(); it != index_offsets.cend(); it++) {
         if (block.vtx[it->second])
             continue;
+        if (!streamed_txn.empty() && streamed_txn[it - index_offsets.cbegin()]) {
+            block.vtx[it->second] = std::move(streamed_txn[it - index_offsets.cbegin()]);
+            continue;
+        }
         try {
             if (it->first < stream.pos()) // Last transaction was longer than expected
                 return READ_STATUS_FAILED; // Could be a shorttxid collision
             stream.seek(it->first);
-            stream >> CTxCompressor(block.vtx[it->second], codec_version);
+            stream >> CTxCompressor(block.vtx[it->second], codec_version, block_ctx, it->second);
+            if (codec_version >= codec_version_t::v2)
+                block_ctx.SetTxid(it->second, block.vtx[it->second]->GetHash());
         } catch (const std::ios_base::failure& e) {
             return READ_STATUS_FAILED; // Could be a shorttxid collision
         }
@@ -639,3 +906,47 @@ void PartiallyDownloadedChunkBlock::MarkChunkAvailable(size_t chunk) {
         remainingChunks--;
     chunksAvailable[chunk] = true;
 }
+
+size_t PartiallyDownloadedChunkBlock::DecodeTxnInChunk(size_t chunk) {
+    assert(chunk < GetChunkCount() && chunksAvailable[chunk]);
+    if (streamed_txn.empty())
+        streamed_txn.resize(index_offsets.size());
+
+    // Start at the transaction covering the beginning of the chunk
+    const size_t chunk_begin = chunk * FEC_CHUNK_SIZE;
+    size_t pos = std::upper_bound(index_offsets.begin(), index_offsets.end(), chunk_begin,
+            [](size_t offset, const std::pair<size_t, size_t>& entry) { return offset < entry.first; }) - index_offsets.begin();
+    assert(pos > 0); // The first transaction is at offset 0
+    pos--;
+
+    size_t decoded = 0;
+    VectorInputStream stream(&codedBlock, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_CACHE);
+    for (; pos < index_offsets.size() && index_offsets[pos].first < chunk_begin + FEC_CHUNK_SIZE; pos++) {
+        if (txn_available[index_offsets[pos].second] || streamed_txn[pos])
+            continue;
+
+        const size_t tx_end = NextTxOffset(pos);
+        bool have_txn = true;
+        for (size_t i = index_offsets[pos].first / FEC_CHUNK_SIZE; i <= (tx_end - 1) / FEC_CHUNK_SIZE && have_txn; i++)
+            have_txn = chunksAvailable[i];
+        if (!have_txn)
+            continue;
+
+        // Anything wrong with the transaction is left for FinalizeBlock to
+        // find when it decodes it again
+        CTransactionRef tx;
+        try {
+            stream.seek(index_offsets[pos].first);
+            stream >> CTxCompressor(tx, codec_version, block_ctx, index_offsets[pos].second);
+        } catch (const std::ios_base::failure& e) {
+            continue; // Or an in-block parent was not decoded yet
+        }
+        if (stream.pos() > tx_end)
+            continue;
+        if (codec_version >= codec_version_t::v2)
+            block_ctx.SetTxid(index_offsets[pos].second, tx->GetHash());
+        streamed_txn[pos] = std::move(tx);
+        decoded++;
+    }
+    return decoded;
+}
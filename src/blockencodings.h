@@ -9,6 +9,9 @@
 #include <primitives/block.h>
 #include <compressor.h>
 
+#include <chrono>
+#include <functional>
+
 
 class CTxMemPool;
 
@@ -109,6 +112,8 @@ public:
     CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID, bool fDeterministic = false);
 
     uint64_t GetShortID(const uint256& txhash) const;
+    /** Compute the short IDs of count txhashes at once, see SipHashUint256Batch */
+    void GetShortIDs(const uint256* txhashes, uint64_t* shortids, size_t count) const;
 
     size_t BlockTxCount() const { return shorttxids.size() + prefilledtxn.size(); }
     size_t BlockPrefilledTxCount() const { return prefilledtxn.size(); }
@@ -217,9 +222,10 @@ public:
 class VectorOutputStream;
 class PartiallyDownloadedChunkBlock : private PartiallyDownloadedBlock {
 private:
-    std::map<size_t, size_t> index_offsets; // offset -> txindex
+    std::vector<std::pair<size_t, size_t>> index_offsets; // (offset, txindex), sorted by offset
     std::vector<unsigned char> codedBlock;
     std::vector<bool> chunksAvailable;
+    std::vector<CTransactionRef> streamed_txn; // txn decoded by DecodeTxnInChunk, by index_offsets position
     uint32_t remainingChunks;
     bool allTxnFromMempool;
     bool block_finalized = false;
@@ -227,21 +233,47 @@ private:
 
     // this is initialized to what we read off the network in InitData()
     codec_version_t codec_version = codec_version_t::default_version;
+    // The block's transactions known to codec v2, as far as we have them
+    CompressionBlockContext block_ctx;
 
     // Things used in the iterative fill-from-mempool:
-    std::map<size_t, size_t>::iterator fill_coding_index_offsets_it;
+    size_t fill_coding_index_offsets_pos = 0; // index of the next index_offsets entry to process
     std::map<uint16_t, uint16_t> txn_prefilled; // index -> number of prefilled txn at or below index
     bool haveChunk = true;
+    // Things used in the parallel fill-from-mempool, which resumes at the
+    // chunk parallel_fill_chunk, whose first transaction is at position
+    // parallel_fill_chunk_pos of index_offsets
+    size_t parallel_fill_chunk = 0;
+    size_t parallel_fill_chunk_pos = 0;
 
     mutable uint256 block_hash; // Cached because its called in critical-path by udpnet
 
-    bool SerializeTransaction(VectorOutputStream& stream, std::map<size_t, size_t>::iterator it);
+    /**
+     * With codec v2, a transaction spending another one of the same block is
+     * coded with a reference to it. Forget about the transactions we could
+     * not code as the sender did, because one of their parents might be in
+     * the block without us knowing it, such that their chunks are received
+     * instead of being filled with wrongly coded data.
+     */
+    void DropTxnSpendingMissingTxn(const CBlockHeaderAndLengthShortTxIDs& comprblock);
+    size_t NextTxOffset(size_t pos) const;
+    bool SerializeTransaction(VectorOutputStream& stream, size_t pos);
 public:
     PartiallyDownloadedChunkBlock(CTxMemPool* poolIn) : PartiallyDownloadedBlock(poolIn), decoded_block(std::make_shared<CBlock>()) {}
+    ~PartiallyDownloadedChunkBlock();
 
     // extra_txn is a list of extra transactions to look at, in <witness hash, reference> form
     ReadStatus InitData(const CBlockHeaderAndLengthShortTxIDs& comprblock, const std::vector<std::pair<uint256, CTransactionRef>>& extra_txn);
     ReadStatus DoIterativeFill(size_t& firstChunkProcessed);
+    /**
+     * Fill the chunks covered by the next slice of mempool transactions, to be
+     * called instead of DoIterativeFill until IsIterativeFillDone, such that
+     * the caller may let others in between slices. Ranges of transactions are
+     * serialized on pool's threads, and chunks_ready(begin, end) is called on
+     * the calling thread, in order, as soon as it is known which of the chunks
+     * in [begin, end) are available.
+     */
+    ReadStatus DoParallelFill(FECWorkerPool& pool, const std::function<void(size_t, size_t)>& chunks_ready);
     bool IsIterativeFillDone() const;
 
     bool IsBlockAvailable() const;
@@ -264,6 +296,24 @@ public:
     // but can happen after MarkChunkAvailable
     unsigned char* GetChunk(size_t chunk);
     void MarkChunkAvailable(size_t chunk);
+
+    /**
+     * Deserialize the transactions overlapping an available chunk which are
+     * not from the mempool and are now fully covered by available chunks, so
+     * that FinalizeBlock only has to decode those the block was missing when
+     * it became decodeable. Returns the number of transactions decoded.
+     */
+    size_t DecodeTxnInChunk(size_t chunk);
 };
 
+/** Time after which an unused coded block buffer is freed */
+static constexpr std::chrono::seconds CODED_BLOCK_CACHE_IDLE_TIME{120};
+
+/**
+ * Free the coded block buffers kept for reuse by PartiallyDownloadedChunkBlock
+ * which were not reused for CODED_BLOCK_CACHE_IDLE_TIME. Returns the number of
+ * buffers freed.
+ */
+size_t TrimCodedBlockBufferCache();
+
 #endif // BITCOIN_BLOCKENCODINGS_H
@@ -14,6 +14,7 @@
 #include <serialize.h>
 #include <util/strencodings.h>
 
+#include <algorithm>
 #include <iostream>
 
 /*
@@ -209,11 +210,46 @@ uint32_t const PrevOutThreshold = 23;
 int const PrevOutVarInt = 24;
 int const SequenceMultiplier = 50;
 
+// Added to the TxHeader by codec v2 if any prevout hash refers to an earlier
+// transaction of the block
+uint8_t const InBlockPrevOutFlag = 48;
+
+void CompressionBlockContext::BuildIndex()
+{
+    m_index.clear();
+    for (size_t i = 0; i < m_txids.size(); i++) {
+        if (!m_txids[i].IsNull())
+            m_index.emplace_back(m_txids[i], i);
+    }
+    std::sort(m_index.begin(), m_index.end());
+}
+
+bool CompressionBlockContext::FindEarlierTxid(const uint256& txid, size_t const tx_index, size_t& index) const
+{
+    auto const it = std::lower_bound(m_index.begin(), m_index.end(), std::make_pair(txid, uint32_t(0)));
+    if (it == m_index.end() || it->first != txid || it->second >= tx_index)
+        return false;
+    index = it->second;
+    return true;
+}
+
+const uint256& CompressionBlockContext::GetTxid(size_t const index) const
+{
+    static const uint256 null_txid;
+    return index < m_txids.size() ? m_txids[index] : null_txid;
+}
+
 template <typename Stream>
-void decompressTransaction(Stream& s, CMutableTransaction& tx)
+void decompressTransaction(Stream& s, CMutableTransaction& tx, codec_version_t const codec_version,
+    const CompressionBlockContext* block_ctx, size_t const tx_index)
 {
     uint8_t TxHeader = 0;
     s >> TxHeader;
+    bool InBlockPrevOuts = false;
+    if (codec_version >= codec_version_t::v2 && TxHeader >= InBlockPrevOutFlag) {
+        InBlockPrevOuts = true;
+        TxHeader -= InBlockPrevOutFlag;
+    }
     LockTimeCode lock_time_code;
     uint8_t tx_version_code;
     std::tie(lock_time_code, tx_version_code) = ParseTxHeader(TxHeader);
@@ -254,8 +290,22 @@ void decompressTransaction(Stream& s, CMutableTransaction& tx)
             } else {
                 s >> VARINT(PrevOutPoint);
             }
+            uint64_t InBlockRef = 0;
+            if (InBlockPrevOuts) {
+                s >> VARINT(InBlockRef);
+            }
             uint256 PrevOutHash;
-            s >> PrevOutHash;
+            if (InBlockRef == 0) {
+                s >> PrevOutHash;
+            } else {
+                if (block_ctx == nullptr || InBlockRef > tx_index) {
+                    throw std::ios_base::failure("invalid compressed transaction. prevout refers outside the block");
+                }
+                PrevOutHash = block_ctx->GetTxid(tx_index - InBlockRef);
+                if (PrevOutHash.IsNull()) {
+                    throw std::ios_base::failure("invalid compressed transaction. prevout refers to an unknown transaction");
+                }
+            }
             txin.prevout.n = PrevOutPoint;
             txin.prevout.hash = PrevOutHash;
         }
@@ -420,11 +470,24 @@ void decompressTransaction(Stream& s, CMutableTransaction& tx)
 }
 
 template <typename Stream>
-void compressTransaction(Stream& s, CTransaction const& tx)
+void compressTransaction(Stream& s, CTransaction const& tx, codec_version_t const codec_version,
+    const CompressionBlockContext* block_ctx, size_t const tx_index)
 {
     uint8_t const TxHeader = GenerateTxHeader(tx.nLockTime, tx.nVersion);
 
-    s << TxHeader;
+    // Distance back in the block to the transaction spent by each input, or 0
+    std::vector<uint64_t> InBlockRefs;
+    if (codec_version >= codec_version_t::v2 && block_ctx != nullptr) {
+        for (size_t i = 0; i < tx.vin.size(); i++) {
+            size_t index;
+            if (block_ctx->FindEarlierTxid(tx.vin[i].prevout.hash, tx_index, index)) {
+                InBlockRefs.resize(tx.vin.size());
+                InBlockRefs[i] = tx_index - index;
+            }
+        }
+    }
+
+    s << uint8_t(InBlockRefs.empty() ? TxHeader : TxHeader + InBlockPrevOutFlag);
     LockTimeCode lock_time_code;
     uint8_t tx_version_code;
     std::tie(lock_time_code, tx_version_code) = ParseTxHeader(TxHeader);
@@ -455,7 +518,12 @@ void compressTransaction(Stream& s, CTransaction const& tx)
             if (PrevOutCode == PrevOutVarInt) {
                 s << VARINT(tx.vin[i].prevout.n);
             }
-            s << tx.vin[i].prevout.hash;
+            if (!InBlockRefs.empty()) {
+                s << VARINT(InBlockRefs[i]);
+            }
+            if (InBlockRefs.empty() || InBlockRefs[i] == 0) {
+                s << tx.vin[i].prevout.hash;
+            }
         }
 
         if (SeqCode == SequenceCode::raw) {
@@ -464,7 +532,7 @@ void compressTransaction(Stream& s, CTransaction const& tx)
 
         uint16_t ScriptSigHeader;
         valtype SmallScriptSig;
-        std::tie(ScriptSigHeader, SmallScriptSig) = GenerateScriptSigHeader(i, tx.vin[i]);
+        std::tie(ScriptSigHeader, SmallScriptSig) = GenerateScriptSigHeader(i, tx.vin[i], codec_version);
 
         s << VARINT(ScriptSigHeader);
         if (ScriptSigHeader < 4) {
@@ -503,12 +571,12 @@ void compressTransaction(Stream& s, CTransaction const& tx)
     }
 }
 
-template void compressTransaction<CDataStream>(CDataStream&, CTransaction const&);
-template void compressTransaction<VectorOutputStream>(VectorOutputStream&, CTransaction const&);
-template void compressTransaction<CVectorWriter>(CVectorWriter&, CTransaction const&);
-template void compressTransaction<CSizeComputer>(CSizeComputer&, CTransaction const&);
-template void decompressTransaction<CDataStream>(CDataStream&, CMutableTransaction&);
-template void decompressTransaction<VectorInputStream>(VectorInputStream&, CMutableTransaction&);
+template void compressTransaction<CDataStream>(CDataStream&, CTransaction const&, codec_version_t, const CompressionBlockContext*, size_t);
+template void compressTransaction<VectorOutputStream>(VectorOutputStream&, CTransaction const&, codec_version_t, const CompressionBlockContext*, size_t);
+template void compressTransaction<CVectorWriter>(CVectorWriter&, CTransaction const&, codec_version_t, const CompressionBlockContext*, size_t);
+template void compressTransaction<CSizeComputer>(CSizeComputer&, CTransaction const&, codec_version_t, const CompressionBlockContext*, size_t);
+template void decompressTransaction<CDataStream>(CDataStream&, CMutableTransaction&, codec_version_t, const CompressionBlockContext*, size_t);
+template void decompressTransaction<VectorInputStream>(VectorInputStream&, CMutableTransaction&, codec_version_t, const CompressionBlockContext*, size_t);
 
 uint8_t GenerateTxHeader(uint32_t const lock_time, uint32_t const version)
 {
@@ -623,8 +691,14 @@ bool ValidSignatureEncoding(const std::vector<unsigned char> &sig)
     return true;
 }
 */
-bool IsValidPubKey(const valtype &pubkey)
+bool IsValidPubKey(const valtype &pubkey, codec_version_t const codec_version)
 {
+    // Compressed pubkeys are coded as their prefix and X coordinate, so
+    // unlike uncompressed ones, they need not be on the curve to be coded.
+    // Codec v2 skips the check, which takes longer than all the rest of
+    // compressing a typical transaction.
+    if (codec_version >= codec_version_t::v2 && pubkey.size() == CPubKey::COMPRESSED_SIZE)
+        return pubkey[0] == 0x02 || pubkey[0] == 0x03;
     CPubKey pk(pubkey);
     // 0x06 and 0x07 are "hybrid encodings" for keys
     // virtually all keys are fully valid, but we can only turn them into the
@@ -654,7 +728,7 @@ bool IsFromMultisig(Span<valtype const> stack, stattype statistic)
     return true;
 }
 
-bool IsFromEmbeddedMultisig(Span<valtype const> stack, stattype statistic)
+bool IsFromEmbeddedMultisig(Span<valtype const> stack, stattype statistic, codec_version_t const codec_version)
 {
     if (stack.size() < 3 || stack[0].size() != 0) return false;
     valtype redeemscript = std::move(stack.back());
@@ -675,7 +749,7 @@ bool IsFromEmbeddedMultisig(Span<valtype const> stack, stattype statistic)
         if (redeemstack[0][0] != sigcount || redeemstack.back()[0] != pkcount) return false;
         uint64_t compressedcount = 0;
         for (size_t i = 1; i < (pkcount + 1); ++i) {
-            if (!IsValidPubKey(redeemstack[i])) return false;
+            if (!IsValidPubKey(redeemstack[i], codec_version)) return false;
             if (redeemstack[i].size() == 33) compressedcount++;
         }
         if (sigcount > 20 || pkcount > 21) return false;
@@ -699,9 +773,9 @@ bool IsFromPubKey(Span<valtype const> stack, Span<valtype const> witnessstack, s
     return false;
 }
 
-bool IsFromPubKeyHash(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic)
+bool IsFromPubKeyHash(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic, codec_version_t const codec_version)
 {
-    if (witnessstack.size() == 0 && stack.size() == 2 && IsValidSignatureEncoding(stack[0]) && IsValidPubKey(stack[1])) {
+    if (witnessstack.size() == 0 && stack.size() == 2 && IsValidSignatureEncoding(stack[0]) && IsValidPubKey(stack[1], codec_version)) {
         if (stack[0].back() != SIGHASH_ALL) statistic[0]++;
         statistic[1]++;
         if (stack[1].size() != 33) statistic[2]++;
@@ -710,9 +784,9 @@ bool IsFromPubKeyHash(Span<valtype const> stack, Span<valtype const> witnessstac
     return false;
 }
 
-bool IsFromWitnessPubKeyHash(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic)
+bool IsFromWitnessPubKeyHash(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic, codec_version_t const codec_version)
 {
-    if (stack.size() == 0 && witnessstack.size() == 2 && IsValidSignatureEncoding(witnessstack[0]) && IsValidPubKey(witnessstack[1])) {
+    if (stack.size() == 0 && witnessstack.size() == 2 && IsValidSignatureEncoding(witnessstack[0]) && IsValidPubKey(witnessstack[1], codec_version)) {
         if (witnessstack[0].back() != SIGHASH_ALL) statistic[0]++;
         statistic[1]++;
         if (witnessstack[1].size() != 33) statistic[2]++;
@@ -721,9 +795,9 @@ bool IsFromWitnessPubKeyHash(Span<valtype const> stack, Span<valtype const> witn
     return false;
 }
 
-bool IsFromScriptHashWitnessPubKeyHash(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic)
+bool IsFromScriptHashWitnessPubKeyHash(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic, codec_version_t const codec_version)
 {
-    if (stack.size() == 1 && witnessstack.size() == 2 && IsValidSignatureEncoding(witnessstack[0]) && IsValidPubKey(witnessstack[1])) {
+    if (stack.size() == 1 && witnessstack.size() == 2 && IsValidSignatureEncoding(witnessstack[0]) && IsValidPubKey(witnessstack[1], codec_version)) {
         CScript const witnessscripthash = GetScriptForDestination(WitnessV0KeyHash(CPubKey(witnessstack[1]).GetID()));
         if (witnessscripthash == CScript(stack[0].begin(), stack[0].end())) {
             if (witnessstack[0].back() != SIGHASH_ALL) statistic[0]++;
@@ -741,21 +815,21 @@ bool IsFromRawMultisig(Span<valtype const> stack, Span<valtype const> witnesssta
     return false;
 }
 
-bool IsFromScriptHashMultisig(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic)
+bool IsFromScriptHashMultisig(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic, codec_version_t const codec_version)
 {
-    if (witnessstack.size() == 0 && IsFromEmbeddedMultisig(stack, statistic)) return true;
+    if (witnessstack.size() == 0 && IsFromEmbeddedMultisig(stack, statistic, codec_version)) return true;
     return false;
 }
 
-bool IsFromWitnessScriptHashMultisig(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic)
+bool IsFromWitnessScriptHashMultisig(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic, codec_version_t const codec_version)
 {
-    if (stack.size() == 0 && IsFromEmbeddedMultisig(witnessstack, statistic)) return true;
+    if (stack.size() == 0 && IsFromEmbeddedMultisig(witnessstack, statistic, codec_version)) return true;
     return false;
 }
 
-bool IsFromScriptHashWitnessScriptHashMultisig(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic)
+bool IsFromScriptHashWitnessScriptHashMultisig(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic, codec_version_t const codec_version)
 {
-    if (IsFromScriptHashWitnessScriptHash(stack, witnessstack) && IsFromEmbeddedMultisig(witnessstack, statistic)) return true;
+    if (IsFromScriptHashWitnessScriptHash(stack, witnessstack) && IsFromEmbeddedMultisig(witnessstack, statistic, codec_version)) return true;
     return false;
 }
 
@@ -807,32 +881,25 @@ bool IsFromWitnessOther(Span<valtype const> stack, Span<valtype const> witnessst
     return false;
 }
 
-// turn uncompressed pubkeys into compressed ones
-scriptSigTemplate AnalyzeScriptSig(size_t const txinindex, CTxIn const& in, stattype statistic)
+// Classifies an input by its scriptSig, as parsed by encode_push_only, and witness
+static scriptSigTemplate AnalyzeScriptSig(bool const push_only, Span<valtype const> stack, Span<valtype const> witness,
+    stattype statistic, codec_version_t const codec_version)
 {
     using t = scriptSigTemplate;
-    std::vector<valtype> witnessstack;
-    if (!in.scriptWitness.IsNull())
-        witnessstack = in.scriptWitness.stack;
-    Span<valtype const> witness(witnessstack.data(), witnessstack.size());
-    std::vector<valtype> stack;
-    bool push_only;
-    std::tie(push_only, stack) = encode_push_only(in.scriptSig);
-
     if (push_only) {
-        if (IsFromPubKeyHash(MakeSpan(stack), witness, statistic)) return t::P2PKH;
-        else if (IsFromScriptHashMultisig(MakeSpan(stack), witness, statistic)) return t::P2SH_MS;
-        else if (IsFromScriptHashWitnessPubKeyHash(MakeSpan(stack), witness, statistic)) return t::P2SH_P2WPKH;
-        else if (IsFromScriptHashWitnessScriptHashMultisig(MakeSpan(stack), witness, statistic)) return t::P2SH_P2WSH_MS;
-        else if (IsFromWitnessPubKeyHash(MakeSpan(stack), witness, statistic)) return t::P2WPKH;
-        else if (IsFromPubKey(MakeSpan(stack), witness, statistic)) return t::P2PK;
-        else if (IsFromWitnessScriptHashMultisig(MakeSpan(stack), witness, statistic)) return t::P2WSH_MS;
-        else if (IsFromRawMultisig(MakeSpan(stack), witness, statistic)) return t::MS;
-        else if (IsFromScriptHashWitnessScriptHashPubKeyHash(MakeSpan(stack), witness, statistic)) return t::P2SH_P2WSH_P2PKH;
-        else if (IsFromScriptHashWitnessScriptHashOther(MakeSpan(stack), witness, statistic)) return t::P2SH_P2WSH_OTHER;
-    }
-    if (IsFromNonWitnessOther(MakeSpan(stack), witness, statistic)) return t::NONWIT_OTHER;
-    else if (IsFromWitnessOther(MakeSpan(stack), witness, statistic)) return t::WIT_OTHER;
+        if (IsFromPubKeyHash(stack, witness, statistic, codec_version)) return t::P2PKH;
+        else if (IsFromScriptHashMultisig(stack, witness, statistic, codec_version)) return t::P2SH_MS;
+        else if (IsFromScriptHashWitnessPubKeyHash(stack, witness, statistic, codec_version)) return t::P2SH_P2WPKH;
+        else if (IsFromScriptHashWitnessScriptHashMultisig(stack, witness, statistic, codec_version)) return t::P2SH_P2WSH_MS;
+        else if (IsFromWitnessPubKeyHash(stack, witness, statistic, codec_version)) return t::P2WPKH;
+        else if (IsFromPubKey(stack, witness, statistic)) return t::P2PK;
+        else if (IsFromWitnessScriptHashMultisig(stack, witness, statistic, codec_version)) return t::P2WSH_MS;
+        else if (IsFromRawMultisig(stack, witness, statistic)) return t::MS;
+        else if (IsFromScriptHashWitnessScriptHashPubKeyHash(stack, witness, statistic)) return t::P2SH_P2WSH_P2PKH;
+        else if (IsFromScriptHashWitnessScriptHashOther(stack, witness, statistic)) return t::P2SH_P2WSH_OTHER;
+    }
+    if (IsFromNonWitnessOther(stack, witness, statistic)) return t::NONWIT_OTHER;
+    else if (IsFromWitnessOther(stack, witness, statistic)) return t::WIT_OTHER;
     else {
         statistic[0] += witness.size();
         statistic[1]++;
@@ -840,6 +907,15 @@ scriptSigTemplate AnalyzeScriptSig(size_t const txinindex, CTxIn const& in, stat
     }
 }
 
+// turn uncompressed pubkeys into compressed ones
+scriptSigTemplate AnalyzeScriptSig(size_t const txinindex, CTxIn const& in, stattype statistic, codec_version_t const codec_version)
+{
+    bool push_only;
+    std::vector<valtype> stack;
+    std::tie(push_only, stack) = encode_push_only(in.scriptSig);
+    return AnalyzeScriptSig(push_only, MakeSpan(stack), MakeSpan(in.scriptWitness.stack), statistic, codec_version);
+}
+
 // copies src into the right side of dst
 void right_align(Span<uint8_t const> src, Span<uint8_t> dst)
 {
@@ -971,22 +1047,20 @@ uint16_t KNCoder(uint64_t const k, uint64_t const n)
     return 0;
 }
 
-std::pair<uint16_t, valtype> GenerateScriptSigHeader(size_t const txinindex, CTxIn const& in)
+std::pair<uint16_t, valtype> GenerateScriptSigHeader(size_t const txinindex, CTxIn const& in, codec_version_t const codec_version)
 {
     uint16_t ScriptSigHeader = 0;
     valtype SmallScriptSig;
 
     std::array<uint64_t, 5> statistic = {0, 0, 0, 0, 0};
-    std::vector<valtype> witnessstack;
-    if (!in.scriptWitness.IsNull()) {
-        witnessstack = in.scriptWitness.stack;
-    }
+    Span<valtype const> const witnessstack = MakeSpan(in.scriptWitness.stack);
+    bool push_only;
+    std::vector<valtype> stack;
+    std::tie(push_only, stack) = encode_push_only(in.scriptSig);
     bool sighashall = true;
-    scriptSigTemplate const templateType = AnalyzeScriptSig(txinindex, in, MakeSpan(statistic));
+    scriptSigTemplate const templateType = AnalyzeScriptSig(push_only, MakeSpan(stack), witnessstack, MakeSpan(statistic), codec_version);
     if (statistic[0] != 0)
         sighashall = false;
-
-    std::vector<valtype> const stack = encode_push_only(in.scriptSig).second;
     switch (templateType) {
     case scriptSigTemplate::P2SH_P2WSH_OTHER:
     case scriptSigTemplate::WIT_OTHER:
@@ -1032,9 +1106,8 @@ std::pair<uint16_t, valtype> GenerateScriptSigHeader(size_t const txinindex, CTx
             ScriptSigHeader += 4;
         uint16_t const kncode = KNCoder(statistic[2], statistic[3]);
         ScriptSigHeader += 8 * kncode;
-        std::vector<valtype> sigstack = witnessstack;
-        if (templateType == scriptSigTemplate::P2SH_MS)
-            sigstack = stack;
+        std::vector<valtype> sigstack = templateType == scriptSigTemplate::P2SH_MS ?
+            std::move(stack) : std::vector<valtype>(witnessstack.begin(), witnessstack.end());
         std::vector<valtype> pkstack = encode_push_only(CScript(sigstack.back().begin(), sigstack.back().end())).second;
         sigstack.pop_back();
         pkstack.erase(pkstack.begin());
@@ -143,6 +143,8 @@ struct TxOutCompression
     FORMATTER_METHODS(CTxOut, obj) { READWRITE(Using<AmountCompression>(obj.nValue), Using<ScriptCompression>(obj.scriptPubKey)); }
 };
 
+enum codec_version_t : std::uint8_t { none, v1, v2, default_version = v1 };
+
 enum class LockTimeCode : uint8_t { zero, varint, raw };
 
 enum class SequenceCode : uint8_t { zero, final_seq, final_less_one, last_encoded, raw};
@@ -157,18 +159,18 @@ std::tuple<bool, uint8_t> ParseTxOutHeader(uint8_t TxOutHeader);
 std::pair<uint8_t, valtype> GenerateTxOutHeader(bool last, CScript const& TxOutScriptPubKey);
 
 bool IsFromScriptHashWitnessScriptHashOther(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic);
-bool IsValidPubKey(valtype const& pubkey);
+bool IsValidPubKey(valtype const& pubkey, codec_version_t codec_version = codec_version_t::v1);
 bool IsFromScriptHashWitnessScriptHash(Span<valtype const> stack, Span<valtype const> witnessstack);
 bool IsFromMultisig(Span<valtype const> stack, stattype statistic);
-bool IsFromEmbeddedMultisig(Span<valtype const> stack, stattype statistic);
+bool IsFromEmbeddedMultisig(Span<valtype const> stack, stattype statistic, codec_version_t codec_version = codec_version_t::v1);
 bool IsFromPubKey(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic);
-bool IsFromPubKeyHash(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic);
-bool IsFromWitnessPubKeyHash(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic);
-bool IsFromScriptHashWitnessPubKeyHash(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic);
+bool IsFromPubKeyHash(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic, codec_version_t codec_version = codec_version_t::v1);
+bool IsFromWitnessPubKeyHash(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic, codec_version_t codec_version = codec_version_t::v1);
+bool IsFromScriptHashWitnessPubKeyHash(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic, codec_version_t codec_version = codec_version_t::v1);
 bool IsFromRawMultisig(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic);
-bool IsFromScriptHashMultisig(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic);
-bool IsFromWitnessScriptHashMultisig(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic);
-bool IsFromScriptHashWitnessScriptHashMultisig(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic);
+bool IsFromScriptHashMultisig(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic, codec_version_t codec_version = codec_version_t::v1);
+bool IsFromWitnessScriptHashMultisig(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic, codec_version_t codec_version = codec_version_t::v1);
+bool IsFromScriptHashWitnessScriptHashMultisig(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic, codec_version_t codec_version = codec_version_t::v1);
 bool IsFromScriptHashWitnessScriptHashPubKeyHash(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic);
 bool IsFromNonWitnessOther(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic);
 bool IsFromWitnessOther(Span<valtype const> stack, Span<valtype const> witnessstack, stattype statistic);
@@ -191,9 +193,9 @@ valtype StripAllSigs(Span<valtype const> stack, bool sighashall);
 valtype StripPubKey(const valtype &pubkey);
 void StripAllPubKeys(Span<valtype const> stack, valtype &strippedpubkeys);
 uint16_t KNCoder(uint64_t k, uint64_t n);
-std::pair<uint16_t, valtype> GenerateScriptSigHeader(size_t txinindex, CTxIn const& in);
+std::pair<uint16_t, valtype> GenerateScriptSigHeader(size_t txinindex, CTxIn const& in, codec_version_t codec_version = codec_version_t::v1);
 std::pair<scriptSigTemplate, uint16_t> ParseScriptSigHeader(uint16_t ScriptSigHeader, uint16_t lastCode);
-scriptSigTemplate AnalyzeScriptSig(size_t txinindex, CTxIn const& in, stattype statistic);
+scriptSigTemplate AnalyzeScriptSig(size_t txinindex, CTxIn const& in, stattype statistic, codec_version_t codec_version = codec_version_t::v1);
 
 CScript decode_push_only(Span<valtype const> values);
 valtype PadHash(Span<unsigned char const> h, bool iswitnesshash);
@@ -206,19 +208,50 @@ std::pair<uint8_t, uint8_t> KNDecoder(uint16_t kncode);
 void PadAllPubkeys(valtype &strippedstack, std::vector<valtype>& paddedstack, uint8_t n);
 void PadScriptPubKey(uint8_t TxOutCode, CScript &scriptPubKey);
 
-template <typename Stream>
-void decompressTransaction(Stream& s, CMutableTransaction& tx);
+/**
+ * The transactions of a block, as far as they are known, for codec v2 to
+ * refer to the prevout hash of an input spending an earlier transaction of the
+ * same block by its position instead. Txids set after BuildIndex() can be
+ * referred to when decoding, but are not looked up when encoding.
+ */
+class CompressionBlockContext
+{
+public:
+    explicit CompressionBlockContext(size_t tx_count = 0) : m_txids(tx_count) {}
+
+    void SetTxid(size_t index, const uint256& txid) { m_txids[index] = txid; }
+    void BuildIndex();
+
+    // Returns false if txid is not that of a known transaction before tx_index
+    bool FindEarlierTxid(const uint256& txid, size_t tx_index, size_t& index) const;
+    // Returns null if index is out of range or the transaction is not known
+    const uint256& GetTxid(size_t index) const;
+
+private:
+    std::vector<uint256> m_txids; // by index in the block, null where unknown
+    std::vector<std::pair<uint256, uint32_t>> m_index; // (txid, index), sorted by txid
+};
 
 template <typename Stream>
-void compressTransaction(Stream& s, CTransaction const& tx);
+void decompressTransaction(Stream& s, CMutableTransaction& tx, codec_version_t codec_version = codec_version_t::v1,
+    const CompressionBlockContext* block_ctx = nullptr, size_t tx_index = 0);
 
-enum codec_version_t : std::uint8_t { none, v1, default_version = v1 };
+template <typename Stream>
+void compressTransaction(Stream& s, CTransaction const& tx, codec_version_t codec_version = codec_version_t::v1,
+    const CompressionBlockContext* block_ctx = nullptr, size_t tx_index = 0);
 
 struct CTxCompressor
 {
     CTxCompressor(CTransactionRef& txin, codec_version_t v) : tx(&txin), codec_version(v) {}
     CTxCompressor(CTransaction const& txin, codec_version_t v) : tx(&txin), codec_version(v) {}
     CTxCompressor(CMutableTransaction &txin, codec_version_t v) : tx(&txin), codec_version(v) {}
+    // For codec v2 within a block, tx_index being the position of the transaction in it
+    CTxCompressor(CTransactionRef& txin, codec_version_t v, const CompressionBlockContext& ctx, size_t tx_index) :
+        tx(&txin), codec_version(v), block_ctx(&ctx), block_tx_index(tx_index) {}
+    CTxCompressor(CTransaction const& txin, codec_version_t v, const CompressionBlockContext& ctx, size_t tx_index) :
+        tx(&txin), codec_version(v), block_ctx(&ctx), block_tx_index(tx_index) {}
+    CTxCompressor(CMutableTransaction& txin, codec_version_t v, const CompressionBlockContext& ctx, size_t tx_index) :
+        tx(&txin), codec_version(v), block_ctx(&ctx), block_tx_index(tx_index) {}
 
     template<typename Stream>
     void Serialize(Stream& s) const {
@@ -233,12 +266,12 @@ struct CTxCompressor
                 throw std::runtime_error("cannot serialize CMutableTransaction");
             }
         }
-        else if (codec_version == codec_version_t::v1) {
+        else if (codec_version == codec_version_t::v1 || codec_version == codec_version_t::v2) {
             if (boost::get<CTransactionRef*>(&tx) != nullptr) {
-                compressTransaction(s, **boost::get<CTransactionRef*>(tx));
+                compressTransaction(s, **boost::get<CTransactionRef*>(tx), codec_version, block_ctx, block_tx_index);
             }
             else if (boost::get<CTransaction const*>(&tx) != nullptr) {
-                compressTransaction(s, *boost::get<CTransaction const*>(tx));
+                compressTransaction(s, *boost::get<CTransaction const*>(tx), codec_version, block_ctx, block_tx_index);
             }
             else {
                 throw std::runtime_error("cannot serialize CMutableTransaction");
@@ -262,14 +295,14 @@ struct CTxCompressor
                 throw std::runtime_error("cannot un-serialize into CTransaction");
            }
         }
-        else if (codec_version == codec_version_t::v1) {
+        else if (codec_version == codec_version_t::v1 || codec_version == codec_version_t::v2) {
             if (boost::get<CTransactionRef*>(&tx) != nullptr) {
                 CMutableTransaction local_tx;
-                decompressTransaction(s, local_tx);
+                decompressTransaction(s, local_tx, codec_version, block_ctx, block_tx_index);
                 *boost::get<CTransactionRef*>(tx) = MakeTransactionRef(std::move(local_tx));
             }
             else if (boost::get<CMutableTransaction*>(&tx) != nullptr) {
-                decompressTransaction(s, *boost::get<CMutableTransaction*>(tx));
+                decompressTransaction(s, *boost::get<CMutableTransaction*>(tx), codec_version, block_ctx, block_tx_index);
             }
             else {
                 throw std::runtime_error("cannot un-serialize into CTransaction");
@@ -282,6 +315,8 @@ struct CTxCompressor
 private:
     boost::variant<CMutableTransaction*, CTransaction const*, CTransactionRef*> tx;
     codec_version_t codec_version = codec_version_t::v1;
+    const CompressionBlockContext* block_ctx = nullptr;
+    size_t block_tx_index = 0;
 };
 
 #endif // BITCOIN_COMPRESSOR_H
@@ -3,27 +3,125 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 // Based on the public domain implementation by Andrew Moon
-// poly1305-donna-unrolled.c from https://github.com/floodyberry/poly1305-donna
+// poly1305-donna-unrolled.c and poly1305-donna-64.h from
+// https://github.com/floodyberry/poly1305-donna
 
 #include <crypto/common.h>
 #include <crypto/poly1305.h>
 
 #include <string.h>
 
+#ifdef __SIZEOF_INT128__
+
+typedef unsigned __int128 uint128_t;
+
+void poly1305_key_init(Poly1305Key& state, const unsigned char key[POLY1305_KEYLEN]) {
+    /* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+    const uint64_t t0 = ReadLE64(key+0);
+    const uint64_t t1 = ReadLE64(key+8);
+
+    state.r[0] = ( t0                    ) & 0xffc0fffffff;
+    state.r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffff;
+    state.r[2] = ((t1 >> 24)             ) & 0x00ffffffc0f;
+
+    /* precompute multipliers */
+    state.s[0] = state.r[1] * (5 << 2);
+    state.s[1] = state.r[2] * (5 << 2);
+
+    state.pad[0] = ReadLE64(key+16);
+    state.pad[1] = ReadLE64(key+24);
+}
+
+void poly1305_auth(unsigned char out[POLY1305_TAGLEN], const unsigned char *m, size_t inlen, const Poly1305Key& key) {
+    const uint64_t r0 = key.r[0], r1 = key.r[1], r2 = key.r[2];
+    const uint64_t s1 = key.s[0], s2 = key.s[1];
+    uint64_t h0 = 0, h1 = 0, h2 = 0;
+    uint64_t hibit = ((uint64_t)1) << 40;
+    uint64_t t0, t1, c;
+    uint64_t g0, g1, g2;
+    uint128_t d0, d1, d2;
+    unsigned char mp[16];
+
+    while (inlen > 0) {
+        if (inlen >= 16) {
+            t0 = ReadLE64(m+0);
+            t1 = ReadLE64(m+8);
+            m += 16;
+            inlen -= 16;
+        } else {
+            /* final bytes, padded with a single 1 bit and no high bit */
+            memcpy(mp, m, inlen);
+            mp[inlen] = 1;
+            memset(mp + inlen + 1, 0, 15 - inlen);
+            t0 = ReadLE64(mp+0);
+            t1 = ReadLE64(mp+8);
+            hibit = 0;
+            inlen = 0;
+        }
+
+        h0 += (( t0                    ) & 0xfffffffffff);
+        h1 += (((t0 >> 44) | (t1 << 20)) & 0xfffffffffff);
+        h2 += (((t1 >> 24)             ) & 0x3ffffffffff) | hibit;
+
+        /* h *= r */
+        d0 = ((uint128_t)h0 * r0) + ((uint128_t)h1 * s2) + ((uint128_t)h2 * s1);
+        d1 = ((uint128_t)h0 * r1) + ((uint128_t)h1 * r0) + ((uint128_t)h2 * s2);
+        d2 = ((uint128_t)h0 * r2) + ((uint128_t)h1 * r1) + ((uint128_t)h2 * r0);
+
+        /* (partial) h %= p */
+                      c = (uint64_t)(d0 >> 44); h0 = (uint64_t)d0 & 0xfffffffffff;
+        d1 += c;      c = (uint64_t)(d1 >> 44); h1 = (uint64_t)d1 & 0xfffffffffff;
+        d2 += c;      c = (uint64_t)(d2 >> 42); h2 = (uint64_t)d2 & 0x3ffffffffff;
+        h0 += c * 5;  c = (h0 >> 44);           h0 =           h0 & 0xfffffffffff;
+        h1 += c;
+    }
+
+    /* fully carry h */
+                 c = (h1 >> 44); h1 &= 0xfffffffffff;
+    h2 += c;     c = (h2 >> 42); h2 &= 0x3ffffffffff;
+    h0 += c * 5; c = (h0 >> 44); h0 &= 0xfffffffffff;
+    h1 += c;     c = (h1 >> 44); h1 &= 0xfffffffffff;
+    h2 += c;     c = (h2 >> 42); h2 &= 0x3ffffffffff;
+    h0 += c * 5; c = (h0 >> 44); h0 &= 0xfffffffffff;
+    h1 += c;
+
+    /* compute h + -p */
+    g0 = h0 + 5; c = (g0 >> 44); g0 &= 0xfffffffffff;
+    g1 = h1 + c; c = (g1 >> 44); g1 &= 0xfffffffffff;
+    g2 = h2 + c - (((uint64_t)1) << 42);
+
+    /* select h if h < p, or h + -p if h >= p */
+    c = (g2 >> 63) - 1;
+    g0 &= c;
+    g1 &= c;
+    g2 &= c;
+    c = ~c;
+    h0 = (h0 & c) | g0;
+    h1 = (h1 & c) | g1;
+    h2 = (h2 & c) | g2;
+
+    /* h = (h + pad) */
+    t0 = key.pad[0];
+    t1 = key.pad[1];
+
+    h0 += (( t0                    ) & 0xfffffffffff)    ; c = (h0 >> 44); h0 &= 0xfffffffffff;
+    h1 += (((t0 >> 44) | (t1 << 20)) & 0xfffffffffff) + c; c = (h1 >> 44); h1 &= 0xfffffffffff;
+    h2 += (((t1 >> 24)             ) & 0x3ffffffffff) + c;                 h2 &= 0x3ffffffffff;
+
+    /* mac = h % (2^128) */
+    h0 = ((h0      ) | (h1 << 44));
+    h1 = ((h1 >> 20) | (h2 << 24));
+
+    WriteLE64(&out[0], h0);
+    WriteLE64(&out[8], h1);
+}
+
+#else
+
 #define mul32x32_64(a,b) ((uint64_t)(a) * (b))
 
-void poly1305_auth(unsigned char out[POLY1305_TAGLEN], const unsigned char *m, size_t inlen, const unsigned char key[POLY1305_KEYLEN]) {
+void poly1305_key_init(Poly1305Key& state, const unsigned char key[POLY1305_KEYLEN]) {
     uint32_t t0,t1,t2,t3;
-    uint32_t h0,h1,h2,h3,h4;
-    uint32_t r0,r1,r2,r3,r4;
-    uint32_t s1,s2,s3,s4;
-    uint32_t b, nb;
-    size_t j;
-    uint64_t t[5];
-    uint64_t f0,f1,f2,f3;
-    uint64_t g0,g1,g2,g3,g4;
-    uint64_t c;
-    unsigned char mp[16];
 
     /* clamp key */
     t0 = ReadLE32(key+0);
@@ -32,16 +130,35 @@ void poly1305_auth(unsigned char out[POLY1305_TAGLEN], const unsigned char *m, s
     t3 = ReadLE32(key+12);
 
     /* precompute multipliers */
-    r0 = t0 & 0x3ffffff; t0 >>= 26; t0 |= t1 << 6;
-    r1 = t0 & 0x3ffff03; t1 >>= 20; t1 |= t2 << 12;
-    r2 = t1 & 0x3ffc0ff; t2 >>= 14; t2 |= t3 << 18;
-    r3 = t2 & 0x3f03fff; t3 >>= 8;
-    r4 = t3 & 0x00fffff;
+    state.r[0] = t0 & 0x3ffffff; t0 >>= 26; t0 |= t1 << 6;
+    state.r[1] = t0 & 0x3ffff03; t1 >>= 20; t1 |= t2 << 12;
+    state.r[2] = t1 & 0x3ffc0ff; t2 >>= 14; t2 |= t3 << 18;
+    state.r[3] = t2 & 0x3f03fff; t3 >>= 8;
+    state.r[4] = t3 & 0x00fffff;
+
+    state.s[0] = state.r[1] * 5;
+    state.s[1] = state.r[2] * 5;
+    state.s[2] = state.r[3] * 5;
+    state.s[3] = state.r[4] * 5;
 
-    s1 = r1 * 5;
-    s2 = r2 * 5;
-    s3 = r3 * 5;
-    s4 = r4 * 5;
+    state.pad[0] = ReadLE32(&key[16]);
+    state.pad[1] = ReadLE32(&key[20]);
+    state.pad[2] = ReadLE32(&key[24]);
+    state.pad[3] = ReadLE32(&key[28]);
+}
+
+void poly1305_auth(unsigned char out[POLY1305_TAGLEN], const unsigned char *m, size_t inlen, const Poly1305Key& key) {
+    uint32_t t0,t1,t2,t3;
+    uint32_t h0,h1,h2,h3,h4;
+    const uint32_t r0 = key.r[0], r1 = key.r[1], r2 = key.r[2], r3 = key.r[3], r4 = key.r[4];
+    const uint32_t s1 = key.s[0], s2 = key.s[1], s3 = key.s[2], s4 = key.s[3];
+    uint32_t b, nb;
+    size_t j;
+    uint64_t t[5];
+    uint64_t f0,f1,f2,f3;
+    uint64_t g0,g1,g2,g3,g4;
+    uint64_t c;
+    unsigned char mp[16];
 
     /* init state */
     h0 = 0;
@@ -129,13 +246,21 @@ poly1305_donna_finish:
     h3 = (h3 & nb) | (g3 & b);
     h4 = (h4 & nb) | (g4 & b);
 
-    f0 = ((h0      ) | (h1 << 26)) + (uint64_t)ReadLE32(&key[16]);
-    f1 = ((h1 >>  6) | (h2 << 20)) + (uint64_t)ReadLE32(&key[20]);
-    f2 = ((h2 >> 12) | (h3 << 14)) + (uint64_t)ReadLE32(&key[24]);
-    f3 = ((h3 >> 18) | (h4 <<  8)) + (uint64_t)ReadLE32(&key[28]);
+    f0 = ((h0      ) | (h1 << 26)) + (uint64_t)key.pad[0];
+    f1 = ((h1 >>  6) | (h2 << 20)) + (uint64_t)key.pad[1];
+    f2 = ((h2 >> 12) | (h3 << 14)) + (uint64_t)key.pad[2];
+    f3 = ((h3 >> 18) | (h4 <<  8)) + (uint64_t)key.pad[3];
 
     WriteLE32(&out[ 0], f0); f1 += (f0 >> 32);
     WriteLE32(&out[ 4], f1); f2 += (f1 >> 32);
     WriteLE32(&out[ 8], f2); f3 += (f2 >> 32);
     WriteLE32(&out[12], f3);
 }
+
+#endif
+
+void poly1305_auth(unsigned char out[POLY1305_TAGLEN], const unsigned char *m, size_t inlen, const unsigned char key[POLY1305_KEYLEN]) {
+    Poly1305Key state;
+    poly1305_key_init(state, key);
+    poly1305_auth(out, m, inlen, state);
+}
@@ -11,6 +11,27 @@
 #define POLY1305_KEYLEN 32
 #define POLY1305_TAGLEN 16
 
+/** A poly1305 key with its clamped multiplier and pad already unpacked into
+ *  limbs, for authenticating many messages with the same key. Where 128-bit
+ *  integer arithmetic is available, the limbs are 44/44/42 bits wide (3x64),
+ *  otherwise 26 bits wide (5x32). */
+struct Poly1305Key {
+#ifdef __SIZEOF_INT128__
+    uint64_t r[3];
+    uint64_t s[2];
+    uint64_t pad[2];
+#else
+    uint32_t r[5];
+    uint32_t s[4];
+    uint32_t pad[4];
+#endif
+};
+
+void poly1305_key_init(Poly1305Key& state, const unsigned char key[POLY1305_KEYLEN]);
+
+void poly1305_auth(unsigned char out[POLY1305_TAGLEN], const unsigned char *m, size_t inlen,
+    const Poly1305Key& key);
+
 void poly1305_auth(unsigned char out[POLY1305_TAGLEN], const unsigned char *m, size_t inlen,
     const unsigned char key[POLY1305_KEYLEN]);
 
@@ -2,8 +2,21 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#if defined(HAVE_CONFIG_H)
+#include <config/bitcoin-config.h>
+#endif
+
 #include <crypto/siphash.h>
 
+#include <compat/cpuid.h>
+
+#if defined(ENABLE_AVX2) && defined(HAVE_GETCPUID) && !defined(BUILD_BITCOIN_INTERNAL)
+namespace siphash_avx2
+{
+void SipHashUint256_4way(uint64_t k0, uint64_t k1, const uint256* vals, uint64_t* out);
+}
+#endif
+
 #define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
 
 #define SIPROUND do { \
@@ -171,3 +184,47 @@ uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint3
     SIPROUND;
     return v0 ^ v1 ^ v2 ^ v3;
 }
+
+namespace {
+
+typedef void (*SipHashUint256_4wayFn)(uint64_t k0, uint64_t k1, const uint256* vals, uint64_t* out);
+
+SipHashUint256_4wayFn SipHashUint256_4wayDetect()
+{
+#if defined(ENABLE_AVX2) && defined(HAVE_GETCPUID) && !defined(BUILD_BITCOIN_INTERNAL)
+    uint32_t eax, ebx, ecx, edx;
+    GetCPUID(1, 0, eax, ebx, ecx, edx);
+    const bool have_xsave = (ecx >> 27) & 1;
+    const bool have_avx = (ecx >> 28) & 1;
+    if (!have_xsave || !have_avx) return nullptr;
+    // Check whether the OS has enabled AVX registers.
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    if ((a & 6) != 6) return nullptr;
+    GetCPUID(7, 0, eax, ebx, ecx, edx);
+    if ((ebx >> 5) & 1) return siphash_avx2::SipHashUint256_4way;
+#endif
+    return nullptr;
+}
+
+const SipHashUint256_4wayFn hash_4way = SipHashUint256_4wayDetect();
+
+} // namespace
+
+void SipHashUint256Batch(uint64_t k0, uint64_t k1, const uint256* vals, uint64_t* out, size_t count)
+{
+    size_t i = 0;
+    if (hash_4way) {
+        for (; i + 4 <= count; i += 4) {
+            hash_4way(k0, k1, vals + i, out + i);
+        }
+    }
+    for (; i < count; i++) {
+        out[i] = SipHashUint256(k0, k1, vals[i]);
+    }
+}
+
+std::string SipHashUint256BatchImplementation()
+{
+    return hash_4way ? "avx2(4way)" : "standard";
+}
@@ -5,7 +5,9 @@
 #ifndef BITCOIN_CRYPTO_SIPHASH_H
 #define BITCOIN_CRYPTO_SIPHASH_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <string>
 
 #include <uint256.h>
 
@@ -44,4 +46,13 @@ public:
 uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
 uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint32_t extra);
 
+/** Compute SipHashUint256(k0, k1, vals[i]) into out[i] for count values.
+ *
+ *  Hashes 4 values at a time in AVX2 lanes where the CPU supports it.
+ */
+void SipHashUint256Batch(uint64_t k0, uint64_t k1, const uint256* vals, uint64_t* out, size_t count);
+
+/** Name of the implementation used by SipHashUint256Batch. */
+std::string SipHashUint256BatchImplementation();
+
 #endif // BITCOIN_CRYPTO_SIPHASH_H
@@ -0,0 +1,79 @@
+// Copyright (c) 2016-2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include <uint256.h>
+
+namespace siphash_avx2 {
+namespace {
+
+__m256i inline K(uint64_t x) { return _mm256_set1_epi64x(x); }
+__m256i inline Add(__m256i x, __m256i y) { return _mm256_add_epi64(x, y); }
+__m256i inline Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+__m256i inline RotL(__m256i x, int n) { return _mm256_or_si256(_mm256_slli_epi64(x, n), _mm256_srli_epi64(x, 64 - n)); }
+__m256i inline RotL32(__m256i x) { return _mm256_shuffle_epi32(x, 0xB1); }
+
+void inline SipRound(__m256i& v0, __m256i& v1, __m256i& v2, __m256i& v3)
+{
+    v0 = Add(v0, v1); v1 = RotL(v1, 13); v1 = Xor(v1, v0);
+    v0 = RotL32(v0);
+    v2 = Add(v2, v3); v3 = RotL(v3, 16); v3 = Xor(v3, v2);
+    v0 = Add(v0, v3); v3 = RotL(v3, 21); v3 = Xor(v3, v0);
+    v2 = Add(v2, v1); v1 = RotL(v1, 17); v1 = Xor(v1, v2);
+    v2 = RotL32(v2);
+}
+
+void inline Compress(__m256i& v0, __m256i& v1, __m256i& v2, __m256i& v3, __m256i m)
+{
+    v3 = Xor(v3, m);
+    SipRound(v0, v1, v2, v3);
+    SipRound(v0, v1, v2, v3);
+    v0 = Xor(v0, m);
+}
+
+}
+
+/** SipHashUint256 of 4 values at once, with one value per 64-bit lane. */
+void SipHashUint256_4way(uint64_t k0, uint64_t k1, const uint256* vals, uint64_t* out)
+{
+    // Transpose the four values so that mN holds 64-bit word N of each of them.
+    __m256i a = _mm256_loadu_si256((const __m256i*)vals[0].begin());
+    __m256i b = _mm256_loadu_si256((const __m256i*)vals[1].begin());
+    __m256i c = _mm256_loadu_si256((const __m256i*)vals[2].begin());
+    __m256i d = _mm256_loadu_si256((const __m256i*)vals[3].begin());
+    __m256i t0 = _mm256_unpacklo_epi64(a, b);
+    __m256i t1 = _mm256_unpackhi_epi64(a, b);
+    __m256i t2 = _mm256_unpacklo_epi64(c, d);
+    __m256i t3 = _mm256_unpackhi_epi64(c, d);
+    __m256i m0 = _mm256_permute2x128_si256(t0, t2, 0x20);
+    __m256i m1 = _mm256_permute2x128_si256(t1, t3, 0x20);
+    __m256i m2 = _mm256_permute2x128_si256(t0, t2, 0x31);
+    __m256i m3 = _mm256_permute2x128_si256(t1, t3, 0x31);
+
+    __m256i v0 = K(0x736f6d6570736575ULL ^ k0);
+    __m256i v1 = K(0x646f72616e646f6dULL ^ k1);
+    __m256i v2 = K(0x6c7967656e657261ULL ^ k0);
+    __m256i v3 = K(0x7465646279746573ULL ^ k1);
+
+    Compress(v0, v1, v2, v3, m0);
+    Compress(v0, v1, v2, v3, m1);
+    Compress(v0, v1, v2, v3, m2);
+    Compress(v0, v1, v2, v3, m3);
+    Compress(v0, v1, v2, v3, K(((uint64_t)4) << 59));
+    v2 = Xor(v2, K(0xFF));
+    SipRound(v0, v1, v2, v3);
+    SipRound(v0, v1, v2, v3);
+    SipRound(v0, v1, v2, v3);
+    SipRound(v0, v1, v2, v3);
+
+    _mm256_storeu_si256((__m256i*)out, Xor(Xor(v0, v1), Xor(v2, v3)));
+}
+
+}
+
+#endif
@@ -8,10 +8,14 @@
 #include <blockencodings.h> // for MAX_CHUNK_CODED_BLOCK_SIZE_FACTOR
 #include <util/system.h>
 
+#include <fcntl.h>
+#include <limits>
 #include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
+#include <unistd.h>
 #include <fs.h>
 
 #define DIV_CEIL(a, b) (((a) + (b) - 1) / (b))
@@ -21,6 +25,16 @@
 
 #define CACHE_STATES_COUNT 5
 
+// Number of freed cm256 chunk slabs of each size class kept around for reuse
+// by new decoders
+#define CM256_SLAB_CACHE_COUNT 32
+// Number of cm256 chunk slab size classes (2, 4, 8, 16 and CM256_MAX_CHUNKS
+// chunks)
+#define CM256_SLAB_SIZE_CLASSES 5
+
+// Number of chunks a FECWorkerPool thread encodes at once
+#define FEC_ENCODE_RANGE_SIZE 16
+
 
 static std::atomic<WirehairCodec> cache_states[CACHE_STATES_COUNT];
 static inline WirehairCodec get_wirehair_codec() {
@@ -42,6 +56,34 @@ static inline void return_wirehair_codec(WirehairCodec state) {
     wirehair_free(state);
 }
 
+static_assert(CM256_MAX_CHUNKS <= (size_t(2) << (CM256_SLAB_SIZE_CLASSES - 1)), "cm256 slab size classes too small");
+static inline size_t cm256_slab_class_chunks(size_t size_class) {
+    return std::min<size_t>(size_t(2) << size_class, CM256_MAX_CHUNKS);
+}
+static std::atomic<FECChunkType*> cache_cm256_slabs[CM256_SLAB_SIZE_CLASSES][CM256_SLAB_CACHE_COUNT];
+static Cm256ChunkSlab get_cm256_slab(size_t chunk_count) {
+    assert(CHUNK_COUNT_USES_CM256(chunk_count));
+    size_t size_class = 0;
+    while (cm256_slab_class_chunks(size_class) < chunk_count)
+        size_class++;
+    for (size_t i = 0; i < CM256_SLAB_CACHE_COUNT; i++) {
+        FECChunkType* slab = cache_cm256_slabs[size_class][i].exchange(nullptr);
+        if (slab) {
+            return Cm256ChunkSlab(slab, Cm256SlabDeleter(size_class));
+        }
+    }
+    return Cm256ChunkSlab(new FECChunkType[cm256_slab_class_chunks(size_class)], Cm256SlabDeleter(size_class));
+}
+void Cm256SlabDeleter::operator()(FECChunkType* slab) const {
+    for (size_t i = 0; i < CM256_SLAB_CACHE_COUNT; i++) {
+        FECChunkType* null_slab = nullptr;
+        if (cache_cm256_slabs[size_class][i].compare_exchange_strong(null_slab, slab)) {
+            return;
+        }
+    }
+    delete[] slab;
+}
+
 BlockChunkRecvdTracker::BlockChunkRecvdTracker(size_t chunk_count) :
         data_chunk_recvd_flags(CHUNK_COUNT_USES_CM256(chunk_count) ? 0xff : chunk_count),
         fec_chunks_recvd(CHUNK_COUNT_USES_CM256(chunk_count) ? 1 : chunk_count) { }
@@ -72,126 +114,500 @@ T* exchange(T*& var, std::nullptr_t)
 }
 
 
-MapStorage::MapStorage(boost::filesystem::path const& p, int const c, bool create) :
-    m_chunk_count(c),
-    m_file_size((CHUNK_ID_SIZE + FEC_CHUNK_SIZE) * c)
+// Layout of the ChunkArena file:
+//   * a ChunkArenaHeader, padded to a page
+//   * CHUNK_ARENA_MAX_OBJECTS object entries: chunk count and key
+//   * one slab header per slab: owning object + 1 (0 if free), position
+//     within that object and the ids of the CHUNK_ARENA_SLAB_CHUNKS chunks
+//   * the slabs, page-aligned
+#define CHUNK_ARENA_PAGE_SIZE 4096
+#define CHUNK_ARENA_SLAB_SIZE (CHUNK_ARENA_SLAB_CHUNKS * FEC_CHUNK_SIZE)
+#define CHUNK_ARENA_MAX_OBJECTS 65536
+#define CHUNK_ARENA_KEY_SIZE 124
+#define CHUNK_ARENA_ENTRY_SIZE (sizeof(uint32_t) + CHUNK_ARENA_KEY_SIZE)
+#define CHUNK_ARENA_SLAB_HEADER_WORDS (2 + CHUNK_ARENA_SLAB_CHUNKS)
+#define CHUNK_ARENA_VERSION 1
+#define CHUNK_ARENA_NO_SLAB std::numeric_limits<uint32_t>::max()
+
+// Freed slabs beyond this many have their disk space released, the others are
+// kept paged in for the next objects
+#define CHUNK_ARENA_WARM_SLABS 1024
+
+static_assert(CHUNK_ARENA_SLAB_SIZE % CHUNK_ARENA_PAGE_SIZE == 0, "Slabs should not share pages");
+
+static const size_t CHUNK_ARENA_OBJECTS_OFFSET = CHUNK_ARENA_PAGE_SIZE;
+static const size_t CHUNK_ARENA_SLAB_HEADERS_OFFSET = CHUNK_ARENA_OBJECTS_OFFSET + CHUNK_ARENA_MAX_OBJECTS * CHUNK_ARENA_ENTRY_SIZE;
+
+// Space for chunk data in the ChunkArena file, see ChunkArena::SetDataSize
+// (-udpchunkarena). The file is created sparse, so only the slabs in use take
+// up disk space.
+static std::atomic<uint64_t> chunk_arena_data_size{sizeof(void*) >= 8 ? (uint64_t{16} << 30) : (uint64_t{512} << 20)};
+
+struct ChunkArenaHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t chunk_size;
+    uint32_t slab_chunks;
+    uint32_t max_objects;
+    uint32_t slab_count;
+    uint32_t objects_used; // object entries at or above this index were never used
+    uint32_t slabs_used;   // slabs at or above this index were never used
+};
+static const char CHUNK_ARENA_MAGIC[8] = {'F', 'E', 'C', 'A', 'R', 'E', 'N', 'A'};
+
+void ChunkArena::SetDataSize(uint64_t data_size)
 {
-    if (create) {
-        fs::create_directories(p.parent_path());
+    chunk_arena_data_size = data_size;
+}
+
+std::shared_ptr<ChunkArena> ChunkArena::Get()
+{
+    static std::mutex arena_mutex;
+    static std::shared_ptr<ChunkArena> arena;
+    static fs::path arena_datadir;
+    static uint64_t arena_data_size = 0;
+    static bool arena_set = false;
+
+    const fs::path& datadir = GetDataDir();
+    const uint64_t data_size = chunk_arena_data_size;
+    std::lock_guard<std::mutex> lock(arena_mutex);
+    // A failed or disabled arena is not retried until the datadir or size
+    // changes, its decoders keep their chunks in memory instead
+    if (!arena_set || arena_datadir != datadir || arena_data_size != data_size) {
+        arena.reset();
+        arena_set = true;
+        arena_datadir = datadir;
+        arena_data_size = data_size;
+        if (data_size > 0) {
+            const fs::path path = datadir / "partial_blocks" / "chunk_arena";
+            try {
+                arena = std::make_shared<ChunkArena>(path, data_size);
+            } catch (const std::exception& e) {
+                LogPrintf("FEC chunk arena unavailable, keeping chunks in memory: %s\n", e.what());
+            }
+        }
     }
+    return arena;
+}
 
-    const int flags = create ? (O_RDWR | O_CREAT) : O_RDWR;
-    m_chunk_file = ::open(p.c_str(), flags, 0755);
-    if (m_chunk_file == -1) {
-        throw std::runtime_error("failed to open file: " + p.string() + " " + ::strerror(errno));
+ChunkArena::ChunkArena(const fs::path& path, uint64_t data_size) :
+    m_path(path),
+    m_slab_count(std::min<uint64_t>(data_size / CHUNK_ARENA_SLAB_SIZE, CHUNK_ARENA_NO_SLAB - 1)),
+    m_objects(CHUNK_ARENA_MAX_OBJECTS)
+{
+    if (m_slab_count == 0) {
+        throw std::runtime_error("chunk arena size " + std::to_string(data_size) + " is below one slab");
     }
+    m_data_offset = DIV_CEIL(CHUNK_ARENA_SLAB_HEADERS_OFFSET + size_t{m_slab_count} * CHUNK_ARENA_SLAB_HEADER_WORDS * sizeof(uint32_t), CHUNK_ARENA_PAGE_SIZE) * CHUNK_ARENA_PAGE_SIZE;
+    const uint64_t file_size = uint64_t{m_data_offset} + uint64_t{m_slab_count} * CHUNK_ARENA_SLAB_SIZE;
+    if (file_size > std::numeric_limits<size_t>::max()) {
+        throw std::runtime_error("chunk arena size " + std::to_string(data_size) + " exceeds the address space");
+    }
+    m_map_size = file_size;
+
+    fs::create_directories(path.parent_path());
 
-    m_data_storage = static_cast<char*>(::mmap(nullptr, m_file_size,
-        PROT_READ | PROT_WRITE, MAP_SHARED, m_chunk_file, 0));
-    if (m_data_storage == MAP_FAILED) {
-        ::close(m_chunk_file);
-        throw std::runtime_error("mmap failed " + p.string() + " " + ::strerror(errno));
+    m_fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (m_fd == -1) {
+        throw std::runtime_error("failed to open file: " + path.string() + " " + ::strerror(errno));
     }
-    m_id_storage = m_data_storage + (m_chunk_count * FEC_CHUNK_SIZE);
 
-    if (create) {
-        m_recoverable = Recoverable(p);
-        if (!m_recoverable) {
-            int const ret = ::ftruncate(m_chunk_file, m_file_size);
-            if (ret != 0) {
-                ::unlink(p.c_str());
-                throw std::runtime_error("ftruncate failed " + p.string() + " " + ::strerror(errno));
-            }
+    struct stat st;
+    const bool existed = ::fstat(m_fd, &st) == 0 && (size_t)st.st_size == m_map_size;
+    if (!existed && ::ftruncate(m_fd, m_map_size) != 0) {
+        ::close(m_fd);
+        throw std::runtime_error("ftruncate failed " + path.string() + " " + ::strerror(errno));
+    }
+
+    m_map = static_cast<char*>(::mmap(nullptr, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0));
+    if (m_map == MAP_FAILED) {
+        ::close(m_fd);
+        throw std::runtime_error("mmap failed " + path.string() + " " + ::strerror(errno));
+    }
 
-            // Initialize all chunk ids to an invalid value (FEC_CHUNK_COUNT_MAX
-            // + 1) if creating the chunk file. In the future, when recovering
-            // the chunk storage from a pre-existing file, it is possible to
-            // know the chunks that were previously populated by checking
-            // whether the chunk id is a valid one.
-            uint32_t initial_chunk_id = FEC_CHUNK_COUNT_MAX + 1;
-            for (size_t i = 0; i < m_chunk_count; i++) {
-                auto const chunk_id_dest_ptr = m_id_storage + (i * CHUNK_ID_SIZE);
-                memcpy(chunk_id_dest_ptr, &initial_chunk_id, CHUNK_ID_SIZE);
+    try {
+        if (!existed || !Recover()) {
+            Reset();
+        }
+    } catch (...) {
+        ::munmap(m_map, m_map_size);
+        ::close(m_fd);
+        throw;
+    }
+}
+
+ChunkArena::~ChunkArena()
+{
+    ::munmap(m_map, m_map_size);
+    ::close(m_fd);
+}
+
+uint32_t* ChunkArena::GetSlabHeader(uint32_t slab) const
+{
+    return reinterpret_cast<uint32_t*>(m_map + CHUNK_ARENA_SLAB_HEADERS_OFFSET) + size_t{slab} * CHUNK_ARENA_SLAB_HEADER_WORDS;
+}
+
+char* ChunkArena::GetSlabData(uint32_t slab) const
+{
+    return m_map + m_data_offset + size_t{slab} * CHUNK_ARENA_SLAB_SIZE;
+}
+
+char* ChunkArena::GetObjectEntry(int obj) const
+{
+    return m_map + CHUNK_ARENA_OBJECTS_OFFSET + size_t(obj) * CHUNK_ARENA_ENTRY_SIZE;
+}
+
+/** Rebuild the object and free slab lists from the index in the file */
+bool ChunkArena::Recover()
+{
+    ChunkArenaHeader* header = reinterpret_cast<ChunkArenaHeader*>(m_map);
+    if (memcmp(header->magic, CHUNK_ARENA_MAGIC, sizeof(CHUNK_ARENA_MAGIC)) != 0 ||
+        header->version != CHUNK_ARENA_VERSION || header->chunk_size != FEC_CHUNK_SIZE ||
+        header->slab_chunks != CHUNK_ARENA_SLAB_CHUNKS || header->max_objects != CHUNK_ARENA_MAX_OBJECTS ||
+        header->slab_count != m_slab_count || header->objects_used > CHUNK_ARENA_MAX_OBJECTS ||
+        header->slabs_used > m_slab_count) {
+        return false;
+    }
+
+    for (int obj = header->objects_used - 1; obj >= 0; obj--) {
+        char* entry = GetObjectEntry(obj);
+        uint32_t chunk_count;
+        memcpy(&chunk_count, entry, sizeof(chunk_count));
+        const char* key = entry + sizeof(uint32_t);
+        if (key[0] == '\0' || key[CHUNK_ARENA_KEY_SIZE - 1] != '\0' ||
+            chunk_count == 0 || chunk_count > FEC_CHUNK_COUNT_MAX ||
+            !m_keys.emplace(key, obj).second) {
+            memset(entry, 0, CHUNK_ARENA_ENTRY_SIZE);
+            m_free_objects.push_back(obj);
+            continue;
+        }
+        m_objects[obj].chunk_count = chunk_count;
+        m_objects[obj].slabs.assign(DIV_CEIL(chunk_count, CHUNK_ARENA_SLAB_CHUNKS), CHUNK_ARENA_NO_SLAB);
+    }
+
+    for (uint32_t slab = header->slabs_used; slab > 0; slab--) {
+        uint32_t* slab_header = GetSlabHeader(slab - 1);
+        if (slab_header[0] > 0 && slab_header[0] <= header->objects_used) {
+            Object& object = m_objects[slab_header[0] - 1];
+            if (slab_header[1] < object.slabs.size() && object.slabs[slab_header[1]] == CHUNK_ARENA_NO_SLAB) {
+                object.slabs[slab_header[1]] = slab - 1;
+                m_slabs_in_use++;
+                continue;
             }
         }
+        slab_header[0] = 0;
+        m_free_slabs.push_back(slab - 1);
+    }
+    return true;
+}
+
+/** Drop everything in the file and start over with an empty arena */
+void ChunkArena::Reset()
+{
+    if (::ftruncate(m_fd, 0) != 0 || ::ftruncate(m_fd, m_map_size) != 0) {
+        throw std::runtime_error("ftruncate failed " + m_path.string() + " " + ::strerror(errno));
     }
+    m_keys.clear();
+    m_objects.assign(CHUNK_ARENA_MAX_OBJECTS, Object());
+    m_free_objects.clear();
+    m_free_slabs.clear();
+    m_slabs_in_use = 0;
+
+    ChunkArenaHeader* header = reinterpret_cast<ChunkArenaHeader*>(m_map);
+    memcpy(header->magic, CHUNK_ARENA_MAGIC, sizeof(CHUNK_ARENA_MAGIC));
+    header->version = CHUNK_ARENA_VERSION;
+    header->chunk_size = FEC_CHUNK_SIZE;
+    header->slab_chunks = CHUNK_ARENA_SLAB_CHUNKS;
+    header->max_objects = CHUNK_ARENA_MAX_OBJECTS;
+    header->slab_count = m_slab_count;
+    header->objects_used = 0;
+    header->slabs_used = 0;
 }
 
-MapStorage::MapStorage(MapStorage&& ms) noexcept :
-    m_chunk_count(ms.m_chunk_count),
-    m_chunk_file(exchange(ms.m_chunk_file, -1)),
-    m_data_storage(exchange(ms.m_data_storage, nullptr))
-{}
+int ChunkArena::FindObject(const std::string& key) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_keys.find(key);
+    return it == m_keys.end() ? -1 : it->second;
+}
 
-void MapStorage::Insert(const unsigned char* chunk, uint32_t chunk_id, size_t idx)
+int ChunkArena::CreateObject(const std::string& key, size_t chunk_count)
 {
-    memcpy(GetChunk(idx), chunk, FEC_CHUNK_SIZE);
+    if (key.empty() || key.size() >= CHUNK_ARENA_KEY_SIZE) {
+        throw std::runtime_error("invalid chunk arena key: " + key);
+    }
+    assert(chunk_count > 0 && chunk_count <= FEC_CHUNK_COUNT_MAX);
 
-    // store chunk_id at the end of the file
-    auto const chunk_id_dest_ptr = m_id_storage + (idx * CHUNK_ID_SIZE);
-    memcpy(chunk_id_dest_ptr, &chunk_id, CHUNK_ID_SIZE);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_keys.find(key);
+    if (it != m_keys.end()) {
+        if (m_objects[it->second].chunk_count == chunk_count) {
+            return it->second;
+        }
+        FreeObject(it->second);
+        m_keys.erase(it);
+    }
+
+    int obj;
+    ChunkArenaHeader* header = reinterpret_cast<ChunkArenaHeader*>(m_map);
+    if (!m_free_objects.empty()) {
+        obj = m_free_objects.back();
+        m_free_objects.pop_back();
+    } else if (header->objects_used < CHUNK_ARENA_MAX_OBJECTS) {
+        obj = header->objects_used++;
+    } else {
+        return -1;
+    }
+
+    m_objects[obj].chunk_count = chunk_count;
+    m_objects[obj].slabs.assign(DIV_CEIL(chunk_count, CHUNK_ARENA_SLAB_CHUNKS), CHUNK_ARENA_NO_SLAB);
+    m_keys.emplace(key, obj);
+
+    char* entry = GetObjectEntry(obj);
+    const uint32_t chunk_count_entry = chunk_count;
+    memset(entry, 0, CHUNK_ARENA_ENTRY_SIZE);
+    memcpy(entry, &chunk_count_entry, sizeof(chunk_count_entry));
+    memcpy(entry + sizeof(uint32_t), key.data(), key.size());
+    return obj;
 }
 
-char* MapStorage::GetChunk(size_t idx) const
+void ChunkArena::RemoveObject(const std::string& key)
 {
-    if (idx < m_chunk_count) {
-        return m_data_storage + (idx * FEC_CHUNK_SIZE);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_keys.find(key);
+    if (it != m_keys.end()) {
+        FreeObject(it->second);
+        m_keys.erase(it);
     }
-    throw std::runtime_error("Invalid chunk index: " + std::to_string(idx));
 }
 
-uint32_t MapStorage::GetChunkId(size_t idx) const
+void ChunkArena::UnlinkKey(int obj)
 {
-    if (idx < m_chunk_count) {
-        uint32_t chunk_id = 0;
-        memcpy(&chunk_id, m_id_storage + (idx * CHUNK_ID_SIZE), CHUNK_ID_SIZE);
-        return chunk_id;
+    const std::string key(GetObjectEntry(obj) + sizeof(uint32_t));
+    auto it = m_keys.find(key);
+    if (it != m_keys.end() && it->second == obj) {
+        m_keys.erase(it);
     }
-    throw std::runtime_error("Invalid chunk id index: " + std::to_string(idx));
 }
 
-size_t MapStorage::Size() const
+void ChunkArena::DetachObject(int obj)
 {
-    return m_file_size;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    UnlinkKey(obj);
+    // A cleared entry is dropped on recovery, along with the object's slabs
+    memset(GetObjectEntry(obj), 0, CHUNK_ARENA_ENTRY_SIZE);
 }
 
-bool MapStorage::IsRecoverable() const
+void ChunkArena::ReleaseObject(int obj)
 {
-    return m_recoverable;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    UnlinkKey(obj);
+    FreeObject(obj);
 }
 
-bool MapStorage::Recoverable(const boost::filesystem::path& filename) const
+bool ChunkArena::RenameObject(const std::string& from, const std::string& to)
 {
-    if (filename.empty() || !fs::exists(filename)) {
-        return false;
+    if (to.empty() || to.size() >= CHUNK_ARENA_KEY_SIZE) {
+        throw std::runtime_error("invalid chunk arena key: " + to);
     }
 
-    size_t chunk_file_size = fs::file_size(filename);
-    if (chunk_file_size == 0 || chunk_file_size != m_file_size || m_chunk_count == 0) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto from_it = m_keys.find(from);
+    if (from_it == m_keys.end()) {
         return false;
     }
+    if (from == to) {
+        return true;
+    }
+    const int obj = from_it->second;
+    m_keys.erase(from_it);
+
+    auto to_it = m_keys.find(to);
+    if (to_it != m_keys.end()) {
+        FreeObject(to_it->second);
+        m_keys.erase(to_it);
+    }
+    m_keys.emplace(to, obj);
+
+    char* key = GetObjectEntry(obj) + sizeof(uint32_t);
+    memset(key, 0, CHUNK_ARENA_KEY_SIZE);
+    memcpy(key, to.data(), to.size());
+    return true;
+}
+
+std::vector<std::string> ChunkArena::GetObjectKeys() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<std::string> keys;
+    keys.reserve(m_keys.size());
+    for (const auto& key : m_keys) {
+        keys.push_back(key.first);
+    }
+    return keys;
+}
 
-    // At least one chunk id should have a valid value, otherwise the file does
-    // not have useful data
-    if (CHUNK_ID_IS_NOT_SET(GetChunkId(0))) {
+void ChunkArena::FreeObject(int obj)
+{
+    for (uint32_t slab : m_objects[obj].slabs) {
+        if (slab != CHUNK_ARENA_NO_SLAB) {
+            FreeSlab(slab);
+        }
+    }
+    m_objects[obj] = Object();
+    memset(GetObjectEntry(obj), 0, CHUNK_ARENA_ENTRY_SIZE);
+    m_free_objects.push_back(obj);
+}
+
+void ChunkArena::FreeSlab(uint32_t slab)
+{
+    GetSlabHeader(slab)[0] = 0;
+    // Where MADV_REMOVE is not available, the disk space of freed slabs is
+    // only released when the arena is reset
+#ifdef MADV_REMOVE
+    if (m_free_slabs.size() >= CHUNK_ARENA_WARM_SLABS) {
+        ::madvise(GetSlabData(slab), CHUNK_ARENA_SLAB_SIZE, MADV_REMOVE);
+    }
+#endif
+    m_free_slabs.push_back(slab);
+    m_slabs_in_use--;
+}
+
+char* ChunkArena::GetChunk(int obj, size_t idx)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Object& object = m_objects[obj];
+    assert(idx < object.chunk_count);
+    uint32_t& slab = object.slabs[idx / CHUNK_ARENA_SLAB_CHUNKS];
+    if (slab == CHUNK_ARENA_NO_SLAB) {
+        ChunkArenaHeader* header = reinterpret_cast<ChunkArenaHeader*>(m_map);
+        if (!m_free_slabs.empty()) {
+            slab = m_free_slabs.back();
+            m_free_slabs.pop_back();
+        } else if (header->slabs_used < m_slab_count) {
+            slab = header->slabs_used++;
+        } else {
+            return nullptr;
+        }
+        m_slabs_in_use++;
+
+        // Mark all chunk slots of the new slab as empty, so that recovery
+        // knows which ones were populated
+        uint32_t* slab_header = GetSlabHeader(slab);
+        slab_header[0] = obj + 1;
+        slab_header[1] = idx / CHUNK_ARENA_SLAB_CHUNKS;
+        std::fill(slab_header + 2, slab_header + CHUNK_ARENA_SLAB_HEADER_WORDS, FEC_CHUNK_COUNT_MAX + 1);
+    }
+    return GetSlabData(slab) + (idx % CHUNK_ARENA_SLAB_CHUNKS) * FEC_CHUNK_SIZE;
+}
+
+uint32_t ChunkArena::GetChunkId(int obj, size_t idx) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const Object& object = m_objects[obj];
+    assert(idx < object.chunk_count);
+    const uint32_t slab = object.slabs[idx / CHUNK_ARENA_SLAB_CHUNKS];
+    if (slab == CHUNK_ARENA_NO_SLAB) {
+        return FEC_CHUNK_COUNT_MAX + 1;
+    }
+    return GetSlabHeader(slab)[2 + idx % CHUNK_ARENA_SLAB_CHUNKS];
+}
+
+void ChunkArena::SetChunkId(int obj, size_t idx, uint32_t chunk_id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const Object& object = m_objects[obj];
+    assert(idx < object.chunk_count);
+    const uint32_t slab = object.slabs[idx / CHUNK_ARENA_SLAB_CHUNKS];
+    assert(slab != CHUNK_ARENA_NO_SLAB);
+    GetSlabHeader(slab)[2 + idx % CHUNK_ARENA_SLAB_CHUNKS] = chunk_id;
+}
+
+size_t ChunkArena::SlabsInUse() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_slabs_in_use;
+}
+
+size_t ChunkArena::ObjectsInUse() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const ChunkArenaHeader* header = reinterpret_cast<const ChunkArenaHeader*>(m_map);
+    return header->objects_used - m_free_objects.size();
+}
+
+MapStorage::MapStorage(const std::string& key, int const c, bool create) :
+    m_arena(ChunkArena::Get()),
+    m_chunk_count(c)
+{
+    if (!m_arena) {
+        if (create) {
+            return;
+        }
+        throw std::runtime_error("no chunk arena for " + key);
+    }
+    m_object = m_arena->FindObject(key);
+    if (create) {
+        // An existing object of a different chunk count is recreated empty.
+        // At least one chunk id should have a valid value, otherwise the
+        // object does not have useful data.
+        const bool existed = m_object != -1;
+        m_object = m_arena->CreateObject(key, m_chunk_count);
+        m_recoverable = existed && m_object != -1 && !CHUNK_ID_IS_NOT_SET(GetChunkId(0));
+    } else if (m_object == -1) {
+        throw std::runtime_error("no chunk storage for " + key);
+    }
+}
+
+MapStorage::MapStorage(const std::shared_ptr<ChunkArena>& arena, int obj, int const c) :
+    m_arena(arena),
+    m_object(obj),
+    m_chunk_count(c)
+{
+    assert(m_arena && m_object != -1);
+}
+
+bool MapStorage::Insert(const unsigned char* chunk, uint32_t chunk_id, size_t idx)
+{
+    if (idx >= m_chunk_count) {
+        throw std::runtime_error("Invalid chunk index: " + std::to_string(idx));
+    }
+    char* const chunk_dest_ptr = m_arena->GetChunk(m_object, idx);
+    if (!chunk_dest_ptr) {
         return false;
     }
+    memcpy(chunk_dest_ptr, chunk, FEC_CHUNK_SIZE);
+
+    // store chunk_id only once the chunk is in place
+    m_arena->SetChunkId(m_object, idx, chunk_id);
     return true;
 }
 
-MapStorage::~MapStorage()
+char* MapStorage::GetChunk(size_t idx) const
 {
-    if (m_data_storage != nullptr)
-        ::munmap(m_data_storage, m_file_size);
-    if (m_chunk_file != -1)
-        ::close(m_chunk_file);
+    if (idx < m_chunk_count) {
+        return m_arena->GetChunk(m_object, idx);
+    }
+    throw std::runtime_error("Invalid chunk index: " + std::to_string(idx));
+}
+
+uint32_t MapStorage::GetChunkId(size_t idx) const
+{
+    if (idx < m_chunk_count) {
+        return m_arena->GetChunkId(m_object, idx);
+    }
+    throw std::runtime_error("Invalid chunk id index: " + std::to_string(idx));
+}
+
+bool MapStorage::IsRecoverable() const
+{
+    return m_recoverable;
 }
 
 FECDecoder::FECDecoder()
 {
 }
 
-FECDecoder::FECDecoder(size_t const data_size, MemoryUsageMode memory_mode, const std::string& obj_id, const bool keep_mmap_file) :
+FECDecoder::FECDecoder(size_t const data_size, MemoryUsageMode memory_mode, const std::string& obj_id, const bool keep_mmap_storage) :
         chunk_count(DIV_CEIL(data_size, FEC_CHUNK_SIZE)),
         obj_size(data_size),
         chunk_tracker(chunk_count),
@@ -201,16 +617,25 @@ FECDecoder::FECDecoder(size_t const data_size, MemoryUsageMode memory_mode, cons
         return;
 
     if (memory_usage_mode == MemoryUsageMode::USE_MMAP) {
-        filename = compute_filename(obj_id);
-        MapStorage map_storage(filename, chunk_count, true /* create */);
-        if (map_storage.IsRecoverable()) {
-            RecoverFromDisk();
+        storage_key = compute_storage_key(obj_id);
+        MapStorage map_storage(storage_key, chunk_count, true /* create */);
+        storage_obj = map_storage.GetObject();
+        if (storage_obj == -1) {
+            LogPrintf("FEC chunk arena is unavailable or out of object slots, keeping %s in memory\n", storage_key);
+            memory_usage_mode = MemoryUsageMode::USE_MEMORY;
+            storage_key.clear();
+        } else {
+            m_arena = map_storage.GetArena();
+            owns_storage = true;
+            m_keep_mmap_storage = keep_mmap_storage;
+            if (map_storage.IsRecoverable()) {
+                RecoverFromDisk();
+            }
         }
-        owns_file = true;
-        m_keep_mmap_file = keep_mmap_file;
-    } else {
+    }
+    if (memory_usage_mode == MemoryUsageMode::USE_MEMORY) {
         if (CHUNK_COUNT_USES_CM256(chunk_count)) {
-            cm256_chunks.reserve(chunk_count);
+            cm256_chunks = get_cm256_slab(chunk_count);
         } else {
             wirehair_decoder = wirehair_decoder_create(get_wirehair_codec(), data_size, FEC_CHUNK_SIZE);
             assert(wirehair_decoder);
@@ -218,20 +643,20 @@ FECDecoder::FECDecoder(size_t const data_size, MemoryUsageMode memory_mode, cons
     }
 }
 
-fs::path FECDecoder::compute_filename(const std::string& obj_id) const
+std::string FECDecoder::compute_storage_key(const std::string& obj_id) const
 {
     // Try to make a unique name out of the available information
     if (obj_id.empty()) {
-        return GetDataDir() / "partial_blocks" / std::to_string(std::uintptr_t(this));
+        return std::to_string(std::uintptr_t(this));
     } else {
-        // filename pattern = <obj_id>_<obj_size>
-        return GetDataDir() / "partial_blocks" / (obj_id + "_" + std::to_string(obj_size));
+        // key pattern = <obj_id>_<obj_size>
+        return obj_id + "_" + std::to_string(obj_size);
     }
 }
 
 FECDecoder& FECDecoder::operator=(FECDecoder&& decoder) noexcept {
-    if (owns_file && !m_keep_mmap_file)
-        RemoveMmapFile();
+    if (owns_storage && !m_keep_mmap_storage)
+        m_arena->ReleaseObject(storage_obj);
     if (wirehair_decoder)
         return_wirehair_codec(wirehair_decoder);
 
@@ -241,16 +666,18 @@ FECDecoder& FECDecoder::operator=(FECDecoder&& decoder) noexcept {
     decodeComplete    = decoder.decodeComplete;
     chunk_tracker     = std::move(decoder.chunk_tracker);
     memory_usage_mode = decoder.memory_usage_mode;
-    owns_file         = exchange(decoder.owns_file, false);
-    m_keep_mmap_file  = decoder.m_keep_mmap_file;
+    owns_storage      = exchange(decoder.owns_storage, false);
+    m_keep_mmap_storage = decoder.m_keep_mmap_storage;
+    storage_obj       = exchange(decoder.storage_obj, -1);
+    m_arena           = std::move(decoder.m_arena);
     cm256_decoded     = exchange(decoder.cm256_decoded, false);
     cm256_chunks      = std::move(decoder.cm256_chunks);
-    if (owns_file) {
-        assert(fs::exists(decoder.filename));
-        if (filename.empty()) {
-            filename = decoder.filename;
+    if (owns_storage) {
+        if (storage_key.empty()) {
+            storage_key = decoder.storage_key;
         } else {
-            fs::rename(decoder.filename, filename);
+            bool const renamed = m_arena->RenameObject(decoder.storage_key, storage_key);
+            assert(renamed);
         }
     }
     tmp_chunk        = decoder.tmp_chunk;
@@ -266,13 +693,11 @@ FECDecoder& FECDecoder::operator=(FECDecoder&& decoder) noexcept {
     return *this;
 }
 
-void FECDecoder::RemoveMmapFile()
+void FECDecoder::RemoveMmapStorage()
 {
-    if (owns_file && fs::exists(filename)) {
-        MapStorage map_storage(filename, chunk_count);
-        ::madvise(map_storage.GetStorage(), map_storage.Size(), MADV_REMOVE);
-        ::unlink(filename.c_str());
-        owns_file = false;
+    if (owns_storage) {
+        m_arena->DetachObject(storage_obj);
+        m_keep_mmap_storage = false;
     }
 }
 
@@ -281,8 +706,8 @@ FECDecoder::~FECDecoder()
     if (wirehair_decoder)
         return_wirehair_codec(wirehair_decoder);
 
-    if (owns_file && !m_keep_mmap_file)
-        RemoveMmapFile();
+    if (owns_storage && !m_keep_mmap_storage)
+        m_arena->ReleaseObject(storage_obj);
 }
 
 bool FECDecoder::ProvideChunk(const unsigned char* const chunk, uint32_t const chunk_id, bool recovery_run)
@@ -313,12 +738,15 @@ bool FECDecoder::ProvideChunk(const unsigned char* const chunk, uint32_t const c
 
 bool FECDecoder::ProvideChunkMmap(const unsigned char* chunk, uint32_t chunk_id, bool recovery_run)
 {
-    MapStorage map_storage(filename, chunk_count);
+    MapStorage map_storage(m_arena, storage_obj, chunk_count);
 
     // both wirehair and cm256 need chunk_count chunks, so regardless of
     // which decoder we use, fill our chunk storage
     if (chunks_recvd < chunk_count && !recovery_run) {
-        map_storage.Insert(chunk, chunk_id, chunks_recvd);
+        if (!map_storage.Insert(chunk, chunk_id, chunks_recvd)) {
+            LogPrintf("FEC chunk arena is full, dropping chunk for %s\n", storage_key);
+            return false;
+        }
     }
 
     // CM256 is an MDS code. Hence, as soon as chunk_count chunks are available,
@@ -336,7 +764,12 @@ bool FECDecoder::ProvideChunkMmap(const unsigned char* chunk, uint32_t chunk_id,
             assert(wirehair_decoder);
 
             for (size_t i = 0; i < chunk_count; ++i) {
-                const WirehairResult decode_res = wirehair_decode(wirehair_decoder, map_storage.GetChunkId(i), map_storage.GetChunk(i), FEC_CHUNK_SIZE);
+                const char* const stored_chunk = map_storage.GetChunk(i);
+                if (!stored_chunk) {
+                    LogPrintf("FEC chunk arena is full, cannot decode %s\n", storage_key);
+                    return false;
+                }
+                const WirehairResult decode_res = wirehair_decode(wirehair_decoder, map_storage.GetChunkId(i), stored_chunk, FEC_CHUNK_SIZE);
                 if (decode_res == Wirehair_Success) {
                     decodeComplete = true;
                     break;
@@ -370,9 +803,8 @@ bool FECDecoder::ProvideChunkMmap(const unsigned char* chunk, uint32_t chunk_id,
 bool FECDecoder::ProvideChunkMemory(const unsigned char* chunk, uint32_t chunk_id)
 {
     if (CHUNK_COUNT_USES_CM256(chunk_count)) {
-        cm256_chunks.emplace_back();
-        memcpy(&cm256_chunks.back(), chunk, FEC_CHUNK_SIZE);
-        cm256_blocks[chunks_recvd].Block = &cm256_chunks.back();
+        memcpy(&cm256_chunks[chunks_recvd], chunk, FEC_CHUNK_SIZE);
+        cm256_blocks[chunks_recvd].Block = &cm256_chunks[chunks_recvd];
         cm256_blocks[chunks_recvd].Index = (uint8_t)chunk_id;
         if (chunk_count == chunks_recvd + 1){
             decodeComplete = true;
@@ -421,6 +853,27 @@ const void* FECDecoder::GetDataPtr(uint32_t chunk_id)
     return &tmp_chunk;
 }
 
+bool FECDecoder::UsesWirehair() const
+{
+    return CHUNK_COUNT_USES_WIREHAIR(chunk_count);
+}
+
+bool FECDecoder::RecoverChunk(uint32_t chunk_id, void* out) const
+{
+    assert(DecodeReady());
+    assert(UsesWirehair());
+    assert(chunk_id < chunk_count);
+    uint32_t chunk_size = FEC_CHUNK_SIZE;
+    // wirehair_recover_block only writes the bytes of the chunk into out and
+    // reports their count, which is short for the final chunk of the object.
+    // Zero the rest of out, so that callers always get a full chunk.
+    if (wirehair_recover_block(wirehair_decoder, chunk_id, out, &chunk_size) != Wirehair_Success)
+        return false;
+    if (chunk_size != FEC_CHUNK_SIZE)
+        memset((char*)out + chunk_size, 0, FEC_CHUNK_SIZE - chunk_size);
+    return true;
+}
+
 /* Clean-up routine to be executed after calls to GetDataPtr() */
 void FECDecoder::GetDataPtrDone()
 {
@@ -479,17 +932,20 @@ void FECDecoder::DecodeCm256()
 
 void FECDecoder::CopyCm256MmapChunksToMemory()
 {
-    MapStorage map_storage(filename, chunk_count);
+    MapStorage map_storage(m_arena, storage_obj, chunk_count);
 
     // cm256_chunks will be used to store the decoded chunks
-    cm256_chunks.reserve(chunk_count);
+    if (!cm256_chunks)
+        cm256_chunks = get_cm256_slab(chunk_count);
 
     // Fill in cm256 chunks in the order they were received. These
     // can consist of both original and recovery chunks.
     for (size_t i = 0; i < chunk_count; ++i) {
-        cm256_chunks.emplace_back();
-        memcpy(&cm256_chunks.back(), map_storage.GetChunk(i), FEC_CHUNK_SIZE);
-        cm256_blocks[i].Block = &cm256_chunks.back();
+        // All chunk_count slots were filled before the object became decodable
+        const char* const stored_chunk = map_storage.GetChunk(i);
+        assert(stored_chunk);
+        memcpy(&cm256_chunks[i], stored_chunk, FEC_CHUNK_SIZE);
+        cm256_blocks[i].Block = &cm256_chunks[i];
         cm256_blocks[i].Index = (uint8_t)map_storage.GetChunkId(i);
     }
 }
@@ -503,33 +959,29 @@ void FECDecoder::CleanCm256Storage()
     // the mmap file and can always be copied back to "cm256_chunks".
     assert(cm256_decoded);
     assert(memory_usage_mode == MemoryUsageMode::USE_MMAP);
-    cm256_chunks.clear();
-
-    // Make sure the memory is also released. Here, one can also use
-    // shrink_to_fit. However, that's not binding and does not guarantee the
-    // relesing of memory. In contrast, swapping with an empty vector always
-    // releases the memory.
-    std::vector<FECChunkType>().swap(cm256_chunks);
+    // Hand the slab back to the cache, where the next decoder can pick it up
+    cm256_chunks.reset();
     cm256_decoded = false;
 }
 
 void FECDecoder::RecoverFromDisk()
 {
-    MapStorage map_storage(filename, chunk_count);
+    MapStorage map_storage(m_arena, storage_obj, chunk_count);
 
     for (size_t i = 0; i < chunk_count; i++) {
         uint32_t chunk_id = map_storage.GetChunkId(i);
         if (CHUNK_ID_IS_NOT_SET(chunk_id)) {
             break;
         }
+        // A slot with a chunk id is backed by a slab
         char* chunk = map_storage.GetChunk(i);
+        assert(chunk);
         ProvideChunk((unsigned char*)chunk, chunk_id, true /*recovery_run*/);
     }
 }
 
 FECEncoder::FECEncoder(const std::vector<unsigned char>* dataIn, std::pair<std::unique_ptr<FECChunkType[]>, std::vector<uint32_t>>* fec_chunksIn)
         : data(dataIn), fec_chunks(fec_chunksIn) {
-    assert(!fec_chunks->second.empty());
     assert(!data->empty());
 
     size_t chunk_count = DIV_CEIL(data->size(), FEC_CHUNK_SIZE);
@@ -557,7 +1009,6 @@ FECEncoder::FECEncoder(const std::vector<unsigned char>* dataIn, std::pair<std::
 
 FECEncoder::FECEncoder(FECDecoder&& decoder, const std::vector<unsigned char>* dataIn, std::pair<std::unique_ptr<FECChunkType[]>, std::vector<uint32_t>>* fec_chunksIn)
         : data(dataIn), fec_chunks(fec_chunksIn) {
-    assert(!fec_chunks->second.empty());
     assert(!data->empty());
 
     size_t chunk_count = DIV_CEIL(data->size(), FEC_CHUNK_SIZE);
@@ -618,20 +1069,10 @@ FECEncoder::~FECEncoder() {
  * `vector_idx` even when another chunk already exists in this index.
  *
  */
-bool FECEncoder::BuildChunk(size_t vector_idx, bool overwrite) {
-    if (vector_idx >= fec_chunks->second.size())
-         throw std::runtime_error("Invalid vector_idx");
-
-    if (!overwrite && fec_chunks->second[vector_idx])
-        return true;
-
+uint32_t FECEncoder::NextChunkId(size_t vector_idx) {
     size_t data_chunks = DIV_CEIL(data->size(), FEC_CHUNK_SIZE);
-    if (data_chunks < 2) { // When the original data fits in 1 chunk, just send it repeatedly...
-        memcpy(&fec_chunks->first[vector_idx], &(*data)[0], data->size());
-        memset(((char*)&fec_chunks->first[vector_idx]) + data->size(), 0, FEC_CHUNK_SIZE - data->size());
-        fec_chunks->second[vector_idx] = vector_idx; // chunk_id
-        return true;
-    }
+    if (data_chunks < 2) // When the original data fits in 1 chunk, just send it repeatedly...
+        return vector_idx;
 
     uint32_t fec_chunk_id;
     // wh256 supports either unlimited chunks, or up to 256 incl data chunks
@@ -642,41 +1083,199 @@ bool FECEncoder::BuildChunk(size_t vector_idx, bool overwrite) {
         fec_chunk_id = (cm256_start_idx + vector_idx) % (0xff - data_chunks);
     } else
         fec_chunk_id = rand.randrange(FEC_CHUNK_COUNT_MAX + 1 - data_chunks);
-    size_t chunk_id = fec_chunk_id + data_chunks;
+    return fec_chunk_id + data_chunks;
+}
 
-    if (overwrite && (fec_chunks->second[vector_idx] == chunk_id))
+bool FECEncoder::EncodeChunk(uint32_t chunk_id, void* out) const {
+    size_t data_chunks = DIV_CEIL(data->size(), FEC_CHUNK_SIZE);
+    if (data_chunks < 2) {
+        memcpy(out, &(*data)[0], data->size());
+        memset(((char*)out) + data->size(), 0, FEC_CHUNK_SIZE - data->size());
         return true;
+    }
 
     if (CHUNK_COUNT_USES_CM256(data_chunks)) {
         cm256_encoder_params params { (int)data_chunks, uint8_t(256 - data_chunks - 1), FEC_CHUNK_SIZE };
-        cm256_encode_block(params, cm256_blocks, chunk_id, &fec_chunks->first[vector_idx]);
+        cm256_encode_block(params, const_cast<cm256_block*>(cm256_blocks), chunk_id, out);
     } else {
         uint32_t chunk_bytes;
-        const WirehairResult encode_res = wirehair_encode(wirehair_encoder, chunk_id, &fec_chunks->first[vector_idx], FEC_CHUNK_SIZE, &chunk_bytes);
+        const WirehairResult encode_res = wirehair_encode(wirehair_encoder, chunk_id, out, FEC_CHUNK_SIZE, &chunk_bytes);
         if (encode_res != Wirehair_Success) {
             LogPrintf("wirehair_encode failed: %s\n", wirehair_result_string(encode_res));
             return false;
         }
 
         if (chunk_bytes != FEC_CHUNK_SIZE)
-            memset(((char*)&fec_chunks->first[vector_idx]) + chunk_bytes, 0, FEC_CHUNK_SIZE - chunk_bytes);
+            memset(((char*)out) + chunk_bytes, 0, FEC_CHUNK_SIZE - chunk_bytes);
     }
+    return true;
+}
+
+bool FECEncoder::BuildChunk(size_t vector_idx, bool overwrite) {
+    if (vector_idx >= fec_chunks->second.size())
+         throw std::runtime_error("Invalid vector_idx");
+
+    if (!overwrite && fec_chunks->second[vector_idx])
+        return true;
+
+    const uint32_t chunk_id = NextChunkId(vector_idx);
+    if (overwrite && (fec_chunks->second[vector_idx] == chunk_id) && DIV_CEIL(data->size(), FEC_CHUNK_SIZE) >= 2)
+        return true;
+
+    if (!EncodeChunk(chunk_id, &fec_chunks->first[vector_idx]))
+        return false;
 
     fec_chunks->second[vector_idx] = chunk_id;
     return true;
 }
 
-bool FECEncoder::PrefillChunks() {
-    bool fSuccess = true;
-    for (size_t i = 0; i < fec_chunks->second.size() && fSuccess; i++) {
-        fSuccess = BuildChunk(i);
+bool FECEncoder::PrefillChunks(FECWorkerPool* pool) {
+    if (!pool) {
+        bool fSuccess = true;
+        for (size_t i = 0; i < fec_chunks->second.size() && fSuccess; i++) {
+            fSuccess = BuildChunk(i);
+        }
+        return fSuccess;
+    }
+
+    // Draw the chunk ids serially, then encode all chunks which were not yet
+    // built in parallel, directly into their final slots
+    std::vector<size_t> todo;
+    std::vector<uint32_t> chunk_ids;
+    for (size_t i = 0; i < fec_chunks->second.size(); i++) {
+        if (fec_chunks->second[i])
+            continue;
+        todo.push_back(i);
+        chunk_ids.push_back(NextChunkId(i));
+    }
+    std::unique_ptr<FECChunkType[]> chunks(new FECChunkType[todo.size()]);
+    return pool->EncodeChunks(*this, chunk_ids.data(), chunks.get(), todo.size(), FEC_ENCODE_RANGE_SIZE,
+        [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                memcpy(&fec_chunks->first[todo[i]], &chunks[i], FEC_CHUNK_SIZE);
+                fec_chunks->second[todo[i]] = chunk_ids[i];
+            }
+        });
+}
+
+/** Work split in ranges, being run by a FECWorkerPool */
+struct FECWorkerPool::Job {
+    enum : uint8_t { PENDING, DONE, FAILED };
+
+    const std::function<bool(size_t, size_t)>& work;
+    const size_t n;
+    const size_t range_size;
+    const size_t n_ranges;
+
+    std::atomic<size_t> next_range{0};
+    std::unique_ptr<std::atomic<uint8_t>[]> range_state;
+
+    // Signalled whenever a range completes
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    Job(const std::function<bool(size_t, size_t)>& workIn, size_t nIn, size_t range_sizeIn) :
+        work(workIn), n(nIn), range_size(range_sizeIn),
+        n_ranges(DIV_CEIL(nIn, range_sizeIn)), range_state(new std::atomic<uint8_t>[n_ranges]) {
+        for (size_t i = 0; i < n_ranges; i++)
+            range_state[i] = PENDING;
+    }
+
+    bool HasUnclaimedRanges() const { return next_range.load(std::memory_order_relaxed) < n_ranges; }
+
+    /** Claim the next unclaimed range and run it. Returns false if there was none left. */
+    bool RunNextRange() {
+        const size_t range = next_range.fetch_add(1);
+        if (range >= n_ranges)
+            return false;
+
+        const bool success = work(range * range_size, std::min(n, (range + 1) * range_size));
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            range_state[range] = success ? DONE : FAILED;
+        }
+        cv.notify_all();
+        return true;
+    }
+};
+
+FECWorkerPool::FECWorkerPool(size_t n_workers) {
+    for (size_t i = 0; i < n_workers; i++)
+        threads.emplace_back(&TraceThread<std::function<void()>>, "fecworker", std::function<void()>(std::bind(&FECWorkerPool::ThreadWorker, this)));
+}
+
+FECWorkerPool::~FECWorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    cv.notify_all();
+    for (std::thread& t : threads)
+        t.join();
+}
+
+void FECWorkerPool::ThreadWorker() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        cv.wait(lock, [this] { return stop || (job && job->HasUnclaimedRanges()); });
+        if (stop)
+            return;
+        std::shared_ptr<Job> current = job;
+        lock.unlock();
+        while (current->RunNextRange()) {}
+        lock.lock();
+    }
+}
+
+bool FECWorkerPool::Run(size_t n, size_t range_size, const std::function<bool(size_t, size_t)>& work,
+                        const std::function<void(size_t, size_t)>& ready) {
+    if (n == 0)
+        return true;
+    assert(range_size > 0);
+
+    std::shared_ptr<Job> new_job = std::make_shared<Job>(work, n, range_size);
+    if (!threads.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = new_job;
+        }
+        cv.notify_all();
+    }
+
+    // Hand out the ranges in order, helping with the work while the next one
+    // is not ready yet. Even on failure, all claimed ranges must complete
+    // before returning, as the workers reference work and its outputs.
+    bool success = true;
+    for (size_t range = 0; range < new_job->n_ranges; range++) {
+        while (new_job->range_state[range] == Job::PENDING && new_job->RunNextRange()) {}
+        if (new_job->range_state[range] == Job::PENDING) {
+            std::unique_lock<std::mutex> lock(new_job->mutex);
+            new_job->cv.wait(lock, [&] { return new_job->range_state[range] != Job::PENDING; });
+        }
+        if (new_job->range_state[range] == Job::FAILED)
+            success = false;
+        if (success && ready)
+            ready(range * range_size, std::min(n, (range + 1) * range_size));
+    }
+
+    if (!threads.empty()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (job == new_job)
+            job.reset();
     }
-    return fSuccess;
+    return success;
 }
 
-bool BuildFECChunks(const std::vector<unsigned char>& data, std::pair<std::unique_ptr<FECChunkType[]>, std::vector<uint32_t>>& fec_chunks) {
-    FECEncoder enc(&data, &fec_chunks);
-    return enc.PrefillChunks();
+bool FECWorkerPool::EncodeChunks(const FECEncoder& enc, const uint32_t* chunk_ids, FECChunkType* out, size_t n_chunks,
+                                 size_t range_size, const std::function<void(size_t, size_t)>& ready) {
+    return Run(n_chunks, range_size, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            if (!enc.EncodeChunk(chunk_ids[i], &out[i]))
+                return false;
+        }
+        return true;
+    }, ready);
 }
 
 class FECInit
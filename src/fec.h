@@ -6,8 +6,15 @@
 #define BITCOIN_FEC_H
 
 #include <assert.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <stdint.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include <fs.h>
 
@@ -16,6 +23,7 @@
 #define CM256_MAX_CHUNKS 27
 #define FEC_CHUNK_COUNT_MAX ((1 << 24) - 1)
 #define CHUNK_ID_IS_NOT_SET(chunk_id) (chunk_id == FEC_CHUNK_COUNT_MAX + 1)
+#define CHUNK_ARENA_SLAB_CHUNKS 32
 
 #include "wirehair/wirehair.h"
 #include "wirehair/cm256.h"
@@ -82,6 +90,7 @@ private:
 public:
     // dataIn/fec_chunksIn must not change during lifetime of this object
     // fec_chunks->second[i] must be 0 for all i!
+    // fec_chunks may be empty if chunks are only encoded with EncodeChunk.
     FECEncoder(const std::vector<unsigned char>* dataIn, std::pair<std::unique_ptr<FECChunkType[]>, std::vector<uint32_t>>* fec_chunksIn);
     FECEncoder(FECDecoder&& decoder, const std::vector<unsigned char>* dataIn, std::pair<std::unique_ptr<FECChunkType[]>, std::vector<uint32_t>>* fec_chunksIn);
     ~FECEncoder();
@@ -96,7 +105,64 @@ public:
      * (ie it will be offset by the data chunk count).
      */
     bool BuildChunk(size_t vector_idx, bool overwrite=false);
-    bool PrefillChunks();
+    bool PrefillChunks(class FECWorkerPool* pool = nullptr);
+
+    /**
+     * Draw the chunk_id BuildChunk(vector_idx) would encode next, without
+     * encoding it. Not thread-safe.
+     */
+    uint32_t NextChunkId(size_t vector_idx);
+    /**
+     * Encode the chunk with the given chunk_id (as returned by NextChunkId)
+     * into out, which must hold FEC_CHUNK_SIZE bytes but need not be aligned.
+     * Only reads the encoder state, so may be called from several threads at
+     * once, as long as each writes to a different out.
+     */
+    bool EncodeChunk(uint32_t chunk_id, void* out) const;
+};
+
+/**
+ * A pool of threads which work through ranges of FEC chunks in parallel, for
+ * encoding many chunks of one FECEncoder or recovering many chunks of one
+ * FECDecoder. The calling thread also takes part in the work, so a pool with
+ * no worker threads simply works serially.
+ */
+class FECWorkerPool {
+private:
+    struct Job;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::shared_ptr<Job> job;
+    bool stop = false;
+    std::vector<std::thread> threads;
+
+    void ThreadWorker();
+
+public:
+    explicit FECWorkerPool(size_t n_workers);
+    ~FECWorkerPool();
+
+    FECWorkerPool(const FECWorkerPool&) = delete;
+    FECWorkerPool& operator=(const FECWorkerPool&) = delete;
+
+    size_t GetWorkerCount() const { return threads.size(); }
+
+    /**
+     * Run work(begin, end) over [0, n) in ranges of range_size, on the pool
+     * threads and the calling thread. ready(begin, end) is called on the
+     * calling thread, in order, as soon as the work for [begin, end) is done,
+     * such that it can be used while the following ranges are still being
+     * worked on. Returns once all ranges were handed to ready, or false if
+     * work failed for any range (in which case ready is not called for it and
+     * the ranges after it).
+     */
+    bool Run(size_t n, size_t range_size, const std::function<bool(size_t, size_t)>& work,
+             const std::function<void(size_t, size_t)>& ready);
+
+    /** Run over FECEncoder::EncodeChunk(chunk_ids[i], &out[i]) for every i < n_chunks */
+    bool EncodeChunks(const FECEncoder& enc, const uint32_t* chunk_ids, FECChunkType* out, size_t n_chunks,
+                      size_t range_size, const std::function<void(size_t, size_t)>& ready);
 };
 
 enum class MemoryUsageMode : bool {
@@ -104,34 +170,139 @@ enum class MemoryUsageMode : bool {
     USE_MMAP = true
 };
 
-class MapStorage
+/**
+ * A single file holding the chunks of all FECDecoders in USE_MMAP mode.
+ *
+ * The file starts with a small index of named objects, followed by the
+ * headers of fixed-size slabs of CHUNK_ARENA_SLAB_CHUNKS chunks each and then
+ * by the slabs themselves. Objects take slabs from a free list as their chunks
+ * arrive and hand them back when removed. Each slab header records the object
+ * owning the slab, the slab's position within it and the ids of the chunks
+ * stored in it, so the objects can be rebuilt from the file after a restart.
+ *
+ * The file is created sparse at its full size and mapped once, so disk space
+ * and pages are only used for the slabs that were handed out.
+ */
+class ChunkArena
 {
 public:
-    MapStorage(boost::filesystem::path const& p, int const c, bool create = false);
-    MapStorage(MapStorage&& ms) noexcept;
+    /** The arena in the partial_blocks directory of the current datadir, or
+     * nullptr if it is disabled or could not be created */
+    static std::shared_ptr<ChunkArena> Get();
+    /** Space for chunk data of the arena returned by Get(), in bytes. Zero
+     * disables the arena. Must be set before any decoder uses the arena. */
+    static void SetDataSize(uint64_t data_size);
+
+    // Throws std::runtime_error if the file cannot be created or mapped
+    ChunkArena(const fs::path& path, uint64_t data_size);
+    ~ChunkArena();
+    ChunkArena(const ChunkArena&) =delete;
+    ChunkArena& operator=(const ChunkArena&) =delete;
+
+    // Returns the index of the object stored under key, or -1
+    int FindObject(const std::string& key) const;
+    // Returns the index of the object stored under key, creating an empty one
+    // if there is no such object or it has a different chunk count. Returns -1
+    // if the arena is out of object slots.
+    int CreateObject(const std::string& key, size_t chunk_count);
+    void RemoveObject(const std::string& key);
+    // Unlinks object obj from its key, such that it is neither found nor
+    // recovered after a restart anymore, but keeps its chunks in place until
+    // it is released
+    void DetachObject(int obj);
+    // Frees object obj and its slabs, whether it is still linked to its key or
+    // not
+    void ReleaseObject(int obj);
+    // Moves the object stored under from to key to, replacing any object
+    // already stored there. Returns false if there is no object under from.
+    bool RenameObject(const std::string& from, const std::string& to);
+    std::vector<std::string> GetObjectKeys() const;
+
+    // Returns a pointer to chunk slot idx of object obj, taking a new slab for
+    // it if required, or nullptr if the arena is full
+    char* GetChunk(int obj, size_t idx);
+    uint32_t GetChunkId(int obj, size_t idx) const;
+    void SetChunkId(int obj, size_t idx, uint32_t chunk_id);
+
+    size_t SlabsInUse() const;
+    size_t ObjectsInUse() const;
+    const fs::path& GetPath() const { return m_path; }
 
-    void Insert(const unsigned char* chunk, uint32_t chunk_id, size_t idx);
+private:
+    struct Object {
+        size_t chunk_count = 0;
+        std::vector<uint32_t> slabs; // slab index per slab-sized range of chunk slots
+    };
+
+    fs::path m_path;
+    int m_fd = -1;
+    char* m_map = nullptr;
+    size_t m_map_size = 0;
+    uint32_t m_slab_count = 0;
+    size_t m_data_offset = 0;
+
+    mutable std::mutex m_mutex;
+    std::unordered_map<std::string, int> m_keys;
+    std::vector<Object> m_objects;
+    std::vector<int> m_free_objects;
+    std::vector<uint32_t> m_free_slabs;
+    size_t m_slabs_in_use = 0;
+
+    bool Recover();
+    void Reset();
+    uint32_t* GetSlabHeader(uint32_t slab) const;
+    char* GetSlabData(uint32_t slab) const;
+    char* GetObjectEntry(int obj) const;
+    void FreeObject(int obj);
+    void FreeSlab(uint32_t slab);
+    void UnlinkKey(int obj);
+};
+
+/**
+ * View of the chunk slots of one object in the ChunkArena: chunk slot idx
+ * holds the idx-th chunk received and its id.
+ */
+class MapStorage
+{
+public:
+    // key names the object in the ChunkArena, c is its chunk count. If create
+    // is false, the object must already exist. If create is true and the
+    // arena is unavailable or out of object slots, GetObject() returns -1.
+    MapStorage(const std::string& key, int const c, bool create = false);
+    // View of object obj of arena, whether linked to a key or not
+    MapStorage(const std::shared_ptr<ChunkArena>& arena, int obj, int const c);
+
+    // Returns false if the arena is full
+    bool Insert(const unsigned char* chunk, uint32_t chunk_id, size_t idx);
+    // Returns nullptr if the slot has no storage and the arena is full
     char* GetChunk(size_t idx) const;
     uint32_t GetChunkId(size_t idx) const;
-    size_t Size() const;
-    char* GetStorage() const { return m_data_storage; }
 
     // Return value is only valid if MapStorage gets instantiated with 'create=true'
     bool IsRecoverable() const;
-    ~MapStorage();
-
-private:
-    bool Recoverable(const boost::filesystem::path& filename) const;
+    int GetObject() const { return m_object; }
+    const std::shared_ptr<ChunkArena>& GetArena() const { return m_arena; }
 
 private:
+    std::shared_ptr<ChunkArena> m_arena;
+    int m_object = -1;
     size_t m_chunk_count = 0;
-    int m_chunk_file = -1;
-    char* m_data_storage = nullptr;
-    char* m_id_storage = nullptr;
-    size_t m_file_size = 0;
     bool m_recoverable = false;
 };
 
+/**
+ * Hands cm256 chunk slabs back to a small cache per size class instead of
+ * freeing them, so that the decoders of consecutive blocks reuse the same
+ * storage. Slabs of size class k hold up to 2^(k+1) chunks (capped at
+ * CM256_MAX_CHUNKS), so that objects of a few chunks take small slabs.
+ */
+struct Cm256SlabDeleter {
+    size_t size_class;
+    explicit Cm256SlabDeleter(size_t size_class_in = 0) : size_class(size_class_in) {}
+    void operator()(FECChunkType* slab) const;
+};
+typedef std::unique_ptr<FECChunkType[], Cm256SlabDeleter> Cm256ChunkSlab;
+
 class FECDecoder {
     FECChunkType tmp_chunk;
     size_t chunk_count = 0;
@@ -147,26 +318,32 @@ class FECDecoder {
     // to store them in a memory mapped file on the disk
     MemoryUsageMode memory_usage_mode = MemoryUsageMode::USE_MEMORY;
 
-    // whether this instance owns an mmap chunk file
-    bool owns_file = false;
+    // whether this instance owns an object in the ChunkArena
+    bool owns_storage = false;
 
-    // Whether this instance is expected to keep (persist) the mmap chunk file
-    // or not when destructed. When set to true, the destructor does not remove
-    // the chunk file. In this case, the chunk file shall be removed by calling
-    // RemoveMmapFile() explicitly.
-    bool m_keep_mmap_file = false;
+    // Whether this instance is expected to keep (persist) its ChunkArena
+    // object or not when destructed. When set to true, the destructor does not
+    // remove the object. In this case, the object shall be removed by calling
+    // RemoveMmapStorage() explicitly.
+    bool m_keep_mmap_storage = false;
+
+    // index of the ChunkArena object holding the chunks, which remains valid
+    // after RemoveMmapStorage() unlinks it from storage_key
+    int storage_obj = -1;
+    // arena holding storage_obj, looked up once on construction
+    std::shared_ptr<ChunkArena> m_arena;
 
     bool cm256_decoded = false;
     // Only used in cm256 mode:
-    std::vector<FECChunkType> cm256_chunks;
+    Cm256ChunkSlab cm256_chunks;
     cm256_block cm256_blocks[CM256_MAX_CHUNKS];
 
-    // filename for the chunk storage
-    fs::path filename;
+    // name of the ChunkArena object holding the chunks
+    std::string storage_key;
 
     friend FECEncoder::FECEncoder(FECDecoder&& decoder, const std::vector<unsigned char>* dataIn, std::pair<std::unique_ptr<FECChunkType[]>, std::vector<uint32_t>>* fec_chunksIn);
 
-    fs::path compute_filename(const std::string& obj_id) const;
+    std::string compute_storage_key(const std::string& obj_id) const;
 
     bool ProvideChunkMemory(const unsigned char* chunk, uint32_t chunk_id);
     bool ProvideChunkMmap(const unsigned char* chunk, uint32_t chunk_id, bool recovery_run = false);
@@ -180,11 +357,12 @@ class FECDecoder {
 
 public:
     // data_size must be <= MAX_BLOCK_SERIALIZED_SIZE * MAX_CHUNK_CODED_BLOCK_SIZE_FACTOR
-    // memory_usage_mode if set to USE_MMAP, all chunks and chunk ids are stored in a memory-mapped file on disk
+    // memory_usage_mode if set to USE_MMAP, all chunks and chunk ids are stored in the memory-mapped ChunkArena on disk
     //                  if set to USE_MEMORY, nothing is stored on disk and everything will live in the memory
-    // obj_id identification string used to generate a unique Mmap file name (used when memory_usage_mode == USE_MMAP)
-    // keep_mmap_file persist the chunk file in mmap mode (see the keep_mmap_file notes above)
-    FECDecoder(size_t data_size, MemoryUsageMode memory_usage_mode = MemoryUsageMode::USE_MEMORY, const std::string& obj_id = "", const bool keep_mmap_file = false);
+    //                  falls back to USE_MEMORY if the ChunkArena is unavailable or out of object slots
+    // obj_id identification string used to generate a unique ChunkArena object name (used when memory_usage_mode == USE_MMAP)
+    // keep_mmap_storage persist the ChunkArena object in mmap mode (see the m_keep_mmap_storage notes above)
+    FECDecoder(size_t data_size, MemoryUsageMode memory_usage_mode = MemoryUsageMode::USE_MEMORY, const std::string& obj_id = "", const bool keep_mmap_storage = false);
 
     FECDecoder();
     ~FECDecoder();
@@ -200,11 +378,23 @@ public:
     const void* GetDataPtr(uint32_t chunk_id); // Only valid until called again
     void GetDataPtrDone();
 
+    bool UsesWirehair() const;
+    /**
+     * Write data chunk chunk_id into out, which must hold FEC_CHUNK_SIZE
+     * bytes. Only for wirehair-coded objects once DecodeReady(). Unlike
+     * GetDataPtr, only reads the decoder state, so may be called from several
+     * threads at once.
+     */
+    bool RecoverChunk(uint32_t chunk_id, void* out) const;
+
     std::vector<unsigned char> GetDecodedData();
     size_t GetChunkCount() const { return chunk_count; }
     size_t GetChunksRcvd() const { return chunks_recvd; }
-    fs::path GetFileName() const { return filename; }
-    void RemoveMmapFile();
+    const std::string& GetStorageKey() const { return storage_key; }
+    // Unlink the ChunkArena object from its key, such that it is not
+    // recovered after a restart, and free it once the decoder is destroyed.
+    // Until then, other holders of the decoder may keep using it.
+    void RemoveMmapStorage();
 
 };
 
@@ -475,9 +475,18 @@ void SetupServerArgs(NodeContext& node)
     argsman.AddArg("-peertimeout=<n>", strprintf("Specify p2p connection timeout in seconds. This option determines the amount of time a peer may be inactive before the connection to it is dropped. (minimum: 1, default: %d)", DEFAULT_PEER_CONNECT_TIMEOUT), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::CONNECTION);
     argsman.AddArg("-torcontrol=<ip>:<port>", strprintf("Tor control port to use if onion listening enabled (default: %s)", DEFAULT_TOR_CONTROL), ArgsManager::ALLOW_ANY, OptionsCategory::CONNECTION);
     argsman.AddArg("-torpassword=<pass>", "Tor control port password (default: empty)", ArgsManager::ALLOW_ANY | ArgsManager::SENSITIVE, OptionsCategory::CONNECTION);
-    argsman.AddArg("-udpport=<port>,<group>[,<bw>]", "Accepts UDP connections on <port> (default: bw=1024 =1024Mbps)", ArgsManager::ALLOW_ANY, OptionsCategory::CONNECTION);
+    argsman.AddArg("-udpport=<port>,<group>[,<bw>[,<weight>]]", "Accepts UDP connections on <port>, sending at most <bw> Mbps to them (0 for no limit), and sending <weight> times as many bytes per turn as groups of weight 1 when several groups have messages queued (default: bw=1024 =1024Mbps, weight=1)", ArgsManager::ALLOW_ANY, OptionsCategory::CONNECTION);
     argsman.AddArg("-udpmulticast=<if>,<dst_ip>:<port>,<src_ip>,<trusted>[,<label>]", "Listen to multicast-addressed UDP messages sent by <src_ip> towards <dst_ip>:<port> using interface <if>. Set <trusted> to 1 if sender is a trusted node. An optional <label> may be defined for the multicast group in order to facilitate inspection of logs.", ArgsManager::ALLOW_ANY, OptionsCategory::UDP);
     argsman.AddArg("-udpmulticasttx=<if>,<ip/host>:<port>,<bw>,<txn_per_sec>[,<ttl>,<depth>,<offset>,<dscp>,<interleave>]", "Transmit multicast-addressed messages to <ip/host>:<port> through interface <if> with bandwidth <bw> in bps and TTL <ttl> (3 by default). If <txn_per_sec> is non-zero, send this number of mempool txns per second in addition to FEC-coded blocks. Iteratively transmit the past <depth> blocks with FEC coding. If <depth> is set to 0, iterate over the full chain. Start by transmitting a block height with offset <offset> relative to the bottom of the specified depth. Optionally define a DSCP for marking IP packets. Send <interleave> FEC-coded blocks in parallel while interleaving their FEC chunks. If <interleave> is set to 1, do not interleave the blocks and instead send only one FEC-coded block a time. If <interleave> is set to 0, completely disable the transmission of FEC-coded blocks.", ArgsManager::ALLOW_ANY, OptionsCategory::UDP);
+    argsman.AddArg("-udprecvbatch=<n>", strprintf("Maximum number of UDP datagrams to read from a socket per wakeup and to process under a single lock acquisition. Uses recvmmsg where available. Set to 1 to read one datagram at a time (default: %u, maximum: %u)", DEFAULT_UDP_RECV_BATCH, MAX_UDP_RECV_BATCH), ArgsManager::ALLOW_ANY, OptionsCategory::UDP);
+    argsman.AddArg("-udpreadthreads=<n>", strprintf("Number of threads reading from the UDP sockets. Each additional thread binds its own socket to every -udpport using SO_REUSEPORT, such that inbound peers are spread across threads, and multicast sockets are distributed among all threads (default: %u, maximum: %u)", DEFAULT_UDP_READ_THREADS, MAX_UDP_READ_THREADS), ArgsManager::ALLOW_ANY, OptionsCategory::UDP);
+    argsman.AddArg("-udpfecthreads=<n>", strprintf("Number of threads encoding the FEC chunks of blocks relayed over UDP, filling the chunks of blocks received over UDP from the mempool and recovering their missing chunks, including the relaying or processing thread. Relayed chunks are sent as soon as each range of them is encoded. Set to 1 to encode serially, or 0 to use one thread per CPU core (default: %d, maximum: %d)", DEFAULT_UDP_FEC_THREADS, MAX_UDP_FEC_THREADS), ArgsManager::ALLOW_ANY, OptionsCategory::UDP);
+    argsman.AddArg("-udpblockcodec=<n>", strprintf("Version of the compression of the transactions of blocks relayed or backfilled over UDP: 0 for none, 1 for transactions compressed on their own, 2 to also refer to the transactions spent within the same block by their position, which all receivers must support (default: %u)", DEFAULT_UDP_BLOCK_CODEC), ArgsManager::ALLOW_ANY, OptionsCategory::UDP);
+    argsman.AddArg("-udpblockcache=<n>", strprintf("Maximum memory in MiB used to cache the coded data and FEC encoders of blocks transmitted repeatedly over UDP multicast (e.g. by the backfill), such that each block is read from disk and prepared for FEC-coding only once. Set to 0 to disable the cache (default: %u)", DEFAULT_UDP_BLOCK_CACHE_SIZE), ArgsManager::ALLOW_ANY, OptionsCategory::UDP);
+    argsman.AddArg("-udpchunkarena=<n>", strprintf("Maximum disk space in MiB of the sparse file holding the FEC chunks of blocks partially received over UDP, such that they survive a restart. Blocks that do not fit are kept in memory. Set to 0 to keep all of them in memory (default: %u)", DEFAULT_UDP_CHUNK_ARENA_SIZE), ArgsManager::ALLOW_ANY, OptionsCategory::UDP);
+    argsman.AddArg("-udpsendbatch=<n>", strprintf("Maximum number of UDP datagrams to send from a queue per write turn with a single system call. Uses sendmmsg where available. A batch never extends a group's turn beyond its share of the round. Set to 1 to send one datagram at a time (default: %u, maximum: %u)", DEFAULT_UDP_SEND_BATCH, MAX_UDP_SEND_BATCH), ArgsManager::ALLOW_ANY, OptionsCategory::UDP);
+    argsman.AddArg("-udpqueueweights=<high>,<best-effort>,<txns>,<blocks>", strprintf("Weights of the high priority, best-effort, background txn and background block buffers of each UDP group's Tx queue. Buffers with messages share the group's bandwidth in proportion to their weights, such that each of them is guaranteed its share. Multicast Tx streams may override them with option queue_weights (default: %s)", DEFAULT_UDP_QUEUE_WEIGHTS), ArgsManager::ALLOW_ANY, OptionsCategory::UDP);
+    argsman.AddArg("-udpgso", strprintf("Coalesce consecutive equally-sized UDP datagrams towards the same destination into a single send using UDP generic segmentation offload (Linux only, default: %u)", DEFAULT_UDP_GSO), ArgsManager::ALLOW_ANY, OptionsCategory::UDP);
     argsman.AddArg("-udpmulticastloginterval=<interval>", "Change periodicity of multicast bit rate logs that are activated by option debug=udpmulticast. Set <interval> in seconds.", ArgsManager::ALLOW_ANY, OptionsCategory::UDP);
 #ifdef USE_UPNP
 #if USE_UPNP
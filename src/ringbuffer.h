@@ -1,10 +1,13 @@
 #ifndef BITCOIN_RINGBUFFER_H
 #define BITCOIN_RINGBUFFER_H
 
+#include <algorithm>
 #include <assert.h>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <mutex>
+#include <stdexcept>
 
 static const size_t BUFF_DEPTH = 8192;
 
@@ -26,16 +29,17 @@ class RingBuffer;
  * @brief Ring buffer's read proxy
  *
  * Reads an element from the ring buffer while taking care of the read
- * confirmation or abortion calls.
+ * confirmation or abortion calls. Works with any of the ring buffer
+ * implementations (RingBuffer or MPSCRingBuffer).
  */
-template <typename T>
+template <typename T, typename Buffer = RingBuffer<T>>
 struct ReadProxy {
 private:
-    RingBuffer<T>* m_buf;
+    Buffer* m_buf;
     T* m_obj;
 
 public:
-    explicit ReadProxy(RingBuffer<T>* buf) : m_buf(buf), m_obj(buf->GetNextRead()) {}
+    explicit ReadProxy(Buffer* buf) : m_buf(buf), m_obj(buf->GetNextRead()) {}
 
     ReadProxy(ReadProxy const&) = delete;
 
@@ -67,6 +71,58 @@ public:
 };
 
 
+/**
+ * @brief Ring buffer's batch read proxy
+ *
+ * Reads up to a given number of consecutive elements from the ring buffer
+ * under a single lock acquisition. The caller confirms how many of the leading
+ * elements were actually consumed, and the remaining ones stay in the buffer.
+ */
+template <typename T, typename Buffer = RingBuffer<T>>
+struct BatchReadProxy {
+private:
+    Buffer* m_buf;
+    T** m_objs;
+    size_t m_n_objs;
+
+public:
+    BatchReadProxy(Buffer* buf, T** objs, size_t n_max) : m_buf(buf), m_objs(objs), m_n_objs(buf->GetNextReads(objs, n_max)) {}
+
+    BatchReadProxy(BatchReadProxy const&) = delete;
+
+    BatchReadProxy& operator=(BatchReadProxy const&) = delete;
+
+    ~BatchReadProxy()
+    {
+        if (m_n_objs != 0)
+            m_buf->AbortRead();
+    }
+
+    void ConfirmRead(size_t n_elems, uint64_t n_bytes = 0)
+    {
+        if (m_n_objs == 0)
+            return;
+        assert(n_elems <= m_n_objs);
+        if (n_elems == 0)
+            m_buf->AbortRead();
+        else
+            m_buf->ConfirmReads(n_elems, n_bytes);
+        m_n_objs = 0;
+    }
+
+    size_t Size() const
+    {
+        return m_n_objs;
+    }
+
+    T* operator[](size_t i) const
+    {
+        assert(i < m_n_objs);
+        return m_objs[i];
+    }
+};
+
+
 /**
  * @brief General purpose ring buffer
  *
@@ -175,6 +231,26 @@ public:
         return &m_buffer[m_read_ptr];
     }
 
+    /**
+     * @brief Get the next elements to be read from the buffer.
+     * @param (T**) Array that receives pointers to up to n_max elements.
+     * @param (size_t) Maximum number of elements to read.
+     * @return (size_t) Number of elements placed in the array.
+     * @note As in GetNextRead(), the buffer is left locked until the read is
+     * confirmed/aborted.
+     */
+    size_t GetNextReads(T** objs, size_t n_max)
+    {
+        if (IsEmpty()) {
+            throw std::runtime_error("Unexpected read from empty buffer");
+        }
+        m_mutex.lock(); // leave it locked until the read is confirmed/aborted
+        const size_t n = std::min(n_max, m_occupancy);
+        for (size_t i = 0; i < n; i++)
+            objs[i] = &m_buffer[(m_read_ptr + i) % BUFF_DEPTH];
+        return n;
+    }
+
     /**
      * @brief Abort an ongoing read transaction.
      * @return Void.
@@ -211,6 +287,31 @@ public:
         }
     }
 
+    /**
+     * @brief Confirm that a batch read transaction was executed.
+     * @param (size_t) Number of elements read, starting from the tail.
+     * @param (uint64_t) Bytes read across all elements.
+     * @return Void.
+     */
+    void ConfirmReads(size_t n_elems, uint64_t n_bytes = 0)
+    {
+        assert(n_elems <= m_occupancy);
+        const bool was_full = !HasSpaceForWrite();
+
+        m_read_ptr = (m_read_ptr + n_elems) % BUFF_DEPTH;
+        m_occupancy -= n_elems;
+
+        // Update the read counters
+        m_stats.rd_bytes += n_bytes;
+        m_stats.rd_count += n_elems;
+
+        m_mutex.unlock();
+
+        if (was_full) {
+            m_cv_nonfull.notify_all();
+        }
+    }
+
     /**
      * @brief Get buffer statistics
      * @return (const RingBufferStats&) Buffer statistics
@@ -222,4 +323,241 @@ public:
     }
 };
 
+
+/**
+ * @brief Lock-free multi-producer single-consumer ring buffer
+ *
+ * Drop-in alternative to RingBuffer for the case of a single reader thread.
+ * Writers claim slots by advancing the head with a compare-and-swap, and
+ * publish them through a per-slot sequence number, so that neither writers
+ * nor the reader take a lock in the common case. Only writers that find the
+ * buffer full block on a condition variable, which the reader notifies only
+ * when some writer is actually waiting.
+ *
+ * Reads follow the same GetNextRead(s)/ConfirmRead(s)/AbortRead protocol as
+ * RingBuffer, but must all come from the same thread. Read elements remain
+ * owned by the reader until confirmed, so aborting a read is a no-op.
+ */
+template <typename T>
+class MPSCRingBuffer
+{
+private:
+    struct Slot {
+        std::atomic<size_t> seq; //!< position at which the slot is writable/readable
+        T obj;
+    };
+
+    /* Keep the writer and reader positions on separate cache lines */
+    std::atomic<size_t> m_write_ptr{0}; //!< next position claimed by writers
+    char m_pad_write[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_read_ptr{0};  //!< next position to be read
+    char m_pad_read[64 - sizeof(std::atomic<size_t>)];
+    Slot m_buffer[BUFF_DEPTH];
+
+    /* Slow path for writers waiting on a full buffer */
+    std::mutex m_mutex;
+    std::condition_variable m_cv_nonfull;
+    std::atomic<unsigned int> m_n_waiting_writers{0};
+    std::atomic_bool m_force_cv_wakeup{false};
+
+    /* Statistics tracking */
+    std::atomic<uint64_t> m_rd_bytes{0};
+    std::atomic<uint64_t> m_rd_count{0};
+
+    /**
+     * @brief Check if the element at a given read position has been published.
+     */
+    bool IsReadable(size_t pos) const
+    {
+        return m_buffer[pos % BUFF_DEPTH].seq.load(std::memory_order_acquire) == pos + 1;
+    }
+
+    /**
+     * @brief Try to claim the next free slot for writing.
+     * @return (Slot*) The claimed slot, or nullptr if the buffer is full.
+     */
+    Slot* TryClaim(size_t& pos)
+    {
+        pos = m_write_ptr.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = m_buffer[pos % BUFF_DEPTH];
+            const size_t seq = slot.seq.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (m_write_ptr.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    return &slot;
+            } else if (diff < 0) {
+                return nullptr; // the slot has not been read yet
+            } else {
+                pos = m_write_ptr.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void Release(size_t pos, size_t n_elems, uint64_t n_bytes)
+    {
+        for (size_t i = 0; i < n_elems; i++)
+            m_buffer[(pos + i) % BUFF_DEPTH].seq.store(pos + i + BUFF_DEPTH, std::memory_order_release);
+        m_read_ptr.store(pos + n_elems, std::memory_order_relaxed);
+
+        // Update the read counters
+        m_rd_bytes.fetch_add(n_bytes, std::memory_order_relaxed);
+        m_rd_count.fetch_add(n_elems, std::memory_order_relaxed);
+
+        /* Wake up the writers waiting for space, if any. Pairs with the fence
+         * in WriteElement, such that either the writer sees the free slot or
+         * we see the writer waiting. */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_n_waiting_writers.load(std::memory_order_relaxed) > 0) {
+            { std::lock_guard<std::mutex> lock(m_mutex); }
+            m_cv_nonfull.notify_all();
+        }
+    }
+
+public:
+    MPSCRingBuffer()
+    {
+        for (size_t i = 0; i < BUFF_DEPTH; i++)
+            m_buffer[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    MPSCRingBuffer(const MPSCRingBuffer&) = delete;
+    MPSCRingBuffer& operator=(const MPSCRingBuffer&) = delete;
+
+    /**
+     * @brief Write to the next free element in the buffer.
+     * @param Callback function used to write into the buffer element.
+     * @return (bool) Whether the write was executed.
+     */
+    template <typename Fun>
+    bool WriteElement(Fun f)
+    {
+        size_t pos;
+        Slot* slot = TryClaim(pos);
+
+        // Wait until the buffer has free space for a new write transaction.
+        if (slot == nullptr) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_n_waiting_writers.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            m_cv_nonfull.wait(lock, [&] {
+                return (slot = TryClaim(pos)) != nullptr || m_force_cv_wakeup;
+            });
+            m_n_waiting_writers.fetch_sub(1, std::memory_order_relaxed);
+
+            // If the wake-up was forced, don't complete the writing
+            if (slot == nullptr)
+                return false;
+        }
+
+        f(slot->obj);
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Abort all pending write transactions waiting on buffer space
+     * @return Void.
+     */
+    void AbortWrite()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_force_cv_wakeup = true;
+        }
+        m_cv_nonfull.notify_all();
+    }
+
+    /**
+     * @brief Check if the buffer has an element ready to be read.
+     * @return (bool) Whether it is empty.
+     */
+    bool IsEmpty() const
+    {
+        return !IsReadable(m_read_ptr.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * @brief Check if the buffer is full.
+     * @return (bool) Whether it is full.
+     */
+    bool IsFull() const
+    {
+        const size_t rd = m_read_ptr.load(std::memory_order_relaxed);
+        return m_write_ptr.load(std::memory_order_relaxed) - rd >= BUFF_DEPTH;
+    }
+
+    /**
+     * @brief Get the next element to be read from the buffer.
+     * @return (T*) Pointer to the element of type T.
+     */
+    T* GetNextRead()
+    {
+        const size_t rd = m_read_ptr.load(std::memory_order_relaxed);
+        if (!IsReadable(rd)) {
+            throw std::runtime_error("Unexpected read from empty buffer");
+        }
+        return &m_buffer[rd % BUFF_DEPTH].obj;
+    }
+
+    /**
+     * @brief Get the next elements to be read from the buffer.
+     * @param (T**) Array that receives pointers to up to n_max elements.
+     * @param (size_t) Maximum number of elements to read.
+     * @return (size_t) Number of elements placed in the array.
+     */
+    size_t GetNextReads(T** objs, size_t n_max)
+    {
+        const size_t rd = m_read_ptr.load(std::memory_order_relaxed);
+        if (!IsReadable(rd)) {
+            throw std::runtime_error("Unexpected read from empty buffer");
+        }
+        size_t n = 0;
+        while (n < n_max && n < BUFF_DEPTH && IsReadable(rd + n)) {
+            objs[n] = &m_buffer[(rd + n) % BUFF_DEPTH].obj;
+            n++;
+        }
+        return n;
+    }
+
+    /**
+     * @brief Abort an ongoing read transaction.
+     * @return Void.
+     */
+    void AbortRead() {}
+
+    /**
+     * @brief Confirm that a read transaction was executed.
+     * @param (unsigned int) Bytes read
+     * @return Void.
+     */
+    void ConfirmRead(unsigned int n_bytes = 0)
+    {
+        Release(m_read_ptr.load(std::memory_order_relaxed), 1, n_bytes);
+    }
+
+    /**
+     * @brief Confirm that a batch read transaction was executed.
+     * @param (size_t) Number of elements read, starting from the tail.
+     * @param (uint64_t) Bytes read across all elements.
+     * @return Void.
+     */
+    void ConfirmReads(size_t n_elems, uint64_t n_bytes = 0)
+    {
+        Release(m_read_ptr.load(std::memory_order_relaxed), n_elems, n_bytes);
+    }
+
+    /**
+     * @brief Get buffer statistics
+     * @return (RingBufferStats) Snapshot of the buffer statistics
+     */
+    RingBufferStats GetStats() const
+    {
+        RingBufferStats stats;
+        stats.rd_bytes = m_rd_bytes.load(std::memory_order_relaxed);
+        stats.rd_count = m_rd_count.load(std::memory_order_relaxed);
+        return stats;
+    }
+};
+
 #endif
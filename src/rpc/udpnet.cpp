@@ -300,6 +300,7 @@ UniValue gettxntxinfo(const JSONRPCRequest& request)
                 {RPCResult::Type::OBJ, "idx", "Physical stream index - logical stream index",
                     {
                         {RPCResult::Type::NUM, "tx_count", "Total number of txns transmitted"},
+                        {RPCResult::Type::NUM, "queued", "Number of mempool txns waiting for transmission"},
                     }},
             }},
         RPCExamples{
@@ -329,6 +330,13 @@ UniValue gettxqueueinfo(const JSONRPCRequest& request)
                                 {RPCResult::Type::NUM, "tx_bytes", "Bytes transmitted"},
                                 {RPCResult::Type::NUM, "tx_pkts", "Packets transmitted"},
                             }},
+                        {RPCResult::Type::STR, "pacing", /* optional */ true, "Pacing of a rate-limited group (none, timer or txtime)"},
+                        {RPCResult::Type::OBJ, "jitter", /* optional */ true, "Inter-packet delay variation of a rate-limited group: deviation of the spacing between consecutive packets from the duration of a packet at the group's rate",
+                            {
+                                {RPCResult::Type::NUM, "pkts", "Packets measured"},
+                                {RPCResult::Type::NUM, "avg_us", "Average deviation in microseconds"},
+                                {RPCResult::Type::NUM, "max_us", "Maximum deviation in microseconds"},
+                            }},
                     }},
             }},
         RPCExamples{HelpExampleCli("gettxqueueinfo", "") + HelpExampleRpc("gettxqueueinfo", "")}}
@@ -372,6 +380,37 @@ UniValue getfechitratio(const JSONRPCRequest& request)
     return FecHitRatioToJson();
 }
 
+UniValue getfecoverhead(const JSONRPCRequest& request)
+{
+    RPCHelpMan{
+        "getfecoverhead",
+        "\nGet the adaptive FEC overhead of each UDP peer.\n"
+        "\nA unicast peer is always sent the whole block plus a fixed number of FEC\n"
+        "chunks, and on top of that an overhead that compensates for losses. The\n"
+        "overhead is adjusted after every block received from the peer, based on the\n"
+        "fraction of its chunks that turned out to be redundant. It only grows and\n"
+        "shrinks with the losses, as peers do not report the chunks they prefill from\n"
+        "their mempool. Multicast Tx streams have no return channel and are always sent\n"
+        "the default number of FEC chunks (see overhead_rep_blks for the backfill).\n",
+        {},
+        RPCResult{
+            RPCResult::Type::OBJ, "", "",
+            {
+                {RPCResult::Type::OBJ, "addr", "UDP peer address",
+                    {
+                        {
+                            {RPCResult::Type::NUM, "overhead", "Extra FEC chunks sent to compensate for losses, relative to the block size"},
+                            {RPCResult::Type::NUM, "redundancy", "Average fraction of the chunks received from the peer that were not needed (-1 if unknown)"},
+                            {RPCResult::Type::NUM, "blocks", "Number of blocks the estimate is based on"},
+                        },
+                    }},
+            }},
+        RPCExamples{HelpExampleCli("getfecoverhead", "") + HelpExampleRpc("getfecoverhead", "")}}
+        .Check(request);
+
+    return FecOverheadToJson();
+}
+
 UniValue txblock(const JSONRPCRequest& request)
 {
     RPCHelpMan{"txblock",
@@ -402,6 +441,7 @@ static const CRPCCommand commands[] =
         {"udpnetwork", "gettxntxinfo", &gettxntxinfo, {}},
         {"udpnetwork", "gettxqueueinfo", &gettxqueueinfo, {}},
         {"udpnetwork", "getfechitratio", &getfechitratio, {}},
+        {"udpnetwork", "getfecoverhead", &getfecoverhead, {}},
         {"udpnetwork", "txblock", &txblock, {"height"}}};
 
 void RegisterUDPNetRPCCommands(CRPCTable& t)
@@ -0,0 +1,216 @@
+#include <boost/test/unit_test.hpp>
+#include <test/util/setup_common.h>
+#include <backfill.h>
+
+BOOST_FIXTURE_TEST_SUITE(backfill_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(test_linear)
+{
+    BackfillConfig config;
+    config.depth = 5;
+    config.offset = 2;
+    BackfillScheduler scheduler(config);
+    BOOST_CHECK_EQUAL(scheduler.NumCarousels(), 1U);
+
+    // Start at the offset from the bottom of the window and wrap around
+    const std::vector<int> expected{8, 9, 10, 6, 7, 8, 9, 10, 6};
+    for (const int height : expected) {
+        BOOST_CHECK_EQUAL(scheduler.Next(10), height);
+        scheduler.Charge(1000);
+    }
+
+    // Keep the place when the tip advances
+    BOOST_CHECK_EQUAL(scheduler.Next(11), 7);
+    BOOST_CHECK_EQUAL(scheduler.Next(11), 8);
+    // Restart from the bottom when falling behind the window
+    BOOST_CHECK_EQUAL(scheduler.Next(20), 16);
+    BOOST_CHECK_EQUAL(scheduler.Next(20), 17);
+}
+
+BOOST_AUTO_TEST_CASE(test_linear_short_chain)
+{
+    // A window deeper than the chain covers the full chain
+    BackfillConfig config;
+    config.depth = 20;
+    config.offset = 4;
+    BackfillScheduler scheduler(config);
+    const std::vector<int> expected{1, 2, 0, 1, 2, 0};
+    for (const int height : expected)
+        BOOST_CHECK_EQUAL(scheduler.Next(2), height);
+
+    // Full chain
+    config.depth = 0;
+    config.offset = 0;
+    BackfillScheduler full_chain(config);
+    for (int i = 0; i < 10; i++)
+        BOOST_CHECK_EQUAL(full_chain.Next(4), i % 5);
+}
+
+BOOST_AUTO_TEST_CASE(test_carousels)
+{
+    BackfillConfig config;
+    config.policy = BackfillPolicy::CAROUSELS;
+    config.depth = 1000;
+    config.recent_depth = 6;
+    config.recent_weight = 3;
+    BackfillScheduler scheduler(config);
+    BOOST_CHECK_EQUAL(scheduler.NumCarousels(), 2U);
+
+    const int chain_height = 5000;
+    std::vector<int> picks(2, 0);
+    for (int i = 0; i < 400; i++) {
+        const int height = scheduler.Next(chain_height);
+        const size_t carousel = scheduler.LastCarousel();
+        if (carousel == 0) {
+            BOOST_CHECK(height > chain_height - 6 && height <= chain_height);
+        } else {
+            BOOST_CHECK(height > chain_height - 1000 && height <= chain_height - 6);
+        }
+        picks[carousel]++;
+        scheduler.Charge(1000);
+    }
+    BOOST_CHECK_EQUAL(picks[0], 300);
+    BOOST_CHECK_EQUAL(picks[1], 100);
+
+    // The shares are in bytes, rather than blocks
+    picks.assign(2, 0);
+    for (int i = 0; i < 400; i++) {
+        scheduler.Next(chain_height);
+        const size_t carousel = scheduler.LastCarousel();
+        picks[carousel]++;
+        scheduler.Charge(carousel == 0 ? 3000 : 1000);
+    }
+    BOOST_CHECK_EQUAL(picks[0], 200);
+    BOOST_CHECK_EQUAL(picks[1], 200);
+}
+
+BOOST_AUTO_TEST_CASE(test_carousel_activation)
+{
+    BackfillConfig config;
+    config.policy = BackfillPolicy::CAROUSELS;
+    config.depth = 0;
+    config.recent_depth = 6;
+    BackfillScheduler scheduler(config);
+
+    // Only the recent carousel has blocks while the chain is short
+    for (int i = 0; i < 50; i++) {
+        BOOST_CHECK_EQUAL(scheduler.Next(3), i % 4);
+        BOOST_CHECK_EQUAL(scheduler.LastCarousel(), 0U);
+        scheduler.Charge(1000);
+    }
+
+    // Once the history carousel has blocks, it gets its share from then on
+    std::vector<int> picks(2, 0);
+    for (int i = 0; i < 20; i++) {
+        scheduler.Next(100);
+        picks[scheduler.LastCarousel()]++;
+        scheduler.Charge(1000);
+    }
+    BOOST_CHECK_EQUAL(picks[0], 10);
+    BOOST_CHECK_EQUAL(picks[1], 10);
+}
+
+BOOST_AUTO_TEST_CASE(test_decay)
+{
+    BackfillConfig config;
+    config.policy = BackfillPolicy::DECAY;
+    config.depth = 0;
+    config.decay_depth = 10;
+    BackfillScheduler scheduler(config);
+    BOOST_CHECK_EQUAL(scheduler.NumCarousels(), (size_t)BACKFILL_DECAY_TIERS);
+
+    // Each tier is sent half as often as the tier above it
+    const int chain_height = 10000;
+    std::vector<int> picks(BACKFILL_DECAY_TIERS, 0);
+    const int n_picks = 255 * 16;
+    for (int i = 0; i < n_picks; i++) {
+        const int height = scheduler.Next(chain_height);
+        const size_t tier = scheduler.LastCarousel();
+        const int depth = chain_height - height;
+        BOOST_CHECK(depth >= (int)tier * 10);
+        if (tier < BACKFILL_DECAY_TIERS - 1)
+            BOOST_CHECK(depth < (int)(tier + 1) * 10);
+        picks[tier]++;
+        scheduler.Charge(1000);
+    }
+    for (int k = 0; k < BACKFILL_DECAY_TIERS - 1; k++)
+        BOOST_CHECK(std::abs(picks[k] - 2 * picks[k + 1]) <= 2);
+
+    // The tiers stop at the bottom of the window
+    config.depth = 25;
+    BackfillScheduler shallow(config);
+    BOOST_CHECK_EQUAL(shallow.NumCarousels(), 3U);
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK(chain_height - shallow.Next(chain_height) < 25);
+}
+
+BOOST_AUTO_TEST_CASE(test_peek)
+{
+    BackfillConfig config;
+    config.policy = BackfillPolicy::CAROUSELS;
+    config.depth = 100;
+    config.recent_depth = 6;
+    config.recent_weight = 2;
+    BackfillScheduler scheduler(config);
+
+    const int chain_height = 500;
+    for (int i = 0; i < 10; i++) {
+        scheduler.Next(chain_height);
+        scheduler.Charge(scheduler.LastCarousel() == 0 ? 3000 : 1000);
+    }
+
+    // Peeking does not change the schedule, which matches the prediction
+    // while the blocks keep their sizes
+    const std::vector<int> predicted = scheduler.Peek(chain_height, 20);
+    BOOST_CHECK(predicted == scheduler.Peek(chain_height, 20));
+    for (const int height : predicted) {
+        BOOST_CHECK_EQUAL(scheduler.Next(chain_height), height);
+        scheduler.Charge(scheduler.LastCarousel() == 0 ? 3000 : 1000);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_skip)
+{
+    BackfillConfig config;
+    config.depth = 5;
+    config.offset = 2;
+    BackfillScheduler scheduler(config);
+
+    // Pass over the skipped blocks, wrapping around the window
+    BOOST_CHECK_EQUAL(scheduler.Next(10, {8, 9}), 10);
+    BOOST_CHECK_EQUAL(scheduler.Next(10, {6}), 7);
+    // Pick nothing when all blocks are skipped, and keep the place
+    BOOST_CHECK_EQUAL(scheduler.Next(10, {6, 7, 8, 9, 10}), -1);
+    BOOST_CHECK_EQUAL(scheduler.Next(10), 8);
+
+    // Fall back to the next carousel when all blocks of one are skipped
+    config.policy = BackfillPolicy::CAROUSELS;
+    config.depth = 1000;
+    config.recent_depth = 6;
+    config.recent_weight = 3;
+    BackfillScheduler carousels(config);
+    const int chain_height = 5000;
+    for (int i = 0; i < 4; i++) {
+        carousels.Next(chain_height);
+        carousels.Charge(1000);
+    }
+    const std::set<int> recent{4995, 4996, 4997, 4998, 4999, 5000};
+    for (int i = 0; i < 10; i++) {
+        const int height = carousels.Next(chain_height, recent);
+        BOOST_CHECK_EQUAL(carousels.LastCarousel(), 1U);
+        BOOST_CHECK(height <= chain_height - 6);
+        carousels.Charge(1000);
+    }
+
+    // Predictions skip the same blocks
+    const std::set<int> skip{4998, 4999, 5000};
+    const std::vector<int> predicted = carousels.Peek(chain_height, 20, skip);
+    BOOST_CHECK_EQUAL(predicted.size(), 20U);
+    for (const int height : predicted) {
+        BOOST_CHECK(!skip.count(height));
+        BOOST_CHECK_EQUAL(carousels.Next(chain_height, skip), height);
+        carousels.Charge(1000);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
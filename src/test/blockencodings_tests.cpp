@@ -9,11 +9,13 @@
 #include <fec.h>
 #include <pow.h>
 #include <streams.h>
+#include <util/time.h>
 
 #include <test/util/setup_common.h>
 
 #include <boost/test/unit_test.hpp>
 #include <random>
+#include <set>
 
 namespace {
 std::vector<std::pair<uint256, CTransactionRef>> extra_txn;
@@ -115,6 +117,82 @@ BOOST_AUTO_TEST_CASE(SimpleRoundTripTest)
     }
 }
 
+BOOST_AUTO_TEST_CASE(RepeatedInitDataTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+    CBlock block(BuildBlockTestCase());
+
+    LOCK2(cs_main, pool.cs);
+    pool.addUnchecked(entry.FromTx(block.vtx[2]));
+
+    // The same block from several peers carries the same short IDs
+    CBlockHeaderAndShortTxIDs shortIDs(block, true);
+
+    {
+        PartiallyDownloadedBlock partialBlock(&pool);
+        BOOST_CHECK(partialBlock.InitData(shortIDs, extra_txn) == READ_STATUS_OK);
+        BOOST_CHECK(!partialBlock.IsTxAvailable(1));
+        BOOST_CHECK( partialBlock.IsTxAvailable(2));
+    }
+    BOOST_CHECK_EQUAL(pool.m_shortid_matches.size(), 1U);
+    BOOST_CHECK_EQUAL(pool.m_shortid_matches.front().matches.size(), 1U);
+    BOOST_CHECK(!pool.m_shortid_matches.front().complete);
+
+    // Incomplete matches are reused while the mempool is unchanged. Drop the
+    // cached matches to tell a reuse (which then finds no txn) from a rescan.
+    pool.m_shortid_matches.front().matches.clear();
+    {
+        PartiallyDownloadedBlock partialBlock(&pool);
+        BOOST_CHECK(partialBlock.InitData(shortIDs, extra_txn) == READ_STATUS_OK);
+        BOOST_CHECK(!partialBlock.IsTxAvailable(1));
+        BOOST_CHECK(!partialBlock.IsTxAvailable(2));
+    }
+    BOOST_CHECK_EQUAL(pool.m_shortid_matches.size(), 1U);
+
+    // but not once the mempool has changed
+    pool.addUnchecked(entry.FromTx(block.vtx[1]));
+    {
+        PartiallyDownloadedBlock partialBlock(&pool);
+        BOOST_CHECK(partialBlock.InitData(shortIDs, extra_txn) == READ_STATUS_OK);
+        BOOST_CHECK(partialBlock.IsTxAvailable(1));
+        BOOST_CHECK(partialBlock.IsTxAvailable(2));
+    }
+    BOOST_CHECK_EQUAL(pool.m_shortid_matches.size(), 1U);
+    BOOST_CHECK_EQUAL(pool.m_shortid_matches.front().matches.size(), 2U);
+    BOOST_CHECK(pool.m_shortid_matches.front().complete);
+
+    // Complete matches are reused (a rescan would leave them incomplete), but
+    // only for txn still in the mempool
+    pool.removeRecursive(*block.vtx[1], MemPoolRemovalReason::REPLACED);
+    {
+        PartiallyDownloadedBlock partialBlock(&pool);
+        BOOST_CHECK(partialBlock.InitData(shortIDs, extra_txn) == READ_STATUS_OK);
+        BOOST_CHECK(!partialBlock.IsTxAvailable(1));
+        BOOST_CHECK( partialBlock.IsTxAvailable(2));
+
+        CBlock block2;
+        BOOST_CHECK(partialBlock.FillBlock(block2, {block.vtx[1]}) == READ_STATUS_OK);
+        BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+    }
+    BOOST_CHECK_EQUAL(pool.m_shortid_matches.size(), 1U);
+    BOOST_CHECK(pool.m_shortid_matches.front().complete);
+
+    // Short IDs of the same block under a different nonce miss the cache
+    CBlockHeaderAndShortTxIDs otherShortIDs(block, true);
+    BOOST_CHECK(otherShortIDs.GetShortID(block.vtx[2]->GetWitnessHash()) != shortIDs.GetShortID(block.vtx[2]->GetWitnessHash()));
+    {
+        PartiallyDownloadedBlock partialBlock(&pool);
+        BOOST_CHECK(partialBlock.InitData(otherShortIDs, extra_txn) == READ_STATUS_OK);
+        BOOST_CHECK(!partialBlock.IsTxAvailable(1));
+        BOOST_CHECK( partialBlock.IsTxAvailable(2));
+    }
+    BOOST_CHECK_EQUAL(pool.m_shortid_matches.size(), 2U);
+    BOOST_CHECK(pool.m_shortid_matches.front().nonce != pool.m_shortid_matches.back().nonce);
+    BOOST_CHECK(!pool.m_shortid_matches.front().complete);
+    BOOST_CHECK(pool.m_shortid_matches.back().complete);
+}
+
 class TestHeaderAndShortIDs {
     // Utility to encode custom CBlockHeaderAndShortTxIDs
 public:
@@ -642,6 +720,260 @@ BOOST_AUTO_TEST_CASE(RealFECedBlockRoundTripTest)
 }
 */
 
+// A block of txn of various sizes, many of them spanning chunks, and a third
+// of them spending an earlier one if spend_in_block
+static CBlock BuildLargeBlockTestCase(bool spend_in_block = false, size_t n_txns = 300) {
+    CBlock block(BuildBlockTestCase());
+    block.vtx.resize(1);
+    for (size_t i = 0; i < n_txns; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1 + InsecureRandRange(8));
+        for (CTxIn& txin : tx.vin) {
+            txin.prevout = COutPoint(InsecureRand256(), InsecureRandRange(4));
+            txin.scriptSig << g_insecure_rand_ctx.randbytes(InsecureRandRange(200));
+        }
+        if (spend_in_block && i > 0 && InsecureRandRange(3) == 0)
+            tx.vin[0].prevout.hash = block.vtx[1 + InsecureRandRange(i)]->GetHash();
+        tx.vout.resize(1 + InsecureRandRange(3));
+        for (CTxOut& txout : tx.vout) {
+            txout.nValue = InsecureRandRange(100000);
+            txout.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << g_insecure_rand_ctx.randbytes(20) << OP_EQUALVERIFY << OP_CHECKSIG;
+        }
+        block.vtx.push_back(MakeTransactionRef(tx));
+    }
+    bool mutated;
+    block.hashMerkleRoot = BlockMerkleRoot(block, &mutated);
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(ParallelFillTest)
+{
+    // Large enough to be filled in several slices
+    CBlock block(BuildLargeBlockTestCase(false, 2500));
+    bool mutated;
+
+    CBlockHeaderAndLengthShortTxIDs headerAndIDs(block, codec_version_t::v1, true);
+    ChunkCodedBlock fecBlock(block, headerAndIDs);
+    const std::vector<unsigned char>& coded_block = fecBlock.GetCodedBlock();
+    const size_t chunk_count = coded_block.size() / FEC_CHUNK_SIZE;
+
+    FECWorkerPool worker_pool(3);
+    std::mt19937_64 g(0xdeadbeef);
+
+    // Leave every other, every 7th and every 50th txn out of the mempool
+    for (size_t step : {2, 7, 50}) {
+        CTxMemPool pool;
+        TestMemPoolEntryHelper entry;
+        std::vector<CTransactionRef> vtx(block.vtx.begin() + 1, block.vtx.end());
+        std::shuffle(vtx.begin(), vtx.end(), g);
+        for (size_t i = 0; i < vtx.size(); i++) {
+            if (i % step)
+                pool.addUnchecked(entry.FromTx(vtx[i]));
+        }
+
+        PartiallyDownloadedChunkBlock iterativeBlock(&pool);
+        BOOST_REQUIRE(iterativeBlock.InitData(headerAndIDs, extra_txn) == READ_STATUS_OK);
+        size_t firstChunkProcessed;
+        while (!iterativeBlock.IsIterativeFillDone())
+            BOOST_REQUIRE(iterativeBlock.DoIterativeFill(firstChunkProcessed) == READ_STATUS_OK);
+
+        PartiallyDownloadedChunkBlock parallelBlock(&pool);
+        BOOST_REQUIRE(parallelBlock.InitData(headerAndIDs, extra_txn) == READ_STATUS_OK);
+        size_t chunks_ready = 0, n_slices = 0;
+        while (!parallelBlock.IsIterativeFillDone()) {
+            BOOST_REQUIRE(parallelBlock.DoParallelFill(worker_pool, [&](size_t begin, size_t end) {
+                BOOST_CHECK_EQUAL(begin, chunks_ready);
+                chunks_ready = end;
+            }) == READ_STATUS_OK);
+            n_slices++;
+        }
+        BOOST_CHECK(n_slices > 1);
+        BOOST_CHECK_EQUAL(chunks_ready, chunk_count);
+
+        // The parallel fill provides at least the chunks the iterative one
+        // does (which gives up on some chunks it could fill), all matching
+        // the sender's
+        BOOST_REQUIRE_EQUAL(parallelBlock.GetChunkCount(), chunk_count);
+        size_t available = 0;
+        for (size_t i = 0; i < chunk_count; i++) {
+            BOOST_CHECK(parallelBlock.IsChunkAvailable(i) || !iterativeBlock.IsChunkAvailable(i));
+            if (iterativeBlock.IsChunkAvailable(i))
+                BOOST_CHECK(!memcmp(iterativeBlock.GetChunk(i), &coded_block[i * FEC_CHUNK_SIZE], FEC_CHUNK_SIZE));
+            if (parallelBlock.IsChunkAvailable(i)) {
+                available++;
+                BOOST_CHECK(!memcmp(parallelBlock.GetChunk(i), &coded_block[i * FEC_CHUNK_SIZE], FEC_CHUNK_SIZE));
+            }
+        }
+        BOOST_CHECK(available > 0 && available < chunk_count);
+
+        for (size_t i = 0; i < chunk_count; i++) {
+            if (!parallelBlock.IsChunkAvailable(i)) {
+                memcpy(parallelBlock.GetChunk(i), &coded_block[i * FEC_CHUNK_SIZE], FEC_CHUNK_SIZE);
+                parallelBlock.MarkChunkAvailable(i);
+            }
+        }
+        BOOST_REQUIRE(parallelBlock.IsBlockAvailable());
+        BOOST_CHECK(parallelBlock.FinalizeBlock() == READ_STATUS_OK);
+        BOOST_CHECK_EQUAL(block.hashMerkleRoot.ToString(), BlockMerkleRoot(*parallelBlock.GetBlock(), &mutated).ToString());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(StreamedDecodeTest)
+{
+    CBlock block(BuildLargeBlockTestCase());
+    bool mutated;
+
+    CBlockHeaderAndLengthShortTxIDs headerAndIDs(block, codec_version_t::v1, true);
+    ChunkCodedBlock fecBlock(block, headerAndIDs);
+    const std::vector<unsigned char>& coded_block = fecBlock.GetCodedBlock();
+    const size_t chunk_count = coded_block.size() / FEC_CHUNK_SIZE;
+
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+    size_t mempool_txn = 0;
+    for (size_t i = 1; i < block.vtx.size(); i += 3, mempool_txn++)
+        pool.addUnchecked(entry.FromTx(block.vtx[i]));
+
+    PartiallyDownloadedChunkBlock partialBlock(&pool);
+    BOOST_REQUIRE(partialBlock.InitData(headerAndIDs, extra_txn) == READ_STATUS_OK);
+    size_t firstChunkProcessed;
+    while (!partialBlock.IsIterativeFillDone())
+        BOOST_REQUIRE(partialBlock.DoIterativeFill(firstChunkProcessed) == READ_STATUS_OK);
+
+    // Receive the rest of the chunks out of order, except for a few which are
+    // left to be recovered, decoding txn as they are completed
+    std::vector<size_t> missing;
+    for (size_t i = 0; i < chunk_count; i++) {
+        if (!partialBlock.IsChunkAvailable(i))
+            missing.push_back(i);
+    }
+    Shuffle(missing.begin(), missing.end(), g_insecure_rand_ctx);
+    const size_t recovered = 5;
+    BOOST_REQUIRE(missing.size() > recovered);
+
+    size_t streamed = 0;
+    for (size_t k = 0; k < missing.size(); k++) {
+        memcpy(partialBlock.GetChunk(missing[k]), &coded_block[missing[k] * FEC_CHUNK_SIZE], FEC_CHUNK_SIZE);
+        partialBlock.MarkChunkAvailable(missing[k]);
+        if (k < missing.size() - recovered)
+            streamed += partialBlock.DecodeTxnInChunk(missing[k]);
+    }
+    BOOST_CHECK(streamed > 0);
+    BOOST_CHECK(streamed < block.vtx.size() - 1 - mempool_txn);
+
+    // Decoding a chunk again does not decode its txn again
+    BOOST_CHECK_EQUAL(partialBlock.DecodeTxnInChunk(missing[0]), 0U);
+
+    BOOST_REQUIRE(partialBlock.IsBlockAvailable());
+    BOOST_CHECK(partialBlock.FinalizeBlock() == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.hashMerkleRoot.ToString(), BlockMerkleRoot(*partialBlock.GetBlock(), &mutated).ToString());
+    BOOST_CHECK(!mutated);
+}
+
+BOOST_AUTO_TEST_CASE(CodedBlockCacheTrimTest)
+{
+    CBlock block(BuildLargeBlockTestCase());
+    CBlockHeaderAndLengthShortTxIDs headerAndIDs(block, codec_version_t::v1, true);
+    CTxMemPool pool;
+
+    // Drop the buffers left behind by the other tests
+    const int64_t now = GetTime();
+    SetMockTime(now + count_seconds(CODED_BLOCK_CACHE_IDLE_TIME) + 1);
+    TrimCodedBlockBufferCache();
+
+    // The buffer of a destroyed block is kept for reuse until left idle
+    {
+        PartiallyDownloadedChunkBlock partialBlock(&pool);
+        BOOST_REQUIRE(partialBlock.InitData(headerAndIDs, extra_txn) == READ_STATUS_OK);
+    }
+    BOOST_CHECK_EQUAL(TrimCodedBlockBufferCache(), 0U);
+    SetMockTime(now + 2 * (count_seconds(CODED_BLOCK_CACHE_IDLE_TIME) + 1));
+    BOOST_CHECK_EQUAL(TrimCodedBlockBufferCache(), 1U);
+    BOOST_CHECK_EQUAL(TrimCodedBlockBufferCache(), 0U);
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(InBlockPrevoutTest)
+{
+    CBlock block(BuildLargeBlockTestCase(true));
+    bool mutated;
+
+    CBlockHeaderAndLengthShortTxIDs v1HeaderAndIDs(block, codec_version_t::v1, true);
+    ChunkCodedBlock v1FecBlock(block, v1HeaderAndIDs);
+    CBlockHeaderAndLengthShortTxIDs headerAndIDs(block, codec_version_t::v2, true);
+    ChunkCodedBlock fecBlock(block, headerAndIDs);
+    const std::vector<unsigned char>& coded_block = fecBlock.GetCodedBlock();
+    const size_t chunk_count = coded_block.size() / FEC_CHUNK_SIZE;
+    BOOST_CHECK(coded_block.size() < v1FecBlock.GetCodedBlock().size());
+
+    FECWorkerPool worker_pool(3);
+
+    // Leave every 7th and every 50th txn out of the mempool, along with
+    // their descendants, as the mempool would. Put those left out for their
+    // parent only in the extra txn, which we can't tell are in the block if
+    // the parent was left out.
+    for (size_t step : {7, 50}) {
+        CTxMemPool pool;
+        TestMemPoolEntryHelper entry;
+        std::vector<std::pair<uint256, CTransactionRef>> extra;
+        std::set<uint256> in_mempool;
+        for (size_t i = 1; i < block.vtx.size(); i++) {
+            const CTransactionRef& tx = block.vtx[i];
+            if (i % step == 0)
+                continue;
+            bool have_parents = true;
+            for (const CTxIn& txin : tx->vin) {
+                for (size_t j = 1; j < i; j++)
+                    have_parents &= block.vtx[j]->GetHash() != txin.prevout.hash || in_mempool.count(txin.prevout.hash);
+            }
+            if (have_parents) {
+                pool.addUnchecked(entry.FromTx(tx));
+                in_mempool.insert(tx->GetHash());
+            } else {
+                extra.emplace_back(tx->GetWitnessHash(), tx);
+            }
+        }
+
+        for (bool parallel : {false, true}) {
+            PartiallyDownloadedChunkBlock partialBlock(&pool);
+            BOOST_REQUIRE(partialBlock.InitData(headerAndIDs, extra) == READ_STATUS_OK);
+            BOOST_CHECK(partialBlock.GetMempoolCount() >= in_mempool.size());
+            BOOST_CHECK(extra.empty() || partialBlock.GetMempoolCount() < in_mempool.size() + extra.size());
+            if (parallel) {
+                while (!partialBlock.IsIterativeFillDone())
+                    BOOST_REQUIRE(partialBlock.DoParallelFill(worker_pool, nullptr) == READ_STATUS_OK);
+            } else {
+                size_t firstChunkProcessed;
+                while (!partialBlock.IsIterativeFillDone())
+                    BOOST_REQUIRE(partialBlock.DoIterativeFill(firstChunkProcessed) == READ_STATUS_OK);
+            }
+
+            // Mempool txn spending others of the block are coded as the
+            // sender did, and so are the txn decoded from received chunks
+            BOOST_REQUIRE_EQUAL(partialBlock.GetChunkCount(), chunk_count);
+            size_t available = 0;
+            for (size_t i = 0; i < chunk_count; i++) {
+                if (partialBlock.IsChunkAvailable(i)) {
+                    available++;
+                    BOOST_CHECK(!memcmp(partialBlock.GetChunk(i), &coded_block[i * FEC_CHUNK_SIZE], FEC_CHUNK_SIZE));
+                }
+            }
+            BOOST_CHECK(available > 0 && available < chunk_count);
+
+            for (size_t i = 0; i < chunk_count; i++) {
+                if (!partialBlock.IsChunkAvailable(i)) {
+                    memcpy(partialBlock.GetChunk(i), &coded_block[i * FEC_CHUNK_SIZE], FEC_CHUNK_SIZE);
+                    partialBlock.MarkChunkAvailable(i);
+                    partialBlock.DecodeTxnInChunk(i);
+                }
+            }
+            BOOST_REQUIRE(partialBlock.IsBlockAvailable());
+            BOOST_CHECK(partialBlock.FinalizeBlock() == READ_STATUS_OK);
+            BOOST_CHECK_EQUAL(block.hashMerkleRoot.ToString(), BlockMerkleRoot(*partialBlock.GetBlock(), &mutated).ToString());
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest) {
     BlockTransactionsRequest req1;
     req1.blockhash = InsecureRand256();
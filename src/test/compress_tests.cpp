@@ -417,6 +417,59 @@ BOOST_AUTO_TEST_CASE(compress_transaction_basic)
 
     round_trip_compress_transaction(outputm);
 }
+
+BOOST_AUTO_TEST_CASE(compress_transaction_in_block_prevout)
+{
+    CMutableTransaction parent;
+    parent.vin.resize(1);
+    parent.vin[0].prevout = COutPoint(InsecureRand256(), 1);
+    parent.vout.resize(2);
+    parent.vout[0].nValue = 1;
+    parent.vout[1].nValue = 2;
+
+    CMutableTransaction child;
+    child.vin.resize(2);
+    child.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+    child.vin[1].prevout = COutPoint(parent.GetHash(), 1);
+    child.vout.resize(1);
+    child.vout[0].nValue = 3;
+    const CTransaction child_tx(child);
+
+    // The parent at index 3 of a block, the child at index 5
+    CompressionBlockContext block_ctx(6);
+    block_ctx.SetTxid(3, parent.GetHash());
+    block_ctx.SetTxid(5, child_tx.GetHash());
+    block_ctx.BuildIndex();
+
+    CDataStream v1_stream(SER_NETWORK, PROTOCOL_VERSION);
+    v1_stream << CTxCompressor(child_tx, codec_version_t::v1, block_ctx, 5);
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << CTxCompressor(child_tx, codec_version_t::v2, block_ctx, 5);
+    // An InBlockRef for each input instead of the parent's txid
+    BOOST_CHECK_EQUAL(stream.size() + 32 - 2, v1_stream.size());
+
+    const CDataStream coded(stream);
+    CMutableTransaction ret;
+    stream >> CTxCompressor(ret, codec_version_t::v2, block_ctx, 5);
+    BOOST_CHECK(CTransaction(ret).GetHash() == child_tx.GetHash());
+
+    // The reference can't be resolved outside of the block, or from elsewhere in it
+    stream = coded;
+    BOOST_CHECK_THROW(stream >> CTxCompressor(ret, codec_version_t::v2), std::ios_base::failure);
+    stream = coded;
+    BOOST_CHECK_THROW(stream >> CTxCompressor(ret, codec_version_t::v2, block_ctx, 4), std::ios_base::failure);
+    stream = coded;
+    BOOST_CHECK_THROW(stream >> CTxCompressor(ret, codec_version_t::v1), std::runtime_error);
+
+    // Only earlier txn of the block are referred to, and outside of a block
+    // v2 is the same as v1
+    stream.clear();
+    stream << CTxCompressor(child_tx, codec_version_t::v2, block_ctx, 2);
+    BOOST_CHECK(stream.str() == v1_stream.str());
+    stream.clear();
+    stream << CTxCompressor(child_tx, codec_version_t::v2);
+    BOOST_CHECK(stream.str() == v1_stream.str());
+}
 /*
 BOOST_AUTO_TEST_CASE(compress_transaction_corpus)
 {
@@ -885,6 +938,17 @@ BOOST_AUTO_TEST_CASE(valid_pubkey)
         valtype broken = pubkey;
         broken[0] -= 0x2;
         BOOST_CHECK(!IsValidPubKey(broken));
+        BOOST_CHECK(!IsValidPubKey(broken, codec_version_t::v2));
+    }
+
+    {
+        // v2 codes compressed pubkeys without checking that they are on the curve
+        valtype offcurve(CPubKey::COMPRESSED_SIZE, 0xff);
+        offcurve[0] = 0x02;
+        BOOST_CHECK(!IsValidPubKey(offcurve));
+        BOOST_CHECK(IsValidPubKey(offcurve, codec_version_t::v2));
+        offcurve[0] = 0x04;
+        BOOST_CHECK(!IsValidPubKey(offcurve, codec_version_t::v2));
     }
 }
 
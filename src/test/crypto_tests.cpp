@@ -169,6 +169,15 @@ static void TestPoly1305(const std::string &hexmessage, const std::string &hexke
     tagres.resize(POLY1305_TAGLEN);
     poly1305_auth(tagres.data(), m.data(), m.size(), key.data());
     BOOST_CHECK(tag == tagres);
+
+    // The precomputed key must yield the same tag, also when reused
+    Poly1305Key key_state;
+    poly1305_key_init(key_state, key.data());
+    for (int i = 0; i < 2; i++) {
+        std::fill(tagres.begin(), tagres.end(), 0);
+        poly1305_auth(tagres.data(), m.data(), m.size(), key_state);
+        BOOST_CHECK(tag == tagres);
+    }
 }
 
 static void TestHKDF_SHA256_32(const std::string &ikm_hex, const std::string &salt_hex, const std::string &info_hex, const std::string &okm_check_hex) {
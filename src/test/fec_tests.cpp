@@ -3,6 +3,7 @@
 #include <memory>
 #include <sys/mman.h>
 #include <test/util/setup_common.h>
+#include <udpapi.h>
 #include <util/memory.h>
 #include <util/system.h>
 
@@ -14,7 +15,7 @@ constexpr size_t default_encoding_overhead = 10;
 
 struct FecTestingSetup : public BasicTestingSetup {
     /**
-     * The files generated within the partial_blocks directory during tests get
+     * The chunk arena generated within the partial_blocks directory during tests get
      * cleaned once the tests finish, but the directories stay. Thus, after a
      * while, "/tmp/test_common_Bitcoin Core" will be filled with useless empty
      * directories. The FecTestingSetup destructor runs after all the tests and
@@ -98,6 +99,11 @@ bool generate_encoded_chunks(size_t block_size, TestData& test_data, size_t n_ov
     return true;
 }
 
+static bool HasArenaObject(const std::string& key)
+{
+    return ChunkArena::Get()->FindObject(key) != -1;
+}
+
 static void check_chunk_equal(const void* p_chunk1, std::vector<unsigned char>& chunk2)
 {
     // Chunk1 is the chunk under test, whose size is always FEC_CHUNK_SIZE
@@ -269,29 +275,81 @@ BOOST_AUTO_TEST_CASE(fec_test_buildchunk_successful_cm256_encoder)
     BOOST_CHECK(generate_encoded_chunks(block_size, test_data));
 }
 
+BOOST_AUTO_TEST_CASE(fec_test_worker_pool)
+{
+    constexpr size_t n_uncoded_chunks = 200;
+    constexpr size_t n_encoded_chunks = n_uncoded_chunks + default_encoding_overhead;
+    std::vector<unsigned char> original_data(n_uncoded_chunks * FEC_CHUNK_SIZE - 7);
+    fill_with_random_data(original_data);
+
+    std::pair<std::unique_ptr<FECChunkType[]>, std::vector<uint32_t>>
+        block_fec_chunks(std::piecewise_construct,
+                         std::forward_as_tuple(new FECChunkType[n_encoded_chunks]),
+                         std::forward_as_tuple(n_encoded_chunks));
+    FECEncoder block_encoder(&original_data, &block_fec_chunks);
 
-void test_fecdecoder_filename_pattern(size_t data_size)
+    // Ranges are handed out in order and cover all chunks, whatever the
+    // number of workers
+    for (size_t n_workers : {0, 3}) {
+        FECWorkerPool pool(n_workers);
+        BOOST_CHECK_EQUAL(pool.GetWorkerCount(), n_workers);
+
+        std::vector<uint32_t> chunk_ids(n_encoded_chunks);
+        for (size_t i = 0; i < n_encoded_chunks; i++)
+            chunk_ids[i] = block_encoder.NextChunkId(i);
+        std::unique_ptr<FECChunkType[]> chunks(new FECChunkType[n_encoded_chunks]);
+        size_t next_chunk = 0;
+        BOOST_CHECK(pool.EncodeChunks(block_encoder, chunk_ids.data(), chunks.get(), n_encoded_chunks, 7,
+            [&](size_t begin, size_t end) {
+                BOOST_CHECK_EQUAL(begin, next_chunk);
+                BOOST_CHECK(end > begin && end - begin <= 7);
+                next_chunk = end;
+            }));
+        BOOST_CHECK_EQUAL(next_chunk, n_encoded_chunks);
+
+        // Each chunk is the same as when encoded serially
+        FECChunkType serial_chunk;
+        for (size_t i = 0; i < n_encoded_chunks; i++) {
+            BOOST_CHECK(block_encoder.EncodeChunk(chunk_ids[i], &serial_chunk));
+            BOOST_CHECK(memcmp(&serial_chunk, &chunks[i], FEC_CHUNK_SIZE) == 0);
+        }
+    }
+
+    // A parallel prefill produces FEC chunks which decode the original data
+    FECWorkerPool pool(3);
+    BOOST_CHECK(block_encoder.PrefillChunks(&pool));
+    FECDecoder decoder(original_data.size());
+    for (size_t i = 0; i < n_encoded_chunks && !decoder.DecodeReady(); i++) {
+        BOOST_CHECK(block_fec_chunks.second[i] >= n_uncoded_chunks);
+        decoder.ProvideChunk(&block_fec_chunks.first[i], block_fec_chunks.second[i]);
+    }
+    BOOST_REQUIRE(decoder.DecodeReady());
+    BOOST_CHECK(decoder.GetDecodedData() == original_data);
+}
+
+
+void test_fecdecoder_storage_key_pattern(size_t data_size)
 {
     // Object ID provided:
     {
         std::string obj_id = random_string();
         FECDecoder decoder(data_size, MemoryUsageMode::USE_MMAP, obj_id);
-        // filename should be set as "<obj_id>_<obj_size>"
-        BOOST_CHECK_MESSAGE(decoder.GetFileName().filename().c_str() == obj_id + "_" + std::to_string(data_size), data_size);
+        // storage key should be set as "<obj_id>_<obj_size>"
+        BOOST_CHECK_MESSAGE(decoder.GetStorageKey() == obj_id + "_" + std::to_string(data_size), data_size);
     }
     // Object ID not provided:
     {
         FECDecoder decoder(data_size, MemoryUsageMode::USE_MMAP);
-        // filename should be equal to the FECDecoder object's address
-        BOOST_CHECK_MESSAGE(decoder.GetFileName().filename().c_str() == std::to_string(std::uintptr_t(&decoder)), data_size);
+        // storage key should be equal to the FECDecoder object's address
+        BOOST_CHECK_MESSAGE(decoder.GetStorageKey() == std::to_string(std::uintptr_t(&decoder)), data_size);
     }
 }
 
-BOOST_AUTO_TEST_CASE(fec_test_fecdecoder_filename_pattern)
+BOOST_AUTO_TEST_CASE(fec_test_fecdecoder_storage_key_pattern)
 {
     std::vector<size_t> data_sizes{FEC_CHUNK_SIZE + 1, 2000, FEC_CHUNK_SIZE * 2, 1048576};
     for (const auto data_size : data_sizes) {
-        test_fecdecoder_filename_pattern(data_size);
+        test_fecdecoder_storage_key_pattern(data_size);
     }
 }
 
@@ -476,47 +534,47 @@ BOOST_AUTO_TEST_CASE(fec_test_providechunk_repetition)
     }
 }
 
-BOOST_AUTO_TEST_CASE(fec_test_creation_removal_chunk_file)
+BOOST_AUTO_TEST_CASE(fec_test_creation_removal_arena_object)
 {
-    fs::path filename;
+    std::string storage_key;
     {
-        // FECDecoder's constructor should create the file in the partial_blocks directory
+        // FECDecoder's constructor should create the object in the chunk arena
         FECDecoder decoder(10000, MemoryUsageMode::USE_MMAP);
-        filename = decoder.GetFileName();
-        BOOST_CHECK(fs::exists(filename));
-    } // When FECDecoder's destructor is called, it should remove the file
+        storage_key = decoder.GetStorageKey();
+        BOOST_CHECK(HasArenaObject(storage_key));
+    } // When FECDecoder's destructor is called, it should remove the object
 
-    BOOST_CHECK(!fs::exists(filename));
+    BOOST_CHECK(!HasArenaObject(storage_key));
 
     {
-        // Now construct the FECDecoder object with keep_mmap_file=true
-        FECDecoder decoder(10000, MemoryUsageMode::USE_MMAP, "" /* obj_id */, true /* keep_mmap_file */);
-        filename = decoder.GetFileName();
-        BOOST_CHECK(fs::exists(filename));
-    } // When FECDecoder's destructor is called, it should NOT remove the file
+        // Now construct the FECDecoder object with keep_mmap_storage=true
+        FECDecoder decoder(10000, MemoryUsageMode::USE_MMAP, "" /* obj_id */, true /* keep_mmap_storage */);
+        storage_key = decoder.GetStorageKey();
+        BOOST_CHECK(HasArenaObject(storage_key));
+    } // When FECDecoder's destructor is called, it should NOT remove the object
 
-    BOOST_CHECK(fs::exists(filename));
+    BOOST_CHECK(HasArenaObject(storage_key));
 }
 
-BOOST_AUTO_TEST_CASE(fec_test_chunk_file_stays_if_destructor_not_called)
+BOOST_AUTO_TEST_CASE(fec_test_arena_object_stays_if_destructor_not_called)
 {
-    fs::path filename;
+    std::string storage_key;
     {
         FECDecoder* decoder = new FECDecoder(10000, MemoryUsageMode::USE_MMAP);
-        filename = decoder->GetFileName();
-        BOOST_CHECK(fs::exists(filename));
+        storage_key = decoder->GetStorageKey();
+        BOOST_CHECK(HasArenaObject(storage_key));
     }
-    BOOST_CHECK(fs::exists(filename));
+    BOOST_CHECK(HasArenaObject(storage_key));
 }
 
-BOOST_AUTO_TEST_CASE(fec_test_filename_is_empty_in_memory_mode)
+BOOST_AUTO_TEST_CASE(fec_test_storage_key_is_empty_in_memory_mode)
 {
-    fs::path filename;
+    std::string storage_key;
 
-    // FECDecoder's constructor shouldn't intialize filename
+    // FECDecoder's constructor shouldn't intialize the storage key
     FECDecoder decoder(10000, MemoryUsageMode::USE_MEMORY);
-    filename = decoder.GetFileName();
-    BOOST_CHECK(filename.empty());
+    storage_key = decoder.GetStorageKey();
+    BOOST_CHECK(storage_key.empty());
 }
 
 BOOST_AUTO_TEST_CASE(fec_test_decoding_multiple_blocks_in_parallel)
@@ -576,7 +634,7 @@ BOOST_AUTO_TEST_CASE(fec_test_map_storage_initialized_correctly)
     generate_encoded_chunks(data_size, test_data);
     std::string obj_id = random_string();
     FECDecoder decoder_a(data_size, MemoryUsageMode::USE_MMAP, obj_id);
-    MapStorage map_storage_a(decoder_a.GetFileName(), decoder_a.GetChunkCount());
+    MapStorage map_storage_a(decoder_a.GetStorageKey(), decoder_a.GetChunkCount());
 
     bool initialized_fine = true;
     for (size_t i = 0; i < n_chunks; i++) {
@@ -591,15 +649,15 @@ BOOST_AUTO_TEST_CASE(fec_test_map_storage_initialized_correctly)
         decoder_a.ProvideChunk(test_data.encoded_chunks[i].data(), test_data.chunk_ids[i]);
     }
 
-    // A new decoder with the same filename (for example, a decoder created in
+    // A new decoder with the same storage key (for example, a decoder created in
     // recovery mode)
     FECDecoder decoder_b(data_size, MemoryUsageMode::USE_MMAP, obj_id);
-    BOOST_CHECK_EQUAL(decoder_a.GetFileName(), decoder_b.GetFileName());
+    BOOST_CHECK_EQUAL(decoder_a.GetStorageKey(), decoder_b.GetStorageKey());
     BOOST_CHECK_EQUAL(decoder_a.GetChunkCount(), decoder_b.GetChunkCount());
 
     // The expectation is that the new decoder does not reset the values (chunk
-    // data and id) that are already stored in the file
-    MapStorage map_storage_b(decoder_b.GetFileName(), decoder_b.GetChunkCount());
+    // data and id) that are already stored in the arena
+    MapStorage map_storage_b(decoder_b.GetStorageKey(), decoder_b.GetChunkCount());
     bool stored_items_untouched = true;
     for (size_t i = 0; i < n_chunks - 1; i++) {
         if (CHUNK_ID_IS_NOT_SET(map_storage_b.GetChunkId(i)) || *map_storage_b.GetChunk(i) == '\0') {
@@ -619,27 +677,27 @@ BOOST_AUTO_TEST_CASE(fec_test_map_storage_recoverable)
     std::string obj_id = random_string();
     FECDecoder decoder(data_size, MemoryUsageMode::USE_MMAP, obj_id);
     {
-        MapStorage map_storage(decoder.GetFileName(), decoder.GetChunkCount(), true);
+        MapStorage map_storage(decoder.GetStorageKey(), decoder.GetChunkCount(), true);
         BOOST_CHECK(!map_storage.IsRecoverable());
     }
 
     decoder.ProvideChunk(test_data.encoded_chunks[0].data(), test_data.chunk_ids[0]);
     {
-        MapStorage map_storage(decoder.GetFileName(), decoder.GetChunkCount(), true);
+        MapStorage map_storage(decoder.GetStorageKey(), decoder.GetChunkCount(), true);
         BOOST_CHECK(map_storage.IsRecoverable());
     }
 
     {
-        MapStorage map_storage(decoder.GetFileName(), decoder.GetChunkCount());
+        MapStorage map_storage(decoder.GetStorageKey(), decoder.GetChunkCount());
         // When MapStorage is not instantiated with create=true, the IsRecoverable always returns false
         BOOST_CHECK(!map_storage.IsRecoverable());
     }
 }
 
-// checks if the chunk ids stored in the filename match the ids in the expected_chunk_ids vector
+// checks if the chunk ids stored in the arena match the ids in the expected_chunk_ids vector
 void check_stored_chunk_ids(const FECDecoder& decoder, const std::vector<uint32_t>& expected_chunk_ids)
 {
-    MapStorage map_storage(decoder.GetFileName(), decoder.GetChunkCount());
+    MapStorage map_storage(decoder.GetStorageKey(), decoder.GetChunkCount());
     std::vector<uint32_t> stored_chunk_ids;
 
     for (size_t i = 0; i < decoder.GetChunksRcvd(); i++) {
@@ -694,7 +752,7 @@ BOOST_AUTO_TEST_CASE(fec_test_map_storage_insert)
     fill_with_random_data(test_data_c);
 
     FECDecoder decoder(FEC_CHUNK_SIZE * 5, MemoryUsageMode::USE_MMAP);
-    MapStorage map_storage(decoder.GetFileName(), decoder.GetChunkCount());
+    MapStorage map_storage(decoder.GetStorageKey(), decoder.GetChunkCount());
 
     // Insert into consequtive indexes
     map_storage.Insert(test_data_a.data(), 1, 0);
@@ -739,6 +797,162 @@ BOOST_AUTO_TEST_CASE(fec_test_map_storage_insert)
     }
 }
 
+BOOST_AUTO_TEST_CASE(fec_test_chunk_arena_recovery)
+{
+    fs::path path = GetDataDir() / "arena_test" / "chunk_arena";
+    std::vector<unsigned char> chunk(FEC_CHUNK_SIZE);
+    fill_with_random_data(chunk);
+    const size_t n_chunks = 3 * CHUNK_ARENA_SLAB_CHUNKS + 1;
+    const uint64_t arena_size = 8 * CHUNK_ARENA_SLAB_CHUNKS * FEC_CHUNK_SIZE;
+    {
+        ChunkArena arena(path, arena_size);
+        int kept = arena.CreateObject("kept", n_chunks);
+        int removed = arena.CreateObject("removed", n_chunks);
+        for (size_t i = 0; i < n_chunks; i++) {
+            memcpy(arena.GetChunk(kept, i), chunk.data(), FEC_CHUNK_SIZE);
+            arena.SetChunkId(kept, i, i);
+        }
+        // Slabs are only taken for the chunk slots in use
+        BOOST_CHECK(CHUNK_ID_IS_NOT_SET(arena.GetChunkId(removed, 0)));
+        BOOST_CHECK_EQUAL(arena.SlabsInUse(), 4U);
+        arena.GetChunk(removed, n_chunks - 1);
+        BOOST_CHECK_EQUAL(arena.SlabsInUse(), 5U);
+        arena.RemoveObject("removed");
+        BOOST_CHECK_EQUAL(arena.SlabsInUse(), 4U);
+        BOOST_CHECK(arena.RenameObject("kept", "renamed"));
+        BOOST_CHECK(!arena.RenameObject("kept", "renamed"));
+    }
+
+    // Reopening the arena rebuilds the objects from the index in the file
+    {
+        ChunkArena arena(path, arena_size);
+        BOOST_CHECK(arena.GetObjectKeys() == std::vector<std::string>{"renamed"});
+        BOOST_CHECK_EQUAL(arena.FindObject("kept"), -1);
+        BOOST_CHECK_EQUAL(arena.SlabsInUse(), 4U);
+        int obj = arena.FindObject("renamed");
+        BOOST_REQUIRE(obj != -1);
+        bool recovered = true;
+        for (size_t i = 0; i < n_chunks; i++) {
+            if (arena.GetChunkId(obj, i) != i || memcmp(arena.GetChunk(obj, i), chunk.data(), FEC_CHUNK_SIZE) != 0) {
+                recovered = false;
+                break;
+            }
+        }
+        BOOST_CHECK(recovered);
+
+        // An object of a different size under the same key starts out empty
+        int resized = arena.CreateObject("renamed", n_chunks + 1);
+        BOOST_CHECK_EQUAL(arena.SlabsInUse(), 0U);
+        BOOST_CHECK(CHUNK_ID_IS_NOT_SET(arena.GetChunkId(resized, 0)));
+
+        // The arena holds as many slabs as fit in its size
+        int big = arena.CreateObject("big", 9 * CHUNK_ARENA_SLAB_CHUNKS);
+        for (size_t i = 0; i < 8; i++)
+            BOOST_CHECK(arena.GetChunk(big, i * CHUNK_ARENA_SLAB_CHUNKS) != nullptr);
+        BOOST_CHECK(arena.GetChunk(big, 8 * CHUNK_ARENA_SLAB_CHUNKS) == nullptr);
+    }
+
+    // An arena reopened with a different size starts out empty
+    {
+        ChunkArena arena(path, 2 * arena_size);
+        BOOST_CHECK(arena.GetObjectKeys().empty());
+        BOOST_CHECK_EQUAL(arena.SlabsInUse(), 0U);
+    }
+    BOOST_CHECK_THROW(ChunkArena(path, FEC_CHUNK_SIZE), std::runtime_error);
+
+    // Decoders hand their slabs back when destroyed
+    const size_t slabs_in_use = ChunkArena::Get()->SlabsInUse();
+    {
+        TestData test_data;
+        size_t data_size = FEC_CHUNK_SIZE * n_chunks;
+        generate_encoded_chunks(data_size, test_data, default_encoding_overhead);
+        FECDecoder decoder(data_size, MemoryUsageMode::USE_MMAP);
+        for (size_t i = 0; i < test_data.encoded_chunks.size(); i++) {
+            decoder.ProvideChunk(test_data.encoded_chunks[i].data(), test_data.chunk_ids[i]);
+        }
+        BOOST_CHECK(decoder.DecodeReady());
+        BOOST_CHECK_EQUAL(ChunkArena::Get()->SlabsInUse(), slabs_in_use + 4);
+    }
+    BOOST_CHECK_EQUAL(ChunkArena::Get()->SlabsInUse(), slabs_in_use);
+}
+
+BOOST_AUTO_TEST_CASE(fec_test_chunk_arena_detach)
+{
+    const std::shared_ptr<ChunkArena> arena = ChunkArena::Get();
+    const size_t objects_in_use = arena->ObjectsInUse();
+    const size_t slabs_in_use = arena->SlabsInUse();
+    TestData test_data;
+    const size_t data_size = FEC_CHUNK_SIZE * (2 * CHUNK_ARENA_SLAB_CHUNKS);
+    generate_encoded_chunks(data_size, test_data, default_encoding_overhead);
+    const size_t n_half = test_data.encoded_chunks.size() / 2;
+
+    {
+        FECDecoder decoder(data_size, MemoryUsageMode::USE_MMAP, "detached", true /* persist */);
+        for (size_t i = 0; i < n_half; i++)
+            decoder.ProvideChunk(test_data.encoded_chunks[i].data(), test_data.chunk_ids[i]);
+
+        // A removed object is no longer found, and a new one under the same key
+        // starts out empty
+        decoder.RemoveMmapStorage();
+        BOOST_CHECK_EQUAL(arena->FindObject(decoder.GetStorageKey()), -1);
+        BOOST_CHECK_EQUAL(arena->ObjectsInUse(), objects_in_use + 1);
+        {
+            FECDecoder other(data_size, MemoryUsageMode::USE_MMAP, "detached", true /* persist */);
+            BOOST_CHECK_EQUAL(other.GetChunksRcvd(), 0U);
+            BOOST_CHECK_EQUAL(arena->ObjectsInUse(), objects_in_use + 2);
+            other.RemoveMmapStorage();
+        }
+        BOOST_CHECK_EQUAL(arena->ObjectsInUse(), objects_in_use + 1);
+
+        // The decoder keeps its chunks until destroyed
+        for (size_t i = n_half; i < test_data.encoded_chunks.size() && !decoder.DecodeReady(); i++)
+            decoder.ProvideChunk(test_data.encoded_chunks[i].data(), test_data.chunk_ids[i]);
+        BOOST_REQUIRE(decoder.DecodeReady());
+        BOOST_CHECK(decoder.GetDecodedData() == test_data.original_data);
+    }
+    BOOST_CHECK_EQUAL(arena->ObjectsInUse(), objects_in_use);
+    BOOST_CHECK_EQUAL(arena->SlabsInUse(), slabs_in_use);
+
+    // Out of object slots, decoders fall back to memory
+    size_t n_created = 0;
+    while (arena->CreateObject("filler_" + std::to_string(n_created), 1) != -1)
+        n_created++;
+    BOOST_CHECK(n_created > 0);
+    {
+        FECDecoder decoder(data_size, MemoryUsageMode::USE_MMAP, "no_slot", true /* persist */);
+        BOOST_CHECK(decoder.GetStorageKey().empty());
+        for (size_t i = 0; i < test_data.encoded_chunks.size() && !decoder.DecodeReady(); i++)
+            decoder.ProvideChunk(test_data.encoded_chunks[i].data(), test_data.chunk_ids[i]);
+        BOOST_REQUIRE(decoder.DecodeReady());
+        BOOST_CHECK(decoder.GetDecodedData() == test_data.original_data);
+    }
+    for (size_t i = 0; i < n_created; i++)
+        arena->RemoveObject("filler_" + std::to_string(i));
+    BOOST_CHECK_EQUAL(arena->ObjectsInUse(), objects_in_use);
+}
+
+BOOST_AUTO_TEST_CASE(fec_test_chunk_arena_disabled)
+{
+    TestData test_data;
+    const size_t data_size = FEC_CHUNK_SIZE * (2 * CHUNK_ARENA_SLAB_CHUNKS);
+    generate_encoded_chunks(data_size, test_data, default_encoding_overhead);
+
+    // Without an arena, decoders keep their chunks in memory
+    ChunkArena::SetDataSize(0);
+    BOOST_CHECK(!ChunkArena::Get());
+    {
+        FECDecoder decoder(data_size, MemoryUsageMode::USE_MMAP, "no_arena", true /* persist */);
+        BOOST_CHECK(decoder.GetStorageKey().empty());
+        for (size_t i = 0; i < test_data.encoded_chunks.size() && !decoder.DecodeReady(); i++)
+            decoder.ProvideChunk(test_data.encoded_chunks[i].data(), test_data.chunk_ids[i]);
+        BOOST_REQUIRE(decoder.DecodeReady());
+        BOOST_CHECK(decoder.GetDecodedData() == test_data.original_data);
+    }
+
+    ChunkArena::SetDataSize(uint64_t{DEFAULT_UDP_CHUNK_ARENA_SIZE} << 20);
+    BOOST_CHECK(ChunkArena::Get());
+}
+
 void test_decoding_getdataptr(size_t n_uncoded_chunks, MemoryUsageMode memory_usage_mode)
 {
     std::ostringstream check_msg;
@@ -788,50 +1002,84 @@ BOOST_AUTO_TEST_CASE(fec_test_decoding_getdataptr)
     }
 }
 
+BOOST_AUTO_TEST_CASE(fec_test_cm256_slab_reuse)
+{
+    // Decoders of consecutive objects reuse the (dirty) chunk slabs of the
+    // ones before them, which must not leak into the decoded data. The chunk
+    // counts cover slabs of all size classes, at and below their capacity.
+    const std::vector<size_t> chunk_counts{CM256_MAX_CHUNKS, CM256_MAX_CHUNKS - 1, 16, 9, 8, 5, 4, 3, 2};
+    for (const auto memory_usage_mode : memory_usage_modes) {
+        for (size_t round = 0; round < chunk_counts.size(); round++) {
+            size_t n_uncoded_chunks = chunk_counts[round];
+            size_t data_size = FEC_CHUNK_SIZE * n_uncoded_chunks - round;
+            TestData test_data;
+            BOOST_CHECK(generate_encoded_chunks(data_size, test_data, n_uncoded_chunks));
+
+            // Provide the FEC chunks first so that decoding is not a copy
+            FECDecoder decoder(data_size, memory_usage_mode);
+            for (size_t i = test_data.encoded_chunks.size(); i > 0 && !decoder.DecodeReady(); i--) {
+                decoder.ProvideChunk(test_data.encoded_chunks[i - 1].data(), test_data.chunk_ids[i - 1]);
+            }
+            BOOST_CHECK(decoder.DecodeReady());
+
+            // In mmap mode, the slab is handed back after GetDataPtrDone and
+            // taken again on the next GetDataPtr
+            for (size_t pass = 0; pass < 2; pass++) {
+                std::vector<unsigned char> decoded_data(n_uncoded_chunks * FEC_CHUNK_SIZE);
+                for (size_t i = 0; i < n_uncoded_chunks; i++)
+                    memcpy(&decoded_data[i * FEC_CHUNK_SIZE], decoder.GetDataPtr(i), FEC_CHUNK_SIZE);
+                decoder.GetDataPtrDone();
+                BOOST_CHECK_EQUAL_COLLECTIONS(decoded_data.begin(), decoded_data.begin() + data_size,
+                                              test_data.original_data.begin(), test_data.original_data.end());
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(fec_test_decoder_move_assignment_operator)
 {
     {
         // - both decoders without obj_id
-        // - decoder1 constructed in mmap mode (gets a filename)
-        // - decoder2 default-constructed (without a filename)
+        // - decoder1 constructed in mmap mode (gets a storage key)
+        // - decoder2 default-constructed (without a storage key)
         FECDecoder decoder1(5000, MemoryUsageMode::USE_MMAP);
-        auto filename1 = decoder1.GetFileName();
+        auto key1 = decoder1.GetStorageKey();
         FECDecoder decoder2;
         decoder2 = std::move(decoder1);
-        // Given that decoder2 did not have a filename originally, its filename
-        // becomes filename1 after the move assignment.
-        BOOST_CHECK_EQUAL(filename1, decoder2.GetFileName());
-        BOOST_CHECK(fs::exists(decoder2.GetFileName()));
+        // Given that decoder2 did not have a storage key originally, its key
+        // becomes key1 after the move assignment.
+        BOOST_CHECK_EQUAL(key1, decoder2.GetStorageKey());
+        BOOST_CHECK(HasArenaObject(decoder2.GetStorageKey()));
     }
     {
         // - decoder1 with obj_id, decoder2 without it
-        // - decoder1 constructed in mmap mode (gets a filename)
-        // - decoder2 default-constructed (without a filename)
+        // - decoder1 constructed in mmap mode (gets a storage key)
+        // - decoder2 default-constructed (without a storage key)
         std::string obj_id = random_string();
         FECDecoder decoder1(5000, MemoryUsageMode::USE_MMAP, obj_id);
-        auto filename1 = decoder1.GetFileName();
+        auto key1 = decoder1.GetStorageKey();
         FECDecoder decoder2;
         decoder2 = std::move(decoder1);
-        // Again, because decoder2 was default-constructed, its filename becomes
+        // Again, because decoder2 was default-constructed, its key becomes
         // that of the moved object (decoder1).
-        BOOST_CHECK_EQUAL(filename1, decoder2.GetFileName());
-        BOOST_CHECK(fs::exists(decoder2.GetFileName()));
+        BOOST_CHECK_EQUAL(key1, decoder2.GetStorageKey());
+        BOOST_CHECK(HasArenaObject(decoder2.GetStorageKey()));
     }
     {
         // - both decoders constructed in mmap mode with an obj_id
         FECDecoder decoder1(5000, MemoryUsageMode::USE_MMAP, "1234_body");
-        auto filename1 = decoder1.GetFileName();
+        auto key1 = decoder1.GetStorageKey();
         FECDecoder decoder2(4000, MemoryUsageMode::USE_MMAP, "5678_body");
-        auto filename2 = decoder2.GetFileName();
+        auto key2 = decoder2.GetStorageKey();
         decoder2 = std::move(decoder1);
-        // In this case, decoder2 does have a filename originally. Thus, after
-        // the move assignment, the file pointed by filename1 gets moved into
-        // decoder2 and renamed as filename2. Meanwhile, the original filename2
-        // is destroyed and only its name is preserved, although now with the
-        // contents of filename1.
-        BOOST_CHECK(!fs::exists(filename1));
-        BOOST_CHECK(fs::exists(filename2));
-        BOOST_CHECK_EQUAL(filename2, decoder2.GetFileName());
+        // In this case, decoder2 does have a storage key originally. Thus,
+        // after the move assignment, the arena object named key1 gets moved
+        // into decoder2 and renamed as key2. Meanwhile, the original key2
+        // object is destroyed and only its name is preserved, although now
+        // with the contents of key1.
+        BOOST_CHECK(!HasArenaObject(key1));
+        BOOST_CHECK(HasArenaObject(key2));
+        BOOST_CHECK_EQUAL(key2, decoder2.GetStorageKey());
     }
     {
         // - decoder1 default-constructed
@@ -839,12 +1087,12 @@ BOOST_AUTO_TEST_CASE(fec_test_decoder_move_assignment_operator)
         FECDecoder decoder1;
         std::string obj_id = random_string();
         FECDecoder decoder2(5000, MemoryUsageMode::USE_MMAP, obj_id);
-        auto filename2 = decoder2.GetFileName();
+        auto key2 = decoder2.GetStorageKey();
         decoder2 = std::move(decoder1);
-        // In this case, decoder1 does not own a file. Hence, the move
-        // assignment operator does not apply any file renaming. Ultimately,
-        // decoder2's filename should be preserved after the move.
-        BOOST_CHECK_EQUAL(filename2, decoder2.GetFileName());
+        // In this case, decoder1 does not own an arena object. Hence, the move
+        // assignment operator does not apply any renaming. Ultimately,
+        // decoder2's storage key should be preserved after the move.
+        BOOST_CHECK_EQUAL(key2, decoder2.GetStorageKey());
     }
     {
         // - decoder1 constructed in memory mode
@@ -852,7 +1100,7 @@ BOOST_AUTO_TEST_CASE(fec_test_decoder_move_assignment_operator)
         FECDecoder decoder1(5000, MemoryUsageMode::USE_MEMORY);
         FECDecoder decoder2;
         BOOST_CHECK_NO_THROW(decoder2 = std::move(decoder1));
-        // no checks required, as there is no files. just make sure = operator
+        // no checks required, as there are no arena objects. just make sure = operator
         // does not throw.
     }
 }
@@ -917,6 +1165,62 @@ BOOST_AUTO_TEST_CASE(fec_test_decode_using_moved_decoder)
     }
 }
 
+/**
+ * Decode wirehair-coded data from every other original chunk plus FEC chunks,
+ * then recover the missing chunks in parallel with RecoverChunk and check them
+ * against GetDataPtr and the original data.
+ */
+void test_recover_chunks(size_t n_uncoded_chunks)
+{
+    TestData test_data;
+    const size_t data_size = FEC_CHUNK_SIZE * n_uncoded_chunks - 100;
+    BOOST_REQUIRE(generate_encoded_chunks(data_size, test_data, n_uncoded_chunks / 2 + default_encoding_overhead));
+
+    FECDecoder decoder(data_size, MemoryUsageMode::USE_MEMORY);
+    BOOST_CHECK(decoder.UsesWirehair());
+    std::vector<uint32_t> missing;
+    for (uint32_t i = 0; i < n_uncoded_chunks; i++) {
+        if (i % 2) {
+            missing.push_back(i);
+            continue;
+        }
+        std::vector<unsigned char> chunk(FEC_CHUNK_SIZE);
+        memcpy(chunk.data(), &test_data.original_data[i * FEC_CHUNK_SIZE], std::min<size_t>(FEC_CHUNK_SIZE, data_size - i * FEC_CHUNK_SIZE));
+        BOOST_CHECK(decoder.ProvideChunk(chunk.data(), i));
+    }
+    for (size_t i = 0; i < test_data.encoded_chunks.size() && !decoder.DecodeReady(); i++) {
+        BOOST_CHECK(decoder.ProvideChunk(test_data.encoded_chunks[i].data(), test_data.chunk_ids[i]));
+    }
+    BOOST_REQUIRE(decoder.DecodeReady());
+
+    std::unique_ptr<FECChunkType[]> recovered(new FECChunkType[missing.size()]);
+    FECWorkerPool pool(3);
+    BOOST_CHECK(pool.Run(missing.size(), 7, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++) {
+            if (!decoder.RecoverChunk(missing[k], &recovered[k]))
+                return false;
+        }
+        return true;
+    }, nullptr));
+
+    for (size_t k = 0; k < missing.size(); k++) {
+        const size_t offset = missing[k] * FEC_CHUNK_SIZE;
+        const size_t len = std::min<size_t>(FEC_CHUNK_SIZE, data_size - offset);
+        BOOST_CHECK(memcmp(&recovered[k], &test_data.original_data[offset], len) == 0);
+        BOOST_CHECK(memcmp(&recovered[k], decoder.GetDataPtr(missing[k]), len) == 0);
+        // The final chunk is zero-padded
+        for (size_t j = len; j < FEC_CHUNK_SIZE; j++)
+            BOOST_CHECK_EQUAL(((const unsigned char*)&recovered[k])[j], 0);
+    }
+    decoder.GetDataPtrDone();
+}
+
+BOOST_AUTO_TEST_CASE(fec_test_recover_chunks)
+{
+    test_recover_chunks(CM256_MAX_CHUNKS + 2);
+    test_recover_chunks(1000);
+}
+
 /**
  * Test helper funtion for testing recovery of FECDecoder
  * @param[in] n_uncoded_chunks     number of uncoded chunk to be generated
@@ -947,7 +1251,7 @@ void recovery_test(size_t n_uncoded_chunks, size_t n_overhead_chunks, size_t abo
     }
 
     /// Assume the application was aborted here *******
-    /// The file is left on the disk but the decoding is not finished yet
+    /// The arena object is left on the disk but the decoding is not finished yet
 
     // try to recover the data on disk first, and continue decoding with second_decoder
     FECDecoder second_decoder(data_size, MemoryUsageMode::USE_MMAP, obj_id);
@@ -1000,15 +1304,15 @@ void test_fecdecoder_recovery_after_decoding(size_t n_uncoded_chunks)
     // This test case tests the situation in which the mmap-mode decoder has all
     // the chunks and proceeds with the decoding, but for some reason the
     // application exits before the decoded data is used and, more importantly,
-    // before the corresponding mmaped file is removed from disk. For example,
-    // this scenario can arise in udprelay.cpp when the header object is
-    // decodable but the application closes before the associated body object
-    // becomes decodable. In this case, the header mmap file would remain in
-    // disk because udprelay.cpp only removes the header file when the body
-    // object also becomes decodable.
+    // before the corresponding chunk arena object is removed from disk. For
+    // example, this scenario can arise in udprelay.cpp when the header object
+    // is decodable but the application closes before the associated body
+    // object becomes decodable. In this case, the header arena object would
+    // remain in disk because udprelay.cpp only removes the header object when
+    // the body object also becomes decodable.
     //
     // As a result, on the next run, there will be another attempt to decode the
-    // same chunks from the recovered mmap file. In this case, the fact that the
+    // same chunks from the recovered arena object. In this case, the fact that the
     // previous session already decoded the data once should not prevent the
     // recoverability of the chunks on the subsequent session.
 
@@ -1021,7 +1325,7 @@ void test_fecdecoder_recovery_after_decoding(size_t n_uncoded_chunks)
 
     // First session
     {
-        FECDecoder decoder(data_size, MemoryUsageMode::USE_MMAP, obj_id, true /* keep_mmap_file */);
+        FECDecoder decoder(data_size, MemoryUsageMode::USE_MMAP, obj_id, true /* keep_mmap_storage */);
 
         for (size_t i = 0; i < n_encoded_chunks; i++) {
             decoder.ProvideChunk(test_data.encoded_chunks[i].data(), test_data.chunk_ids[i]);
@@ -10,6 +10,12 @@
 
 #include <boost/test/unit_test.hpp>
 
+#include <vector>
+
+#if defined(HAVE_CONFIG_H)
+#include <config/bitcoin-config.h>
+#endif
+
 BOOST_FIXTURE_TEST_SUITE(hash_tests, BasicTestingSetup)
 
 BOOST_AUTO_TEST_CASE(murmurhash3)
@@ -145,6 +151,27 @@ BOOST_AUTO_TEST_CASE(siphash)
         BOOST_CHECK_EQUAL(SipHashUint256(k1, k2, x), sip256.Finalize());
         BOOST_CHECK_EQUAL(SipHashUint256Extra(k1, k2, x, n), sip288.Finalize());
     }
+
+    // Check consistency between SipHashUint256Batch and SipHashUint256, for
+    // counts which do and do not fill whole batch lanes.
+    for (size_t count = 0; count < 19; ++count) {
+        uint64_t k1 = ctx.rand64();
+        uint64_t k2 = ctx.rand64();
+        std::vector<uint256> vals(count);
+        for (uint256& val : vals) val = InsecureRand256();
+        std::vector<uint64_t> out(count);
+        SipHashUint256Batch(k1, k2, vals.data(), out.data(), count);
+        for (size_t i = 0; i < count; ++i) {
+            BOOST_CHECK_EQUAL(out[i], SipHashUint256(k1, k2, vals[i]));
+        }
+    }
+
+    // The batch must be hashed in AVX2 lanes wherever the CPU supports it
+#if defined(ENABLE_AVX2) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+    if (__builtin_cpu_supports("avx2")) {
+        BOOST_CHECK_EQUAL(SipHashUint256BatchImplementation(), "avx2(4way)");
+    }
+#endif
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -1,8 +1,10 @@
 #include <boost/test/unit_test.hpp>
 #include <iostream>
+#include <memory>
 #include <ringbuffer.h>
 #include <test/util/setup_common.h>
 #include <thread>
+#include <vector>
 namespace tt = boost::test_tools;
 
 BOOST_FIXTURE_TEST_SUITE(ringbuffer_tests, BasicTestingSetup)
@@ -178,4 +180,159 @@ BOOST_AUTO_TEST_CASE(test_ringbuffer_stats)
     BOOST_CHECK(stats.rd_count == n_elem);
 }
 
+BOOST_AUTO_TEST_CASE(test_ringbuffer_batch_read_proxy)
+{
+    const int n_elem = 10;
+    RingBuffer<int> buffer;
+
+    for (int i = 0; i < n_elem; i++) {
+        buffer.WriteElement([&](int& elem) {
+            elem = i;
+        });
+    }
+
+    int* objs[n_elem];
+
+    // Read a batch, but do not confirm it
+    {
+        BatchReadProxy<int> rd_proxy(&buffer, objs, 4);
+        BOOST_CHECK(rd_proxy.Size() == 4);
+        for (size_t i = 0; i < rd_proxy.Size(); i++)
+            BOOST_CHECK(*rd_proxy[i] == (int)i);
+        // When the read proxy object is destructed, it aborts the read
+    }
+
+    // Read a batch and confirm only part of it
+    {
+        BatchReadProxy<int> rd_proxy(&buffer, objs, 4);
+        BOOST_CHECK(rd_proxy.Size() == 4);
+        rd_proxy.ConfirmRead(3, 3 * sizeof(int));
+        BOOST_CHECK(rd_proxy.Size() == 0);
+    }
+
+    // The batch size is limited by the buffer occupancy
+    BatchReadProxy<int> rd_proxy(&buffer, objs, n_elem);
+    BOOST_CHECK(rd_proxy.Size() == n_elem - 3);
+    BOOST_CHECK(*rd_proxy[0] == 3);
+    rd_proxy.ConfirmRead(rd_proxy.Size(), (n_elem - 3) * sizeof(int));
+    BOOST_CHECK(buffer.IsEmpty());
+
+    const RingBufferStats& stats = buffer.GetStats();
+    BOOST_CHECK(stats.rd_bytes == (n_elem * sizeof(int)));
+    BOOST_CHECK(stats.rd_count == n_elem);
+}
+
+BOOST_AUTO_TEST_CASE(test_mpsc_ringbuffer_read_proxy)
+{
+    const int n_elem = 10;
+    std::unique_ptr<MPSCRingBuffer<int>> buffer(new MPSCRingBuffer<int>());
+    BOOST_CHECK(buffer->IsEmpty());
+    BOOST_CHECK_THROW(buffer->GetNextRead(), std::runtime_error);
+
+    for (int i = 0; i < n_elem; i++) {
+        buffer->WriteElement([&](int& elem) {
+            elem = i;
+        });
+    }
+    BOOST_CHECK(!buffer->IsEmpty());
+
+    // Read element, but do not confirm the read
+    {
+        ReadProxy<int, MPSCRingBuffer<int>> rd_proxy(buffer.get());
+        BOOST_CHECK(*rd_proxy.GetObj() == 0);
+    }
+
+    // Read it again and confirm
+    {
+        ReadProxy<int, MPSCRingBuffer<int>> rd_proxy(buffer.get());
+        BOOST_CHECK(*rd_proxy.GetObj() == 0);
+        rd_proxy.ConfirmRead(sizeof(int));
+        BOOST_CHECK(rd_proxy.GetObj() == nullptr);
+    }
+
+    int* objs[n_elem];
+
+    // Read a batch and confirm only part of it
+    {
+        BatchReadProxy<int, MPSCRingBuffer<int>> rd_proxy(buffer.get(), objs, 4);
+        BOOST_CHECK(rd_proxy.Size() == 4);
+        BOOST_CHECK(*rd_proxy[0] == 1);
+        rd_proxy.ConfirmRead(3, 3 * sizeof(int));
+    }
+
+    // The batch size is limited by the buffer occupancy
+    BatchReadProxy<int, MPSCRingBuffer<int>> rd_proxy(buffer.get(), objs, n_elem);
+    BOOST_CHECK(rd_proxy.Size() == n_elem - 4);
+    BOOST_CHECK(*rd_proxy[0] == 4);
+    rd_proxy.ConfirmRead(rd_proxy.Size(), (n_elem - 4) * sizeof(int));
+    BOOST_CHECK(buffer->IsEmpty());
+
+    const RingBufferStats stats = buffer->GetStats();
+    BOOST_CHECK(stats.rd_bytes == (n_elem * sizeof(int)));
+    BOOST_CHECK(stats.rd_count == n_elem);
+}
+
+BOOST_AUTO_TEST_CASE(test_mpsc_ringbuffer_write_abort)
+{
+    std::unique_ptr<MPSCRingBuffer<int>> buffer(new MPSCRingBuffer<int>());
+
+    // On a thread, try to write more elements than the buffer can hold
+    std::thread t1([&] {
+        bool wr_success = true;
+        for (size_t i = 0; i < (BUFF_DEPTH + 1); i++) {
+            wr_success = buffer->WriteElement([&](int& elem) {
+                elem = i;
+            });
+        }
+        // The last write should have been aborted (failed)
+        BOOST_CHECK(!wr_success);
+    });
+
+    while (!buffer->IsFull()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    buffer->AbortWrite();
+    t1.join();
+}
+
+BOOST_AUTO_TEST_CASE(test_mpsc_ringbuffer_multiple_writers)
+{
+    // Several writers overflow the buffer while a single reader drains it
+    const int n_writers = 4;
+    const int n_per_writer = 3 * BUFF_DEPTH;
+    std::unique_ptr<MPSCRingBuffer<std::pair<int, int>>> buffer(new MPSCRingBuffer<std::pair<int, int>>());
+
+    std::vector<std::thread> writers;
+    for (int w = 0; w < n_writers; w++) {
+        writers.emplace_back([&, w] {
+            for (int i = 0; i < n_per_writer; i++) {
+                buffer->WriteElement([&](std::pair<int, int>& elem) {
+                    elem = std::make_pair(w, i);
+                });
+            }
+        });
+    }
+
+    // Elements of each writer must be read in order, and none may be lost
+    std::vector<int> next(n_writers, 0);
+    std::vector<std::pair<int, int>*> objs(64);
+    int n_read = 0;
+    while (n_read < n_writers * n_per_writer) {
+        if (buffer->IsEmpty())
+            continue;
+        BatchReadProxy<std::pair<int, int>, MPSCRingBuffer<std::pair<int, int>>> rd_proxy(buffer.get(), objs.data(), objs.size());
+        for (size_t i = 0; i < rd_proxy.Size(); i++) {
+            BOOST_REQUIRE(rd_proxy[i]->second == next[rd_proxy[i]->first]);
+            next[rd_proxy[i]->first]++;
+        }
+        n_read += rd_proxy.Size();
+        rd_proxy.ConfirmRead(rd_proxy.Size());
+    }
+
+    for (std::thread& t : writers)
+        t.join();
+    BOOST_CHECK(buffer->IsEmpty());
+    BOOST_CHECK(buffer->GetStats().rd_count == (uint64_t)n_writers * n_per_writer);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
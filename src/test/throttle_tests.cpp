@@ -86,4 +86,64 @@ BOOST_AUTO_TEST_CASE(test_quota_wait_estimate)
     }
 }
 
+BOOST_AUTO_TEST_CASE(test_token_bucket)
+{
+    const auto t0 = std::chrono::steady_clock::now();
+    TokenBucket bucket;
+    bucket.SetRate(1000, 500, t0);
+
+    // Start empty and accumulate tokens without rounding
+    BOOST_CHECK(!bucket.HasTokens(1, t0));
+    BOOST_CHECK(bucket.HasTokens(250, t0 + std::chrono::milliseconds(250)));
+    BOOST_CHECK(!bucket.HasTokens(251, t0 + std::chrono::milliseconds(250)));
+
+    // The wait for tokens is exact
+    BOOST_CHECK(bucket.TimeUntil(300, t0 + std::chrono::milliseconds(250)) == std::chrono::milliseconds(50));
+    BOOST_CHECK(bucket.TimeUntil(200, t0 + std::chrono::milliseconds(250)) == std::chrono::nanoseconds(0));
+
+    // Tokens are capped at the depth of the bucket, which is also the longest
+    // wait for any number of tokens
+    BOOST_CHECK(!bucket.HasTokens(501, t0 + std::chrono::seconds(10)));
+    BOOST_CHECK(bucket.HasTokens(500, t0 + std::chrono::seconds(10)));
+    BOOST_CHECK(bucket.TimeUntil(1000, t0 + std::chrono::seconds(10)) == std::chrono::nanoseconds(0));
+
+    // Overdrawing leads to a longer wait
+    bucket.Consume(600, t0 + std::chrono::seconds(10));
+    BOOST_CHECK(bucket.TimeUntil(100, t0 + std::chrono::seconds(10)) == std::chrono::milliseconds(200));
+}
+
+BOOST_AUTO_TEST_CASE(test_token_bucket_hierarchy)
+{
+    const auto t0 = std::chrono::steady_clock::now();
+    TokenBucket parent;
+    TokenBucket limited_child;
+    TokenBucket unlimited_child;
+    limited_child.SetParent(&parent);
+    unlimited_child.SetParent(&parent);
+
+    // Without any rate, the whole hierarchy is unlimited
+    BOOST_CHECK(unlimited_child.HasTokens(1e9, t0));
+
+    parent.SetRate(1000, 1000, t0);
+    limited_child.SetRate(100, 1000, t0);
+    BOOST_CHECK(!unlimited_child.HasTokens(1e9, t0));
+
+    // Each child is limited by its own rate and by its parent's
+    const auto t1 = t0 + std::chrono::seconds(1);
+    BOOST_CHECK(unlimited_child.HasTokens(1000, t1));
+    BOOST_CHECK(limited_child.HasTokens(100, t1));
+    BOOST_CHECK(!limited_child.HasTokens(101, t1));
+
+    // Tokens consumed by a child are taken from its parent, and thus from its
+    // siblings
+    unlimited_child.Consume(950, t1);
+    BOOST_CHECK(!limited_child.HasTokens(100, t1));
+    BOOST_CHECK(limited_child.HasTokens(50, t1));
+    BOOST_CHECK(limited_child.TimeUntil(100, t1) == std::chrono::milliseconds(50));
+    limited_child.Consume(50, t1);
+    BOOST_CHECK(!unlimited_child.HasTokens(1, t1));
+    BOOST_CHECK(unlimited_child.TimeUntil(100, t1) == std::chrono::milliseconds(100));
+    BOOST_CHECK(limited_child.TimeUntil(100, t1) == std::chrono::milliseconds(500));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
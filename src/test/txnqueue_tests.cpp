@@ -0,0 +1,109 @@
+#include <boost/test/unit_test.hpp>
+#include <test/util/setup_common.h>
+#include <txnqueue.h>
+
+BOOST_FIXTURE_TEST_SUITE(txnqueue_tests, BasicTestingSetup)
+
+/* Transaction spending the first output of each parent (or a unique null
+ * parent if none) */
+static CTransactionRef MakeTx(const std::vector<CTransactionRef>& parents)
+{
+    static uint32_t n_tx = 0;
+    CMutableTransaction mtx;
+    if (parents.empty()) {
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout.n = n_tx;
+    }
+    for (const auto& parent : parents)
+        mtx.vin.emplace_back(COutPoint(parent->GetHash(), 0));
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = ++n_tx;
+    return MakeTransactionRef(mtx);
+}
+
+BOOST_AUTO_TEST_CASE(test_feerate_order)
+{
+    TxnPriorityQueue queue;
+    const CTransactionRef a = MakeTx({}), b = MakeTx({}), c = MakeTx({}), d = MakeTx({});
+    BOOST_CHECK(queue.Add(a, 1000, 100));
+    BOOST_CHECK(queue.Add(b, 5000, 100));
+    BOOST_CHECK(queue.Add(c, 1000, 100));
+    BOOST_CHECK(queue.Add(d, 4000, 200));
+    BOOST_CHECK(!queue.Add(a, 1000, 100));
+    BOOST_CHECK_EQUAL(queue.Size(), 4U);
+
+    // Highest feerate first, then arrival order
+    const std::vector<CTransactionRef> expected{b, d, a, c};
+    BOOST_CHECK(queue.Pop(10) == expected);
+    BOOST_CHECK_EQUAL(queue.Size(), 0U);
+    BOOST_CHECK(queue.Pop(10).empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_packages)
+{
+    TxnPriorityQueue queue;
+    const CTransactionRef parent = MakeTx({});
+    const CTransactionRef other = MakeTx({});
+    BOOST_CHECK(queue.Add(parent, 100, 100));
+    BOOST_CHECK(queue.Add(other, 2000, 100));
+
+    // A high-fee child pulls its parent ahead
+    const CTransactionRef child = MakeTx({parent});
+    BOOST_CHECK(queue.Add(child, 5900, 100));
+    BOOST_CHECK_EQUAL(queue.NumPackages(), 2U);
+    std::vector<CTransactionRef> expected{parent, child};
+    BOOST_CHECK(queue.Pop(1) == expected);
+    BOOST_CHECK_EQUAL(queue.Size(), 1U);
+
+    // Once the parent is gone, its later children stand on their own
+    const CTransactionRef late_child = MakeTx({parent});
+    BOOST_CHECK(queue.Add(late_child, 3000, 100));
+    expected = {late_child, other};
+    BOOST_CHECK(queue.Pop(2) == expected);
+}
+
+BOOST_AUTO_TEST_CASE(test_merge)
+{
+    TxnPriorityQueue queue;
+    const CTransactionRef p1 = MakeTx({}), p2 = MakeTx({}), p3 = MakeTx({});
+    BOOST_CHECK(queue.Add(p1, 1000, 100));
+    BOOST_CHECK(queue.Add(p2, 1000, 100));
+    BOOST_CHECK(queue.Add(p3, 1500, 100));
+    BOOST_CHECK_EQUAL(queue.NumPackages(), 3U);
+
+    // A child of two packages merges them, with the parents ahead of it
+    const CTransactionRef child = MakeTx({p1, p2});
+    BOOST_CHECK(queue.Add(child, 4000, 100));
+    BOOST_CHECK_EQUAL(queue.NumPackages(), 2U);
+    const CTransactionRef grandchild = MakeTx({child});
+    BOOST_CHECK(queue.Add(grandchild, 2000, 100));
+
+    const std::vector<CTransactionRef> txns = queue.Pop(1);
+    const std::vector<CTransactionRef> expected{p1, p2, child, grandchild};
+    BOOST_CHECK(txns == expected);
+    BOOST_CHECK_EQUAL(queue.Size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(test_remove)
+{
+    TxnPriorityQueue queue;
+    const CTransactionRef parent = MakeTx({});
+    const CTransactionRef child = MakeTx({parent});
+    const CTransactionRef other = MakeTx({});
+    BOOST_CHECK(queue.Add(parent, 10000, 100));
+    BOOST_CHECK(queue.Add(child, 100, 100));
+    BOOST_CHECK(queue.Add(other, 2000, 100));
+
+    // Removing the parent (e.g., mined) leaves the child with its own feerate
+    BOOST_CHECK(queue.Remove(parent->GetHash()));
+    BOOST_CHECK(!queue.Remove(parent->GetHash()));
+    BOOST_CHECK_EQUAL(queue.Size(), 2U);
+    const std::vector<CTransactionRef> expected{other, child};
+    BOOST_CHECK(queue.Pop(10) == expected);
+
+    BOOST_CHECK(queue.Add(other, 2000, 100));
+    BOOST_CHECK(queue.Remove(other->GetHash()));
+    BOOST_CHECK_EQUAL(queue.NumPackages(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,8 +1,12 @@
 #include <boost/test/unit_test.hpp>
+#include <blockencodings.h>
+#include <chainparams.h>
 #include <fec.h>
+#include <script/interpreter.h>
 #include <test/util/setup_common.h>
 #include <udprelay.h>
 #include <util/system.h>
+#include <validation.h>
 
 BOOST_AUTO_TEST_SUITE(udprelay_tests)
 
@@ -34,20 +38,25 @@ BOOST_FIXTURE_TEST_CASE(test_recovery_invalid_files_get_removed, BasicTestingSet
     FECDecoder decoder2(FEC_CHUNK_SIZE * 2, MemoryUsageMode::USE_MMAP);
     FECDecoder decoder3(FEC_CHUNK_SIZE * 2, MemoryUsageMode::USE_MMAP, "1234_body");
 
+    // A chunk file left in the partial_blocks directory by an older version
+    fs::path legacy_file = ChunkArena::Get()->GetPath().parent_path() / (obj_id1 + "_1");
+    fsbridge::ofstream(legacy_file) << "chunks";
+
     // Assume the application was aborted/closed, leaving partial block data in
     // disk. Next, reload the partial blocks, as if relaunching the application.
     LoadPartialBlocks(nullptr);
 
-    // Given that decoder1 is the only decoder applying the chunk file naming
+    // Given that decoder1 is the only decoder applying the chunk object naming
     // convention expected by the udprelay logic (more specifically by
     // IsChunkFileRecoverable()), the expectation is that decoder1's FEC data is
     // succesfully reloaded after calling "LoadPartialBlocks", in which case its
-    // chunk file remains. In contrast, the chunk files from decoder2 and
+    // arena object remains. In contrast, the arena objects from decoder2 and
     // decoder3 shall be considered non-recoverable and removed by
-    // LoadPartialBlocks().
-    BOOST_CHECK(fs::exists(decoder1.GetFileName()));
-    BOOST_CHECK(!fs::exists(decoder2.GetFileName()));
-    BOOST_CHECK(!fs::exists(decoder3.GetFileName()));
+    // LoadPartialBlocks(), as are the chunk files of older versions.
+    BOOST_CHECK(ChunkArena::Get()->FindObject(decoder1.GetStorageKey()) != -1);
+    BOOST_CHECK(ChunkArena::Get()->FindObject(decoder2.GetStorageKey()) == -1);
+    BOOST_CHECK(ChunkArena::Get()->FindObject(decoder3.GetStorageKey()) == -1);
+    BOOST_CHECK(!fs::exists(legacy_file));
 
     // cleanup mapPartialBlocks
     ResetPartialBlocks();
@@ -65,16 +74,16 @@ BOOST_FIXTURE_TEST_CASE(test_recovery_handles_body_and_header, BasicTestingSetup
     CService peer(ipv4Addr, port);
 
     // Construct two decoders for the same hash prefix, one for the header data,
-    // the other for body data. Persist the chunk files in disk.
+    // the other for body data. Persist the arena objects in disk.
     size_t n_body_chunks = 5;
     size_t n_header_chunks = 2;
     std::string chunk_file_prefix = peer.ToString() + "_" + std::to_string(hash_prefix);
     std::string obj_id1 = chunk_file_prefix + "_body";
     std::string obj_id2 = chunk_file_prefix + "_header";
     {
-        const bool keep_mmap_file = true;
-        FECDecoder decoder1(FEC_CHUNK_SIZE * n_body_chunks, MemoryUsageMode::USE_MMAP, obj_id1, keep_mmap_file);
-        FECDecoder decoder2(FEC_CHUNK_SIZE * n_header_chunks, MemoryUsageMode::USE_MMAP, obj_id2, keep_mmap_file);
+        const bool keep_mmap_storage = true;
+        FECDecoder decoder1(FEC_CHUNK_SIZE * n_body_chunks, MemoryUsageMode::USE_MMAP, obj_id1, keep_mmap_storage);
+        FECDecoder decoder2(FEC_CHUNK_SIZE * n_header_chunks, MemoryUsageMode::USE_MMAP, obj_id2, keep_mmap_storage);
     }
 
     // Assume the application was aborted/closed, leaving partial block data in
@@ -102,8 +111,8 @@ BOOST_FIXTURE_TEST_CASE(test_recovery_handles_body_and_header, BasicTestingSetup
     BOOST_CHECK(partial_block->header_initialized);
     BOOST_CHECK(partial_block->blk_len == FEC_CHUNK_SIZE * n_body_chunks);
     BOOST_CHECK(partial_block->header_len == FEC_CHUNK_SIZE * n_header_chunks);
-    BOOST_CHECK(partial_block->body_decoder.GetFileName().filename().c_str() == obj_id1 + "_" + std::to_string(FEC_CHUNK_SIZE * n_body_chunks));
-    BOOST_CHECK(partial_block->header_decoder.GetFileName().filename().c_str() == obj_id2 + "_" + std::to_string(FEC_CHUNK_SIZE * n_header_chunks));
+    BOOST_CHECK(partial_block->body_decoder.GetStorageKey() == obj_id1 + "_" + std::to_string(FEC_CHUNK_SIZE * n_body_chunks));
+    BOOST_CHECK(partial_block->header_decoder.GetStorageKey() == obj_id2 + "_" + std::to_string(FEC_CHUNK_SIZE * n_header_chunks));
     BOOST_CHECK(partial_block->body_decoder.GetChunkCount() == n_body_chunks);
     BOOST_CHECK(partial_block->header_decoder.GetChunkCount() == n_header_chunks);
 
@@ -124,7 +133,7 @@ BOOST_FIXTURE_TEST_CASE(test_recovery_of_decodable_state, BasicTestingSetup)
 
     // Construct two decoders for the same hash prefix, one for the header data,
     // the other for body data. Provide all the header chunks. Then, destroy the
-    // decoders while persisting their chunk files in disk.
+    // decoders while persisting their arena objects in disk.
     std::vector<unsigned char> dummy_chunk(FEC_CHUNK_SIZE);
     size_t n_body_chunks = 5;
     size_t n_header_chunks = 2;
@@ -132,9 +141,9 @@ BOOST_FIXTURE_TEST_CASE(test_recovery_of_decodable_state, BasicTestingSetup)
     std::string obj_id1 = chunk_file_prefix + "_body";
     std::string obj_id2 = chunk_file_prefix + "_header";
     {
-        const bool keep_mmap_file = true;
-        FECDecoder decoder1(FEC_CHUNK_SIZE * n_body_chunks, MemoryUsageMode::USE_MMAP, obj_id1, keep_mmap_file);
-        FECDecoder decoder2(FEC_CHUNK_SIZE * n_header_chunks, MemoryUsageMode::USE_MMAP, obj_id2, keep_mmap_file);
+        const bool keep_mmap_storage = true;
+        FECDecoder decoder1(FEC_CHUNK_SIZE * n_body_chunks, MemoryUsageMode::USE_MMAP, obj_id1, keep_mmap_storage);
+        FECDecoder decoder2(FEC_CHUNK_SIZE * n_header_chunks, MemoryUsageMode::USE_MMAP, obj_id2, keep_mmap_storage);
 
         for (size_t chunk_id = 0; chunk_id < n_header_chunks; chunk_id++) {
             decoder2.ProvideChunk(dummy_chunk.data(), chunk_id);
@@ -172,12 +181,12 @@ BOOST_FIXTURE_TEST_CASE(test_recovery_multiple_blocks, BasicTestingSetup)
         hash_prefixes_set.insert(1000 + (rand() % 10000));
     hash_prefixes.insert(hash_prefixes.end(), hash_prefixes_set.begin(), hash_prefixes_set.end());
 
-    // Construct many decoders while persisting their chunk files in disk
+    // Construct many decoders while persisting their arena objects in disk
     {
-        const bool keep_mmap_file = true;
+        const bool keep_mmap_storage = true;
         for (size_t i = 0; i < n_decoders; i++) {
             std::string obj_id = "172.16.235.1:8080_" + std::to_string(hash_prefixes[i]) + "_body";
-            decoders_vec.emplace_back(std::move(MakeUnique<FECDecoder>(FEC_CHUNK_SIZE * n_body_chunks, MemoryUsageMode::USE_MMAP, obj_id, keep_mmap_file)));
+            decoders_vec.emplace_back(std::move(MakeUnique<FECDecoder>(FEC_CHUNK_SIZE * n_body_chunks, MemoryUsageMode::USE_MMAP, obj_id, keep_mmap_storage)));
         }
     }
 
@@ -205,7 +214,7 @@ BOOST_FIXTURE_TEST_CASE(test_recovery_multiple_blocks, BasicTestingSetup)
         BOOST_CHECK(partial_block->header_len == 0);
         BOOST_CHECK(partial_block->blk_len == FEC_CHUNK_SIZE * n_body_chunks);
         std::string obj_id = peer.ToString() + "_" + std::to_string(hash_prefixes[i]) + "_body";
-        BOOST_CHECK(partial_block->body_decoder.GetFileName().filename().c_str() == obj_id + "_" + std::to_string(FEC_CHUNK_SIZE * n_body_chunks));
+        BOOST_CHECK(partial_block->body_decoder.GetStorageKey() == obj_id + "_" + std::to_string(FEC_CHUNK_SIZE * n_body_chunks));
         BOOST_CHECK(partial_block->body_decoder.GetChunkCount() == n_body_chunks);
     }
 
@@ -213,4 +222,111 @@ BOOST_FIXTURE_TEST_CASE(test_recovery_multiple_blocks, BasicTestingSetup)
     ResetPartialBlocks();
 }
 
+BOOST_AUTO_TEST_CASE(test_fec_overhead_estimator)
+{
+    const size_t data_chunks = 1000;
+    FecOverheadEstimator est;
+
+    // Without any estimate, the whole block plus a fixed overhead is sent
+    BOOST_CHECK_EQUAL(est.GetFecChunks(data_chunks), data_chunks + 10);
+
+    // Blocks with too few chunks are ignored
+    est.Update(5, 5);
+    BOOST_CHECK_EQUAL(est.n_blocks, 0U);
+
+    // Every chunk was needed: the overhead grows
+    est.Update(100, 100);
+    BOOST_CHECK_EQUAL(est.n_blocks, 1U);
+    BOOST_CHECK(est.overhead > 0);
+    const size_t fec_chunks_lossy = est.GetFecChunks(data_chunks);
+    BOOST_CHECK(fec_chunks_lossy > data_chunks + 10);
+
+    // Mostly redundant chunks: the overhead shrinks back, but the whole block
+    // plus the fixed overhead is still sent
+    for (int i = 0; i < 10; i++)
+        est.Update(50, 100);
+    BOOST_CHECK_EQUAL(est.overhead, 0);
+    BOOST_CHECK_EQUAL(est.GetFecChunks(data_chunks), data_chunks + 10);
+
+    // The overhead is bounded
+    for (int i = 0; i < 100; i++)
+        est.Update(100, 100);
+    BOOST_CHECK(est.GetFecChunks(data_chunks) > fec_chunks_lossy);
+    BOOST_CHECK(est.GetFecChunks(data_chunks) <= 2 * data_chunks + 10);
+}
+
+BOOST_FIXTURE_TEST_CASE(test_block_cache_fill, TestChain100Setup)
+{
+    // Mine a block large enough to be FEC-coded with wirehair
+    const CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction tx;
+    tx.nVersion = 1;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(m_coinbase_txns[0]->GetHash(), 0);
+    tx.vout.resize(2000);
+    for (CTxOut& out : tx.vout) {
+        out.nValue = CENT;
+        out.scriptPubKey = scriptPubKey;
+    }
+    std::vector<unsigned char> vchSig;
+    const uint256 hash = SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+
+    const CBlock block = CreateAndProcessBlock({tx}, scriptPubKey);
+    const CBlockIndex* pindex = WITH_LOCK(cs_main, return ::ChainActive().Tip());
+    BOOST_REQUIRE(pindex->GetBlockHash() == block.GetHash());
+
+    CBlockHeaderAndLengthShortTxIDs headerAndIDs(block, codec_version_t::default_version, true);
+    headerAndIDs.setBlockHeight(pindex->nHeight);
+    const ChunkCodedBlock coded_block(block, headerAndIDs);
+    const std::vector<unsigned char>& coded = coded_block.GetCodedBlock();
+    const size_t n_chunks = (coded.size() + FEC_CHUNK_SIZE - 1) / FEC_CHUNK_SIZE;
+    BOOST_REQUIRE(n_chunks > CM256_MAX_CHUNKS);
+    std::vector<unsigned char> header_data;
+    VectorOutputStream header_stream(&header_data, SER_NETWORK, PROTOCOL_VERSION);
+    header_stream << headerAndIDs;
+
+    // The first fill populates the cache and the second one reuses the cached
+    // encoder. Both must decode to the chunk-coded block, with new chunk ids.
+    std::vector<uint32_t> first_chunk_ids;
+    for (int i = 0; i < 2; i++) {
+        std::vector<UDPMessage> msgs;
+        UDPFillMessagesFromBlockIndex(pindex, msgs, 10, 0.05);
+
+        FECDecoder decoder(coded.size());
+        FECDecoder header_decoder(header_data.size());
+        std::vector<uint32_t> chunk_ids;
+        for (const UDPMessage& msg : msgs) {
+            if ((msg.header.msg_type & UDP_MSG_TYPE_TYPE_MASK) == MSG_TYPE_BLOCK_HEADER) {
+                if (!header_decoder.DecodeReady())
+                    header_decoder.ProvideChunk(msg.msg.block.data, msg.msg.block.chunk_id);
+                continue;
+            }
+            BOOST_CHECK_EQUAL(le32toh(msg.msg.block.obj_length), coded.size());
+            chunk_ids.push_back(msg.msg.block.chunk_id);
+            if (!decoder.DecodeReady())
+                decoder.ProvideChunk(msg.msg.block.data, msg.msg.block.chunk_id);
+        }
+        BOOST_REQUIRE(header_decoder.DecodeReady());
+        for (size_t j = 0; j < (header_data.size() + FEC_CHUNK_SIZE - 1) / FEC_CHUNK_SIZE; j++) {
+            const size_t len = std::min<size_t>(FEC_CHUNK_SIZE, header_data.size() - j * FEC_CHUNK_SIZE);
+            BOOST_CHECK(memcmp(header_decoder.GetDataPtr(j), &header_data[j * FEC_CHUNK_SIZE], len) == 0);
+        }
+        BOOST_REQUIRE(decoder.DecodeReady());
+        for (size_t j = 0; j < n_chunks; j++) {
+            const size_t len = std::min<size_t>(FEC_CHUNK_SIZE, coded.size() - j * FEC_CHUNK_SIZE);
+            BOOST_CHECK(memcmp(decoder.GetDataPtr(j), &coded[j * FEC_CHUNK_SIZE], len) == 0);
+        }
+
+        if (i == 0)
+            first_chunk_ids = chunk_ids;
+        else
+            BOOST_CHECK(chunk_ids != first_chunk_ids);
+    }
+
+    ClearUDPBlockCache();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
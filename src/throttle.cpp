@@ -63,3 +63,57 @@ uint32_t Throttle::EstimateWait(uint32_t n_units)
     assert(wait > 0);
     return wait;
 }
+
+void TokenBucket::Update(time_point now)
+{
+    if (now <= m_t_last)
+        return;
+    typedef std::chrono::duration<double, std::chrono::seconds::period> dsecs;
+    const double elapsed = std::chrono::duration_cast<dsecs>(now - m_t_last).count();
+    m_tokens = std::min(m_tokens + elapsed * m_rate, m_depth);
+    m_t_last = now;
+}
+
+void TokenBucket::SetRate(double rate, double depth, time_point now)
+{
+    m_rate = rate;
+    m_depth = depth;
+    m_tokens = 0;
+    m_t_last = now;
+}
+
+bool TokenBucket::HasTokens(double n, time_point now)
+{
+    for (TokenBucket* b = this; b; b = b->m_parent) {
+        if (b->m_rate <= 0)
+            continue;
+        b->Update(now);
+        if (b->m_tokens < n)
+            return false;
+    }
+    return true;
+}
+
+void TokenBucket::Consume(double n, time_point now)
+{
+    for (TokenBucket* b = this; b; b = b->m_parent) {
+        if (b->m_rate <= 0)
+            continue;
+        b->Update(now);
+        b->m_tokens -= n;
+    }
+}
+
+std::chrono::nanoseconds TokenBucket::TimeUntil(double n, time_point now)
+{
+    double wait = 0; // in seconds
+    for (TokenBucket* b = this; b; b = b->m_parent) {
+        if (b->m_rate <= 0)
+            continue;
+        b->Update(now);
+        const double target = std::min(n, b->m_depth);
+        if (b->m_tokens < target)
+            wait = std::max(wait, (target - b->m_tokens) / b->m_rate);
+    }
+    return std::chrono::nanoseconds(static_cast<int64_t>(std::ceil(wait * 1e9)));
+}
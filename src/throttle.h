@@ -76,4 +76,79 @@ public:
     uint32_t EstimateWait(uint32_t n_units = 1);
 };
 
+/**
+ * Token bucket of a hierarchy of rate limiters
+ *
+ * Tokens (e.g., bytes) accumulate at the bucket's rate up to its depth, i.e.
+ * the largest burst it allows. Units can only be transmitted when the bucket
+ * and all of its ancestors hold enough tokens for them, and transmitting them
+ * takes the tokens from all of these buckets. A bucket without a rate is
+ * unlimited, such that a child bucket without a rate of its own is only
+ * limited by its parent.
+ *
+ * Unlike Throttle, tokens are not rounded to integer units, the wait until
+ * tokens become available is exact rather than rounded to milliseconds, and
+ * the current time is passed in by the caller, such that a scheduler can read
+ * the clock once for all of its buckets.
+ */
+class TokenBucket
+{
+public:
+    typedef std::chrono::steady_clock::time_point time_point;
+
+private:
+    double m_rate = 0;   //!< Tokens per second, or 0 when unlimited
+    double m_depth = 0;  //!< Maximum number of accumulated tokens
+    double m_tokens = 0; //!< Tokens ready for transmission
+    time_point m_t_last = std::chrono::steady_clock::now();
+    TokenBucket* m_parent = nullptr;
+
+    void Update(time_point now);
+
+public:
+    /**
+     * @brief Set the parent bucket, whose tokens are also consumed.
+     * @param (TokenBucket*) Parent bucket, or nullptr for a root bucket.
+     * @return Void.
+     */
+    void SetParent(TokenBucket* parent) { m_parent = parent; }
+
+    /**
+     * @brief Set the rate, starting with an empty bucket.
+     * @param (double) rate Tokens per second, or 0 for an unlimited bucket.
+     * @param (double) depth Maximum number of accumulated tokens.
+     * @param (time_point) now Current time.
+     * @return Void.
+     */
+    void SetRate(double rate, double depth, time_point now);
+
+    /**
+     * @brief Check if this bucket and its ancestors hold n tokens.
+     * @param (double) n Number of tokens.
+     * @param (time_point) now Current time.
+     * @return (bool) True when the tokens are available.
+     */
+    bool HasTokens(double n, time_point now);
+
+    /**
+     * @brief Take n tokens from this bucket and its ancestors.
+     * @param (double) n Number of tokens, which may exceed the available ones
+     * (e.g., when a transmission turned out larger), in which case the tokens
+     * become negative and the next transmissions wait for the difference.
+     * @param (time_point) now Current time.
+     * @return Void.
+     */
+    void Consume(double n, time_point now);
+
+    /**
+     * @brief Get the time until this bucket and its ancestors hold n tokens.
+     * @param (double) n Number of tokens. Buckets shallower than n tokens are
+     * waited for until they are full.
+     * @param (time_point) now Current time.
+     * @return (std::chrono::nanoseconds) Time to wait, or zero if the tokens
+     * are available now.
+     */
+    std::chrono::nanoseconds TimeUntil(double n, time_point now);
+};
+
 #endif
@@ -599,6 +599,7 @@ void CTxMemPool::_clear()
     lastRollingFeeUpdate = GetTime();
     blockSinceLastRollingFeeBump = false;
     rollingMinimumFeeRate = 0;
+    m_shortid_matches.clear();
     ++nTransactionsUpdated;
 }
 
@@ -7,6 +7,7 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <atomic>
+#include <deque>
 #include <map>
 #include <set>
 #include <string>
@@ -579,6 +580,26 @@ public:
     using txiter = indexed_transaction_set::nth_index<0>::type::const_iterator;
     std::vector<std::pair<uint256, txiter>> vTxHashes GUARDED_BY(cs); //!< All tx witness hashes/entries in mapTx, in random order
 
+    /**
+     * Mempool transactions which matched the short IDs of a recently
+     * initialized compact block. FIBRE derives the short ID key from the
+     * block header alone, so every peer relaying a block sends the same short
+     * IDs and only the first of them needs to be matched against all of
+     * vTxHashes. Matches are kept by wtxid rather than by reference so the
+     * cache never keeps transactions alive; a null wtxid marks a short ID
+     * which matched more than one mempool transaction.
+     */
+    struct ShortIDMatches {
+        uint256 block_hash;
+        uint64_t nonce;
+        std::vector<uint64_t> shorttxids;
+        unsigned int txn_updated; //!< nTransactionsUpdated when the matches were found
+        bool complete; //!< Whether every short ID was matched
+        std::vector<std::pair<uint64_t, uint256>> matches;
+    };
+    static constexpr size_t SHORTID_MATCHES_CACHE_SIZE = 4;
+    mutable std::deque<ShortIDMatches> m_shortid_matches GUARDED_BY(cs); //!< Most recently used first
+
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
 
     uint64_t CalculateDescendantMaximum(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <assert.h>
+#include <txnqueue.h>
+
+
+TxnPriorityQueue::Key TxnPriorityQueue::MakeKey(uint64_t id, const Package& package)
+{
+    return {package.vsize > 0 ? (double)package.fee / package.vsize : 0, id};
+}
+
+bool TxnPriorityQueue::Add(const CTransactionRef& tx, CAmount fee, int64_t vsize)
+{
+    const uint256& txid = tx->GetHash();
+    if (m_txns.count(txid))
+        return false;
+
+    /* Packages of the queued parents, oldest first */
+    std::set<uint64_t> parents;
+    for (const CTxIn& txin : tx->vin) {
+        auto it = m_txns.find(txin.prevout.hash);
+        if (it != m_txns.end())
+            parents.insert(it->second.package);
+    }
+
+    uint64_t id;
+    if (parents.empty()) {
+        id = m_next_id++;
+    } else {
+        /* Merge into the oldest package. The packages being merged do not
+         * depend on each other, so appending them keeps the order valid. */
+        id = *parents.begin();
+        Package& package = m_packages.at(id);
+        m_order.erase(MakeKey(id, package));
+        for (auto it = std::next(parents.begin()); it != parents.end(); ++it) {
+            Package& other = m_packages.at(*it);
+            m_order.erase(MakeKey(*it, other));
+            for (const CTransactionRef& other_tx : other.txns)
+                m_txns.at(other_tx->GetHash()).package = id;
+            package.txns.insert(package.txns.end(), other.txns.begin(), other.txns.end());
+            package.fee += other.fee;
+            package.vsize += other.vsize;
+            m_packages.erase(*it);
+        }
+    }
+
+    Package& package = m_packages[id];
+    package.txns.push_back(tx);
+    package.fee += fee;
+    package.vsize += vsize;
+    m_order.insert(MakeKey(id, package));
+    m_txns.emplace(txid, Entry{id, fee, vsize});
+    return true;
+}
+
+bool TxnPriorityQueue::Remove(const uint256& txid)
+{
+    auto it = m_txns.find(txid);
+    if (it == m_txns.end())
+        return false;
+
+    const uint64_t id = it->second.package;
+    Package& package = m_packages.at(id);
+    m_order.erase(MakeKey(id, package));
+    auto tx_it = std::find_if(package.txns.begin(), package.txns.end(),
+                              [&txid](const CTransactionRef& tx) { return tx->GetHash() == txid; });
+    assert(tx_it != package.txns.end());
+    package.txns.erase(tx_it);
+    package.fee -= it->second.fee;
+    package.vsize -= it->second.vsize;
+    m_txns.erase(it);
+
+    if (package.txns.empty())
+        m_packages.erase(id);
+    else
+        m_order.insert(MakeKey(id, package));
+    return true;
+}
+
+std::vector<CTransactionRef> TxnPriorityQueue::Pop(size_t max_txns)
+{
+    std::vector<CTransactionRef> txns;
+    while (txns.size() < max_txns && !m_order.empty()) {
+        const uint64_t id = m_order.begin()->id;
+        m_order.erase(m_order.begin());
+        auto it = m_packages.find(id);
+        for (CTransactionRef& tx : it->second.txns) {
+            m_txns.erase(tx->GetHash());
+            txns.push_back(std::move(tx));
+        }
+        m_packages.erase(it);
+    }
+    return txns;
+}
@@ -0,0 +1,96 @@
+#ifndef BITCOIN_TXNQUEUE_H
+#define BITCOIN_TXNQUEUE_H
+
+#include <amount.h>
+#include <primitives/transaction.h>
+#include <txmempool.h>
+#include <uint256.h>
+
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+ * Fee-ordered queue of transactions waiting to be sent
+ *
+ * Transactions are grouped into packages as they arrive: a transaction that
+ * spends an output of a transaction still in the queue joins the package of
+ * its parent (merging the packages of all its queued parents), so that parents
+ * always leave the queue before or together with their children. Packages are
+ * ordered by their aggregate feerate, such that a high-fee child pulls its
+ * low-fee parents along with it, and by arrival order among equal feerates.
+ * Parents that already left the queue (sent, mined or otherwise unknown) are
+ * not tracked.
+ *
+ * The queue is not thread-safe.
+ */
+class TxnPriorityQueue
+{
+private:
+    struct Package {
+        std::vector<CTransactionRef> txns; //!< in topological order
+        CAmount fee = 0;
+        int64_t vsize = 0;
+    };
+
+    struct Entry {
+        uint64_t package;
+        CAmount fee;
+        int64_t vsize;
+    };
+
+    /** Position of a package in the send order */
+    struct Key {
+        double feerate;
+        uint64_t id;
+        bool operator<(const Key& other) const {
+            if (feerate != other.feerate)
+                return feerate > other.feerate;
+            return id < other.id;
+        }
+    };
+
+    std::map<uint64_t, Package> m_packages;
+    std::unordered_map<uint256, Entry, SaltedTxidHasher> m_txns;
+    std::set<Key> m_order;
+    uint64_t m_next_id = 0;
+
+    static Key MakeKey(uint64_t id, const Package& package);
+
+public:
+    /**
+     * @brief Queue a transaction.
+     * @param (CTransactionRef) Transaction.
+     * @param (CAmount) Fee used to order the transaction.
+     * @param (int64_t) Virtual size of the transaction.
+     * @return (bool) Whether the transaction was queued (false if already queued).
+     */
+    bool Add(const CTransactionRef& tx, CAmount fee, int64_t vsize);
+
+    /**
+     * @brief Drop a transaction from the queue, if queued.
+     * @param (uint256) Txid.
+     * @return (bool) Whether the transaction was queued.
+     */
+    bool Remove(const uint256& txid);
+
+    /**
+     * @brief Take the best packages out of the queue.
+     *
+     * Whole packages are taken until there are at least max_txns transactions,
+     * so the last package may exceed the limit.
+     *
+     * @param (size_t) Number of transactions to take.
+     * @return (std::vector<CTransactionRef>) Transactions in send order.
+     */
+    std::vector<CTransactionRef> Pop(size_t max_txns);
+
+    size_t Size() const { return m_txns.size(); }
+
+    size_t NumPackages() const { return m_packages.size(); }
+};
+
+#endif
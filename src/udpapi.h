@@ -14,7 +14,46 @@
 
 class CBlock;
 
-std::vector<std::pair<unsigned short, uint64_t> > GetUDPInboundPorts(); // port, outbound bandwidth for group
+/** Default number of datagrams drained from a socket per read wakeup */
+static const unsigned int DEFAULT_UDP_RECV_BATCH = 32;
+/** Upper bound for -udprecvbatch */
+static const unsigned int MAX_UDP_RECV_BATCH = 1024;
+/** Default number of datagrams handed to the kernel per send call */
+static const unsigned int DEFAULT_UDP_SEND_BATCH = 32;
+/** Upper bound for -udpsendbatch */
+static const unsigned int MAX_UDP_SEND_BATCH = 1024;
+/** Default for -udpgso */
+static const bool DEFAULT_UDP_GSO = false;
+/** Default number of UDP read threads */
+static const unsigned int DEFAULT_UDP_READ_THREADS = 1;
+/** Upper bound for -udpreadthreads */
+static const unsigned int MAX_UDP_READ_THREADS = 64;
+/** Default for -udpblockcache, in MiB */
+static const unsigned int DEFAULT_UDP_BLOCK_CACHE_SIZE = 256;
+/** Default for -udpchunkarena, in MiB */
+static const unsigned int DEFAULT_UDP_CHUNK_ARENA_SIZE = sizeof(void*) >= 8 ? 16384 : 512;
+/** Default for -udpblockcodec, see codec_version_t */
+static const unsigned int DEFAULT_UDP_BLOCK_CODEC = 1;
+/** Upper bound for -udpblockcodec */
+static const unsigned int MAX_UDP_BLOCK_CODEC = 2;
+/** Default for -udpfecthreads (0 = one per CPU core) */
+static const int DEFAULT_UDP_FEC_THREADS = 0;
+/** Upper bound for -udpfecthreads */
+static const int MAX_UDP_FEC_THREADS = 64;
+/** Upper bound for the prefetch_depth of -udpmulticasttx, in blocks */
+static const unsigned int MAX_UDP_PREFETCH_DEPTH = 64;
+
+/** Default for -udpqueueweights */
+static const char* const DEFAULT_UDP_QUEUE_WEIGHTS = "8,4,1,1";
+
+/** Unicast UDP group, as configured by -udpport */
+struct UDPInboundGroup {
+    unsigned short port;
+    uint64_t bw;     //!< outbound bandwidth in Mbps
+    uint32_t weight; //!< weight of the group's Tx queue relative to the other groups
+};
+
+std::vector<UDPInboundGroup> GetUDPInboundPorts();
 bool InitializeUDPConnections(NodeContext* const node);
 void StopUDPConnections();
 
@@ -47,6 +86,7 @@ UniValue BlkChunkStatsToJSON(int target_height);
 UniValue MaxMinBlkChunkStatsToJSON();
 UniValue AllBlkChunkStatsToJSON();
 UniValue FecHitRatioToJson();
+UniValue FecOverheadToJson();
 
 UniValue UdpMulticastRxInfoToJson();
 UniValue TxWindowInfoToJSON(int phy_idx, int log_idx);
@@ -12,24 +12,28 @@
 #include <throttle.h>
 #include <ringbuffer.h>
 
-#include <bloom.h>
 #include <chainparams.h>
+#include <consensus/consensus.h>
 #include <consensus/validation.h>
 #include <compat/endian.h>
 #include <crypto/poly1305.h>
 #include <hash.h>
 #include <init.h> // for ShutdownRequested()
 #include <validation.h>
+#include <validationinterface.h>
 #include <netbase.h>
 #include <primitives/block.h>
 #include <primitives/transaction.h>
 #include <txmempool.h>
+#include <txnqueue.h>
 #include <logging.h>
 #include <util/strencodings.h>
+#include <util/system.h>
 #include <util/time.h>
 
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <netinet/udp.h>
 
 #include <event2/event.h>
 
@@ -38,13 +42,10 @@
 
 #include <boost/optional.hpp>
 
-#if BOOST_VERSION < 105600
-#include <boost/utility/in_place_factory.hpp> // for boost::in_place
-#endif
-
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <thread>
 
 #ifndef WIN32
@@ -52,6 +53,9 @@
 #include <pthread.h>
 #include <unistd.h>
 #endif
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
 
 #define to_millis_double(t) (std::chrono::duration_cast<std::chrono::duration<double, std::chrono::milliseconds::period> >(t).count())
 
@@ -73,6 +77,12 @@ static char *strncpy_wrapper(char *dest, const char *src, std::size_t count) {
     return dest;
 }
 
+UDPSockAddr::UDPSockAddr(const CService& service) : UDPSockAddr() {
+    len = sizeof(addr);
+    const bool res = service.GetSockAddr(&addr.sa, &len);
+    assert(res);
+}
+
 static std::vector<int> udp_socks; // The sockets we use to send/recv (bound to *:GetUDPInboundPorts()[*])
 
 std::recursive_mutex cs_mapUDPNodes;
@@ -96,49 +106,85 @@ static NodeContext* g_node_context; // Initialized by InitializeUDPConnections
  */
 namespace {
     std::map<std::tuple<CService, int, uint16_t>, UDPMulticastInfo> mapMulticastNodes;
+
+    /* Index of the multicast instances used in the receive path, keyed by
+     * the socket fd and the source address of the instance. The entry caches
+     * the instance's node in mapUDPNodes (or mapUDPNodes.end() while the node
+     * is not connected). Protected by cs_mapUDPNodes. */
+    struct MulticastRoute {
+        std::map<std::tuple<CService, int, uint16_t>, UDPMulticastInfo>::iterator mcast_it;
+        std::map<CService, UDPConnectionState>::iterator node_it;
+    };
+    std::map<std::pair<int, CNetAddr>, MulticastRoute> mapMulticastRoutes;
+
+    /* Point the routes of all multicast instances whose source is addr to
+     * node_it. Requires cs_mapUDPNodes. */
+    void SetMulticastRoutes(const CService& addr, const std::map<CService, UDPConnectionState>::iterator& node_it) {
+        for (auto it = mapMulticastNodes.lower_bound(std::make_tuple(addr, std::numeric_limits<int>::min(), (uint16_t)0));
+             it != mapMulticastNodes.end() && std::get<0>(it->first) == addr; it++) {
+            const auto route = mapMulticastRoutes.find(std::make_pair(it->second.fd, (CNetAddr)addr));
+            if (route != mapMulticastRoutes.end())
+                route->second.node_it = node_it;
+        }
+    }
+
     const std::string multicast_pass = "multicast";
     uint64_t const multicast_magic = Hash(multicast_pass).GetUint64(0);
 }
 uint64_t const multicast_checksum_magic = htole64(multicast_magic);
 
+void UDPChecksumKey::Set(uint64_t magic_in) {
+    magic = magic_in;
+    uint8_t key_bytes[POLY1305_KEYLEN]; // (32 bytes)
+    memcpy(key_bytes,      &magic, sizeof(magic));
+    memcpy(key_bytes + 8,  &magic, sizeof(magic));
+    memcpy(key_bytes + 16, &magic, sizeof(magic));
+    memcpy(key_bytes + 24, &magic, sizeof(magic));
+    poly1305_key_init(key, key_bytes);
+}
+
 //TODO: The checksum stuff is not endian-safe (esp the poly impl):
-static void FillChecksum(uint64_t magic, UDPMessage& msg, const unsigned int length) {
-    assert(length <= sizeof(UDPMessage));
 
-    uint8_t key[POLY1305_KEYLEN]; // (32 bytes)
-    memcpy(key,      &magic, sizeof(magic));
-    memcpy(key + 8,  &magic, sizeof(magic));
-    memcpy(key + 16, &magic, sizeof(magic));
-    memcpy(key + 24, &magic, sizeof(magic));
+/* XOR everything past the checksum of src with the chk1 of dst, a word at a
+ * time, and store the result in dst. src and dst may be the same message. The
+ * operation is its own inverse, i.e. it both scrambles and unscrambles the
+ * message. */
+static void ScrambleMessage(const UDPMessage& src, UDPMessage& dst, const unsigned int length) {
+    const unsigned char* src_data = (const unsigned char*)&src + offsetof(UDPMessageHeader, msg_type);
+    unsigned char* dst_data = (unsigned char*)&dst + offsetof(UDPMessageHeader, msg_type);
+    const unsigned int data_len = length - 16;
+
+    uint64_t mask;
+    memcpy(&mask, &dst.header.chk1, sizeof(mask));
+    unsigned int i = 0;
+    for (; i + 8 <= data_len; i += 8) {
+        uint64_t word;
+        memcpy(&word, src_data + i, sizeof(word));
+        word ^= mask;
+        memcpy(dst_data + i, &word, sizeof(word));
+    }
+    for (unsigned int j = 0; i < data_len; i++, j++)
+        dst_data[i] = src_data[i] ^ ((unsigned char*)&dst.header.chk1)[j];
+}
 
+/* Check the checksum of an already unscrambled message */
+static bool VerifyChecksum(const UDPChecksumKey& key, const UDPMessage& msg, const unsigned int length) {
     uint8_t hash[POLY1305_TAGLEN]; // (16 bytes)
-    poly1305_auth(hash, (unsigned char*)&msg.header.msg_type, length - 16, key);
-    memcpy(&msg.header.chk1, hash, sizeof(msg.header.chk1));
-    memcpy(&msg.header.chk2, hash + 8, sizeof(msg.header.chk2));
-
-    for (unsigned int i = 0; i < length - 16; i += 8) {
-        for (unsigned int j = 0; j < 8 && i + j < length - 16; j++) {
-            ((unsigned char*)&msg.header.msg_type) [i+j] ^= ((unsigned char*)&msg.header.chk1)[j];
-        }
-    }
+    poly1305_auth(hash, (const unsigned char*)&msg.header.msg_type, length - 16, key.key);
+    return !memcmp(&msg.header.chk1, hash, sizeof(msg.header.chk1)) && !memcmp(&msg.header.chk2, hash + 8, sizeof(msg.header.chk2));
 }
-static bool CheckChecksum(uint64_t magic, UDPMessage& msg, const unsigned int length) {
-    assert(length <= sizeof(UDPMessage));
-    for (unsigned int i = 0; i < length - 16; i += 8) {
-        for (unsigned int j = 0; j < 8 && i + j < length - 16; j++) {
-            ((unsigned char*)&msg.header.msg_type) [i+j] ^= ((unsigned char*)&msg.header.chk1)[j];
-        }
-    }
 
-    uint8_t key[POLY1305_KEYLEN]; // (32 bytes)
-    memcpy(key,      &magic, sizeof(magic));
-    memcpy(key + 8,  &magic, sizeof(magic));
-    memcpy(key + 16, &magic, sizeof(magic));
-    memcpy(key + 24, &magic, sizeof(magic));
+/* Checksum src and write the checksummed, scrambled message into dst, which
+ * may be src itself */
+static void FillChecksum(const UDPChecksumKey& key, const UDPMessage& src, UDPMessage& dst, const unsigned int length) {
+    assert(length <= sizeof(UDPMessage));
 
     uint8_t hash[POLY1305_TAGLEN]; // (16 bytes)
-    poly1305_auth(hash, (unsigned char*)&msg.header.msg_type, length - 16, key);
-    return !memcmp(&msg.header.chk1, hash, sizeof(msg.header.chk1)) && !memcmp(&msg.header.chk2, hash + 8, sizeof(msg.header.chk2));
+    poly1305_auth(hash, (const unsigned char*)&src.header.msg_type, length - 16, key.key);
+    memcpy(&dst.header.chk1, hash, sizeof(dst.header.chk1));
+    memcpy(&dst.header.chk2, hash + 8, sizeof(dst.header.chk2));
+
+    ScrambleMessage(src, dst, length);
 }
 
 
@@ -147,41 +193,193 @@ static bool CheckChecksum(uint64_t magic, UDPMessage& msg, const unsigned int le
  * Init/shutdown logic follows
  */
 
-static struct event_base* event_base_read = nullptr;
 static event *timer_event;
-static std::vector<event*> read_events;
 static struct timeval timer_interval;
 
+/* Preallocated receive slots used by read_socket_func. Each read wakeup drains
+ * up to `msgs.size()` datagrams from the socket (with a single recvmmsg call
+ * where available), authenticates them in one pass outside cs_mapUDPNodes and
+ * then processes all of them under a single cs_mapUDPNodes acquisition. */
+struct UDPRecvBatch {
+    std::vector<UDPMessage> msgs;
+    std::vector<struct sockaddr_in6> addrs;
+    std::vector<size_t> lens;
+    std::vector<CService> senders;
+    /* Key each message was authenticated with and the outcome (nullopt if
+     * the sender was unknown when the batch was authenticated) */
+    std::vector<UDPChecksumKey> auth_keys;
+    std::vector<boost::optional<bool>> auth_results;
+#ifdef __linux__
+    std::vector<struct mmsghdr> hdrs;
+    std::vector<struct iovec> iovs;
+#endif
+
+    explicit UDPRecvBatch(size_t n) : msgs(n), addrs(n), lens(n), senders(n), auth_keys(n), auth_results(n)
+#ifdef __linux__
+                                    , hdrs(n), iovs(n)
+#endif
+    {
+#ifdef __linux__
+        for (size_t i = 0; i < n; i++) {
+            iovs[i].iov_base = &msgs[i];
+            iovs[i].iov_len = sizeof(UDPMessage);
+            memset(&hdrs[i], 0, sizeof(hdrs[i]));
+            hdrs[i].msg_hdr.msg_name = &addrs[i];
+            hdrs[i].msg_hdr.msg_iov = &iovs[i];
+            hdrs[i].msg_hdr.msg_iovlen = 1;
+        }
+#endif
+    }
+    size_t Size() const { return msgs.size(); }
+};
+
+/* State of each UDP read thread. Every thread runs its own libevent loop over a
+ * disjoint subset of the UDP sockets and drains them into its own receive
+ * batch. The first thread also runs the timer event. */
+struct UDPReadThread {
+    std::string name;
+    struct event_base* base = nullptr;
+    std::vector<event*> events;
+    std::unique_ptr<UDPRecvBatch> batch;
+    std::unique_ptr<std::thread> thread;
+};
+static std::vector<UDPReadThread> udp_read_threads;
+
+/* Additional sockets bound with SO_REUSEPORT to the unicast group ports when
+ * running multiple read threads. They are only used for reception, such that
+ * the kernel spreads the inbound flows across threads by hashing the peer
+ * address. Transmission always goes through udp_socks. */
+static std::vector<int> udp_reuseport_socks;
+
+/* Maximum number of back-to-back batches read from the same socket within a
+ * single wakeup, such that other sockets and the timer event are not
+ * starved during floods. */
+static const unsigned int MAX_RECV_BATCHES_PER_WAKEUP = 8;
+
 // ~10MB of outbound messages pending
 static std::atomic_bool send_messages_break(false);
 std::mutex non_empty_queues_cv_mutex;
 std::condition_variable non_empty_queues_cv;
+/* Set by the write thread while it waits on non_empty_queues_cv, such that
+ * producers only take the mutex to notify it when it is actually asleep */
+static std::atomic_bool send_thread_sleeping(false);
 
 struct RingBufferElement {
-    CService service;
+    UDPSockAddr addr;
+    /* Payload shared with the elements queued towards other destinations, or
+     * null if the payload is stored in msg. Shared payloads are never
+     * modified: the write thread checksums and scrambles them into msg, which
+     * then serves as the per-destination copy that goes out on the wire. */
+    std::shared_ptr<const UDPMessage> shared_msg;
     UDPMessage msg;
     unsigned int length;
     uint64_t magic;
 };
 
+/* The Tx queues are written by several threads (net, relay, txn and backfill
+ * threads) and read only by the write thread, so they don't need locking */
+typedef MPSCRingBuffer<RingBufferElement> TxRingBuffer;
+
+/* Bytes a buffer or group of weight 1 may send per round of the deficit round
+ * robin schedulers of do_send_messages */
+static const size_t TX_BUFF_QUANTUM = sizeof(UDPMessage);
+/* Largest burst of a rate-limited group, as a duration at the group's rate */
+static const std::chrono::milliseconds TX_MAX_BURST(20);
+/* Timer-paced groups hold up to two messages' worth of tokens, such that a
+ * packet sent late is followed early by the next one, back on schedule */
+static const size_t TX_PACING_BURST = 2 * sizeof(UDPMessage);
+/* Timer-paced groups are woken up this long before their next departure, and
+ * the write thread spins in the meantime, to absorb the wake-up latency */
+static const std::chrono::microseconds TX_PACING_SPIN(50);
+
+/* Inter-packet delay variation (IPDV) of a rate-limited group: how much the
+ * spacing between consecutive departures deviates from the duration of the
+ * earlier packet at the group's rate, while the group has messages waiting.
+ * Updated by the write thread and read by RPC threads. */
+struct TxJitterStats {
+    std::atomic<uint64_t> pkts{0};
+    std::atomic<uint64_t> sum_ns{0};
+    std::atomic<uint64_t> max_ns{0};
+
+    /* Departure time and length of the previous packet, if the group had
+     * messages waiting since then (write thread only) */
+    bool backlogged = false;
+    std::chrono::steady_clock::time_point t_prev;
+    uint32_t prev_len = 0;
+
+    void Add(const std::chrono::steady_clock::time_point t_departure, const uint32_t length, const double ns_per_byte) {
+        if (backlogged) {
+            const int64_t gap = std::chrono::duration_cast<std::chrono::nanoseconds>(t_departure - t_prev).count();
+            const int64_t nominal = prev_len * ns_per_byte;
+            const uint64_t ipdv = (gap > nominal) ? gap - nominal : nominal - gap;
+            pkts.store(pkts.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            sum_ns.store(sum_ns.load(std::memory_order_relaxed) + ipdv, std::memory_order_relaxed);
+            if (ipdv > max_ns.load(std::memory_order_relaxed))
+                max_ns.store(ipdv, std::memory_order_relaxed);
+        }
+        backlogged = true;
+        t_prev = t_departure;
+        prev_len = length;
+    }
+};
+
 struct PerGroupMessageQueue {
-    std::array<RingBuffer<RingBufferElement>, 4> buffs;
+    std::array<TxRingBuffer, 4> buffs;
     ssize_t buff_id; // active buffer
-    /* Three message queues (buffers) per group:
+    /* Four message queues (buffers) per group:
      * 0) high priority
      * 1) best-effort (non priority)
      * 2) background txns (used by txn thread)
      * 3) background blocks (used by backfill thread)
      *
+     * The buffers are served by deficit round robin: on its turn, each
+     * non-empty buffer may send its weight times TX_BUFF_QUANTUM bytes, plus
+     * whatever it had left (or minus whatever it overdrew) in its previous
+     * turn. Hence, a backlogged buffer is guaranteed a share of the group's
+     * bandwidth proportional to its weight, such that bursts of new blocks
+     * don't starve the txn and backfill streams, while any bandwidth left
+     * unused by some buffers goes to the others.
+     *
      * The current buffer is indicated by `state.buff_id`. This id is set to -1
      * when all buffers are empty.
      */
+    std::array<uint32_t, 4> buff_weights;
+    std::array<int64_t, 4> buff_deficits;
+    /* Time until which a buffer is held back by its own ceiling */
+    std::array<std::chrono::steady_clock::time_point, 4> buff_next_send;
+
+    inline bool HasMessages() const {
+        for (const TxRingBuffer& buff : buffs) {
+            if (!buff.IsEmpty())
+                return true;
+        }
+        return false;
+    }
 
-    /* Find the next buffer with data available for transmission, while
-     * respecting buffer priorities. */
-    inline void NextBuff() {
-        for (size_t i = 0; i < buffs.size(); i++) {
-            if (!buffs[i].IsEmpty()) {
+    /* Keep the current buffer while it has messages and deficit left, or
+     * otherwise move on to the next non-empty buffer that is not held back by
+     * its ceiling, and start its turn. */
+    inline void NextBuff(const std::chrono::steady_clock::time_point t_now) {
+        if (buff_id != -1) {
+            if (buffs[buff_id].IsEmpty())
+                buff_deficits[buff_id] = 0; // idle buffers don't save up deficit
+            else if (buff_deficits[buff_id] > 0 && buff_next_send[buff_id] <= t_now)
+                return;
+        }
+        /* A buffer's deficit is positive after adding its quantum, unless it
+         * overdrew by more than a message, so two passes always find the next
+         * buffer if there is any */
+        const size_t start = (buff_id == -1) ? 0 : buff_id + 1;
+        for (size_t n = 0; n < 2 * buffs.size(); n++) {
+            const size_t i = (start + n) % buffs.size();
+            if (buffs[i].IsEmpty()) {
+                buff_deficits[i] = 0;
+                continue;
+            }
+            if (buff_next_send[i] > t_now)
+                continue;
+            buff_deficits[i] += buff_weights[i] * TX_BUFF_QUANTUM;
+            if (buff_deficits[i] > 0) {
                 buff_id = i;
                 return;
             }
@@ -191,26 +389,114 @@ struct PerGroupMessageQueue {
 
     uint64_t bw;
     bool multicast;
-    bool unlimited; // when non rate-limited (limited by a blocking socket instead)
-    Throttle ratelimiter;
+    /* Hierarchical token bucket: the group's rate limit at the root, and an
+     * optional ceiling for each buffer, which otherwise borrows all of the
+     * group's tokens */
+    TokenBucket ratelimiter;
+    std::array<TokenBucket, 4> buff_ratelimiters;
+    /* Deficit of the group in the round robin across groups, and the group's
+     * weight in it */
+    uint32_t weight;
+    int64_t deficit;
     std::chrono::steady_clock::time_point next_send;
-    PerGroupMessageQueue() : buff_id(-1), bw(0), multicast(false), unlimited(0),
-                             ratelimiter(0) {}
+    /* Pacing of the group, its rate in nanoseconds per byte (0 if unlimited),
+     * and the departure time of its next packet when paced by the kernel */
+    UDPPacing pacing;
+    double ns_per_byte;
+    std::chrono::steady_clock::time_point txtime_next;
+    TxJitterStats jitter;
+    PerGroupMessageQueue() : buff_id(-1), buff_deficits{}, bw(0), multicast(false),
+                             weight(1), deficit(0), pacing(UDPPacing::NONE), ns_per_byte(0) {
+        buff_weights.fill(1);
+        for (TokenBucket& b : buff_ratelimiters)
+            b.SetParent(&ratelimiter);
+    }
     PerGroupMessageQueue(PerGroupMessageQueue&& q) =delete;
+
+    /* Set the group's rate limit, or no limit if bytes_per_sec is 0 */
+    void SetRate(double bytes_per_sec, size_t min_burst) {
+        const double burst = (pacing == UDPPacing::TIMER) ? TX_PACING_BURST :
+            std::max<double>(bytes_per_sec * std::chrono::duration<double>(TX_MAX_BURST).count(), min_burst);
+        ratelimiter.SetRate(bytes_per_sec, burst, std::chrono::steady_clock::now());
+        ns_per_byte = (bytes_per_sec > 0) ? 1e9 / bytes_per_sec : 0;
+    }
+
+    /* Set the ceiling of buffer i, or no ceiling if bytes_per_sec is 0 */
+    void SetBuffRate(size_t i, double bytes_per_sec, size_t min_burst) {
+        const double burst = std::max<double>(bytes_per_sec * std::chrono::duration<double>(TX_MAX_BURST).count(), min_burst);
+        buff_ratelimiters[i].SetRate(bytes_per_sec, burst, std::chrono::steady_clock::now());
+    }
 };
 static std::map<size_t, PerGroupMessageQueue> mapTxQueues;
 
-static void ThreadRunReadEventLoop() { event_base_dispatch(event_base_read); }
+#ifdef __linux__
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+// Maximum number of segments the kernel accepts in a single UDP GSO send
+static const size_t UDP_GSO_MAX_SEGMENTS = 64;
+// Maximum payload of a single UDP GSO send (IP datagram limit minus headers)
+static const size_t UDP_GSO_MAX_BYTES = 65535 - 40 - 8;
+
+#ifndef SO_MAX_PACING_RATE
+#define SO_MAX_PACING_RATE 47
+#endif
+#ifndef SO_TXTIME
+#define SO_TXTIME 61
+#endif
+#ifndef SCM_TXTIME
+#define SCM_TXTIME SO_TXTIME
+#endif
+// Argument of SO_TXTIME (struct sock_txtime of linux/net_tstamp.h)
+struct UDPSockTxtime {
+    clockid_t clockid;
+    uint32_t flags;
+};
+#endif
+
+/* Preallocated transmit slots used by do_send_messages. Each queue turn reads
+ * up to `elems.size()` ready elements from the active ring buffer and hands
+ * them to the kernel with a single sendmmsg call where available. With UDP
+ * GSO enabled, runs of equally-sized messages to the same destination are
+ * further coalesced into a single UDP_SEGMENT send. */
+struct UDPSendBatch {
+    std::vector<RingBufferElement*> elems;
+    bool gso;
+#ifdef __linux__
+    std::vector<struct mmsghdr> hdrs;
+    std::vector<struct iovec> iovs;
+    std::vector<size_t> n_segs; // number of elements carried by each hdr
+    std::vector<uint64_t> txtimes; // departure time of each element (SO_TXTIME)
+    // Room for either a UDP_SEGMENT or a SCM_TXTIME control message
+    std::vector<std::array<char, CMSG_SPACE(sizeof(uint64_t))>> cmsgs;
+#endif
+
+    UDPSendBatch(size_t n, bool use_gso) : elems(n), gso(use_gso)
+#ifdef __linux__
+                                         , hdrs(n), iovs(n), n_segs(n), txtimes(n), cmsgs(n)
+#endif
+    {}
+    size_t Size() const { return elems.size(); }
+};
+static std::unique_ptr<UDPSendBatch> send_batch;
+
+/* Messages each group may send per round, times the group's weight. Send
+ * batches are cut at the end of the group's turn, so -udpsendbatch does not
+ * change how the groups share the sender. */
+static const size_t max_consecutive_tx = 10;
+// Default weights of the buffers of each Tx queue (-udpqueueweights)
+static std::array<uint32_t, 4> udp_queue_weights;
+
+static void ThreadRunReadEventLoop(struct event_base* base) { event_base_dispatch(base); }
 static void do_send_messages();
 static void send_messages_flush_and_break();
-static std::map<size_t, PerGroupMessageQueue> init_tx_queues(const std::vector<std::pair<unsigned short, uint64_t> >& group_list,
+static std::map<size_t, PerGroupMessageQueue> init_tx_queues(const std::vector<UDPInboundGroup>& group_list,
                                                              const std::vector<UDPMulticastInfo>& multicast_list);
 static void ThreadRunWriteEventLoop() { do_send_messages(); }
 
 static void read_socket_func(evutil_socket_t fd, short event, void* arg);
 static void timer_func(evutil_socket_t fd, short event, void* arg);
 
-static std::unique_ptr<std::thread> udp_read_thread;
 static std::vector<std::thread> udp_write_threads;
 
 static void OpenMulticastConnection(const CService& service, bool multicast_tx, size_t group, bool trusted);
@@ -273,12 +559,65 @@ static void AddConfAddedConnections() {
 }
 
 static void CloseSocketsAndReadEvents() {
-    for (event* ev : read_events)
-        event_free(ev);
+    for (UDPReadThread& reader : udp_read_threads) {
+        for (event* ev : reader.events)
+            event_free(ev);
+        reader.events.clear();
+    }
     for (int sock : udp_socks)
         close(sock);
-    read_events.clear();
+    for (int sock : udp_reuseport_socks)
+        close(sock);
     udp_socks.clear();
+    udp_reuseport_socks.clear();
+}
+
+static void FreeReadEventBases() {
+    for (UDPReadThread& reader : udp_read_threads) {
+        if (reader.base)
+            event_base_free(reader.base);
+    }
+    udp_read_threads.clear();
+}
+
+/* Open a non-blocking socket bound to the given port on all interfaces */
+static int OpenUDPInboundSocket(unsigned short port, bool reuse_port) {
+    int sock = socket(AF_INET6, SOCK_DGRAM, 0);
+    assert(sock);
+
+    int opt = 1;
+    assert(setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt,  sizeof(opt)) == 0);
+#ifdef SO_REUSEPORT
+    if (reuse_port && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) != 0) {
+        LogPrintf("UDP: setsockopt(SO_REUSEPORT) failed: %s\n", strerror(errno));
+        close(sock);
+        return -1;
+    }
+#endif
+    opt = 0;
+    assert(setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &opt,  sizeof(opt)) == 0);
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+    struct sockaddr_in6 wildcard;
+    memset(&wildcard, 0, sizeof(wildcard));
+    wildcard.sin6_family = AF_INET6;
+    memcpy(&wildcard.sin6_addr, &in6addr_any, sizeof(in6addr_any));
+    wildcard.sin6_port = htons(port);
+
+    if (bind(sock, (sockaddr*) &wildcard, sizeof(wildcard))) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static bool AddReadEvent(UDPReadThread& reader, int sock) {
+    event *read_event = event_new(reader.base, sock, EV_READ | EV_PERSIST, read_socket_func, reader.batch.get());
+    if (!read_event)
+        return false;
+    reader.events.push_back(read_event);
+    event_add(read_event, nullptr);
+    return true;
 }
 
 /* Find the IPv4 address corresponding to a given interface name */
@@ -315,6 +654,44 @@ static struct in_addr GetIfIpAddr(const char* const ifname) {
     return res_sin_addr;
 }
 
+static std::string BackfillPolicyToString(const BackfillConfig& config) {
+    switch (config.policy) {
+    case BackfillPolicy::LINEAR:
+        return "linear";
+    case BackfillPolicy::CAROUSELS:
+        return strprintf("carousels (last %d blocks with weight %u)", config.recent_depth, config.recent_weight);
+    case BackfillPolicy::DECAY:
+        return strprintf("decay (half as often every %d blocks)", config.decay_depth);
+    }
+    assert(false);
+}
+
+/**
+ * Enable kernel pacing on a multicast Tx socket
+ *
+ * Each packet then carries its departure time (SO_TXTIME), which the fq qdisc
+ * of the interface honors, and the socket is capped at the stream's rate plus
+ * the packet headers (SO_MAX_PACING_RATE) in case the departure times bunch up.
+ * Returns false if the kernel does not support per-packet departure times.
+ */
+static bool EnableKernelPacing(int fd, const UDPMulticastInfo& mcast_info) {
+#ifdef __linux__
+    UDPSockTxtime txtime{CLOCK_MONOTONIC, 0};
+    if (setsockopt(fd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) != 0) {
+        LogPrintf("UDP: setsockopt(SO_TXTIME) failed: %s\n", strerror(errno));
+        return false;
+    }
+    const double max_rate = static_cast<double>(mcast_info.bw) / 8 * PACKET_SIZE / sizeof(UDPMessage);
+    const uint32_t max_pacing_rate = std::min<double>(max_rate, std::numeric_limits<uint32_t>::max());
+    if (setsockopt(fd, SOL_SOCKET, SO_MAX_PACING_RATE, &max_pacing_rate, sizeof(max_pacing_rate)) != 0) {
+        LogPrintf("UDP: setsockopt(SO_MAX_PACING_RATE) failed: %s\n", strerror(errno));
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
 /**
  * Initialize multicast tx/rx services
  *
@@ -416,6 +793,13 @@ static bool InitializeUDPMulticast(std::vector<int> &udp_socks,
                 return false;
             }
 
+            /* Pacing */
+            if (mcast_info.pacing == UDPPacing::TXTIME && !EnableKernelPacing(udp_socks.back(), mcast_info)) {
+                LogPrintf("UDP: kernel pacing is not available, pacing multicast Tx socket %d with a timer instead\n",
+                          udp_socks.back());
+                mcast_info.pacing = UDPPacing::TIMER;
+            }
+
             /* CService identifier: destination multicast IP address */
             inet_pton(AF_INET, mcast_info.mcast_ip, &multicastaddr.sin_addr);
         } else {
@@ -511,6 +895,8 @@ static bool InitializeUDPMulticast(std::vector<int> &udp_socks,
                       "    - dscp: %u\n"
                       "    - depth: %d\n"
                       "    - offset: %d\n"
+                      "    - backfill: %s\n"
+                      "    - prefetch: %u\n"
                       "    - interleave: %u\n"
                       "    - txn_per_sec: %u\n"
                       "    - rep_blks: %s\n"
@@ -524,6 +910,8 @@ static bool InitializeUDPMulticast(std::vector<int> &udp_socks,
                       mcast_info.dscp,
                       mcast_info.depth,
                       mcast_info.offset,
+                      BackfillPolicyToString(mcast_info.backfill),
+                      mcast_info.prefetch_depth,
                       mcast_info.interleave_len,
                       mcast_info.txn_per_sec,
                       mcast_info.send_rep_blks ? "true" : "false",
@@ -555,7 +943,8 @@ static bool InitializeUDPMulticast(std::vector<int> &udp_socks,
                       addr.ToString(), ifindex, mcast_info.logical_idx);
             return false;
         }
-        mapMulticastNodes[mcast_map_key] = mcast_info;
+        const auto mcast_it = mapMulticastNodes.emplace(mcast_map_key, mcast_info).first;
+        mapMulticastRoutes[std::make_pair(mcast_info.fd, (CNetAddr)addr)] = {mcast_it, mapUDPNodes.end()};
 
         LogPrintf("UDP: Socket %d bound to port %hd for multicast group %zu %s\n",
                   udp_socks.back(), multicast_port, group,
@@ -606,70 +995,171 @@ UniValue UdpMulticastRxInfoToJson() {
     return ret;
 }
 
+/* Parse one comma-separated value per Tx queue buffer, e.g. "8,4,1,1" */
+template <typename T>
+static bool ParseQueueBuffValues(const std::string& str, std::array<T, 4>& values, const T min_value) {
+    size_t pos = 0;
+    for (size_t i = 0; i < values.size(); i++) {
+        const size_t end = (i + 1 < values.size()) ? str.find(',', pos) : str.size();
+        uint64_t value;
+        if (end == std::string::npos || !ParseUInt64(str.substr(pos, end - pos), &value) ||
+            value < min_value || value > std::numeric_limits<T>::max())
+            return false;
+        values[i] = value;
+        pos = end + 1;
+    }
+    return true;
+}
+
 bool InitializeUDPConnections(NodeContext* const node_context) {
-    assert(udp_write_threads.empty() && !udp_read_thread);
+    assert(udp_write_threads.empty() && udp_read_threads.empty());
     g_node_context = node_context;
 
     if (gArgs.IsArgSet("-udpmulticastloginterval") && (atoi(gArgs.GetArg("-udpmulticastloginterval", "")) > 0))
         g_mcast_log_interval = atoi(gArgs.GetArg("-udpmulticastloginterval", ""));
 
-    const std::vector<std::pair<unsigned short, uint64_t> > group_list(GetUDPInboundPorts());
-    for (std::pair<unsigned short, uint64_t> port : group_list) {
-        udp_socks.push_back(socket(AF_INET6, SOCK_DGRAM, 0));
-        assert(udp_socks.back());
+    const int64_t recv_batch_size = gArgs.GetArg("-udprecvbatch", DEFAULT_UDP_RECV_BATCH);
+    if (recv_batch_size < 1 || recv_batch_size > MAX_UDP_RECV_BATCH) {
+        LogPrintf("UDP: invalid -udprecvbatch=%d (must be between 1 and %u)\n", recv_batch_size, MAX_UDP_RECV_BATCH);
+        return false;
+    }
 
-        int opt = 1;
-        assert(setsockopt(udp_socks.back(), SOL_SOCKET, SO_REUSEADDR, &opt,  sizeof(opt)) == 0);
-        opt = 0;
-        assert(setsockopt(udp_socks.back(), IPPROTO_IPV6, IPV6_V6ONLY, &opt,  sizeof(opt)) == 0);
-        fcntl(udp_socks.back(), F_SETFL, fcntl(udp_socks.back(), F_GETFL) | O_NONBLOCK);
+    const int64_t n_read_threads = gArgs.GetArg("-udpreadthreads", DEFAULT_UDP_READ_THREADS);
+    if (n_read_threads < 1 || n_read_threads > MAX_UDP_READ_THREADS) {
+        LogPrintf("UDP: invalid -udpreadthreads=%d (must be between 1 and %u)\n", n_read_threads, MAX_UDP_READ_THREADS);
+        return false;
+    }
+#ifndef SO_REUSEPORT
+    if (n_read_threads > 1)
+        LogPrintf("UDP: SO_REUSEPORT is not supported on this platform, only multicast sockets will be spread across read threads\n");
+#endif
 
-        struct sockaddr_in6 wildcard;
-        memset(&wildcard, 0, sizeof(wildcard));
-        wildcard.sin6_family = AF_INET6;
-        memcpy(&wildcard.sin6_addr, &in6addr_any, sizeof(in6addr_any));
-        wildcard.sin6_port = htons(port.first);
+    const int64_t send_batch_size = gArgs.GetArg("-udpsendbatch", DEFAULT_UDP_SEND_BATCH);
+    if (send_batch_size < 1 || send_batch_size > MAX_UDP_SEND_BATCH) {
+        LogPrintf("UDP: invalid -udpsendbatch=%d (must be between 1 and %u)\n", send_batch_size, MAX_UDP_SEND_BATCH);
+        return false;
+    }
+    const bool use_gso = gArgs.GetBoolArg("-udpgso", DEFAULT_UDP_GSO);
+#ifndef __linux__
+    if (use_gso)
+        LogPrintf("UDP: -udpgso is not supported on this platform, ignoring\n");
+#endif
+    const int64_t block_cache_size = gArgs.GetArg("-udpblockcache", DEFAULT_UDP_BLOCK_CACHE_SIZE);
+    if (block_cache_size < 0) {
+        LogPrintf("UDP: invalid -udpblockcache=%d (must not be negative)\n", block_cache_size);
+        return false;
+    }
+    SetUDPBlockCacheSize(block_cache_size * 1024 * 1024);
 
-        if (bind(udp_socks.back(), (sockaddr*) &wildcard, sizeof(wildcard))) {
+    const int64_t chunk_arena_size = gArgs.GetArg("-udpchunkarena", DEFAULT_UDP_CHUNK_ARENA_SIZE);
+    if (chunk_arena_size < 0) {
+        LogPrintf("UDP: invalid -udpchunkarena=%d (must not be negative)\n", chunk_arena_size);
+        return false;
+    }
+    ChunkArena::SetDataSize(uint64_t(chunk_arena_size) << 20);
+
+    const int64_t block_codec = gArgs.GetArg("-udpblockcodec", DEFAULT_UDP_BLOCK_CODEC);
+    if (block_codec < 0 || block_codec > MAX_UDP_BLOCK_CODEC) {
+        LogPrintf("UDP: invalid -udpblockcodec=%d (must be between 0 and %u)\n", block_codec, MAX_UDP_BLOCK_CODEC);
+        return false;
+    }
+    SetUDPBlockCodecVersion(static_cast<codec_version_t>(block_codec));
+
+    int64_t n_fec_threads = gArgs.GetArg("-udpfecthreads", DEFAULT_UDP_FEC_THREADS);
+    if (n_fec_threads < 0 || n_fec_threads > MAX_UDP_FEC_THREADS) {
+        LogPrintf("UDP: invalid -udpfecthreads=%d (must be between 0 and %u)\n", n_fec_threads, MAX_UDP_FEC_THREADS);
+        return false;
+    }
+    if (n_fec_threads == 0)
+        n_fec_threads = std::min<int64_t>(std::max<int64_t>(GetNumCores(), 1), MAX_UDP_FEC_THREADS);
+
+    if (!ParseQueueBuffValues(gArgs.GetArg("-udpqueueweights", DEFAULT_UDP_QUEUE_WEIGHTS), udp_queue_weights, 1u)) {
+        LogPrintf("UDP: invalid -udpqueueweights=%s (must be four weights of at least 1)\n", gArgs.GetArg("-udpqueueweights", ""));
+        return false;
+    }
+
+    send_batch.reset(new UDPSendBatch(send_batch_size, use_gso));
+
+    for (int64_t i = 0; i < n_read_threads; i++) {
+        udp_read_threads.emplace_back();
+        UDPReadThread& reader = udp_read_threads.back();
+        reader.name = (i == 0) ? "udpread" : strprintf("udpread%d", i);
+        reader.batch.reset(new UDPRecvBatch(recv_batch_size));
+        reader.base = event_base_new();
+        if (!reader.base) {
+            FreeReadEventBases();
+            return false;
+        }
+    }
+
+#ifdef SO_REUSEPORT
+    const bool reuse_port = n_read_threads > 1;
+#else
+    const bool reuse_port = false;
+#endif
+
+    const std::vector<UDPInboundGroup> group_list(GetUDPInboundPorts());
+    for (const UDPInboundGroup& port : group_list) {
+        udp_socks.push_back(OpenUDPInboundSocket(port.port, reuse_port));
+        if (udp_socks.back() < 0) {
+            udp_socks.pop_back();
             CloseSocketsAndReadEvents();
+            FreeReadEventBases();
             return false;
         }
 
-        LogPrintf("UDP: Bound to port %hd for group %zu with %lu Mbps\n", port.first, udp_socks.size() - 1, port.second);
-    }
+        /* Bind one more socket to the same port for each additional read
+         * thread. The kernel then steers each peer (by address hash) to one
+         * of the sockets, preserving the packet order within a peer. */
+        if (reuse_port) {
+            for (int64_t i = 1; i < n_read_threads; i++) {
+                const int sock = OpenUDPInboundSocket(port.port, true);
+                if (sock < 0) {
+                    CloseSocketsAndReadEvents();
+                    FreeReadEventBases();
+                    return false;
+                }
+                udp_reuseport_socks.push_back(sock);
+                if (!AddReadEvent(udp_read_threads[i], sock)) {
+                    CloseSocketsAndReadEvents();
+                    FreeReadEventBases();
+                    return false;
+                }
+            }
+        }
 
-    event_base_read = event_base_new();
-    if (!event_base_read) {
-        CloseSocketsAndReadEvents();
-        return false;
+        LogPrintf("UDP: Bound to port %hd for group %zu with %lu Mbps\n", port.port, udp_socks.size() - 1, port.bw);
     }
 
     std::vector<UDPMulticastInfo> multicast_list;
     if (!GetUDPMulticastInfo(multicast_list)) {
         CloseSocketsAndReadEvents();
+        FreeReadEventBases();
         return false;
     }
 
     if (!InitializeUDPMulticast(udp_socks, multicast_list)) {
         CloseSocketsAndReadEvents();
+        FreeReadEventBases();
         return false;
     }
 
-    for (int socket : udp_socks) {
-        event *read_event = event_new(event_base_read, socket, EV_READ | EV_PERSIST, read_socket_func, nullptr);
-        if (!read_event) {
-            event_base_free(event_base_read);
+    /* The primary unicast sockets are handled by the first read thread (their
+     * SO_REUSEPORT siblings were assigned above), whereas multicast sockets
+     * are spread over all read threads in round-robin fashion. */
+    for (size_t i = 0; i < udp_socks.size(); i++) {
+        const size_t reader_idx = (i < group_list.size()) ? 0 : (i - group_list.size()) % udp_read_threads.size();
+        if (!AddReadEvent(udp_read_threads[reader_idx], udp_socks[i])) {
             CloseSocketsAndReadEvents();
+            FreeReadEventBases();
             return false;
         }
-        read_events.push_back(read_event);
-        event_add(read_event, nullptr);
     }
 
-    timer_event = event_new(event_base_read, -1, EV_PERSIST, timer_func, nullptr);
+    timer_event = event_new(udp_read_threads[0].base, -1, EV_PERSIST, timer_func, nullptr);
     if (!timer_event) {
         CloseSocketsAndReadEvents();
-        event_base_free(event_base_read);
+        FreeReadEventBases();
         return false;
     }
     timer_interval.tv_sec = 0;
@@ -695,23 +1185,26 @@ bool InitializeUDPConnections(NodeContext* const node_context) {
     /* Multicast transmission threads */
     LaunchMulticastBackfillThreads();
 
-    BlockRecvInit(node_context->chainman);
+    BlockRecvInit(node_context->chainman, n_fec_threads);
 
     /* Load partial blocks acquired in previous sessions */
     LoadPartialBlocks(node_context->mempool.get());
 
-    udp_read_thread.reset(new std::thread(&TraceThread<void (*)()>, "udpread", &ThreadRunReadEventLoop));
+    for (UDPReadThread& reader : udp_read_threads)
+        reader.thread.reset(new std::thread(&TraceThread<std::function<void()>>, reader.name.c_str(), std::function<void()>(std::bind(&ThreadRunReadEventLoop, reader.base))));
 
     return true;
 }
 
 void StopUDPConnections() {
-    if (!udp_read_thread)
+    if (udp_read_threads.empty())
         return;
 
-    event_base_loopbreak(event_base_read);
-    udp_read_thread->join();
-    udp_read_thread.reset();
+    for (UDPReadThread& reader : udp_read_threads) {
+        event_base_loopbreak(reader.base);
+        reader.thread->join();
+        reader.thread.reset();
+    }
 
     BlockRecvShutdown();
 
@@ -723,6 +1216,7 @@ void StopUDPConnections() {
             SendMessage(msg, sizeof(UDPMessageHeader), true, s);
     }
     mapUDPNodes.clear();
+    mapMulticastRoutes.clear();
 
     send_messages_flush_and_break();
 
@@ -733,11 +1227,13 @@ void StopUDPConnections() {
     for (std::thread& t : mcast_tx_threads)
         t.join();
     mcast_tx_threads.clear();
+    ClearUDPBlockCache();
 
     CloseSocketsAndReadEvents();
 
     event_free(timer_event);
-    event_base_free(event_base_read);
+    FreeReadEventBases();
+    send_batch.reset();
 }
 
 
@@ -747,6 +1243,8 @@ void StopUDPConnections() {
  */
 
 static std::map<CService, UDPConnectionState>::iterator silent_disconnect(const std::map<CService, UDPConnectionState>::iterator& it) {
+    if (it->second.connection.udp_mode == udp_mode_t::multicast)
+        SetMulticastRoutes(it->first, mapUDPNodes.end());
     return mapUDPNodes.erase(it);
 }
 
@@ -789,57 +1287,176 @@ static void UpdateUdpMulticastRxBytes(const UDPMulticastInfo& mcast_info, const
     }
 }
 
-static void read_socket_func(evutil_socket_t fd, short event, void* arg) {
-    const bool fBench = LogAcceptCategory(BCLog::BENCH);
-    std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+/* Whether a socket call failed only because it would have blocked */
+static inline bool IsWouldBlock(int err) {
+#if EAGAIN != EWOULDBLOCK
+    if (err == EAGAIN)
+        return true;
+#endif
+    return err == EWOULDBLOCK;
+}
 
-    UDPMessage msg{};
-    /* We will place the incoming UDP message payload into `msg`. However, not
-     * necessarily the incoming payload will fill the entire `UDPMessage`
-     * structure. Hence, zero-initialize `msg` here. */
-    struct sockaddr_in6 remoteaddr;
-    socklen_t remoteaddrlen = sizeof(remoteaddr);
-
-    ssize_t res = recvfrom(fd, &msg, sizeof(msg), MSG_DONTWAIT, (sockaddr*)&remoteaddr, &remoteaddrlen);
-    if (res < 0) {
-        int err = errno;
-        LogPrintf("UDP: Error reading from socket: %d (%s)!\n", err, strerror(err));
-        return;
+/* Read up to batch.Size() datagrams from the socket without blocking. Returns
+ * the number of datagrams placed in the batch slots. */
+static size_t RecvUDPBatch(evutil_socket_t fd, UDPRecvBatch& batch) {
+    size_t n_recvd = 0;
+#ifdef __linux__
+    if (batch.Size() > 1) {
+        for (size_t i = 0; i < batch.Size(); i++)
+            batch.hdrs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+        int res = recvmmsg(fd, batch.hdrs.data(), batch.Size(), MSG_DONTWAIT, nullptr);
+        if (res < 0) {
+            int err = errno;
+            if (!IsWouldBlock(err))
+                LogPrintf("UDP: Error reading from socket: %d (%s)!\n", err, strerror(err));
+            return 0;
+        }
+        for (int i = 0; i < res; i++) {
+            assert(batch.hdrs[i].msg_hdr.msg_namelen == sizeof(struct sockaddr_in6));
+            batch.lens[i] = batch.hdrs[i].msg_len;
+        }
+        n_recvd = res;
+    } else
+#endif
+    {
+        while (n_recvd < batch.Size()) {
+            socklen_t remoteaddrlen = sizeof(struct sockaddr_in6);
+            ssize_t res = recvfrom(fd, &batch.msgs[n_recvd], sizeof(UDPMessage), MSG_DONTWAIT, (sockaddr*)&batch.addrs[n_recvd], &remoteaddrlen);
+            if (res < 0) {
+                int err = errno;
+                if (!IsWouldBlock(err))
+                    LogPrintf("UDP: Error reading from socket: %d (%s)!\n", err, strerror(err));
+                break;
+            }
+            assert(remoteaddrlen == sizeof(struct sockaddr_in6));
+            batch.lens[n_recvd++] = res;
+        }
     }
-    assert(remoteaddrlen == sizeof(remoteaddr));
-    CService c_remoteaddr(remoteaddr);
-
-    if (size_t(res) < sizeof(UDPMessageHeader) || size_t(res) >= sizeof(UDPMessage))
-        return;
 
-    std::unique_lock<std::recursive_mutex> lock(cs_mapUDPNodes);
+    /* The incoming payload does not necessarily fill the entire `UDPMessage`
+     * structure and the slots are reused across reads. Hence, zero the
+     * remainder of each message here. */
+    for (size_t i = 0; i < n_recvd; i++) {
+        if (batch.lens[i] < sizeof(UDPMessage))
+            memset((char*)&batch.msgs[i] + batch.lens[i], 0, sizeof(UDPMessage) - batch.lens[i]);
+    }
+    return n_recvd;
+}
 
+/* Find the node that sent a datagram from remoteaddr through socket fd. If
+ * the node is a multicast Tx node, its multicast instance is returned via itm.
+ * Requires cs_mapUDPNodes. */
+static std::map<CService, UDPConnectionState>::iterator FindUDPNode(evutil_socket_t fd, const CService& remoteaddr,
+                                                                    std::map<std::tuple<CService, int, uint16_t>, UDPMulticastInfo>::iterator& itm) {
     /* Is this coming from a multicast Tx node and through a multicast Rx
-     * socket? */
-    bool from_mcast_tx = false;
+     * socket? If so, the node is resolved by the socket and the source IP
+     * only, and not with the address brought by `recvfrom`, which includes
+     * the source port. This is because the source port of multicast Tx nodes
+     * can be random. */
+    itm = mapMulticastNodes.end();
+    const auto route = mapMulticastRoutes.find(std::make_pair((int)fd, (CNetAddr)remoteaddr));
+    if (route != mapMulticastRoutes.end()) {
+        itm = route->second.mcast_it;
+        return route->second.node_it;
+    }
+    return mapUDPNodes.find(remoteaddr);
+}
+
+/* HandleBlockTxMessage may release cs_mapUDPNodes while it feeds a chunk to
+ * the FEC decoder, meanwhile the node may be dropped (e.g., timed out by the
+ * timer of another read thread). Look the node up again by its address,
+ * checking it is still the same connection, rather than reusing iterators or
+ * references obtained before the call. Requires cs_mapUDPNodes. */
+static std::map<CService, UDPConnectionState>::iterator RefindUDPNode(const CService& addr, uint64_t local_magic) {
+    const auto it = mapUDPNodes.find(addr);
+    if (it != mapUDPNodes.end() && it->second.connection.local_magic != local_magic)
+        return mapUDPNodes.end();
+    return it;
+}
+
+static bool IsValidUDPMessageSize(const size_t res) {
+    return res >= sizeof(UDPMessageHeader) && res < sizeof(UDPMessage);
+}
+
+/* Look up the checksum key of the sender of each datagram in the batch.
+ * Requires cs_mapUDPNodes. */
+static void ResolveChecksumKeys(evutil_socket_t fd, UDPRecvBatch& batch, const size_t n) {
     std::map<std::tuple<CService, int, uint16_t>, UDPMulticastInfo>::iterator itm;
-    for (itm = mapMulticastNodes.begin(); itm != mapMulticastNodes.end(); ++itm) {
-        if ((CNetAddr)c_remoteaddr == (CNetAddr)(std::get<0>(itm->first))) {
-            if (fd == itm->second.fd) {
-                from_mcast_tx = true;
-                break;
-            }
+    for (size_t i = 0; i < n; i++) {
+        batch.auth_results[i].reset();
+        if (!IsValidUDPMessageSize(batch.lens[i]))
+            continue;
+        batch.senders[i] = CService(batch.addrs[i]);
+        const auto it = FindUDPNode(fd, batch.senders[i], itm);
+        if (it == mapUDPNodes.end())
+            continue;
+        batch.auth_keys[i] = it->second.local_key;
+        batch.auth_results[i] = false;
+    }
+}
+
+/* Unscramble and authenticate the datagrams of a batch whose keys were
+ * resolved by ResolveChecksumKeys. Does not require cs_mapUDPNodes. */
+static void CheckChecksums(UDPRecvBatch& batch, const size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (!IsValidUDPMessageSize(batch.lens[i]))
+            continue;
+        ScrambleMessage(batch.msgs[i], batch.msgs[i], batch.lens[i]);
+        if (batch.auth_results[i])
+            batch.auth_results[i] = VerifyChecksum(batch.auth_keys[i], batch.msgs[i], batch.lens[i]);
+    }
+}
+
+static void HandleUDPMessage(evutil_socket_t fd, UDPRecvBatch& batch, const size_t idx, std::unique_lock<std::recursive_mutex>& lock);
+
+static void read_socket_func(evutil_socket_t fd, short event, void* arg) {
+    UDPRecvBatch& batch = *(UDPRecvBatch*)arg;
+
+    for (unsigned int i = 0; i < MAX_RECV_BATCHES_PER_WAKEUP; i++) {
+        const size_t n_recvd = RecvUDPBatch(fd, batch);
+        if (n_recvd == 0)
+            return;
+
+        {
+            std::unique_lock<std::recursive_mutex> lock(cs_mapUDPNodes);
+            ResolveChecksumKeys(fd, batch, n_recvd);
         }
+
+        CheckChecksums(batch, n_recvd);
+
+        {
+            std::unique_lock<std::recursive_mutex> lock(cs_mapUDPNodes);
+            for (size_t j = 0; j < n_recvd; j++)
+                HandleUDPMessage(fd, batch, j, lock);
+        }
+
+        // A short read means the socket has been drained
+        if (n_recvd < batch.Size())
+            return;
     }
+}
 
-    /* If receiving from a multicast service, find node by IP only and not with
-     * the address brought by `recvfrom`, which includes the source port. This
-     * is because the source port of multicast Tx nodes can be random. */
-    std::map<CService, UDPConnectionState>::iterator it;
-    if (from_mcast_tx) {
-        const CService& mcasttx_addr = std::get<0>(itm->first);
-        it = mapUDPNodes.find(mcasttx_addr);
-    } else
-        it = mapUDPNodes.find(c_remoteaddr);
+/* Process the datagram in slot idx of a batch received through socket fd and
+ * already unscrambled by CheckChecksums. Requires cs_mapUDPNodes to be held
+ * through lock, which may be released temporarily while decoding. */
+static void HandleUDPMessage(evutil_socket_t fd, UDPRecvBatch& batch, const size_t idx, std::unique_lock<std::recursive_mutex>& lock) {
+    const bool fBench = LogAcceptCategory(BCLog::BENCH);
+    std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+
+    UDPMessage& msg = batch.msgs[idx];
+    const size_t res = batch.lens[idx];
+    if (!IsValidUDPMessageSize(res))
+        return;
 
+    std::map<std::tuple<CService, int, uint16_t>, UDPMulticastInfo>::iterator itm;
+    std::map<CService, UDPConnectionState>::iterator it = FindUDPNode(fd, batch.senders[idx], itm);
     if (it == mapUDPNodes.end())
         return;
-    if (!CheckChecksum(it->second.connection.local_magic, msg, res)) {
+
+    /* The node may have (re)connected since the batch was authenticated */
+    const bool auth_ok = (batch.auth_results[idx] && batch.auth_keys[idx].magic == it->second.local_key.magic) ?
+        *batch.auth_results[idx] : VerifyChecksum(it->second.local_key, msg, res);
+    if (!auth_ok) {
         LogPrintf("UDP: Checksum error on message from %s\n", it->first.ToString());
         return;
     }
@@ -855,15 +1472,23 @@ static void read_socket_func(evutil_socket_t fd, short event, void* arg) {
             LogPrintf("Couldn't find multicast node\n");
             return;
         }
-        const UDPMulticastInfo& mcast_info = itm->second;
-
         if (msg_type_masked == MSG_TYPE_BLOCK_HEADER ||
             msg_type_masked == MSG_TYPE_BLOCK_CONTENTS ||
             msg_type_masked == MSG_TYPE_TX_CONTENTS) {
-            if (!HandleBlockTxMessage(msg, sizeof(UDPMessage) - 1, it->first, it->second, start, fd, g_node_context))
+            const CService node_addr = it->first;
+            const uint64_t local_magic = state.connection.local_magic;
+            const auto mcast_key = itm->first;
+            const bool ok = HandleBlockTxMessage(msg, sizeof(UDPMessage) - 1, it->first, it->second, start, fd, g_node_context, lock);
+            it = RefindUDPNode(node_addr, local_magic);
+            if (it == mapUDPNodes.end())
+                return;
+            if (!ok) {
                 send_and_disconnect(it);
-            else
-                UpdateUdpMulticastRxBytes(mcast_info, res);
+            } else {
+                itm = mapMulticastNodes.find(mcast_key);
+                if (itm != mapMulticastNodes.end())
+                    UpdateUdpMulticastRxBytes(itm->second, res);
+            }
         } else
             LogPrintf("UDP: Unexpected message from %s!\n", it->first.ToString());
 
@@ -909,7 +1534,13 @@ static void read_socket_func(evutil_socket_t fd, short event, void* arg) {
         return;
 
     if (msg_type_masked == MSG_TYPE_BLOCK_HEADER || msg_type_masked == MSG_TYPE_BLOCK_CONTENTS) {
-        if (!HandleBlockTxMessage(msg, res, it->first, it->second, start, fd, g_node_context)) {
+        const CService node_addr = it->first;
+        const uint64_t local_magic = state.connection.local_magic;
+        const bool ok = HandleBlockTxMessage(msg, res, it->first, it->second, start, fd, g_node_context, lock);
+        it = RefindUDPNode(node_addr, local_magic);
+        if (it == mapUDPNodes.end())
+            return;
+        if (!ok) {
             send_and_disconnect(it);
             return;
         }
@@ -1036,49 +1667,177 @@ static void timer_func(evutil_socket_t fd, short event, void* arg) {
     }
 }
 
-static inline void SendMessage(const UDPMessage& msg, const unsigned int length, PerGroupMessageQueue& queue, RingBuffer<RingBufferElement>& buff, const CService& service, const uint64_t magic) {
-    std::unique_lock<std::mutex> lock(non_empty_queues_cv_mutex);
-    const bool was_empty = buff.IsEmpty();
-    lock.unlock();
+/* Wake up the write thread if it is waiting for messages. Pairs with the fence
+ * in do_send_messages, such that either the write thread sees the message just
+ * written or we see it sleeping. */
+static inline void WakeUpSendThread() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (send_thread_sleeping.load(std::memory_order_relaxed)) {
+        { std::lock_guard<std::mutex> lock(non_empty_queues_cv_mutex); }
+        non_empty_queues_cv.notify_all();
+    }
+}
+
+static inline void SetElementMessage(RingBufferElement& elem, const UDPMessage& msg, const unsigned int length) {
+    elem.shared_msg.reset();
+    memcpy(&elem.msg, &msg, length);
+}
+
+static inline void SetElementMessage(RingBufferElement& elem, const std::shared_ptr<const UDPMessage>& msg, const unsigned int length) {
+    elem.shared_msg = msg;
+}
 
+template <typename Msg>
+static inline void SendMessage(const Msg& msg, const unsigned int length, PerGroupMessageQueue& queue, TxRingBuffer& buff, const UDPSockAddr& addr, const uint64_t magic) {
     buff.WriteElement([&](RingBufferElement& elem) {
-            elem.service = service;
+            elem.addr    = addr;
             elem.length  = length;
             elem.magic   = magic;
-            memcpy(&elem.msg, &msg, length);
+            SetElementMessage(elem, msg, length);
         });
 
-    if (was_empty)
-        non_empty_queues_cv.notify_all();
+    WakeUpSendThread();
 }
 
-void SendMessage(const UDPMessage& msg, const unsigned int length, bool high_prio, const CService& service, const uint64_t magic, size_t group) {
+template <typename Msg>
+static void SendMessage(const Msg& msg, const unsigned int length, bool high_prio, const UDPSockAddr& addr, const uint64_t magic, size_t group) {
     assert(length <= sizeof(UDPMessage));
     assert(mapTxQueues.count(group));
     PerGroupMessageQueue& queue = mapTxQueues[group];
-    RingBuffer<RingBufferElement>& buff = high_prio ? queue.buffs[0] : queue.buffs[1];
-    SendMessage(msg, length, queue, buff, service, magic);
+    TxRingBuffer& buff = high_prio ? queue.buffs[0] : queue.buffs[1];
+    SendMessage(msg, length, queue, buff, addr, magic);
+}
+
+void SendMessage(const UDPMessage& msg, const unsigned int length, bool high_prio, const CService& service, const uint64_t magic, size_t group) {
+    SendMessage(msg, length, high_prio, UDPSockAddr(service), magic, group);
 }
 
 void SendMessage(const UDPMessage& msg, const unsigned int length, bool high_prio, const std::pair<const CService, UDPConnectionState>& node) {
-    SendMessage(msg, length, high_prio, node.first, node.second.connection.remote_magic, node.second.connection.group);
+    SendMessage(msg, length, high_prio, node.second.remote_addr, node.second.connection.remote_magic, node.second.connection.group);
+}
+
+void SendMessage(const std::shared_ptr<const UDPMessage>& msg, const unsigned int length, bool high_prio, const CService& service, const uint64_t magic, size_t group) {
+    SendMessage(msg, length, high_prio, UDPSockAddr(service), magic, group);
+}
+
+void SendMessage(const std::shared_ptr<const UDPMessage>& msg, const unsigned int length, bool high_prio, const std::pair<const CService, UDPConnectionState>& node) {
+    SendMessage(msg, length, high_prio, node.second.remote_addr, node.second.connection.remote_magic, node.second.connection.group);
 }
 
 static inline bool IsAnyQueueReady() {
-    bool have_work = false;
-    for (auto& q : mapTxQueues) {
-        PerGroupMessageQueue& queue = q.second;
-        queue.NextBuff();
-        if (queue.buff_id != -1) {
-            have_work = true;
-            break;
+    for (const auto& q : mapTxQueues) {
+        if (q.second.HasMessages())
+            return true;
+    }
+    return false;
+}
+
+/* Whether a group that is not waiting for its tokens has messages, e.g. an idle
+ * group that just had a message queued */
+static inline bool IsAnyGroupDue(std::chrono::steady_clock::time_point t_now) {
+    for (const auto& q : mapTxQueues) {
+        if (q.second.next_send <= t_now && q.second.HasMessages())
+            return true;
+    }
+    return false;
+}
+
+#ifdef __linux__
+/* Send elems[0..n) with a single sendmmsg call. When GSO is enabled, each run
+ * of equally-sized messages towards the same destination is carried by a
+ * single mmsghdr with a UDP_SEGMENT control message. With txtime, each message
+ * instead carries its departure time in a SCM_TXTIME control message. Returns
+ * the number of leading elements that were handed to the kernel, or -1 on
+ * error (with errno set). */
+static ssize_t SendUDPBatchMmsg(int fd, UDPSendBatch& batch, size_t n, bool txtime) {
+    size_t n_hdrs = 0;
+    for (size_t i = 0; i < n; n_hdrs++) {
+        const RingBufferElement* first = batch.elems[i];
+        size_t n_segs = 1;
+        if (batch.gso && !txtime) {
+            const size_t max_segs = std::min(UDP_GSO_MAX_SEGMENTS, UDP_GSO_MAX_BYTES / first->length);
+            while (i + n_segs < n && n_segs < max_segs &&
+                   batch.elems[i + n_segs]->length == first->length &&
+                   batch.elems[i + n_segs]->addr == first->addr)
+                n_segs++;
         }
+
+        struct msghdr& hdr = batch.hdrs[n_hdrs].msg_hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        for (size_t j = 0; j < n_segs; j++) {
+            batch.iovs[i + j].iov_base = (void*)&batch.elems[i + j]->msg;
+            batch.iovs[i + j].iov_len = batch.elems[i + j]->length;
+        }
+        hdr.msg_name = (void*)&first->addr.addr;
+        hdr.msg_namelen = first->addr.len;
+        hdr.msg_iov = &batch.iovs[i];
+        hdr.msg_iovlen = n_segs;
+        if (n_segs > 1) {
+            hdr.msg_control = batch.cmsgs[n_hdrs].data();
+            hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            struct cmsghdr* cm = CMSG_FIRSTHDR(&hdr);
+            cm->cmsg_level = IPPROTO_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            const uint16_t gso_size = first->length;
+            memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+        } else if (txtime) {
+            hdr.msg_control = batch.cmsgs[n_hdrs].data();
+            hdr.msg_controllen = CMSG_SPACE(sizeof(uint64_t));
+            struct cmsghdr* cm = CMSG_FIRSTHDR(&hdr);
+            cm->cmsg_level = SOL_SOCKET;
+            cm->cmsg_type = SCM_TXTIME;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+            memcpy(CMSG_DATA(cm), &batch.txtimes[i], sizeof(uint64_t));
+        }
+        batch.n_segs[n_hdrs] = n_segs;
+        i += n_segs;
     }
-    return have_work;
+
+    int res = sendmmsg(fd, batch.hdrs.data(), n_hdrs, 0);
+    if (res < 0)
+        return -1;
+
+    size_t n_sent = 0;
+    for (int i = 0; i < res; i++)
+        n_sent += batch.n_segs[i];
+    return n_sent;
 }
+#endif
 
-// Maximum number of consecutive transmissions from the same queue
-static int max_consecutive_tx = 10;
+/* Transmit the first n elements of the batch through socket fd, each at its
+ * departure time in batch.txtimes if txtime is set. Returns the number of
+ * leading elements sent. When the result is lower than n, `errno` describes
+ * why the next element could not be sent. */
+static size_t SendUDPBatch(int fd, UDPSendBatch& batch, size_t n, bool txtime) {
+#ifdef __linux__
+    if (n > 1 || txtime) {
+        ssize_t res = SendUDPBatchMmsg(fd, batch, n, txtime);
+        if (res < 0 && batch.gso && (errno == EINVAL || errno == EIO || errno == ENOPROTOOPT)) {
+            /* The kernel or the NIC does not support UDP GSO. Fall back to
+             * plain sendmmsg from now on and retry. */
+            LogPrintf("UDP: UDP GSO send failed (%s), disabling GSO\n", strerror(errno));
+            batch.gso = false;
+            res = SendUDPBatchMmsg(fd, batch, n, txtime);
+        }
+        if (res < 0)
+            return 0;
+        /* sendmmsg drops the error code of a partially sent batch. Report it
+         * as a full socket buffer, such that the remaining messages are
+         * retried and any persistent error surfaces on the next call. */
+        if ((size_t)res < n)
+            errno = EAGAIN;
+        return res;
+    }
+#endif
+    for (size_t i = 0; i < n; i++) {
+        const RingBufferElement* elem = batch.elems[i];
+        ssize_t res = sendto(fd, &elem->msg, elem->length, 0, &elem->addr.addr.sa, elem->addr.len);
+        if (res != elem->length)
+            return i;
+    }
+    return n;
+}
 
 static void do_send_messages() {
 #ifndef WIN32
@@ -1093,6 +1852,15 @@ static void do_send_messages() {
         }
     }
 #endif
+#ifdef __linux__
+    /* Don't let the kernel defer timed wake-ups by the default 50 us timer
+     * slack, which would throw off the departures of timer-paced groups */
+    prctl(PR_SET_TIMERSLACK, 1);
+#endif
+
+    /* Key schedule of the last checksum magic. Consecutive messages are
+     * usually destined to the same peer or multicast stream. */
+    UDPChecksumKey tx_key;
 
     // Keep one poll configuration for each queue */
     std::map<ssize_t, int> map_pollfd;
@@ -1100,13 +1868,16 @@ static void do_send_messages() {
     const int nfds = mapTxQueues.size();
     pfds = (struct pollfd *) calloc(nfds, sizeof(struct pollfd));
 
-    /* Initialize state of the Tx queues and the corresponding pollfd structs */
-    const std::chrono::steady_clock::time_point t_now(std::chrono::steady_clock::now());
+    /* Initialize state of the Tx queues and the corresponding pollfd structs.
+     * A pollfd only watches its socket (fd != -1) while the queue waits for
+     * the socket to become writable. */
+    const std::chrono::steady_clock::time_point t_start(std::chrono::steady_clock::now());
     int i_pollfd = 0;
     for (auto& q : mapTxQueues) {
-        q.second.next_send    = t_now;
+        q.second.next_send    = t_start;
+        q.second.buff_next_send.fill(t_start);
         q.second.buff_id      = -1;
-        pfds[i_pollfd].fd     = udp_socks[q.first];
+        pfds[i_pollfd].fd     = -1;
         pfds[i_pollfd].events = POLLOUT;
         map_pollfd[q.first]   = i_pollfd;
         assert(pfds[i_pollfd].revents == 0);
@@ -1116,167 +1887,261 @@ static void do_send_messages() {
     while (true) {
         if (send_messages_break)
             return;
-        /* If all queues are rate-limited, keep track of the next upcoming
-         * transmission time and, by the end of this loop, sleep until this time
-         * comes. Start with a timestamp far into the future and reduce the
-         * timestamp for each queue. If there is any non rate-limited (i.e.,
-         * unlimited) queue, this sleeping mechanism will be effectively
-         * disabled, as t_next_tx will always converge to the current time in
-         * subsequent calls to std::min. In this case (with unlimited queues),
-         * the sleeping is handled through blocking calls to poll() instead of
-         * using "sleep_until(t_next_tx)".
-         *
-         * Ideally, either all queues are rate-limited or all unlimited. Mixing
-         * rate-limited with unlimited queues won't lead to efficient
-         * sleeping. */
+        /* The groups are served by deficit round robin: on its turn, each
+         * group with messages may send its weight times max_consecutive_tx
+         * messages' worth of bytes, before moving on to the next group. A group
+         * whose turn ends early because it ran out of tokens or because its
+         * socket would block waits on its own until then, while the others
+         * keep transmitting. When no group can transmit right away, the
+         * thread sleeps until the earliest one of the following: the next
+         * rate-limited group gets its tokens (t_next_tx), a blocked socket
+         * becomes writable, or a message is queued into an empty group. */
         std::chrono::steady_clock::time_point t_next_tx(
             std::chrono::steady_clock::now() + std::chrono::minutes(60));
+        /* Earliest departure of a timer-paced group, which the thread wakes up
+         * early for and spins until */
+        std::chrono::steady_clock::time_point t_next_paced(t_next_tx);
 
         /* Iterate over Tx queues and schedule transmissions */
         bool maybe_all_empty = true; // unless told otherwise
-        bool maybe_all_full  = (mapTxQueues.size() > 0); // likewise
+        bool any_ready = false;      // some group can transmit right away
+        bool any_blocked = false;    // some group waits for its socket
 
         for (auto& q : mapTxQueues) {
             PerGroupMessageQueue& queue   = q.second;
             const size_t group            = q.first;
-            const std::chrono::steady_clock::time_point t_now(std::chrono::steady_clock::now());
+            struct pollfd& pfd            = pfds[map_pollfd[group]];
+            std::chrono::steady_clock::time_point t_now(std::chrono::steady_clock::now());
 
             if (queue.next_send > t_now) {
                 t_next_tx = std::min(t_next_tx, queue.next_send);
+                if (queue.pacing == UDPPacing::TIMER)
+                    t_next_paced = std::min(t_next_paced, queue.next_send);
+                maybe_all_empty = false;
                 continue;
             }
 
-            /* Search a higher priority non-empty buffer if... */
-            if (queue.buff_id != 0 || // we are not currently in the highest priority buffer
-                queue.buffs[queue.buff_id].IsEmpty()) { // ...the current buffer is empty
-                queue.NextBuff();
-            }
-
-            if (queue.buff_id == -1) { // all buffers of this group are empty
+            queue.NextBuff(t_now);
+            if (queue.buff_id == -1) {
+                queue.deficit = 0;
+                if (queue.HasMessages()) {
+                    /* All non-empty buffers are held back by their ceilings,
+                     * unless some buffer just received its first message */
+                    maybe_all_empty = false;
+                    bool held_back = false;
+                    for (const auto& t : queue.buff_next_send) {
+                        if (t > t_now) {
+                            queue.next_send = held_back ? std::min(queue.next_send, t) : t;
+                            held_back = true;
+                        }
+                    }
+                    if (held_back)
+                        t_next_tx = std::min(t_next_tx, queue.next_send);
+                    else
+                        any_ready = true;
+                }
                 continue;
             }
+            pfd.fd = -1;
+            queue.deficit += queue.weight * max_consecutive_tx * TX_BUFF_QUANTUM;
 
-            // Read from the ring buffer and send over the network
-            RingBuffer<RingBufferElement>* buff = &queue.buffs[queue.buff_id];
-
-            int consecutive_tx = 0;     // packets tx'ed consecutively from this queue
             bool wouldblock = false;
-            /* Keep going as long as... */
-            while ((queue.buff_id != -1) && // the queue has messages to transmit
-                   (queue.unlimited || queue.ratelimiter.HasQuota(sizeof(UDPMessage))) && // the output bitrate is OK
-                   (consecutive_tx < max_consecutive_tx)) { // we are not depriving other queues
-                // Get the next message for transmission
-                ReadProxy<RingBufferElement> rd_proxy(buff);
-                RingBufferElement* next_tx = rd_proxy.GetObj();
+            bool out_of_tokens = false;
+            /* Keep going as long as the queue has messages to transmit and it
+             * is still the group's turn */
+            while (queue.buff_id != -1 && queue.deficit > 0) {
+                const size_t buff_id = queue.buff_id;
+                TxRingBuffer* buff = &queue.buffs[buff_id];
+                TokenBucket& ratelimiter = queue.buff_ratelimiters[buff_id];
+
+                // Is the output bitrate OK?
+                if (!ratelimiter.HasTokens(sizeof(UDPMessage), t_now)) {
+                    if (!queue.ratelimiter.HasTokens(sizeof(UDPMessage), t_now)) {
+                        out_of_tokens = true;
+                        break;
+                    }
+                    // Only this buffer reached its ceiling, move on to the next
+                    queue.buff_next_send[buff_id] = t_now + ratelimiter.TimeUntil(sizeof(UDPMessage), t_now);
+                    queue.buff_deficits[buff_id] = 0;
+                    queue.NextBuff(t_now);
+                    continue;
+                }
+
+                // Get the next batch of messages for transmission
+                BatchReadProxy<RingBufferElement, TxRingBuffer> rd_proxy(buff, send_batch->elems.data(), send_batch->Size());
+
+                /* Limit the batch to the available tokens and to the deficits
+                 * of the buffer and of the group, which may each be overdrawn
+                 * by up to one message */
+                size_t n_batch = 0;
+                uint32_t batch_bytes = 0;
+                while (n_batch < rd_proxy.Size() &&
+                       batch_bytes < queue.deficit && batch_bytes < queue.buff_deficits[buff_id] &&
+                       (n_batch == 0 || ratelimiter.HasTokens(batch_bytes + rd_proxy[n_batch]->length, t_now))) {
+                    batch_bytes += rd_proxy[n_batch]->length;
+                    n_batch++;
+                }
 
                 // Set the checksum and scramble the data
-                if (next_tx->msg.header.chk1 == 0 && next_tx->msg.header.chk2 == 0) {
-                    if (queue.multicast) {
-                        assert((next_tx->msg.header.msg_type & UDP_MSG_TYPE_TYPE_MASK) == MSG_TYPE_BLOCK_HEADER ||
-                               (next_tx->msg.header.msg_type & UDP_MSG_TYPE_TYPE_MASK) == MSG_TYPE_BLOCK_CONTENTS ||
-                               (next_tx->msg.header.msg_type & UDP_MSG_TYPE_TYPE_MASK) == MSG_TYPE_TX_CONTENTS);
+                for (size_t i = 0; i < n_batch; i++) {
+                    RingBufferElement* next_tx = rd_proxy[i];
+                    /* Shared payloads are always checksummed into the
+                     * element's own message. Afterwards the reference is
+                     * dropped, so that a retry after EWOULDBLOCK does not
+                     * checksum the message twice. */
+                    const bool shared = (bool)next_tx->shared_msg;
+                    const UDPMessage& payload = shared ? *next_tx->shared_msg : next_tx->msg;
+                    if (shared || (payload.header.chk1 == 0 && payload.header.chk2 == 0)) {
+                        if (queue.multicast) {
+                            assert((payload.header.msg_type & UDP_MSG_TYPE_TYPE_MASK) == MSG_TYPE_BLOCK_HEADER ||
+                                   (payload.header.msg_type & UDP_MSG_TYPE_TYPE_MASK) == MSG_TYPE_BLOCK_CONTENTS ||
+                                   (payload.header.msg_type & UDP_MSG_TYPE_TYPE_MASK) == MSG_TYPE_TX_CONTENTS);
+                        }
+                        if (next_tx->magic != tx_key.magic)
+                            tx_key.Set(next_tx->magic);
+                        FillChecksum(tx_key, payload, next_tx->msg, next_tx->length);
+                        next_tx->shared_msg.reset();
                     }
-                    FillChecksum(next_tx->magic, next_tx->msg, next_tx->length);
                 }
 
-                // Set destination address
-                sockaddr_storage ss = {};
-                socklen_t addrlen;
-                if (next_tx->service.IsIPv6()) {
-                    sockaddr_in6 *remoteaddr = (sockaddr_in6 *) &ss;
-                    remoteaddr->sin6_family = AF_INET6;
-                    assert(next_tx->service.GetIn6Addr(&remoteaddr->sin6_addr));
-                    remoteaddr->sin6_port = htons(next_tx->service.GetPort());
-                    addrlen = sizeof(sockaddr_in6);
-                } else {
-                    sockaddr_in *remoteaddr = (sockaddr_in *) &ss;
-                    remoteaddr->sin_family = AF_INET;
-                    assert(next_tx->service.GetInAddr(&remoteaddr->sin_addr));
-                    remoteaddr->sin_port = htons(next_tx->service.GetPort());
-                    addrlen = sizeof(sockaddr_in);
+                /* Stamp the departure times of kernel-paced groups, spaced
+                 * apart at the group's rate, but never in the past */
+                const std::chrono::steady_clock::time_point t_send(std::chrono::steady_clock::now());
+                const bool txtime = (queue.pacing == UDPPacing::TXTIME);
+                if (txtime) {
+                    std::chrono::steady_clock::time_point t_departure = std::max(t_send, queue.txtime_next);
+                    for (size_t i = 0; i < n_batch; i++) {
+                        send_batch->txtimes[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(t_departure.time_since_epoch()).count();
+                        t_departure += std::chrono::nanoseconds(static_cast<int64_t>(rd_proxy[i]->length * queue.ns_per_byte));
+                    }
+                    queue.txtime_next = t_departure;
                 }
 
                 // Try to transmit
-                ssize_t res = sendto(udp_socks[group], &next_tx->msg, next_tx->length, 0, (sockaddr *) &ss, addrlen);
-                if (res != next_tx->length) {
-                    /* Likely EAGAIN/EWOULDBLOCK. Don't advance the buffer's
-                     * read pointer and try again later */
-                    if (errno == EWOULDBLOCK) {
+                const size_t n_sent = SendUDPBatch(udp_socks[group], *send_batch, n_batch, txtime);
+                const int send_errno = errno;
+                uint32_t sent_bytes = 0;
+                for (size_t i = 0; i < n_sent; i++)
+                    sent_bytes += rd_proxy[i]->length;
+
+                if (queue.ns_per_byte > 0) {
+                    for (size_t i = 0; i < n_sent; i++) {
+                        const std::chrono::steady_clock::time_point t_departure = txtime ?
+                            std::chrono::steady_clock::time_point(std::chrono::nanoseconds(send_batch->txtimes[i])) : t_send;
+                        queue.jitter.Add(t_departure, rd_proxy[i]->length, queue.ns_per_byte);
+                    }
+                    // Unsent messages get new departure times on their retry
+                    if (txtime && n_sent < n_batch)
+                        queue.txtime_next = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(send_batch->txtimes[n_sent]));
+                }
+
+                // Consume the tokens and deficits
+                t_now = std::chrono::steady_clock::now();
+                ratelimiter.Consume(sent_bytes, t_now);
+                queue.deficit -= sent_bytes;
+                queue.buff_deficits[buff_id] -= sent_bytes;
+
+                /* Advance the buffer's read pointer only over the messages
+                 * that were sent. The remaining ones are retried later. */
+                rd_proxy.ConfirmRead(n_sent, sent_bytes);
+
+                if (n_sent < n_batch) {
+                    /* Likely EAGAIN/EWOULDBLOCK. Try again later */
+                    if (IsWouldBlock(send_errno)) {
                         wouldblock = true;
                     } else {
                         LogPrintf("UDP: sendto to group %zu failed: %s\n",
-                                  group, strerror(errno));
+                                  group, strerror(send_errno));
                     }
                     break;
                 }
-                consecutive_tx++;
-
-                // Consume the transmission quota
-                if (!queue.unlimited)
-                    queue.ratelimiter.UseQuota(next_tx->length);
-
-                // Advance to the highest-priority non-empty buffer in this
-                // queue group
-                rd_proxy.ConfirmRead(next_tx->length);
-                if (buff->IsEmpty()) {
-                    queue.NextBuff();
-                    if (queue.buff_id != -1)
-                        buff = &queue.buffs[queue.buff_id];
-                }
-            }
-
-            // If the transmission loop stopped before filling the socket
-            // buffer, it's likely that there is at least one non-full socket.
-            if (!wouldblock)
-                maybe_all_full = false;
 
-            // If the transmission loop stopped before emptying this queue,
-            // there is definitely at least one non-empty queue.
-            if (queue.buff_id != -1)
-                maybe_all_empty = false;
+                // Move on to the next buffer if this one is done with its turn
+                queue.NextBuff(t_now);
+            }
 
-            /* How long will it take until we have enough quota to send at least
-             * one MTU?
-             *
-             * NOTE: A non rate-limited queue sleeps on calls to poll() instead
-             * of sleeping based on the "queue.next_send" values. */
-            const uint32_t wait_ms = (queue.unlimited) ? 0 :
-                queue.ratelimiter.EstimateWait(sizeof(UDPMessage));
-
-            queue.next_send += std::chrono::milliseconds(wait_ms);
-            t_next_tx = std::min(t_next_tx, queue.next_send);
-        }
-
-        // Wait until at least one socket is writable
-        if (maybe_all_full) {
-            int n_ready = 0;
-            bool retry_poll = true;
-            while (retry_poll) {
-                n_ready = poll(pfds, nfds, -1 /* Wait indefinitely */);
-                retry_poll = (n_ready < 0) && (errno == EINTR);
+            if (queue.buff_id == -1 && !queue.HasMessages()) {
+                queue.deficit = 0;
+                queue.jitter.backlogged = false;
+                continue;
             }
-            if (n_ready == 0) {
-                LogPrintf("UDP: unexpected poll timeout\n");
-            } else if (n_ready < 0) {
-                LogPrintf("UDP: unexpected poll error: %s\n", strerror(errno));
+            maybe_all_empty = false;
+
+            if (wouldblock) {
+                // Watch the socket until it becomes writable
+                pfd.fd = udp_socks[group];
+                any_blocked = true;
+                queue.deficit = 0;
+            } else if (out_of_tokens) {
+                /* Wait until there are enough tokens to send at least one
+                 * MTU. Only rate-limited groups run out of tokens. */
+                queue.next_send = t_now + queue.ratelimiter.TimeUntil(sizeof(UDPMessage), t_now);
+                t_next_tx = std::min(t_next_tx, queue.next_send);
+                if (queue.pacing == UDPPacing::TIMER)
+                    t_next_paced = std::min(t_next_paced, queue.next_send);
+                queue.deficit = 0;
+            } else {
+                // The group's turn ended, or its buffers are held back by
+                // their ceilings, which the next visit takes care of
+                any_ready = true;
             }
         }
 
-        // Wait until at least one queue has messages to send
+        if (any_ready)
+            continue;
+
         if (maybe_all_empty) {
+            // Wait until at least one queue has messages to send
             std::unique_lock<std::mutex> lock(non_empty_queues_cv_mutex);
-            if (!IsAnyQueueReady())
+            send_thread_sleeping = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!IsAnyQueueReady() && !send_messages_break)
                 non_empty_queues_cv.wait(lock);
-        }
+            send_thread_sleeping = false;
+        } else {
+            /* Wake up ahead of the next departure of a timer-paced group, and
+             * spin from then on until it is due */
+            const std::chrono::steady_clock::time_point t_wake = std::min(t_next_tx, t_next_paced - TX_PACING_SPIN);
+            const std::chrono::steady_clock::duration t_wait = t_wake - std::chrono::steady_clock::now();
+            if (t_wait <= std::chrono::steady_clock::duration::zero())
+                continue;
 
-        // Wait until the earliest scheduled transmission comes
-        //
-        // NOTE: if we just slept waiting for any queue to become non-empty, do
-        // not sleep now. There is a risk that "t_next_tx" was not set to a
-        // value other than its initialization value (far into the future).
-        std::chrono::steady_clock::time_point t_end(std::chrono::steady_clock::now());
-        if (t_next_tx > t_end && !maybe_all_empty) {
-            std::this_thread::sleep_until(t_next_tx);
+            if (any_blocked) {
+                /* Wait until a blocked socket becomes writable, or until the
+                 * next rate-limited group gets its tokens */
+                const bool infinite = (t_wait > std::chrono::minutes(59));
+#ifdef __linux__
+                const int64_t wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t_wait).count();
+                const struct timespec timeout{static_cast<time_t>(wait_ns / 1000000000), static_cast<long>(wait_ns % 1000000000)};
+#else
+                const int64_t wait_us = std::chrono::duration_cast<std::chrono::microseconds>(t_wait).count();
+                const int timeout_ms = infinite ? -1 : (wait_us + 999) / 1000;
+#endif
+                int n_ready = 0;
+                bool retry_poll = true;
+                while (retry_poll) {
+#ifdef __linux__
+                    n_ready = ppoll(pfds, nfds, infinite ? nullptr : &timeout, nullptr);
+#else
+                    n_ready = poll(pfds, nfds, timeout_ms);
+#endif
+                    retry_poll = (n_ready < 0) && (errno == EINTR);
+                }
+                if (n_ready < 0) {
+                    LogPrintf("UDP: unexpected poll error: %s\n", strerror(errno));
+                }
+            } else {
+                /* All non-empty groups wait for tokens. Wait until the earliest
+                 * one gets them, unless a message is queued in the meantime
+                 * (which may belong to a group that could send it right
+                 * away). */
+                std::unique_lock<std::mutex> lock(non_empty_queues_cv_mutex);
+                send_thread_sleeping = true;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (!IsAnyGroupDue(std::chrono::steady_clock::now()) && !send_messages_break)
+                    non_empty_queues_cv.wait_until(lock, t_wake);
+                send_thread_sleeping = false;
+            }
         }
     }
 }
@@ -1293,6 +2158,19 @@ UniValue TxQueueInfoToJSON()  {
             b_info.pushKV("tx_pkts", stats.rd_count);
             q_info.__pushKV("Buffer " + std::to_string(i), b_info);
         }
+        // Pacing of rate-limited groups
+        const PerGroupMessageQueue& queue = q.second;
+        if (queue.ns_per_byte > 0) {
+            static const char* const pacing_names[] = {"none", "timer", "txtime"};
+            q_info.pushKV("pacing", pacing_names[static_cast<int>(queue.pacing)]);
+            UniValue j_info(UniValue::VOBJ);
+            const uint64_t pkts = queue.jitter.pkts.load(std::memory_order_relaxed);
+            const uint64_t sum_ns = queue.jitter.sum_ns.load(std::memory_order_relaxed);
+            j_info.pushKV("pkts", pkts);
+            j_info.pushKV("avg_us", pkts ? sum_ns / 1e3 / pkts : 0.0);
+            j_info.pushKV("max_us", queue.jitter.max_ns.load(std::memory_order_relaxed) / 1e3);
+            q_info.pushKV("jitter", j_info);
+        }
         ret.__pushKV("Group " + std::to_string(q.first), q_info);
     }
     return ret;
@@ -1312,6 +2190,23 @@ struct backfill_block_window {
 struct backfill_txn_window {
     std::mutex mutex;
     uint64_t tx_count = 0;
+    uint64_t queued = 0;
+};
+
+/* Blocks read from disk and FEC-coded by the prefetch thread of a backfill
+ * stream, in the order the stream's scheduler picks them */
+struct backfill_prefetched_block {
+    int height;
+    uint256 hash;
+    size_t carousel;
+    std::vector<UDPMessage> msgs;
+};
+
+struct backfill_prefetch_queue {
+    std::deque<backfill_prefetched_block> blocks;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stop = false;
 };
 
 std::map<std::pair<uint16_t, uint16_t>, std::shared_ptr<backfill_block_window>> block_window_map;
@@ -1320,6 +2215,110 @@ std::map<std::pair<uint16_t, uint16_t>, backfill_txn_window> txn_window_map;
 std::mutex block_window_map_mutex;
 std::mutex txn_window_map_mutex;
 
+/* Ask the OS to read a block into its page cache ahead of its transmission.
+ * The block's size is not known without reading it, so read up to the next
+ * block of the chain if it follows in the same file, or otherwise up to the
+ * maximum block size. */
+static void PrefetchBlockFromDisk(const FlatFilePos& pos, const FlatFilePos& next_pos) {
+    unsigned int length = MAX_BLOCK_SERIALIZED_SIZE;
+    if (!next_pos.IsNull() && next_pos.nFile == pos.nFile && next_pos.nPos > pos.nPos)
+        length = std::min(length, next_pos.nPos - pos.nPos);
+
+    FILE* file = OpenBlockFile(pos, true);
+    if (!file)
+        return;
+    PrefetchFileRange(file, pos.nPos, length);
+    fclose(file);
+}
+
+/* Read-ahead stage of a backfill stream: picks the blocks to send, reads them
+ * from disk and FEC-codes them, up to prefetch_depth blocks ahead of the
+ * backfill thread, such that cold blocks don't stall the transmission. The
+ * blocks still queued or in the interleave window are skipped, so that no
+ * block is coded (nor charged to the scheduler) while it is being sent. The
+ * OS is further asked to read the blocks predicted to come next, so that it
+ * can fetch them concurrently. */
+static void MulticastBackfillPrefetchThread(const UDPMulticastInfo *info, backfill_prefetch_queue& queue,
+                                            const std::shared_ptr<backfill_block_window> pblock_window) {
+    /* Pick the repeated blocks within the backfill window */
+    BackfillConfig backfill_config = info->backfill;
+    backfill_config.depth = info->depth;
+    backfill_config.offset = info->offset;
+    BackfillScheduler scheduler(backfill_config);
+
+    /* Heights recently handed to the OS for reading */
+    std::deque<int> advised;
+
+    while (true) {
+        /* The backfill thread moves a block from the queue into the window
+         * while holding both locks, so the block is always found in one or
+         * the other */
+        std::set<int> busy;
+        {
+            std::unique_lock<std::mutex> lock(queue.mutex);
+            while (queue.blocks.size() >= info->prefetch_depth && !queue.stop)
+                queue.cv.wait(lock);
+            if (queue.stop)
+                return;
+            for (const auto& b : queue.blocks)
+                busy.insert(b.height);
+            std::lock_guard<std::mutex> window_lock(pblock_window->mutex);
+            for (const auto& b : pblock_window->map)
+                busy.insert(b.first);
+        }
+
+        const CBlockIndex* pindex = nullptr;
+        std::vector<std::pair<FlatFilePos, FlatFilePos>> upcoming;
+        {
+            LOCK(cs_main);
+            const int chain_height = ::ChainActive().Height();
+            const int height = scheduler.Next(chain_height, busy);
+            if (height != -1) {
+                pindex = ::ChainActive()[height];
+                assert(pindex->nHeight == height);
+                busy.insert(height);
+            }
+
+            for (const int h : scheduler.Peek(chain_height, pindex ? info->prefetch_depth : 0, busy)) {
+                if (std::find(advised.begin(), advised.end(), h) != advised.end())
+                    continue;
+                advised.push_back(h);
+                if (advised.size() > 2 * info->prefetch_depth)
+                    advised.pop_front();
+                const CBlockIndex* pnext = ::ChainActive()[h + 1];
+                upcoming.emplace_back(::ChainActive()[h]->GetBlockPos(),
+                                      pnext ? pnext->GetBlockPos() : FlatFilePos());
+            }
+        }
+        if (!pindex) {
+            /* Every block the scheduler picks from is being sent. Wait for
+             * the backfill thread to release some. */
+            std::unique_lock<std::mutex> lock(queue.mutex);
+            if (!queue.stop)
+                queue.cv.wait_for(lock, std::chrono::milliseconds(100));
+            continue;
+        }
+        for (const auto& pos : upcoming)
+            PrefetchBlockFromDisk(pos.first, pos.second);
+
+        /* Generate the block's FEC chunks, which reads the block from disk
+         * unless it was cached on a previous fill (by this or another
+         * stream) */
+        backfill_prefetched_block block{pindex->nHeight, pindex->GetBlockHash(), scheduler.LastCarousel(), {}};
+        UDPFillMessagesFromBlockIndex(pindex,
+            block.msgs,
+            info->overhead_rep_blks.fixed,
+            info->overhead_rep_blks.variable);
+        scheduler.Charge(block.msgs.size() * FEC_CHUNK_SIZE);
+
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.blocks.push_back(std::move(block));
+        }
+        queue.cv.notify_all();
+    }
+}
+
 static void MulticastBackfillThread(const CService& mcastNode,
                                     const UDPMulticastInfo *info) {
     /* Start only after the initial sync */
@@ -1330,36 +2329,11 @@ static void MulticastBackfillThread(const CService& mcastNode,
     // return nullptr and trip the assert below
     if (send_messages_break) return;
 
-    /* Define the initial block height */
-    const int backfill_depth = info->depth;
-    const CBlockIndex *pindex;
-    {
-        LOCK(cs_main);
-        pindex = ::ChainActive().Tip();
-        assert(pindex);
-
-        const int chain_height = ::ChainActive().Height();
-        LogPrint(BCLog::UDPMCAST, "UDP: Multicast Tx %lu-%lu - chain height: %d\n",
-                 info->physical_idx, info->logical_idx, chain_height);
-
-        /* The starting block height is the bottom height of the backfill window
-         * plus a configurable offset */
-        int height;
-        if (backfill_depth == 0)
-            height = info->offset % (chain_height + 1);
-        else
-            height = chain_height - backfill_depth + 1 + (info->offset % backfill_depth);
-
-        LogPrint(BCLog::UDPMCAST, "UDP: Multicast Tx %lu-%lu - starting height: %d\n",
-                 info->physical_idx, info->logical_idx, height);
-        pindex = ::ChainActive()[height];
-        assert(pindex->nHeight == height);
-    }
-
     /* Tx Queue */
     auto it = mapTxQueues.find(info->group);
     assert(it != mapTxQueues.end());
     PerGroupMessageQueue& queue = it->second;
+    const UDPSockAddr mcast_addr(mcastNode);
 
     /* Block transmission window */
     const auto tx_idx_pair = std::make_pair(info->physical_idx, info->logical_idx);
@@ -1381,60 +2355,62 @@ static void MulticastBackfillThread(const CService& mcastNode,
      */
     std::unique_lock<std::mutex> lock(pblock_window->mutex, std::defer_lock);
 
+    /* Read-ahead stage */
+    backfill_prefetch_queue prefetch;
+    std::thread prefetch_thread([info, &prefetch, pblock_window] {
+            char name[50];
+            sprintf(name, "udpblkprefetch %d-%d", info->physical_idx,
+                    info->logical_idx);
+            TraceThread(
+                name,
+                std::bind(MulticastBackfillPrefetchThread, info, std::ref(prefetch), pblock_window)
+                );
+        });
+
     while (!send_messages_break) {
         /* Fill FEC chunk interleaving window */
+        size_t n_dups = 0;
         while ((pblock_window->map.size() < info->interleave_len) && (!send_messages_break)) {
-            // Add the next block to the protected block window map
-            lock.lock();
-            const auto res = pblock_window->map.insert(std::make_pair(pindex->nHeight, backfill_block()));
-            lock.unlock(); // safe to release (no other thread mutates the map)
-
-            /* It's perfectly possible that the block already exists in the
-             * interleave window. The block index could be back on a block that
-             * is still being transmitted. In this case, don't fill the block in
-             * the window, but do advance the block index. */
-            if (res.second) {
-                /* Fetch block from disk and generate its FEC chunks */
-                CBlock block;
-                assert(ReadBlockFromDisk(block, pindex, Params().GetConsensus()));
-                const uint256 block_hash(block.GetHash());
-
-                const auto block_it = res.first;
+            /* Take the next block from the prefetch thread. Wait for it only
+             * when there is nothing else to send. */
+            backfill_prefetched_block block;
+            std::pair<std::map<int, backfill_block>::iterator, bool> res;
+            {
+                std::unique_lock<std::mutex> prefetch_lock(prefetch.mutex);
+                while (prefetch.blocks.empty() && pblock_window->map.empty() && !send_messages_break)
+                    prefetch.cv.wait_for(prefetch_lock, std::chrono::milliseconds(100));
+                if (prefetch.blocks.empty())
+                    break;
+                block = std::move(prefetch.blocks.front());
+                prefetch.blocks.pop_front();
 
-                // Fill the FEC messages on this backfill block within the
-                // protected window of blocks
+                /* Add the block to the protected block window map before
+                 * releasing the queue, such that the prefetch thread finds
+                 * it in either of them */
                 lock.lock();
-                UDPFillMessagesFromBlock(block,
-                    block_it->second.msgs,
-                    pindex->nHeight,
-                    info->overhead_rep_blks.fixed,
-                    info->overhead_rep_blks.variable);
-                pblock_window->bytes_in_window += block_it->second.msgs.size() * FEC_CHUNK_SIZE;
+                res = pblock_window->map.insert(std::make_pair(block.height, backfill_block()));
+                if (res.second) {
+                    res.first->second.msgs = std::move(block.msgs);
+                    pblock_window->bytes_in_window += res.first->second.msgs.size() * FEC_CHUNK_SIZE;
+                }
                 lock.unlock(); // safe to release (no other thread mutates the map)
+            }
+            prefetch.cv.notify_all();
 
+            /* The prefetch thread skips the blocks in the window, so a block
+             * should never be in it already. Should it be regardless, drop
+             * the block and move on to the next one, unless the window
+             * already holds all the blocks the scheduler picks from. */
+            if (res.second) {
+                n_dups = 0;
                 LogPrint(BCLog::FEC, "UDP: Multicast Tx %lu-%lu - "
-                         "fill block %s (%20lu) - height %7d - %5d chunks\n",
+                         "fill block %s (%20lu) - height %7d - %5d chunks - carousel %u\n",
                          info->physical_idx, info->logical_idx,
-                         block_hash.ToString(), block_hash.GetUint64(0),
-                         pindex->nHeight, block_it->second.msgs.size());
-            }
-
-            /* Advance to the next block to be inserted in the block window */
-            {
-                LOCK(cs_main);
-                int height = pindex->nHeight + 1;
-                const int chain_height = ::ChainActive().Height();
-
-                if ((height < chain_height - backfill_depth + 1) && (backfill_depth > 0))
-                    height = chain_height - backfill_depth + 1;
-                else if (height > chain_height) {
-                    if (backfill_depth == 0)
-                        height = 0;
-                    else
-                        height = chain_height - backfill_depth + 1;
-                }
-
-                pindex = ::ChainActive()[height];
+                         block.hash.ToString(), block.hash.GetUint64(0),
+                         block.height, res.first->second.msgs.size(),
+                         block.carousel);
+            } else if (++n_dups > info->interleave_len) {
+                break;
             }
         }
 
@@ -1453,7 +2429,7 @@ static void MulticastBackfillThread(const CService& mcastNode,
             b.second.idx++;
             lock.unlock(); // safe to release (no other thread mutates the map)
 
-            SendMessage(msg, msg_len, queue, queue.buffs[3], mcastNode, multicast_checksum_magic);
+            SendMessage(msg, msg_len, queue, queue.buffs[3], mcast_addr, multicast_checksum_magic);
         }
 
         /* Cleanup the blocks that have been fully transmitted */
@@ -1467,7 +2443,16 @@ static void MulticastBackfillThread(const CService& mcastNode,
             }
         }
         lock.unlock();
+        // Let the prefetch thread pick the blocks released from the window
+        prefetch.cv.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> prefetch_lock(prefetch.mutex);
+        prefetch.stop = true;
     }
+    prefetch.cv.notify_all();
+    prefetch_thread.join();
 }
 
 static UniValue TxWindowShortInfoToJSON(std::shared_ptr<backfill_block_window> pblock_window) {
@@ -1531,6 +2516,64 @@ UniValue TxWindowInfoToJSON(int phy_idx, int log_idx) {
     }
 }
 
+/* Feed of the mempool txns not yet sent by a multicast txn stream, kept up to
+ * date by the mempool notifications instead of rescanning the mempool */
+class MulticastTxnFeed final : public CValidationInterface
+{
+private:
+    const CTxMemPool& m_mempool;
+    std::mutex m_mutex;
+    TxnPriorityQueue m_queue;
+    /* Mempool sequence when seeded. The txns added to the mempool before it
+     * were queued by Seed(), and possibly sent already. */
+    uint64_t m_seed_sequence = 0;
+
+public:
+    explicit MulticastTxnFeed(const CTxMemPool& mempool) : m_mempool(mempool) {}
+
+    /* Queue the txns already in the mempool, parents first. The notifications
+     * are delivered asynchronously, so hold the feed lock while taking the
+     * snapshot: those handled before refer to earlier mempool changes, which
+     * the snapshot reflects, and those handled after apply on top of it. */
+    void Seed() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        LOCK(m_mempool.cs);
+        m_seed_sequence = m_mempool.GetSequence();
+        for (const TxMempoolInfo& info : m_mempool.infoAll())
+            m_queue.Add(info.tx, info.fee + info.nFeeDelta, info.vsize);
+    }
+
+    std::vector<CTransactionRef> Pop(size_t max_txns, size_t& queued) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        std::vector<CTransactionRef> txns = m_queue.Pop(max_txns);
+        queued = m_queue.Size();
+        return txns;
+    }
+
+    void TransactionAddedToMempool(const CTransactionRef& tx, uint64_t mempool_sequence) override {
+        /* The notification carries no fee. The txn may have left the mempool
+         * already, in which case there is nothing to send. */
+        const TxMempoolInfo info = m_mempool.info(tx->GetHash());
+        if (!info.tx)
+            return;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (mempool_sequence >= m_seed_sequence)
+            m_queue.Add(info.tx, info.fee + info.nFeeDelta, info.vsize);
+    }
+
+    void TransactionRemovedFromMempool(const CTransactionRef& tx, MemPoolRemovalReason reason, uint64_t mempool_sequence) override {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_queue.Remove(tx->GetHash());
+    }
+
+    /* Txns mined in a block are not notified as removed from the mempool */
+    void BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex) override {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (const CTransactionRef& tx : block->vtx)
+            m_queue.Remove(tx->GetHash());
+    }
+};
+
 static void MulticastTxnThread(const CService& mcastNode,
                                const UDPMulticastInfo *info) {
     assert(info->txn_per_sec > 0);
@@ -1547,17 +2590,16 @@ static void MulticastTxnThread(const CService& mcastNode,
     auto& txn_window = txn_window_map[tx_idx_pair];
     window_map_lock.unlock();
 
-    /* Use a rolling bloom filter to keep track of the txns already sent */
-    boost::optional<CRollingBloomFilter> sent_txn_bloom;
-#if BOOST_VERSION >= 105600
-    sent_txn_bloom.emplace(500000, 0.001); // Hold 500k (~24*6 blocks of txn) txn
-#else
-    sent_txn_bloom = boost::in_place(500000, 0.001); // Hold 500k (~24*6 blocks of txn) txn
-#endif
+    /* Subscribe to the mempool updates before queueing the current mempool
+     * txns, so that none is missed in between (see MulticastTxnFeed::Seed) */
+    auto feed = std::make_shared<MulticastTxnFeed>(*g_node_context->mempool);
+    RegisterSharedValidationInterface(feed);
+    feed->Seed();
 
     auto it = mapTxQueues.find(info->group);
     assert(it != mapTxQueues.end());
     PerGroupMessageQueue& queue = it->second;
+    const UDPSockAddr mcast_addr(mcastNode);
 
     /* Rate-limit the txn transmissions */
     Throttle throttle(info->txn_per_sec);
@@ -1578,43 +2620,12 @@ static void MulticastTxnThread(const CService& mcastNode,
          * send, but consume the full quota to avoid accumulation. */
         throttle.UseQuota(txn_tx_quota);
 
-        /* Get mempool txns to send now */
-        std::vector<CTransactionRef> txn_to_send;
-        txn_to_send.reserve(txn_tx_quota);
+        /* Take the best unsent txns, each preceded by its unsent parents */
+        size_t queued;
+        const std::vector<CTransactionRef> txn_to_send = feed->Pop(txn_tx_quota, queued);
         {
-            std::set<uint256> txids_to_send;
-            CTxMemPool& mempool = *g_node_context->mempool.get();
-            LOCK(mempool.cs);
-            for (const auto& iter : mempool.mapTx.get<ancestor_score>()) {
-                if (txn_to_send.size() >= (unsigned int)txn_tx_quota)
-                    break;
-                if (txids_to_send.count(iter.GetTx().GetHash()) || sent_txn_bloom->contains(iter.GetTx().GetHash()))
-                    continue;
-
-                std::vector<CTransactionRef> to_add{iter.GetSharedTx()};
-                while (!to_add.empty()) {
-                    bool has_dep = false;
-                    /* If any input of the transaction references a txn that
-                     * is also in the mempool, and which has not been sent
-                     * previously, then add this parent txn also to the list
-                     * of txns to be sent over multicast */
-                    for (const CTxIn& txin : to_add.back()->vin) {
-                        CTxMemPool::txiter init = mempool.mapTx.find(txin.prevout.hash);
-                        if (init != mempool.mapTx.end() && !txids_to_send.count(txin.prevout.hash) &&
-                            !sent_txn_bloom->contains(txin.prevout.hash)) {
-                            to_add.emplace_back(init->GetSharedTx());
-                            has_dep = true;
-                        }
-                    }
-                    if (!has_dep) {
-                        if (txids_to_send.insert(to_add.back()->GetHash()).second) {
-                            sent_txn_bloom->insert(to_add.back()->GetHash());
-                            txn_to_send.emplace_back(std::move(to_add.back()));
-                        }
-                        to_add.pop_back();
-                    }
-                }
-            }
+            std::unique_lock<std::mutex> lock(txn_window.mutex);
+            txn_window.queued = queued;
         }
 
         for (const CTransactionRef& tx : txn_to_send) {
@@ -1628,13 +2639,15 @@ static void MulticastTxnThread(const CService& mcastNode,
                     break;
                 const UDPMessage& msg = msg_info.first;
                 const size_t msg_size = msg_info.second;
-                SendMessage(msg, msg_size, queue, queue.buffs[2], mcastNode, multicast_checksum_magic);
+                SendMessage(msg, msg_size, queue, queue.buffs[2], mcast_addr, multicast_checksum_magic);
             }
 
             std::unique_lock<std::mutex> lock(txn_window.mutex);
             txn_window.tx_count++;
         }
     }
+
+    UnregisterSharedValidationInterface(feed);
 }
 
 UniValue TxnTxInfoToJSON() {
@@ -1646,6 +2659,7 @@ UniValue TxnTxInfoToJSON() {
         UniValue info(UniValue::VOBJ);
         std::unique_lock<std::mutex> lock(w.second.mutex);
         info.pushKV("tx_count", w.second.tx_count);
+        info.pushKV("queued", w.second.queued);
         ret.__pushKV(key, info);
     }
     return ret;
@@ -1713,11 +2727,8 @@ void MulticastTxBlock(const int height)
         assert(pindex->nHeight == height);
     }
 
-    CBlock block;
-    assert(ReadBlockFromDisk(block, pindex, Params().GetConsensus()));
-
     LogPrintf("MulticastTxBlock: sending block %s\n",
-        block.GetHash().ToString());
+        pindex->GetBlockHash().ToString());
 
     for (const auto& node : multicast_nodes()) {
         // Send over the multicasttx instances enabled for block relaying
@@ -1726,7 +2737,7 @@ void MulticastTxBlock(const int height)
 
         // Each node gets a different set of FEC chunks
         std::vector<UDPMessage> msgs;
-        UDPFillMessagesFromBlock(block, msgs, pindex->nHeight,
+        UDPFillMessagesFromBlockIndex(pindex, msgs,
             node.second.overhead_rep_blks.fixed,
             node.second.overhead_rep_blks.variable);
 
@@ -1742,24 +2753,28 @@ void MulticastTxBlock(const int height)
     }
 }
 
-static std::map<size_t, PerGroupMessageQueue> init_tx_queues(const std::vector<std::pair<unsigned short, uint64_t> >& group_list,
+static std::map<size_t, PerGroupMessageQueue> init_tx_queues(const std::vector<UDPInboundGroup>& group_list,
                                                              const std::vector<UDPMulticastInfo>& multicast_list) {
     std::map<size_t, PerGroupMessageQueue> mapQueues; // map group number to group queue
 
+    /* The token buckets hold at least a full round of messages, such that a
+     * group's turn is not cut short by the depth of its bucket */
+    const size_t min_burst = max_consecutive_tx * sizeof(UDPMessage);
+
     /* Each unicast UDP group has one queue, defined in order */
     for (size_t group = 0; group < group_list.size(); group++) {
         auto res = mapQueues.emplace(std::piecewise_construct,
                                      std::forward_as_tuple(group),
                                      std::forward_as_tuple());
-        LogPrintf("UDP: Set bw for group %zu: %d Mbps\n", group, group_list[group].second);
+        LogPrintf("UDP: Set bw for group %zu: %d Mbps\n", group, group_list[group].bw);
         assert(res.second);
-        res.first->second.bw        = group_list[group].second; // in Mbps
-        res.first->second.multicast = false;
-        res.first->second.unlimited = false; // rate-limit internally
+        PerGroupMessageQueue& queue = res.first->second;
+        queue.bw           = group_list[group].bw; // in Mbps
+        queue.multicast    = false;
+        queue.weight       = group_list[group].weight;
+        queue.buff_weights = udp_queue_weights;
         // Set the throttling rate in bytes per sec
-        const double bytes_per_sec = static_cast<double>(group_list[group].second) * 1e6 / 8;
-        res.first->second.ratelimiter.SetRate(bytes_per_sec);
-        res.first->second.ratelimiter.SetMaxQuota(2*bytes_per_sec);
+        queue.SetRate(static_cast<double>(group_list[group].bw) * 1e6 / 8, min_burst);
     }
 
     /* Multicast Rx instances don't have any Tx queue. Only multicast Tx
@@ -1771,20 +2786,19 @@ static std::map<size_t, PerGroupMessageQueue> init_tx_queues(const std::vector<s
                                          std::forward_as_tuple(info.group),
                                          std::forward_as_tuple());
             assert(res.second);
-            res.first->second.bw        = info.bw; // in bps
-            res.first->second.multicast = true;
+            PerGroupMessageQueue& queue = res.first->second;
+            queue.bw        = info.bw; // in bps
+            queue.multicast = true;
+            queue.weight    = info.weight;
+            queue.buff_weights = (info.queue_weights[0] == 0) ? udp_queue_weights : info.queue_weights;
+            queue.pacing    = info.pacing;
 
             /* The multicast group can be rate-limited internally or externally
              * (via a blocking socket). When the BW parameter is set to 0, let
              * it be externally throttled. Otherwise, throttle internally. */
-            if (info.bw == 0) {
-                res.first->second.unlimited = true;
-            } else {
-                res.first->second.unlimited = false;
-                const double bytes_per_sec = static_cast<double>(info.bw) / 8;
-                res.first->second.ratelimiter.SetRate(bytes_per_sec);
-                res.first->second.ratelimiter.SetMaxQuota(2*bytes_per_sec);
-            }
+            queue.SetRate(static_cast<double>(info.bw) / 8, min_burst);
+            for (size_t i = 0; i < queue.buffs.size(); i++)
+                queue.SetBuffRate(i, static_cast<double>(info.queue_max_bw[i]) / 8, min_burst);
         }
     }
 
@@ -1793,6 +2807,9 @@ static std::map<size_t, PerGroupMessageQueue> init_tx_queues(const std::vector<s
 
 static void send_messages_flush_and_break() {
     send_messages_break = true;
+    {
+        std::lock_guard<std::mutex> lock(non_empty_queues_cv_mutex);
+    }
     non_empty_queues_cv.notify_all();
     for (auto& q : mapTxQueues) {
         for (unsigned int i = 0; i < q.second.buffs.size(); i++) {
@@ -1833,6 +2850,35 @@ static bool ParseUDPMulticastTxOpt(UDPMulticastInfo& info,
         info.offset = atoi(value);
         if (info.offset < 0)
             error = "offset must be >= 0\n";
+    } else if (opt == "backfill_policy") {
+        if (value == "linear")
+            info.backfill.policy = BackfillPolicy::LINEAR;
+        else if (value == "carousels")
+            info.backfill.policy = BackfillPolicy::CAROUSELS;
+        else if (value == "decay")
+            info.backfill.policy = BackfillPolicy::DECAY;
+        else
+            error = "backfill_policy should be linear, carousels or decay";
+    } else if (opt == "recent_depth") {
+        info.backfill.recent_depth = atoi(value);
+        if (info.backfill.recent_depth < 1)
+            error = "recent_depth must be >= 1";
+    } else if (opt == "recent_weight") {
+        const int64_t weight = atoi64(value);
+        if (weight < 1 || weight > std::numeric_limits<uint32_t>::max())
+            error = "recent_weight must be >= 1";
+        else
+            info.backfill.recent_weight = weight;
+    } else if (opt == "decay_depth") {
+        info.backfill.decay_depth = atoi(value);
+        if (info.backfill.decay_depth < 1)
+            error = "decay_depth must be >= 1";
+    } else if (opt == "prefetch_depth") {
+        const int64_t depth = atoi64(value);
+        if (depth < 1 || depth > MAX_UDP_PREFETCH_DEPTH)
+            error = strprintf("prefetch_depth must be between 1 and %u", MAX_UDP_PREFETCH_DEPTH);
+        else
+            info.prefetch_depth = depth;
     } else if (opt == "dscp") {
         info.dscp = atoi(value);
     } else if (opt == "interleave_len") {
@@ -1843,6 +2889,27 @@ static bool ParseUDPMulticastTxOpt(UDPMulticastInfo& info,
         info.send_rep_blks = (value == "true" || value == "1");
     } else if (opt == "relay_new_blks") {
         info.relay_new_blks = (value == "true" || value == "1");
+    } else if (opt == "weight") {
+        const int64_t weight = atoi64(value);
+        if (weight < 1 || weight > std::numeric_limits<uint32_t>::max())
+            error = "weight must be >= 1";
+        else
+            info.weight = weight;
+    } else if (opt == "queue_weights") {
+        if (!ParseQueueBuffValues(value, info.queue_weights, 1u))
+            error = "queue_weights should be four weights of at least 1";
+    } else if (opt == "queue_max_bw") {
+        if (!ParseQueueBuffValues(value, info.queue_max_bw, uint64_t(0)))
+            error = "queue_max_bw should be four bit rates in bps (0 for no limit)";
+    } else if (opt == "pacing") {
+        if (value == "none")
+            info.pacing = UDPPacing::NONE;
+        else if (value == "timer")
+            info.pacing = UDPPacing::TIMER;
+        else if (value == "txtime")
+            info.pacing = UDPPacing::TXTIME;
+        else
+            error = "pacing should be none, timer or txtime";
     } else if (opt == "overhead_rep_blks") {
         const size_t pos = value.find(',');
         if (pos == std::string::npos)
@@ -1898,6 +2965,11 @@ static bool ParseUDPMulticastTxInfo(const std::string& conf_file,
         return false;
     }
 
+    if (info.pacing != UDPPacing::NONE && info.bw == 0) {
+        LogPrintf("Failed to parse -udpmulticasttx option, pacing requires a bw\n");
+        return false;
+    }
+
     /* Check mandatory fields */
     if (strlen(info.ifname) == 0) {
         LogPrintf("Failed to parse -udpmulticasttx option, ifname is required\n");
@@ -2003,50 +3075,60 @@ static void OpenMulticastConnection(const CService& service, bool multicast_tx,
  * Public API follows
  */
 
-std::vector<std::pair<unsigned short, uint64_t> > GetUDPInboundPorts()
+std::vector<UDPInboundGroup> GetUDPInboundPorts()
 {
-    if (!gArgs.IsArgSet("-udpport")) return std::vector<std::pair<unsigned short, uint64_t> >();
+    if (!gArgs.IsArgSet("-udpport")) return std::vector<UDPInboundGroup>();
 
-    std::map<size_t, std::pair<unsigned short, uint64_t> > res;
+    std::map<size_t, UDPInboundGroup> res;
     for (const std::string& s : gArgs.GetArgs("-udpport")) {
         size_t port_end = s.find(',');
         size_t group_end = s.find(',', port_end + 1);
-        size_t bw_end = s.find(',', group_end + 1);
+        size_t bw_end = (group_end == std::string::npos) ? std::string::npos : s.find(',', group_end + 1);
+        size_t weight_end = (bw_end == std::string::npos) ? std::string::npos : s.find(',', bw_end + 1);
 
-        if (port_end == std::string::npos || (group_end != std::string::npos && bw_end != std::string::npos)) {
+        if (port_end == std::string::npos || weight_end != std::string::npos) {
             LogPrintf("Failed to parse -udpport option, not starting Bitcoin Satellite\n");
-            return std::vector<std::pair<unsigned short, uint64_t> >();
+            return std::vector<UDPInboundGroup>();
         }
 
         int64_t port = atoi64(s.substr(0, port_end));
         if (port != (unsigned short)port || port == 0) {
             LogPrintf("Failed to parse -udpport option, not starting Bitcoin Satellite\n");
-            return std::vector<std::pair<unsigned short, uint64_t> >();
+            return std::vector<UDPInboundGroup>();
         }
 
         int64_t group = atoi64(s.substr(port_end + 1, group_end - port_end - 1));
         if (group < 0 || res.count(group)) {
             LogPrintf("Failed to parse -udpport option, not starting Bitcoin Satellite\n");
-            return std::vector<std::pair<unsigned short, uint64_t> >();
+            return std::vector<UDPInboundGroup>();
         }
 
         int64_t bw = 1024;
         if (group_end != std::string::npos) {
-            bw = atoi64(s.substr(group_end + 1));
+            bw = atoi64(s.substr(group_end + 1, bw_end - group_end - 1));
             if (bw < 0) {
                 LogPrintf("Failed to parse -udpport option, not starting Bitcoin Satellite\n");
-                return std::vector<std::pair<unsigned short, uint64_t> >();
+                return std::vector<UDPInboundGroup>();
+            }
+        }
+
+        int64_t weight = 1;
+        if (bw_end != std::string::npos) {
+            weight = atoi64(s.substr(bw_end + 1));
+            if (weight < 1 || weight > std::numeric_limits<uint32_t>::max()) {
+                LogPrintf("Failed to parse -udpport option, not starting Bitcoin Satellite\n");
+                return std::vector<UDPInboundGroup>();
             }
         }
 
-        res[group] = std::make_pair((unsigned short)port, uint64_t(bw));
+        res[group] = UDPInboundGroup{(unsigned short)port, uint64_t(bw), uint32_t(weight)};
     }
 
-    std::vector<std::pair<unsigned short, uint64_t> > v;
+    std::vector<UDPInboundGroup> v;
     for (size_t i = 0; i < res.size(); i++) {
         if (!res.count(i)) {
             LogPrintf("Failed to parse -udpport option, not starting Bitcoin Satellite\n");
-            return std::vector<std::pair<unsigned short, uint64_t> >();
+            return std::vector<UDPInboundGroup>();
         }
         v.push_back(res[i]);
     }
@@ -2084,6 +3166,8 @@ static void OpenUDPConnectionTo(const CService& addr, const UDPConnectionInfo& i
 
     UDPConnectionState& state = res.first->second;
     state.connection = info;
+    state.local_key.Set(info.local_magic);
+    state.remote_addr = UDPSockAddr(addr);
     state.state = (info.udp_mode == udp_mode_t::multicast) ? STATE_INIT_COMPLETE : STATE_INIT;
     state.lastSendTime = 0;
     state.lastRecvTime = GetTimeMillis();
@@ -2092,6 +3176,7 @@ static void OpenUDPConnectionTo(const CService& addr, const UDPConnectionInfo& i
         for (size_t i = 0; i < sizeof(state.last_pings) / sizeof(double); i++) {
             state.last_pings[i] = 0;
         }
+        SetMulticastRoutes(addr, res.first);
     }
 }
 
@@ -6,7 +6,9 @@
 #ifndef BITCOIN_UDPNET_H
 #define BITCOIN_UDPNET_H
 
+#include <array>
 #include <atomic>
+#include <memory>
 #include <stdint.h>
 #include <vector>
 #include <mutex>
@@ -18,6 +20,8 @@
 
 #include <blockencodings.h>
 #include <fec.h>
+#include <backfill.h>
+#include <crypto/poly1305.h>
 
 // This is largely the API between udpnet and udprelay, see udpapi for the
 // external-facing API
@@ -113,6 +117,7 @@ struct PartialBlockData {
     std::atomic_bool packet_awaiting_lock; // Indicates there is a packet ready to process that needs state_mutex
     std::atomic_bool awaiting_processing; // Indicates the block has been pushed to the processing queue already
     std::atomic_bool chain_lookup; // Indicates the header has been processed to check if our chain has the block already
+    std::atomic_bool txn_decode_queued; // Indicates the block has been pushed to the txn decode queue already
 
     std::mutex state_mutex;
     // Background thread is preparing to, and is submitting to core
@@ -136,6 +141,10 @@ struct PartialBlockData {
     // nodes with chunks_avail set -> packets that were useful, packets provided
     std::map<CService, std::pair<uint32_t, uint32_t>> perNodeChunkCount;
 
+    // Uncoded chunks received whose txns are yet to be deserialized by the
+    // processing thread (see DecodeTxnInChunk), protected by state_mutex
+    std::vector<uint32_t> txn_decode_pending;
+
     bool Init(const UDPMessage& msg);
     bool Init(const ChunkFileNameParts& cfp);
 
@@ -207,6 +216,21 @@ public:
     bool AreAllAvailable() const { return allSent; }
 };
 
+/** Destination socket address, resolved once from a CService and reused for
+ * every packet sent towards it */
+struct UDPSockAddr {
+    union {
+        struct sockaddr sa;
+        struct sockaddr_in in;
+        struct sockaddr_in6 in6;
+    } addr;
+    socklen_t len;
+
+    UDPSockAddr() : len(0) { memset(&addr, 0, sizeof(addr)); }
+    explicit UDPSockAddr(const CService& service);
+    bool operator==(const UDPSockAddr& o) const { return len == o.len && memcmp(&addr, &o.addr, len) == 0; }
+};
+
 struct UDPConnectionInfo {
     uint64_t local_magic;  // Already LE
     uint64_t remote_magic; // Already LE
@@ -231,6 +255,14 @@ struct FecOverhead {
     double variable;
 };
 
+/** Pacing of the packets of a rate-limited multicast Tx stream */
+enum class UDPPacing {
+    NONE,   /** send in bursts of up to 20 ms worth of packets */
+    TIMER,  /** space packets apart with a precise timer in the write thread */
+    TXTIME, /** stamp packets with their departure time (SO_TXTIME) and let
+             * the fq qdisc space them apart */
+};
+
 struct UDPMulticastInfo {
     char ifname[IFNAMSIZ] = {0};          /** network interface name */
     char mcast_ip[INET_ADDRSTRLEN] = {0}; /** multicast IPv4 address */
@@ -254,6 +286,12 @@ struct UDPMulticastInfo {
                                    * blockchain. */
     int offset = 0;               /** offset within the backfill as starting
                                    * point */
+    BackfillConfig backfill;      /** policy for picking the repeated blocks
+                                   * within the backfill window (its depth and
+                                   * offset are the fields above) */
+    uint32_t prefetch_depth = 4;  /** backfill blocks read from disk and
+                                   * FEC-coded ahead of their transmission (at
+                                   * most MAX_UDP_PREFETCH_DEPTH) */
     uint32_t interleave_len = 1;  /** determines the depth of the sub-window of
                                    *  blocks within the backfill window whose
                                    *  FEC chunks are interleaved (sent in
@@ -269,13 +307,54 @@ struct UDPMulticastInfo {
                                    * repeated (i.e., historic) blocks */
     bool relay_new_blks = true;   /** Whether this stream should relay new
                                    * (i.e., recently mined) blocks */
+    uint32_t weight = 1;          /** weight of the stream's Tx queue relative
+                                   * to the other groups */
+    std::array<uint32_t, 4> queue_weights = {{0, 0, 0, 0}}; /** weights of the
+                                   * buffers of the Tx queue (all 0 to use
+                                   * -udpqueueweights) */
+    std::array<uint64_t, 4> queue_max_bw = {{0, 0, 0, 0}}; /** ceiling of each
+                                   * buffer of the Tx queue in bps (0 for no
+                                   * ceiling other than bw) */
+    UDPPacing pacing = UDPPacing::NONE; /** pacing of the packets sent at
+                                   * rate bw */
     FecOverhead overhead_rep_blks = {60, 0.05}; /** Overhead applied when
                                                  * FEC-encoding repeated
-                                                 * (historic) blocks */
+                                                 * (historic) blocks. Static,
+                                                 * as receivers report no
+                                                 * losses back */
+};
+
+/** Precomputed poly1305 key schedule for the checksum of a connection, which
+ *  is derived from the connection's 64-bit magic */
+struct UDPChecksumKey {
+    uint64_t magic; // Already LE
+    Poly1305Key key;
+
+    explicit UDPChecksumKey(uint64_t magic_in = 0) { Set(magic_in); }
+    void Set(uint64_t magic_in);
+};
+
+/** Adaptive FEC overhead of a peer, which determines how many FEC chunks of a
+ *  new block are sent to it. The whole block plus a fixed overhead is always
+ *  sent; the overhead on top of that is adjusted after every block based on
+ *  the fraction of the chunks received from the peer that turned out to be
+ *  redundant. The link is assumed to be symmetric, i.e. the peer's view of
+ *  our chunks resembles ours of its. Only losses are compensated: the peer
+ *  does not report how much of the block it prefilled from its mempool, so
+ *  fewer chunks than the block are never sent. */
+struct FecOverheadEstimator {
+    double overhead = 0;     // fraction of extra FEC chunks to compensate for losses
+    double redundancy = -1;  // moving average of the fraction of useless chunks received
+    uint64_t n_blocks = 0;   // number of blocks the estimate is based on
+
+    void Update(uint32_t useful_chunks, uint32_t rcvd_chunks);
+    size_t GetFecChunks(size_t data_chunks) const;
 };
 
 struct UDPConnectionState {
     UDPConnectionInfo connection;
+    UDPChecksumKey local_key; // Key schedule of connection.local_magic
+    UDPSockAddr remote_addr; // Cached sockaddr of the CService this state is keyed by
     int state; // Flags from UDPState
     uint32_t protocolVersion;
     int64_t lastSendTime;
@@ -289,6 +368,7 @@ struct UDPConnectionState {
     std::unique_ptr<FECDecoder> tx_in_flight;
     double last_txn_hit_ratio;
     double last_chunk_hit_ratio;
+    FecOverheadEstimator fec_overhead;
 
     UDPConnectionState() : connection({}), state(0), protocolVersion(0), lastSendTime(0), lastRecvTime(0), lastPingTime(0), last_ping_location(0),
         tx_in_flight_hash_prefix(0), tx_in_flight_msg_size(0), last_txn_hit_ratio(-1), last_chunk_hit_ratio(-1)
@@ -305,6 +385,10 @@ extern uint64_t const multicast_checksum_magic;
 
 void SendMessage(const UDPMessage& msg, const unsigned int length, bool high_prio, const CService& service, const uint64_t magic, size_t group);
 void SendMessage(const UDPMessage& msg, const unsigned int length, bool high_prio, const std::pair<const CService, UDPConnectionState>& node);
+/* Queue a payload that is shared with other destinations without copying it.
+ * The message must not be modified once queued. */
+void SendMessage(const std::shared_ptr<const UDPMessage>& msg, const unsigned int length, bool high_prio, const CService& service, const uint64_t magic, size_t group);
+void SendMessage(const std::shared_ptr<const UDPMessage>& msg, const unsigned int length, bool high_prio, const std::pair<const CService, UDPConnectionState>& node);
 void DisconnectNode(const std::map<CService, UDPConnectionState>::iterator& it);
 
 const std::map<std::tuple<CService, int, uint16_t>, UDPMulticastInfo>& multicast_nodes();
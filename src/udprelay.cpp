@@ -16,6 +16,8 @@
 #include <net.h>
 #include <net_processing.h>
 
+#include <cmath>
+#include <list>
 #include <queue>
 #include <condition_variable>
 #include <thread>
@@ -45,6 +47,78 @@ static std::unordered_set<uint64_t> setBlocksRelayed;
 // set here.
 static std::set<std::pair<uint64_t, CService>> setBlocksReceived;
 
+/* Partial non-tip blocks kept in the chunk arena at a time. Each takes up to
+ * two arena objects (header and body). Chunks of further non-tip blocks are
+ * dropped until some of them complete or time out. */
+static const size_t MAX_MMAP_PARTIAL_BLOCKS = 16384;
+
+/* Whether the chunks of new non-tip blocks should be dropped. Requires
+ * cs_mapUDPNodes. */
+static bool NonTipPartialBlocksAtCapacity() {
+    const std::shared_ptr<ChunkArena> arena = ChunkArena::Get();
+    if (!arena)
+        return mapPartialBlocks.size() >= MAX_MMAP_PARTIAL_BLOCKS;
+    return arena->ObjectsInUse() >= 2 * MAX_MMAP_PARTIAL_BLOCKS;
+}
+
+/* Parameters of the adaptive FEC overhead (see FecOverheadEstimator) */
+static const size_t FEC_FIXED_OVERHEAD = 10; // FEC chunks always sent on top of the estimate
+static const double MAX_FEC_OVERHEAD = 1.0;
+static const double FEC_TARGET_REDUNDANCY = 0.05; // fraction of useless chunks the overhead converges to
+static const double FEC_OVERHEAD_GAIN = 2.0;
+static const double FEC_EWMA_WEIGHT = 0.25; // weight of the latest block on the moving averages
+static const uint32_t FEC_MIN_RCVD_CHUNKS = 10; // minimum number of chunks for a block to be taken into account
+
+// Chunks relayed at a time by the parallel FEC encoder. Within a window, the
+// chunks are encoded in ranges of FEC_RELAY_RANGE_SIZE and each range is sent
+// as soon as it is encoded.
+static const size_t FEC_RELAY_WINDOW_SIZE = 1024;
+static const size_t FEC_RELAY_RANGE_SIZE = 16;
+// Chunks of a received block recovered at once by each FEC worker
+static const size_t FEC_RECOVER_RANGE_SIZE = 64;
+static std::unique_ptr<FECWorkerPool> fec_worker_pool;
+// Codec the transactions of blocks we relay or backfill are compressed with
+static codec_version_t block_codec_version = codec_version_t::default_version;
+
+void FecOverheadEstimator::Update(uint32_t useful_chunks, uint32_t rcvd_chunks) {
+    if (rcvd_chunks < FEC_MIN_RCVD_CHUNKS)
+        return;
+
+    const double blk_redundancy = 1.0 - (double)useful_chunks / rcvd_chunks;
+    redundancy = (redundancy < 0) ? blk_redundancy :
+        (1 - FEC_EWMA_WEIGHT) * redundancy + FEC_EWMA_WEIGHT * blk_redundancy;
+
+    // Grow the overhead quickly when (nearly) every chunk was needed, as that
+    // is what under-coding looks like, and shrink it when chunks are wasted
+    overhead += FEC_OVERHEAD_GAIN * (FEC_TARGET_REDUNDANCY - blk_redundancy);
+    overhead = std::max(0.0, std::min(MAX_FEC_OVERHEAD, overhead));
+    n_blocks++;
+}
+
+size_t FecOverheadEstimator::GetFecChunks(size_t data_chunks) const {
+    // Chunks prefilled from the peer's mempool are not reported back to us,
+    // so the whole block is always sent and only the losses are estimated
+    return data_chunks + (size_t)std::ceil(data_chunks * overhead) + FEC_FIXED_OVERHEAD;
+}
+
+/* Number of FEC chunks to generate for a new block, i.e. the most that any
+ * peer or multicast stream is going to be sent */
+static size_t GetMaxFecChunks(size_t data_chunks) {
+    std::lock_guard<std::recursive_mutex> lock(cs_mapUDPNodes);
+    size_t fec_chunks = 0;
+    for (const auto& node : mapUDPNodes) {
+        if (node.second.connection.udp_mode == udp_mode_t::unicast)
+            fec_chunks = std::max(fec_chunks, node.second.fec_overhead.GetFecChunks(data_chunks));
+    }
+    /* Multicast streams have no return channel to estimate the overhead
+     * from, so they are sent the default amount */
+    for (const auto& node : multicast_nodes()) {
+        if (node.second.tx && node.second.relay_new_blks)
+            fec_chunks = std::max(fec_chunks, FecOverheadEstimator().GetFecChunks(data_chunks));
+    }
+    return fec_chunks;
+}
+
 static std::map<std::pair<uint64_t, CService>, std::shared_ptr<PartialBlockData> >::iterator RemovePartialBlock(std::map<std::pair<uint64_t, CService>, std::shared_ptr<PartialBlockData> >::iterator it) {
     uint64_t const hash_prefix = it->first.first;
     std::lock_guard<std::mutex> lock(it->second->state_mutex);
@@ -62,14 +136,20 @@ static std::map<std::pair<uint64_t, CService>, std::shared_ptr<PartialBlockData>
             nodeIt->second.last_chunk_hit_ratio = it->second->chunk_hit_ratio;
         }
 
+        // Adjust the FEC overhead used when relaying blocks to this node
+        nodeIt->second.fec_overhead.Update(node.second.first, node.second.second);
+
         std::map<uint64_t, ChunksAvailableSet>::iterator chunks_avail_it = nodeIt->second.chunks_avail.find(hash_prefix);
         if (chunks_avail_it == nodeIt->second.chunks_avail.end())
             continue; // Peer reconnected at some point
         nodeIt->second.chunks_avail.erase(chunks_avail_it);
     }
-    /* Now that we are done with the FEC data, remove any underlying mmap FEC chunk files */
-    it->second->header_decoder.RemoveMmapFile();
-    it->second->body_decoder.RemoveMmapFile();
+    /* Now that we are done with the FEC data, release any underlying mmap FEC
+     * chunk storage. The storage is freed along with the decoders, once the
+     * threads that may still hold the block (e.g. in the processing queue)
+     * drop it. */
+    it->second->header_decoder.RemoveMmapStorage();
+    it->second->body_decoder.RemoveMmapStorage();
     return mapPartialBlocks.erase(it);
 }
 
@@ -96,7 +176,12 @@ void ResetPartialBlocks(){
     mapPartialBlocks.clear();
 }
 
-static inline void SendMessageToNode(const UDPMessage& msg, unsigned int length, bool high_prio, uint64_t hash_prefix, std::map<CService, UDPConnectionState>::iterator it) {
+static inline const UDPMessage& MessageRef(const UDPMessage& msg) { return msg; }
+static inline const UDPMessage& MessageRef(const std::shared_ptr<const UDPMessage>& msg) { return *msg; }
+
+template <typename Msg>
+static inline void SendMessageToNode(const Msg& queued_msg, unsigned int length, bool high_prio, uint64_t hash_prefix, std::map<CService, UDPConnectionState>::iterator it) {
+    const UDPMessage& msg = MessageRef(queued_msg);
     if ((it->second.state & STATE_INIT_COMPLETE) != STATE_INIT_COMPLETE)
         return;
 
@@ -115,16 +200,18 @@ static inline void SendMessageToNode(const UDPMessage& msg, unsigned int length,
             return;
     }
 
-    SendMessage(msg, length, high_prio, *it);
+    SendMessage(queued_msg, length, high_prio, *it);
 
     if (use_chunks_avail)
         chunks_avail_it->second.SetChunkAvailable(chunk_id, n_chunks, is_blk_content_chunk);
 }
 
 static void SendMessageToAllNodes(const UDPMessage& msg, unsigned int length, bool high_prio, uint64_t hash_prefix) {
+    // Queue a single copy of the message for all peers
+    const std::shared_ptr<const UDPMessage> shared_msg = std::make_shared<UDPMessage>(msg);
     for (std::map<CService, UDPConnectionState>::iterator it = mapUDPNodes.begin(); it != mapUDPNodes.end(); it++)
         if (it->second.connection.connection_type != UDP_CONNECTION_TYPE_INBOUND_ONLY)
-            SendMessageToNode(msg, length, high_prio, hash_prefix, it);
+            SendMessageToNode(shared_msg, length, high_prio, hash_prefix, it);
 }
 
 static size_t CopyMessageData(UDPMessage& msg, const std::vector<unsigned char>& data, size_t msg_chunks, uint16_t chunk_id) {
@@ -141,7 +228,7 @@ static size_t CopyMessageData(UDPMessage& msg, const std::vector<unsigned char>&
 /**
  * Send uncoded (non FEC-coded) data chunks to all peers
  */
-static void RelayUncodedChunks(UDPMessage& msg, const std::vector<unsigned char>& data, const size_t high_prio_chunks_per_peer, const uint64_t hash_prefix, const size_t chunk_limit) {
+static void RelayUncodedChunks(const UDPMessage& msg, const std::vector<unsigned char>& data, const size_t high_prio_chunks_per_peer, const uint64_t hash_prefix, const size_t chunk_limit) {
     const size_t msg_chunks = DIV_CEIL(data.size(), FEC_CHUNK_SIZE);
 
     bool high_prio = high_prio_chunks_per_peer;
@@ -150,17 +237,24 @@ static void RelayUncodedChunks(UDPMessage& msg, const std::vector<unsigned char>
         if (high_prio && i >= high_prio_chunks_per_peer)
             high_prio = false;
 
-        /* Send the same uncoded chunk to all peers */
-        CopyMessageData(msg, data, msg_chunks, i);
+        /* Send the same uncoded chunk to all peers. The chunk is queued by
+         * reference, such that it is copied only once per destination, when
+         * the write thread checksums it. */
+        std::shared_ptr<UDPMessage> chunk_msg = std::make_shared<UDPMessage>();
+        chunk_msg->header = msg.header;
+        chunk_msg->msg.block.hash_prefix = msg.msg.block.hash_prefix;
+        chunk_msg->msg.block.obj_length = msg.msg.block.obj_length;
+        CopyMessageData(*chunk_msg, data, msg_chunks, i);
+        const std::shared_ptr<const UDPMessage> shared_chunk_msg = std::move(chunk_msg);
 
         for (auto it = mapUDPNodes.begin(); it != mapUDPNodes.end(); it++) {
             if (it->second.connection.udp_mode == udp_mode_t::unicast)
-                SendMessageToNode(msg, sizeof(UDPMessageHeader) + sizeof(UDPBlockMessage), high_prio, hash_prefix, it);
+                SendMessageToNode(shared_chunk_msg, sizeof(UDPMessageHeader) + sizeof(UDPBlockMessage), high_prio, hash_prefix, it);
         }
 
         for (const auto& node : multicast_nodes()) {
             if (node.second.tx && node.second.relay_new_blks) {
-                SendMessage(msg,
+                SendMessage(shared_chunk_msg,
                             sizeof(UDPMessageHeader) + sizeof(UDPBlockMessage),
                             high_prio, std::get<0>(node.first),
                             multicast_checksum_magic, node.second.group);
@@ -169,18 +263,21 @@ static void RelayUncodedChunks(UDPMessage& msg, const std::vector<unsigned char>
     }
 }
 
+/* FEC encoder of some data, sending fec_chunks FEC chunks. Chunks are encoded
+ * directly into the messages carrying them (see FillFECData), and only kept in
+ * fec_data if store_chunks is set, so that they can be prefilled with
+ * enc.PrefillChunks before they are sent. */
 struct DataFECer {
     size_t fec_chunks;
     std::pair<std::unique_ptr<FECChunkType[]>, std::vector<uint32_t>> fec_data;
     FECEncoder enc;
-    DataFECer(const std::vector<unsigned char>& data, size_t fec_chunks_in) :
+    DataFECer(const std::vector<unsigned char>& data, size_t fec_chunks_in, bool store_chunks = false) :
         fec_chunks(fec_chunks_in),
-        fec_data(std::piecewise_construct, std::forward_as_tuple(new FECChunkType[fec_chunks]), std::forward_as_tuple(fec_chunks)),
+        fec_data(std::piecewise_construct, std::forward_as_tuple(store_chunks ? new FECChunkType[fec_chunks] : nullptr), std::forward_as_tuple(store_chunks ? fec_chunks : 0)),
         enc(&data, &fec_data) {}
 
     DataFECer(FECDecoder&& decoder, const std::vector<unsigned char>& data, size_t fec_chunks_in) :
         fec_chunks(fec_chunks_in),
-        fec_data(std::piecewise_construct, std::forward_as_tuple(new FECChunkType[fec_chunks]), std::forward_as_tuple(fec_chunks)),
         enc(std::move(decoder), &data, &fec_data) {}
 
 #if BOOST_VERSION < 105600
@@ -188,18 +285,92 @@ struct DataFECer {
     // which is pre-c++11 and can only take arguments by value
     DataFECer(FECDecoder* decoder, const std::vector<unsigned char>& data, size_t fec_chunks_in) :
         fec_chunks(fec_chunks_in),
-        fec_data(std::piecewise_construct, std::forward_as_tuple(new FECChunkType[fec_chunks]), std::forward_as_tuple(fec_chunks)),
         enc(std::move(*decoder), &data, &fec_data) {}
 #endif
 };
 
-static void CopyFECData(UDPMessage& msg, DataFECer& fec, size_t array_idx, bool overwrite_chunk = false) {
-    bool const ret = fec.enc.BuildChunk(array_idx, overwrite_chunk);
-    // TODO: Handle errors?
-    assert(ret);
-    assert(fec.fec_data.second[array_idx] < (1 << 24));
-    msg.msg.block.chunk_id = htole32(fec.fec_data.second[array_idx]);
-    memcpy(msg.msg.block.data, &fec.fec_data.first[array_idx], FEC_CHUNK_SIZE);
+/* Encode FEC chunk array_idx, with a newly drawn chunk id, directly into msg.
+ * If msg_has_chunk is set, msg already holds a chunk of fec, which is kept if
+ * the chunk id drawn is the same (as cm256 chunk ids of an index are). */
+static void FillFECData(UDPMessage& msg, DataFECer& fec, size_t array_idx, bool msg_has_chunk = false) {
+    const uint32_t chunk_id = fec.enc.NextChunkId(array_idx);
+    assert(chunk_id < (1 << 24));
+    if (!msg_has_chunk || le32toh(msg.msg.block.chunk_id) != chunk_id) {
+        if (array_idx < fec.fec_data.second.size() && fec.fec_data.second[array_idx] == chunk_id) {
+            memcpy(msg.msg.block.data, &fec.fec_data.first[array_idx], FEC_CHUNK_SIZE); // Prefilled
+        } else {
+            bool const ret = fec.enc.EncodeChunk(chunk_id, msg.msg.block.data);
+            // TODO: Handle errors?
+            assert(ret);
+        }
+    }
+    msg.msg.block.chunk_id = htole32(chunk_id);
+}
+
+/**
+ * Parallel version of RelayFECedChunks for wirehair-coded data
+ *
+ * Sends the same chunks in the same order as the serial loop, but the chunk
+ * ids are drawn up-front and the chunks encoded by fec_worker_pool. Chunks are
+ * sent range by range as soon as they are encoded, such that the first chunks
+ * go out while the rest of the set is still being computed. If
+ * blk_data_chunks is set, the number of chunks per destination is limited as
+ * for block contents.
+ */
+static void RelayFECedChunksParallel(UDPMessage& msg, DataFECer& fec, const size_t high_prio_chunks_per_peer, const uint64_t hash_prefix, const size_t blk_data_chunks) {
+    struct Destination {
+        std::map<CService, UDPConnectionState>::iterator node; // mapUDPNodes.end() for multicast
+        const CService* mcast_addr;
+        size_t mcast_group;
+        size_t n_chunks;
+    };
+    std::vector<Destination> dests;
+    for (auto it = mapUDPNodes.begin(); it != mapUDPNodes.end(); it++) {
+        if (it->second.connection.udp_mode == udp_mode_t::unicast)
+            dests.push_back({it, nullptr, 0, blk_data_chunks ? it->second.fec_overhead.GetFecChunks(blk_data_chunks) : fec.fec_chunks});
+    }
+    const size_t default_fec_chunks = blk_data_chunks ? FecOverheadEstimator().GetFecChunks(blk_data_chunks) : fec.fec_chunks;
+    for (const auto& node : multicast_nodes()) {
+        if (node.second.tx && node.second.relay_new_blks)
+            dests.push_back({mapUDPNodes.end(), &std::get<0>(node.first), node.second.group, default_fec_chunks});
+    }
+
+    // (chunk index, destination) pairs, in the order of the serial loop
+    std::vector<std::pair<uint32_t, uint32_t>> jobs;
+    for (size_t i = 0; i < fec.fec_chunks; i++) {
+        for (size_t d = 0; d < dests.size(); d++) {
+            if (i < dests[d].n_chunks)
+                jobs.emplace_back(i, d);
+        }
+    }
+
+    const size_t window_size = std::min(jobs.size(), FEC_RELAY_WINDOW_SIZE);
+    std::vector<uint32_t> chunk_ids(window_size);
+    std::unique_ptr<FECChunkType[]> chunks(new FECChunkType[window_size]);
+    for (size_t window_start = 0; window_start < jobs.size(); window_start += window_size) {
+        const size_t n = std::min(window_size, jobs.size() - window_start);
+        for (size_t k = 0; k < n; k++)
+            chunk_ids[k] = fec.enc.NextChunkId(jobs[window_start + k].first);
+
+        bool const ret = fec_worker_pool->EncodeChunks(fec.enc, chunk_ids.data(), chunks.get(), n, FEC_RELAY_RANGE_SIZE,
+            [&](size_t begin, size_t end) {
+                for (size_t k = begin; k < end; k++) {
+                    const size_t i = jobs[window_start + k].first;
+                    const Destination& dest = dests[jobs[window_start + k].second];
+                    const bool high_prio = i < high_prio_chunks_per_peer;
+                    assert(chunk_ids[k] < (1 << 24));
+                    msg.msg.block.chunk_id = htole32(chunk_ids[k]);
+                    memcpy(msg.msg.block.data, &chunks[k], FEC_CHUNK_SIZE);
+                    if (dest.node != mapUDPNodes.end())
+                        SendMessageToNode(msg, sizeof(UDPMessageHeader) + sizeof(UDPBlockMessage), high_prio, hash_prefix, dest.node);
+                    else
+                        SendMessage(msg, sizeof(UDPMessageHeader) + sizeof(UDPBlockMessage), high_prio,
+                                    *dest.mcast_addr, multicast_checksum_magic, dest.mcast_group);
+                }
+            });
+        // TODO: Handle errors?
+        assert(ret);
+    }
 }
 
 /**
@@ -208,11 +379,24 @@ static void CopyFECData(UDPMessage& msg, DataFECer& fec, size_t array_idx, bool
  * For each chunk index, a different (random) chunk id is generated for each
  * outbound service. This is useful for receive peers that are receiving from
  * (combining) more than one service.
+ *
+ * Block contents are sent to each unicast peer only up to the number of FEC
+ * chunks picked by its adaptive FEC overhead.
  */
 static void RelayFECedChunks(UDPMessage& msg, DataFECer& fec, const size_t high_prio_chunks_per_peer, const uint64_t hash_prefix) {
     assert(fec.fec_chunks > 9);
 
+    const bool is_blk_content = (msg.header.msg_type & UDP_MSG_TYPE_TYPE_MASK) == MSG_TYPE_BLOCK_CONTENTS;
+    const size_t data_chunks = DIV_CEIL(le32toh(msg.msg.block.obj_length), FEC_CHUNK_SIZE);
+    const size_t default_fec_chunks = FecOverheadEstimator().GetFecChunks(data_chunks);
+
+    if (fec_worker_pool && data_chunks > CM256_MAX_CHUNKS) {
+        RelayFECedChunksParallel(msg, fec, high_prio_chunks_per_peer, hash_prefix, is_blk_content ? data_chunks : 0);
+        return;
+    }
+
     bool high_prio = high_prio_chunks_per_peer;
+    bool msg_has_chunk = false;
     for (size_t i = 0; i < fec.fec_chunks; i++) {
         if (high_prio && (i >= high_prio_chunks_per_peer))
             high_prio = false;
@@ -220,7 +404,10 @@ static void RelayFECedChunks(UDPMessage& msg, DataFECer& fec, const size_t high_
         /* Send over unicast services */
         for (auto it = mapUDPNodes.begin(); it != mapUDPNodes.end(); it++) {
             if (it->second.connection.udp_mode == udp_mode_t::unicast) {
-                CopyFECData(msg, fec, i, true /*regenerate chunk on index i*/);
+                if (is_blk_content && i >= it->second.fec_overhead.GetFecChunks(data_chunks))
+                    continue;
+                FillFECData(msg, fec, i, msg_has_chunk);
+                msg_has_chunk = true;
                 SendMessageToNode(msg, sizeof(UDPMessageHeader) + sizeof(UDPBlockMessage), high_prio, hash_prefix, it);
             }
         }
@@ -228,7 +415,10 @@ static void RelayFECedChunks(UDPMessage& msg, DataFECer& fec, const size_t high_
         /* Send over each multicast Tx (outbound) service */
         for (const auto& node : multicast_nodes()) {
             if (node.second.tx && node.second.relay_new_blks) {
-                CopyFECData(msg, fec, i, true /*regenerate chunk on index i*/);
+                if (is_blk_content && i >= default_fec_chunks)
+                    continue;
+                FillFECData(msg, fec, i, msg_has_chunk);
+                msg_has_chunk = true;
                 SendMessage(msg,
                             sizeof(UDPMessageHeader) + sizeof(UDPBlockMessage),
                             high_prio, std::get<0>(node.first),
@@ -377,7 +567,7 @@ void UDPRelayBlock(const CBlock& block, int nHeight) {
             initd = std::chrono::steady_clock::now();
 
         boost::optional<ChunkCodedBlock> codedBlock;
-        CBlockHeaderAndLengthShortTxIDs headerAndIDs(block, codec_version_t::default_version, true);
+        CBlockHeaderAndLengthShortTxIDs headerAndIDs(block, block_codec_version, true);
         headerAndIDs.setBlockHeight(nHeight);
         std::vector<unsigned char> header_data;
         header_data.reserve(2500 + 8 * block.vtx.size()); // Rather conservatively high estimate
@@ -389,14 +579,14 @@ void UDPRelayBlock(const CBlock& block, int nHeight) {
             coded = std::chrono::steady_clock::now();
 
         const size_t header_fec_chunks = DIV_CEIL(header_data.size(), FEC_CHUNK_SIZE) + 10;
-        DataFECer header_fecer(header_data, header_fec_chunks);
+        DataFECer header_fecer(header_data, header_fec_chunks, inUDPProcess /* store_chunks, prefilled below */);
 
         boost::optional<DataFECer> block_fecer;
         size_t data_fec_chunks = 0;
         if (inUDPProcess) {
             // If we're actively receiving UDP packets, go ahead and spend the time to precalculate FEC now,
             // otherwise we want to start getting the header/first block chunks out ASAP
-            header_fecer.enc.PrefillChunks();
+            header_fecer.enc.PrefillChunks(fec_worker_pool.get());
 
             if (!skipEncode) {
 #if BOOST_VERSION >= 105600
@@ -407,7 +597,7 @@ void UDPRelayBlock(const CBlock& block, int nHeight) {
                 chunk_coded_block = &codedBlock->GetCodedBlock();
             }
             if (!chunk_coded_block->empty()) {
-                data_fec_chunks = DIV_CEIL(chunk_coded_block->size(), FEC_CHUNK_SIZE) + 10; //TODO: Pick something different?
+                data_fec_chunks = GetMaxFecChunks(DIV_CEIL(chunk_coded_block->size(), FEC_CHUNK_SIZE));
                 if (skipEncode) {
                     // If we get here, we are currently in the processing thread
                     // and have partial_block_ptr set. Additionally, because
@@ -428,7 +618,9 @@ void UDPRelayBlock(const CBlock& block, int nHeight) {
                     block_fecer = boost::in_place(*chunk_coded_block, data_fec_chunks);
 #endif
                 }
-                block_fecer->enc.PrefillChunks();
+                // The block contents are not prefilled, RelayFECedChunks
+                // draws a new chunk id (and thus encodes a new chunk) for
+                // every destination anyway.
             }
         }
 
@@ -468,7 +660,7 @@ void UDPRelayBlock(const CBlock& block, int nHeight) {
             // is important we get the first block packet out to peers ASAP. Thus,
             // we go ahead and send the first few non-FEC block packets here.
             if (!chunk_coded_block->empty()) {
-                data_fec_chunks = DIV_CEIL(chunk_coded_block->size(), FEC_CHUNK_SIZE) + 10; //TODO: Pick something different?
+                data_fec_chunks = GetMaxFecChunks(DIV_CEIL(chunk_coded_block->size(), FEC_CHUNK_SIZE));
                 SendLimitedDataChunks(hashBlock, MSG_TYPE_BLOCK_CONTENTS, *chunk_coded_block);
             }
         }
@@ -606,14 +798,26 @@ void UDPFillMessagesFromTx(const CTransaction& tx, std::vector<std::pair<UDPMess
  * header chunks are sent and, lastly, the overhead block chunks.
  *
  */
-void UDPFillMessagesFromBlock(const CBlock& block, std::vector<UDPMessage>& msgs,
-                              const int height, const size_t base_overhead,
-                              const double overhead) {
-    const uint256 hashBlock(block.GetHash());
-    const uint64_t hash_prefix = hashBlock.GetUint64(0);
+/* The block header and chunk-coded block of a block prepared for FEC-coding,
+ * along with the FEC encoder of the block, if kept for reuse */
+struct FECBlockData {
+    std::mutex mutex; // Protects block_fecer, which is not thread-safe
+    uint64_t hash_prefix;
+    uint8_t flags;
+    bool empty_block;
+    std::vector<unsigned char> header_data;
+    std::vector<unsigned char> chunk_coded_block;
+    size_t header_overhead = 0;
+    size_t block_overhead = 0;
+    std::unique_ptr<DataFECer> block_fecer;
+};
+
+static void InitFECBlockData(FECBlockData& b, const CBlock& block, const int height,
+                             const size_t base_overhead, const double overhead) {
+    b.hash_prefix = block.GetHash().GetUint64(0);
 
     /* Block header */
-    CBlockHeaderAndLengthShortTxIDs headerAndIDs(block, codec_version_t::default_version, true);
+    CBlockHeaderAndLengthShortTxIDs headerAndIDs(block, block_codec_version, true);
     headerAndIDs.setBlockHeight(height);
     /* NOTE: it is not mandatory to include the block height along
      * CBlockHeaderAndLengthShortTxIDs. However, it is useful to include it here
@@ -623,22 +827,46 @@ void UDPFillMessagesFromBlock(const CBlock& block, std::vector<UDPMessage>& msgs
      * the height explicitly, the receive node won't know the height and won't
      * be able to store the block in case it is received out-of-order. */
 
-    const bool empty_block = (headerAndIDs.ShortTxIdCount() == 0);
-    const uint8_t flags    = empty_block ? (HAVE_BLOCK | EMPTY_BLOCK) : HAVE_BLOCK;
+    b.empty_block = (headerAndIDs.ShortTxIdCount() == 0);
+    b.flags       = b.empty_block ? (HAVE_BLOCK | EMPTY_BLOCK) : HAVE_BLOCK;
 
-    std::vector<unsigned char> header_data;
-    header_data.reserve(2500 + 8 * block.vtx.size()); // Rather conservatively high estimate
-    VectorOutputStream stream(&header_data, SER_NETWORK, PROTOCOL_VERSION);
+    b.header_data.reserve(2500 + 8 * block.vtx.size()); // Rather conservatively high estimate
+    VectorOutputStream stream(&b.header_data, SER_NETWORK, PROTOCOL_VERSION);
     stream << headerAndIDs;
-    const size_t n_header_chunks = DIV_CEIL(header_data.size(), FEC_CHUNK_SIZE);
-    const size_t header_overhead = base_overhead + std::round(overhead * n_header_chunks);
-    const size_t n_header_fec_chunks = n_header_chunks + header_overhead;
-    DataFECer header_fecer(header_data, n_header_fec_chunks);
+    const size_t n_header_chunks = DIV_CEIL(b.header_data.size(), FEC_CHUNK_SIZE);
+    b.header_overhead = base_overhead + std::round(overhead * n_header_chunks);
+
+    /* Don't send the chunk-coded block if the block does not have any
+     * transaction other than the coinbase (which is sent in the header) */
+    if (b.empty_block)
+        return;
+
+    ChunkCodedBlock codedBlock(block, headerAndIDs);
+    b.chunk_coded_block = codedBlock.GetCodedBlock();
+    const size_t n_block_chunks = DIV_CEIL(b.chunk_coded_block.size(), FEC_CHUNK_SIZE);
+    b.block_overhead = base_overhead + std::round(overhead * n_block_chunks);
+}
+
+/* Fill the FEC chunks of a block prepared by InitFECBlockData. If keep_encoder
+ * is set, the block's FEC encoder is kept in b and reused by subsequent calls,
+ * which regenerate chunks with new chunk ids. Must be called with b.mutex held
+ * if b is shared. */
+static void FillMessagesFromFECBlockData(FECBlockData& b, std::vector<UDPMessage>& msgs, const bool keep_encoder) {
+    const size_t n_header_chunks = DIV_CEIL(b.header_data.size(), FEC_CHUNK_SIZE);
+    const size_t n_header_fec_chunks = n_header_chunks + b.header_overhead;
+    DataFECer header_fecer(b.header_data, n_header_fec_chunks);
     /* NOTE: the block header will typically be encoded by cm256, due to its
      * size. Since cm256 is MDS, in principle only the N original chunks are
      * necessary. Nevertheless, since chunks can be lost along the transport
      * link, some chunks of overhead are used. */
 
+    /* Each chunk is encoded directly into its message, so reserve all messages
+     * up front rather than moving the chunks along as msgs grows */
+    size_t n_msgs = n_header_fec_chunks;
+    if (!b.empty_block)
+        n_msgs += DIV_CEIL(b.chunk_coded_block.size(), FEC_CHUNK_SIZE) + b.block_overhead;
+    msgs.reserve(msgs.size() + n_msgs);
+
     /* First fill the minimum amount of header chunks for decoding
      *
      * NOTE: since cm256 is MDS, the minimum amount of header chunks is
@@ -646,32 +874,37 @@ void UDPFillMessagesFromBlock(const CBlock& block, std::vector<UDPMessage>& msgs
     int offset = msgs.size();
     msgs.resize(offset + n_header_chunks);
     for (size_t i = 0; i < n_header_chunks; i++) {
-        FillBlockMessageHeader(msgs[offset + i], hash_prefix, MSG_TYPE_BLOCK_HEADER, header_data.size(), flags);
-        CopyFECData(msgs[offset + i], header_fecer, i);
+        FillBlockMessageHeader(msgs[offset + i], b.hash_prefix, MSG_TYPE_BLOCK_HEADER, b.header_data.size(), b.flags);
+        FillFECData(msgs[offset + i], header_fecer, i);
     }
 
-    /* Don't send the chunk-coded block if the block does not have any
-     * transaction other than the coinbase (which is sent in the header) */
-    if (empty_block) {
+    if (b.empty_block) {
         /* Fill overhead header chunks */
         offset = msgs.size();
-        msgs.resize(offset + header_overhead);
-        for (size_t i = 0; i < header_overhead; i++) {
-            FillBlockMessageHeader(msgs[offset + i], hash_prefix, MSG_TYPE_BLOCK_HEADER, header_data.size(), flags);
-            CopyFECData(msgs[offset + i], header_fecer, n_header_chunks + i);
+        msgs.resize(offset + b.header_overhead);
+        for (size_t i = 0; i < b.header_overhead; i++) {
+            FillBlockMessageHeader(msgs[offset + i], b.hash_prefix, MSG_TYPE_BLOCK_HEADER, b.header_data.size(), b.flags);
+            FillFECData(msgs[offset + i], header_fecer, n_header_chunks + i);
         }
         return;
     }
 
-    ChunkCodedBlock codedBlock(block, headerAndIDs);
-    const std::vector<unsigned char>& chunk_coded_block = codedBlock.GetCodedBlock();
-    const size_t n_block_chunks = DIV_CEIL(chunk_coded_block.size(), FEC_CHUNK_SIZE);
-    const size_t block_overhead = base_overhead + std::round(overhead * n_block_chunks);
-    const size_t n_block_fec_chunks = n_block_chunks + block_overhead;
+    const size_t n_block_chunks = DIV_CEIL(b.chunk_coded_block.size(), FEC_CHUNK_SIZE);
+    const size_t n_block_fec_chunks = n_block_chunks + b.block_overhead;
     /* NOTE: on average wirehair needs about 0.02 chunks of overhead to recover,
      * meaning most often it doesn't need overhead at all. Again, we add
      * overhead chunks here in order to overcome loss along the link. */
-    DataFECer block_fecer(chunk_coded_block, n_block_fec_chunks);
+
+    /* Only the wirehair encoder is worth keeping: its initialization is the
+     * expensive part of the encoding. The cm256 encoder would also regenerate
+     * the same chunk ids on every call. */
+    std::unique_ptr<DataFECer> tmp_block_fecer;
+    const bool reuse_encoder = keep_encoder && n_block_chunks > CM256_MAX_CHUNKS;
+    if (!reuse_encoder || !b.block_fecer) {
+        std::unique_ptr<DataFECer>& fecer = reuse_encoder ? b.block_fecer : tmp_block_fecer;
+        fecer.reset(new DataFECer(b.chunk_coded_block, n_block_fec_chunks));
+    }
+    DataFECer& block_fecer = reuse_encoder ? *b.block_fecer : *tmp_block_fecer;
 
     /* Minimum amount of block chunks for decoding
      *
@@ -680,27 +913,116 @@ void UDPFillMessagesFromBlock(const CBlock& block, std::vector<UDPMessage>& msgs
     offset = msgs.size();
     msgs.resize(offset + n_block_chunks);
     for (size_t i = 0; i < n_block_chunks; i++) {
-        FillBlockMessageHeader(msgs[offset + i], hash_prefix, MSG_TYPE_BLOCK_CONTENTS, chunk_coded_block.size(), flags);
-        CopyFECData(msgs[offset + i], block_fecer, i);
+        FillBlockMessageHeader(msgs[offset + i], b.hash_prefix, MSG_TYPE_BLOCK_CONTENTS, b.chunk_coded_block.size(), b.flags);
+        FillFECData(msgs[offset + i], block_fecer, i);
     }
 
     /* Overhead header chunks */
     offset = msgs.size();
-    msgs.resize(offset + header_overhead);
-    for (size_t i = 0; i < header_overhead; i++) {
-        FillBlockMessageHeader(msgs[offset + i], hash_prefix, MSG_TYPE_BLOCK_HEADER, header_data.size(), flags);
-        CopyFECData(msgs[offset + i], header_fecer, n_header_chunks + i);
+    msgs.resize(offset + b.header_overhead);
+    for (size_t i = 0; i < b.header_overhead; i++) {
+        FillBlockMessageHeader(msgs[offset + i], b.hash_prefix, MSG_TYPE_BLOCK_HEADER, b.header_data.size(), b.flags);
+        FillFECData(msgs[offset + i], header_fecer, n_header_chunks + i);
     }
 
     /* Overhead block chunks */
     offset = msgs.size();
-    msgs.resize(offset + block_overhead);
-    for (size_t i = 0; i < block_overhead; i++) {
-        FillBlockMessageHeader(msgs[offset + i], hash_prefix, MSG_TYPE_BLOCK_CONTENTS, chunk_coded_block.size(), flags);
-        CopyFECData(msgs[offset + i], block_fecer, n_block_chunks + i);
+    msgs.resize(offset + b.block_overhead);
+    for (size_t i = 0; i < b.block_overhead; i++) {
+        FillBlockMessageHeader(msgs[offset + i], b.hash_prefix, MSG_TYPE_BLOCK_CONTENTS, b.chunk_coded_block.size(), b.flags);
+        FillFECData(msgs[offset + i], block_fecer, n_block_chunks + i);
+    }
+}
+
+void UDPFillMessagesFromBlock(const CBlock& block, std::vector<UDPMessage>& msgs,
+                              const int height, const size_t base_overhead,
+                              const double overhead) {
+    FECBlockData b;
+    InitFECBlockData(b, block, height, base_overhead, overhead);
+    FillMessagesFromFECBlockData(b, msgs, false /* keep_encoder */);
+}
+
+/* Memory-bounded LRU cache of FECBlockData of blocks transmitted repeatedly
+ * (e.g. by the multicast backfill), keyed by block hash and FEC overhead */
+typedef std::tuple<uint256, size_t, double> FECBlockCacheKey;
+typedef std::list<std::pair<FECBlockCacheKey, std::shared_ptr<FECBlockData>>> FECBlockCacheList;
+static std::mutex fec_block_cache_mutex;
+static FECBlockCacheList fec_block_cache_list; // most recently used first
+static std::map<FECBlockCacheKey, std::pair<FECBlockCacheList::iterator, size_t>> fec_block_cache_map; // -> list entry, memory usage
+static size_t fec_block_cache_usage = 0;
+static size_t fec_block_cache_max = DEFAULT_UDP_BLOCK_CACHE_SIZE * 1024 * 1024;
+
+static size_t FECBlockDataMemoryUsage(const FECBlockData& b) {
+    size_t usage = sizeof(b) + b.header_data.capacity() + b.chunk_coded_block.capacity();
+    if (b.block_fecer) {
+        // The wirehair encoder's own copy of the data
+        usage += b.chunk_coded_block.size();
+    }
+    return usage;
+}
+
+void SetUDPBlockCodecVersion(codec_version_t codec_version) {
+    block_codec_version = codec_version;
+}
+
+void SetUDPBlockCacheSize(size_t max_bytes) {
+    std::lock_guard<std::mutex> lock(fec_block_cache_mutex);
+    fec_block_cache_max = max_bytes;
+}
+
+void ClearUDPBlockCache() {
+    std::lock_guard<std::mutex> lock(fec_block_cache_mutex);
+    fec_block_cache_map.clear();
+    fec_block_cache_list.clear();
+    fec_block_cache_usage = 0;
+}
+
+void UDPFillMessagesFromBlockIndex(const CBlockIndex* pindex, std::vector<UDPMessage>& msgs,
+                                   const size_t base_overhead, const double overhead) {
+    const FECBlockCacheKey key(pindex->GetBlockHash(), base_overhead, overhead);
+
+    std::unique_lock<std::mutex> cache_lock(fec_block_cache_mutex);
+    const auto it = fec_block_cache_map.find(key);
+    if (it != fec_block_cache_map.end()) {
+        fec_block_cache_list.splice(fec_block_cache_list.begin(), fec_block_cache_list, it->second.first);
+        const std::shared_ptr<FECBlockData> b = it->second.first->second;
+        cache_lock.unlock();
+
+        std::lock_guard<std::mutex> block_lock(b->mutex);
+        FillMessagesFromFECBlockData(*b, msgs, true /* keep_encoder */);
+        return;
     }
+    const bool use_cache = fec_block_cache_max > 0;
+    cache_lock.unlock();
+
+    CBlock block;
+    assert(ReadBlockFromDisk(block, pindex, Params().GetConsensus()));
 
-    return;
+    const std::shared_ptr<FECBlockData> b = std::make_shared<FECBlockData>();
+    InitFECBlockData(*b, block, pindex->nHeight, base_overhead, overhead);
+    {
+        std::lock_guard<std::mutex> block_lock(b->mutex);
+        FillMessagesFromFECBlockData(*b, msgs, use_cache /* keep_encoder */);
+    }
+    if (!use_cache)
+        return;
+
+    const size_t usage = FECBlockDataMemoryUsage(*b);
+    cache_lock.lock();
+    if (usage > fec_block_cache_max || fec_block_cache_map.count(key))
+        return; // Too large, or cached concurrently by another thread
+
+    fec_block_cache_list.emplace_front(key, b);
+    fec_block_cache_map.emplace(key, std::make_pair(fec_block_cache_list.begin(), usage));
+    fec_block_cache_usage += usage;
+
+    // Evict the least recently used blocks
+    while (fec_block_cache_usage > fec_block_cache_max) {
+        const auto lru_it = fec_block_cache_map.find(fec_block_cache_list.back().first);
+        fec_block_cache_usage -= lru_it->second.second;
+        fec_block_cache_map.erase(lru_it);
+        fec_block_cache_list.pop_back();
+    }
 }
 
 static std::mutex block_process_mutex;
@@ -723,17 +1045,62 @@ static void DoBackgroundBlockProcessing(const std::pair<std::pair<uint64_t, CSer
     block_process_cv.notify_all();
 }
 
+/* Blocks with uncoded chunks whose txns are yet to be deserialized, which the
+ * processing thread handles whenever block_process_queue is empty. Protected
+ * by block_process_mutex. */
+static std::queue<std::shared_ptr<PartialBlockData> > txn_decode_queue;
+
+static void DoBackgroundTxnDecode(const std::shared_ptr<PartialBlockData>& block) {
+    std::unique_lock<std::mutex> lock(block_process_mutex);
+    txn_decode_queue.emplace(block);
+    lock.unlock();
+    block_process_cv.notify_all();
+}
+
+/* Deserialize the txns completed by the uncoded chunks that the UDP read
+ * threads left in txn_decode_pending, yielding the block's state_mutex to them
+ * whenever they are waiting for it */
+static void DecodePendingTxns(PartialBlockData& block) {
+    std::unique_lock<std::mutex> lock(block.state_mutex);
+    while (!block.txn_decode_pending.empty()) {
+        std::vector<uint32_t> chunks;
+        chunks.swap(block.txn_decode_pending);
+        for (const uint32_t chunk_id : chunks) {
+            // Once the block is decodeable, FinalizeBlock decodes the rest
+            if (block.is_decodeable || block.currentlyProcessing) {
+                block.txn_decode_pending.clear();
+                break;
+            }
+            block.block_data.DecodeTxnInChunk(chunk_id);
+            if (block.packet_awaiting_lock) {
+                lock.unlock();
+                std::this_thread::yield();
+                lock.lock();
+            }
+        }
+    }
+    block.txn_decode_queued = false;
+}
+
 static void ProcessBlockThread(ChainstateManager* chainman) {
     const bool fBench = LogAcceptCategory(BCLog::BENCH);
 
     while (true) {
         std::unique_lock<std::mutex> process_lock(block_process_mutex);
-        while (block_process_queue.empty() && !block_process_shutdown)
+        while (block_process_queue.empty() && txn_decode_queue.empty() && !block_process_shutdown)
             block_process_cv.wait(process_lock);
 
         if (block_process_shutdown)
             return;
 
+        if (block_process_queue.empty()) {
+            const std::shared_ptr<PartialBlockData> decode_block = txn_decode_queue.front();
+            txn_decode_queue.pop();
+            process_lock.unlock();
+            DecodePendingTxns(*decode_block);
+            continue;
+        }
+
         auto process_block = block_process_queue.front();
         CService& node = process_block.first.second;
         PartialBlockData& block = *process_block.second;
@@ -1006,7 +1373,22 @@ static void ProcessBlockThread(ChainstateManager* chainman) {
                         total_chunk_count = block.block_data.GetChunkCount();
                         blockHash = block.block_data.GetBlockHash();
                     }
-                    ReadStatus res = block.block_data.DoIterativeFill(firstChunkProcessed);
+                    ReadStatus res;
+                    if (fec_worker_pool) {
+                        // Fill the chunks of a slice of the txns, handing each
+                        // range of them to the decoder as soon as it is known.
+                        // The lock is yielded between slices (see below).
+                        res = block.block_data.DoParallelFill(*fec_worker_pool, [&](size_t begin, size_t end) {
+                            for (size_t i = begin; i < end; i++) {
+                                if (block.block_data.IsChunkAvailable(i) && !block.body_decoder.HasChunk(i)) {
+                                    block.body_decoder.ProvideChunk(block.block_data.GetChunk(i), i);
+                                    mempool_provided_chunks++;
+                                }
+                            }
+                        });
+                        firstChunkProcessed = total_chunk_count;
+                    } else
+                        res = block.block_data.DoIterativeFill(firstChunkProcessed);
                     if (res != READ_STATUS_OK) {
                         lock.unlock();
                         std::lock_guard<std::recursive_mutex> udpNodesLock(cs_mapUDPNodes);
@@ -1061,8 +1443,12 @@ static void ProcessBlockThread(ChainstateManager* chainman) {
     }
 }
 
-void BlockRecvInit(ChainstateManager* chainman)
+void BlockRecvInit(ChainstateManager* chainman, size_t n_fec_threads)
 {
+    // The relaying (or processing) thread takes part in the work too, so it
+    // counts as one of the threads
+    if (n_fec_threads > 1)
+        fec_worker_pool.reset(new FECWorkerPool(n_fec_threads - 1));
     process_block_thread.reset(new std::thread(&TraceThread<std::function<void()>>, "udpprocess", std::function<void()>(std::bind(&ProcessBlockThread, chainman))));
 }
 
@@ -1073,18 +1459,19 @@ void BlockRecvShutdown() {
         process_block_thread->join();
         process_block_thread.reset();
     }
+    fec_worker_pool.reset();
 }
 
 /*
- * Detect whether a FEC chunk file contains recoverable partial block data
+ * Detect whether a FEC chunk arena object contains recoverable partial block data
  *
- * Assume the file is recoverable if it is named according to the following
+ * Assume the object is recoverable if it is named according to the following
  * format: "<ipaddr:port>_<hashprefix>_<blockpart>_<size>", where:
  *
  * - <ipaddr:port> : is the IP address and port of the sender peer (the trusted
  *                   dummy peer is set to "[::]:0").
  * - <hashprefix>  : is the block hash prefix.
- * - <blockpart>   : indicates which part of the block the chunk file holds
+ * - <blockpart>   : indicates which part of the block the object holds
  *                   (header or body).
  * - "size"        : is the object size in bytes.
  */
@@ -1125,37 +1512,47 @@ bool IsChunkFileRecoverable(const std::string& filename, ChunkFileNameParts& cfp
     return true;
 }
 
-// Scan the disk for recoverable FEC chunk files and try to rebuild the
-// mapPartialBlocks state. Clean up the chunk files that are not recoverable.
+// Scan the chunk arena index for recoverable FEC objects and try to rebuild
+// the mapPartialBlocks state. Clean up the objects that are not recoverable.
 void LoadPartialBlocks(CTxMemPool* mempool)
 {
     LogPrintf("Loading partial blocks from disk...\n");
     uint32_t n_imported = 0;
     uint32_t n_removed = 0;
-    fs::path chunk_files_dir = GetDataDir() / "partial_blocks";
-    if (is_directory(chunk_files_dir)) {
-        for (auto& entry : boost::make_iterator_range(fs::directory_iterator(chunk_files_dir), {})) {
-            boost::filesystem::path chunk_file_path(entry);
-            ChunkFileNameParts cfp;
-            if (!IsChunkFileRecoverable(chunk_file_path.filename().string(), cfp)) {
-                fs::remove(chunk_file_path);
-                n_removed++;
-                continue;
-            }
-            CService peer(cfp.ipv4Addr, cfp.port);
-            const std::pair<uint64_t, CService> hash_peer_pair = std::make_pair(cfp.hash_prefix, peer);
-
-            auto block = GetPartialBlockData(hash_peer_pair);
-            if (!block) {
-                // new block
-                mapPartialBlocks.insert(std::make_pair(hash_peer_pair, std::make_shared<PartialBlockData>(peer, mempool, cfp)));
-                n_imported++;
-            } else {
-                // header or body was already recovered
-                if (!block->Init(cfp)) {
-                    LogPrintf("UDP: Got block contents that couldn't match header for block id %lu\n", cfp.hash_prefix);
-                    fs::remove(chunk_file_path);
-                }
+    const std::shared_ptr<ChunkArena> arena = ChunkArena::Get();
+    if (!arena) {
+        LogPrintf("Loaded 0 partial blocks from disk (no chunk arena)\n");
+        return;
+    }
+
+    // Older versions kept one chunk file per object next to the arena
+    for (auto& entry : boost::make_iterator_range(fs::directory_iterator(arena->GetPath().parent_path()), {})) {
+        if (entry.path() != arena->GetPath()) {
+            fs::remove_all(entry.path());
+            n_removed++;
+        }
+    }
+
+    for (const std::string& key : arena->GetObjectKeys()) {
+        ChunkFileNameParts cfp;
+        if (!IsChunkFileRecoverable(key, cfp)) {
+            arena->RemoveObject(key);
+            n_removed++;
+            continue;
+        }
+        CService peer(cfp.ipv4Addr, cfp.port);
+        const std::pair<uint64_t, CService> hash_peer_pair = std::make_pair(cfp.hash_prefix, peer);
+
+        auto block = GetPartialBlockData(hash_peer_pair);
+        if (!block) {
+            // new block
+            mapPartialBlocks.insert(std::make_pair(hash_peer_pair, std::make_shared<PartialBlockData>(peer, mempool, cfp)));
+            n_imported++;
+        } else {
+            // header or body was already recovered
+            if (!block->Init(cfp)) {
+                LogPrintf("UDP: Got block contents that couldn't match header for block id %lu\n", cfp.hash_prefix);
+                arena->RemoveObject(key);
             }
         }
     }
@@ -1195,8 +1592,8 @@ bool PartialBlockData::Init(const UDPMessage& msg)
     // complete when many (thousands of) non-tip blocks are sent in parallel.
     const MemoryUsageMode memory_usage_mode = tip_blk ? MemoryUsageMode::USE_MEMORY : MemoryUsageMode::USE_MMAP;
 
-    // In mmap mode, save chunks on a consistently-named file that persists
-    // across bitcoind sessions. The name includes the two unique identifiers
+    // In mmap mode, save chunks in a consistently-named chunk arena object that
+    // persists across bitcoind sessions. The name includes the two unique identifiers
     // used to map partial blocks in mapPartialBlocks: the peer (potentially a
     // "trusted peer") and the block hash prefix.
     std::string chunk_file_prefix = GetChunkFilePrefix(peer, msg.msg.block.hash_prefix);
@@ -1206,7 +1603,7 @@ bool PartialBlockData::Init(const UDPMessage& msg)
             obj_length,
             memory_usage_mode,
             chunk_file_prefix + "_header",
-            true /* persist mmap file */
+            true /* persist mmap storage */
         );
         header_len = obj_length;
         header_initialized = true;
@@ -1216,14 +1613,14 @@ bool PartialBlockData::Init(const UDPMessage& msg)
             obj_length,
             memory_usage_mode,
             chunk_file_prefix + "_body",
-            true /* persist mmap file */
+            true /* persist mmap storage */
         );
         blk_len = obj_length;
         blk_initialized = true;
         assert(body_decoder.GetChunksRcvd() == 0);
     }
     // NOTE: Even though the decoder that was just constructed could have
-    // recovered data from a pre-existing mmap file in disk, we don't expect it
+    // recovered data from a pre-existing chunk arena object, we don't expect it
     // to recover data here. At this point, we expect that LoadPartialBlocks()
     // has already recovered all the data that could be recovered. Hence, the
     // decoder should be empty at this point. The above assertions verify that.
@@ -1236,7 +1633,7 @@ PartialBlockData::PartialBlockData(const CService& peer, CTxMemPool* mempool, co
         in_header(true), blk_initialized(false), header_initialized(false),
         is_decodeable(false), is_header_processing(false),
         packet_awaiting_lock(false), awaiting_processing(false),
-        chain_lookup(false), currentlyProcessing(false), blk_len(0),
+        chain_lookup(false), txn_decode_queued(false), currentlyProcessing(false), blk_len(0),
         header_len(0), block_data(mempool)
 {
     bool const ret = Init(msg);
@@ -1256,7 +1653,7 @@ bool PartialBlockData::Init(const ChunkFileNameParts& cfp)
             cfp.length,
             MemoryUsageMode::USE_MMAP,
             chunk_file_prefix + "_header",
-            true /* persist mmap file */
+            true /* persist mmap storage */
         );
         header_len = cfp.length;
         header_initialized = true;
@@ -1268,7 +1665,7 @@ bool PartialBlockData::Init(const ChunkFileNameParts& cfp)
             cfp.length,
             MemoryUsageMode::USE_MMAP,
             chunk_file_prefix + "_body",
-            true /* persist mmap file */
+            true /* persist mmap storage */
         );
         blk_len = cfp.length;
         blk_initialized = true;
@@ -1283,7 +1680,7 @@ PartialBlockData::PartialBlockData(const CService& peer, CTxMemPool* mempool, co
         in_header(true), blk_initialized(false), header_initialized(false),
         is_decodeable(false), is_header_processing(false),
         packet_awaiting_lock(false), awaiting_processing(false),
-        chain_lookup(false), currentlyProcessing(false), blk_len(0),
+        chain_lookup(false), txn_decode_queued(false), currentlyProcessing(false), blk_len(0),
         header_len(0), block_data(mempool), tip_blk(false)
 {
     bool const ret = Init(cfp);
@@ -1293,16 +1690,41 @@ PartialBlockData::PartialBlockData(const CService& peer, CTxMemPool* mempool, co
 void PartialBlockData::ReconstructBlockFromDecoder() {
     assert(body_decoder.DecodeReady());
 
-    for (uint32_t i = 0; i < DIV_CEIL(blk_len, sizeof(UDPBlockMessage::data)); i++) {
-        if (!block_data.IsChunkAvailable(i)) {
-            const void* data_ptr = body_decoder.GetDataPtr(i);
-            assert(data_ptr);
-            memcpy(block_data.GetChunk(i), data_ptr, sizeof(UDPBlockMessage::data));
-            block_data.MarkChunkAvailable(i);
+    if (body_decoder.UsesWirehair()) {
+        // Wirehair recovers each missing chunk independently, straight into
+        // the chunk-coded block, so spread them over the FEC worker pool
+        std::vector<std::pair<uint32_t, unsigned char*>> missing;
+        for (uint32_t i = 0; i < DIV_CEIL(blk_len, sizeof(UDPBlockMessage::data)); i++) {
+            if (!block_data.IsChunkAvailable(i))
+                missing.emplace_back(i, block_data.GetChunk(i));
+        }
+
+        auto recover = [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; k++) {
+                if (!body_decoder.RecoverChunk(missing[k].first, missing[k].second))
+                    return false;
+            }
+            return true;
+        };
+        bool const ret = fec_worker_pool && missing.size() > FEC_RECOVER_RANGE_SIZE ?
+                         fec_worker_pool->Run(missing.size(), FEC_RECOVER_RANGE_SIZE, recover, nullptr) :
+                         recover(0, missing.size());
+        assert(ret);
+
+        for (const auto& chunk : missing)
+            block_data.MarkChunkAvailable(chunk.first);
+    } else {
+        for (uint32_t i = 0; i < DIV_CEIL(blk_len, sizeof(UDPBlockMessage::data)); i++) {
+            if (!block_data.IsChunkAvailable(i)) {
+                const void* data_ptr = body_decoder.GetDataPtr(i);
+                assert(data_ptr);
+                memcpy(block_data.GetChunk(i), data_ptr, sizeof(UDPBlockMessage::data));
+                block_data.MarkChunkAvailable(i);
+            }
         }
+        body_decoder.GetDataPtrDone();
     }
 
-    body_decoder.GetDataPtrDone();
     assert(block_data.IsBlockAvailable());
 };
 
@@ -1392,7 +1814,7 @@ static bool HandleTx(UDPMessage& msg, size_t length, const CService& node, UDPCo
     return true;
 }
 
-bool HandleBlockTxMessage(UDPMessage& msg, size_t length, const CService& node, UDPConnectionState& state, const std::chrono::steady_clock::time_point& packet_process_start, const int sockfd, const NodeContext* const node_context) {
+bool HandleBlockTxMessage(UDPMessage& msg, size_t length, const CService& node, UDPConnectionState& state, const std::chrono::steady_clock::time_point& packet_process_start, const int sockfd, const NodeContext* const node_context, std::unique_lock<std::recursive_mutex>& nodes_lock) {
     //TODO: There are way too many damn tree lookups here...either cut them down or increase parallelism
     const bool fBench = LogAcceptCategory(BCLog::BENCH);
     std::chrono::steady_clock::time_point start;
@@ -1433,6 +1855,15 @@ bool HandleBlockTxMessage(UDPMessage& msg, size_t length, const CService& node,
     if (setBlocksRelayed.count(msg.msg.block.hash_prefix) || setBlocksReceived.count(hash_peer_pair))
         return true;
 
+    /* Non-tip blocks are stored in the chunk arena, which only holds so many of
+     * them. Drop the chunks of new ones while it is at capacity, or while as
+     * many partial blocks are kept in memory if there is no arena. */
+    if (!(msg.header.msg_type & TIP_BLOCK) && !mapPartialBlocks.count(hash_peer_pair) &&
+        NonTipPartialBlocksAtCapacity()) {
+        LogPrint(BCLog::FEC, "UDP: Too many partial blocks in the chunk arena, dropping chunk of block %lu from %s\n", hash_prefix, node.ToString());
+        return true;
+    }
+
     std::map<uint64_t, ChunksAvailableSet>::iterator chunks_avail_it = state.chunks_avail.find(msg.msg.block.hash_prefix);
 
     if (chunks_avail_it == state.chunks_avail.end()) {
@@ -1444,13 +1875,15 @@ bool HandleBlockTxMessage(UDPMessage& msg, size_t length, const CService& node,
                 assert(first_partial_block_it != mapPartialBlocks.end());
                 auto second_partial_block_it = mapPartialBlocks.find(std::make_pair(state.chunks_avail.rbegin()->first, node));
                 assert(second_partial_block_it != mapPartialBlocks.end());
-                if (first_partial_block_it->second->timeHeaderRecvd < second_partial_block_it->second->timeHeaderRecvd) {
-                    state.chunks_avail.erase(first_partial_block_it->first.first);
-                    mapPartialBlocks.erase(first_partial_block_it);
-                } else {
-                    state.chunks_avail.erase(second_partial_block_it->first.first);
-                    mapPartialBlocks.erase(second_partial_block_it);
+                auto evicted_it = (first_partial_block_it->second->timeHeaderRecvd < second_partial_block_it->second->timeHeaderRecvd) ?
+                    first_partial_block_it : second_partial_block_it;
+                state.chunks_avail.erase(evicted_it->first.first);
+                {
+                    std::lock_guard<std::mutex> block_lock(evicted_it->second->state_mutex);
+                    evicted_it->second->header_decoder.RemoveMmapStorage();
+                    evicted_it->second->body_decoder.RemoveMmapStorage();
                 }
+                mapPartialBlocks.erase(evicted_it);
             }
         }
 
@@ -1595,6 +2028,20 @@ bool HandleBlockTxMessage(UDPMessage& msg, size_t length, const CService& node,
         return true;
     }
 
+    /* From here on, only the partial block itself is accessed until the chunk
+     * has been fed to the decoder. Hence, release cs_mapUDPNodes while holding
+     * only the block's state_mutex, such that other UDP read threads can
+     * process chunks of other blocks (and from other peers) in parallel. Keep
+     * a copy of the mapPartialBlocks entry, as the entry may be erased while
+     * cs_mapUDPNodes is released, as well as the peer's address and trust.
+     * Note cs_mapUDPNodes must not be locked again before block_lock is
+     * released (cs_mapUDPNodes is locked first). */
+    const std::pair<std::pair<uint64_t, CService>, std::shared_ptr<PartialBlockData> > partial_block_entry(*it);
+    const bool from_trusted = state.connection.fTrusted;
+    const CService from_node(node);
+    nodes_lock.unlock();
+
+    bool uncoded_chunk_available = false;
     if (is_blk_content_chunk && !block.in_header && msg.msg.block.chunk_id < block.block_data.GetChunkCount()) {
         /* If in_header is true, ProvideHeaderData has not be called yet, which
          * means PartiallyDownloadedChunkBlock::InitData also has not been
@@ -1608,11 +2055,14 @@ bool HandleBlockTxMessage(UDPMessage& msg, size_t length, const CService& node,
         assert(!block.block_data.IsChunkAvailable(msg.msg.block.chunk_id)); // HasChunk should have returned false, then
         memcpy(block.block_data.GetChunk(msg.msg.block.chunk_id), msg.msg.block.data, sizeof(UDPBlockMessage::data));
         block.block_data.MarkChunkAvailable(msg.msg.block.chunk_id);
+        uncoded_chunk_available = true;
     }
 
     if (!decoder.ProvideChunk(msg.msg.block.data, msg.msg.block.chunk_id)) {
         // Bad chunk id, maybe FEC is upset? Don't disconnect in case it can be random
-        LogPrintf("UDP: FEC chunk decode failed for chunk %d from block %lu from %s\n", msg.msg.block.chunk_id, msg.msg.block.hash_prefix, node.ToString());
+        LogPrintf("UDP: FEC chunk decode failed for chunk %d from block %lu from %s\n", msg.msg.block.chunk_id, msg.msg.block.hash_prefix, from_node.ToString());
+        block_lock.unlock();
+        nodes_lock.lock();
         return true;
     }
 
@@ -1623,12 +2073,15 @@ bool HandleBlockTxMessage(UDPMessage& msg, size_t length, const CService& node,
     // Keep track of chunks that are actually used for decoding
     perNodeChunkCountIt->second.first++;
 
-    if (state.connection.fTrusted) {
-        BlockMsgHToLE(msg);
-        msg.header.msg_type &= ~HAVE_BLOCK;
-        // We needed this chunk, call it high priority assuming our
-        // peers will as well
-        SendMessageToAllNodes(msg, length, true, hash_prefix);
+    // Have the processing thread deserialize the transactions this chunk
+    // completes while the rest of the block is still in flight, leaving less
+    // for FinalizeBlock to do once it can be decoded
+    if (uncoded_chunk_available && !decoder.DecodeReady()) {
+        block.txn_decode_pending.push_back(msg.msg.block.chunk_id);
+        if (!block.txn_decode_queued) {
+            block.txn_decode_queued = true;
+            DoBackgroundTxnDecode(partial_block_entry.second);
+        }
     }
 
     if (decoder.DecodeReady()) {
@@ -1690,12 +2143,21 @@ bool HandleBlockTxMessage(UDPMessage& msg, size_t length, const CService& node,
              (block.is_decodeable && !block.in_header)) // if for some reason we've processed the header of the non-tip block already
             ) {
             block.awaiting_processing = true;
-            DoBackgroundBlockProcessing(*it);
+            DoBackgroundBlockProcessing(partial_block_entry);
         }
 
         // We do not RemovePartialBlock as we want ChunkAvailableSets to be there when UDPRelayBlock gets called
         // from inside ProcessBlockThread, so after we notify the ProcessNewBlockThread we cannot access block.
-        block_lock.unlock();
+    }
+    block_lock.unlock();
+    nodes_lock.lock();
+
+    if (from_trusted) {
+        BlockMsgHToLE(msg);
+        msg.header.msg_type &= ~HAVE_BLOCK;
+        // We needed this chunk, call it high priority assuming our
+        // peers will as well
+        SendMessageToAllNodes(msg, length, true, hash_prefix);
     }
 
     if (fBench && new_block) {
@@ -1714,6 +2176,8 @@ void ProcessDownloadTimerEvents() {
         else
             it++;
     }
+    lock.unlock();
+    TrimCodedBlockBufferCache();
     //TODO: Prune setBlocksRelayed and setBlocksReceived to keep lookups fast?
 }
 
@@ -1859,3 +2323,18 @@ UniValue FecHitRatioToJson() {
     }
     return ret;
 }
+
+/* Get the state of the adaptive FEC overhead of each node */
+UniValue FecOverheadToJson() {
+    UniValue ret(UniValue::VOBJ);
+    std::unique_lock<std::recursive_mutex> lock(cs_mapUDPNodes);
+    for (auto it = mapUDPNodes.begin(); it != mapUDPNodes.end(); it++) {
+        const FecOverheadEstimator& est = it->second.fec_overhead;
+        UniValue info(UniValue::VOBJ);
+        info.pushKV("overhead", est.overhead);
+        info.pushKV("redundancy", est.redundancy);
+        info.pushKV("blocks", est.n_blocks);
+        ret.__pushKV(it->first.ToString(), info);
+    }
+    return ret;
+}
@@ -11,7 +11,7 @@
 class CBlock;
 class CTransaction;
 
-void BlockRecvInit(ChainstateManager* chainman);
+void BlockRecvInit(ChainstateManager* chainman, size_t n_fec_threads);
 
 void BlockRecvShutdown();
 
@@ -19,7 +19,14 @@ void LoadPartialBlocks(CTxMemPool* mempool);
 
 bool IsChunkFileRecoverable(const std::string& filename, ChunkFileNameParts& cfp);
 
-bool HandleBlockTxMessage(UDPMessage& msg, size_t length, const CService& node, UDPConnectionState& state, const std::chrono::steady_clock::time_point& packet_process_start, const int sockfd, const NodeContext* const context);
+/**
+ * Handle a block or tx chunk received from node. Must be called with
+ * cs_mapUDPNodes held through nodes_lock. The lock may be released while the
+ * chunk is fed to the FEC decoder, but is always held again on return. As the
+ * node may be dropped meanwhile, callers must look it up again in mapUDPNodes
+ * rather than keep using node and state after the call.
+ */
+bool HandleBlockTxMessage(UDPMessage& msg, size_t length, const CService& node, UDPConnectionState& state, const std::chrono::steady_clock::time_point& packet_process_start, const int sockfd, const NodeContext* const context, std::unique_lock<std::recursive_mutex>& nodes_lock);
 
 void ProcessDownloadTimerEvents();
 
@@ -32,6 +39,18 @@ void ResetPartialBlocks();
 // Each UDPMessage must be of sizeof(UDPMessageHeader) + MAX_UDP_MESSAGE_LENGTH in length!
 void UDPFillMessagesFromBlock(const CBlock& block, std::vector<UDPMessage>& msgs, int height,
                               size_t base_overhead=60, double overhead=0.05);
+/**
+ * Fill the FEC chunks of the block at pindex like UDPFillMessagesFromBlock,
+ * but cache the block's coded data and FEC encoder in memory, such that blocks
+ * transmitted repeatedly are read from disk and prepared for FEC-coding only
+ * once. New FEC chunks (with new chunk ids) are still generated on each call.
+ */
+void UDPFillMessagesFromBlockIndex(const CBlockIndex* pindex, std::vector<UDPMessage>& msgs,
+                                   size_t base_overhead, double overhead);
+void SetUDPBlockCacheSize(size_t max_bytes);
+// Must be called before any block is relayed, receivers accept any version
+void SetUDPBlockCodecVersion(codec_version_t codec_version);
+void ClearUDPBlockCache();
 void UDPFillMessagesFromTx(const CTransaction& tx, std::vector<std::pair<UDPMessage, size_t>>& msgs);
 
 #endif
@@ -1153,6 +1153,21 @@ void AllocateFileRange(FILE *file, unsigned int offset, unsigned int length) {
 #endif
 }
 
+/**
+ * Ask the OS to start reading a range of a file into its page cache, without
+ * waiting for it. This function is advisory.
+ */
+void PrefetchFileRange(FILE *file, unsigned int offset, unsigned int length) {
+#if defined(MAC_OSX)
+    struct radvisory advice;
+    advice.ra_offset = offset;
+    advice.ra_count = length;
+    fcntl(fileno(file), F_RDADVISE, &advice);
+#elif defined(POSIX_FADV_WILLNEED)
+    posix_fadvise(fileno(file), offset, length, POSIX_FADV_WILLNEED);
+#endif
+}
+
 #ifdef WIN32
 fs::path GetSpecialFolderPath(int nFolder, bool fCreate)
 {